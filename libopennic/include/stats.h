@@ -24,6 +24,7 @@ struct stats_block_spec;
 struct stats_metric;
 struct stats_metric_spec;
 struct stats_label_spec;
+struct stats_cursor;
 
 //--------------------------------------------------------------------------------------------------
 struct stats_label_format_spec {
@@ -167,7 +168,7 @@ struct stats_block_spec {
      * attach_metrics: Called for the driver to take ownership of all metrics in the block.
      * detach_metrics: Called for the driver to release ownership of all metrics in the block.
      * latch_metrics: Called prior to reading the current value of all metrics in the block. Is
-     *                passed a stack buffer of latch.data_size for internal use during an update
+     *                passed a buffer of latch.data_size for internal use during an update
      *                operation. The buffer is zeroed prior to use, is only valid until the
      *                release_metrics method is invoked and is also passed to the read_metric and
      *                convert_metric methods.
@@ -176,6 +177,8 @@ struct stats_block_spec {
      *              metric is an array, the "values" parameter is an array sized to the "nelements"
      *              member of the struct stats_metric_spec. Otherwise, the value is singular.
      * convert_metric: Called to convert a raw register value to a floating point representation.
+     *                 Clearing metrics doesn't access the hardware, in which case the data
+     *                 parameter is NULL.
      */
     void (*attach_metrics)(const struct stats_block_spec* bspec);
     void (*detach_metrics)(const struct stats_block_spec* bspec);
@@ -230,15 +233,84 @@ struct stats_clear_filter_spec {
     const struct stats_metric_spec* metric;
     const struct stats_metric_value* values;
     size_t nvalues;
+    const uint64_t* last_change; // Monotonic time in nanoseconds of the last change to each value.
 };
 
 struct stats_clear_filter {
+    // Exact criteria checked before any callback, as for a stats_cursor_filter. NULL matches all.
+    const char* metric;
+    struct {
+        const char* key;
+        const char* value;
+    } label;
+
     void (*setup)(const struct stats_clear_filter_spec* spec, void* arg);
     void (*teardown)(const struct stats_clear_filter_spec* spec, void* arg);
     bool (*match)(const struct stats_clear_filter_spec* spec, unsigned int value_idx, void* arg);
     void* arg;
 };
 
+//--------------------------------------------------------------------------------------------------
+/*
+ * Read-only view of a metric yielded by a stats cursor. The value arrays point directly into a
+ * snapshot published by the most recent update of the metric's block and remain valid until the
+ * cursor is advanced or freed. The labels of element n start at labels[n * nlabels].
+ *
+ * Each element also carries the change generation at which its value last changed (or at which it
+ * was added). Generations are comparable with the value returned by stats_generation(). The time of
+ * that change is also kept, in nanoseconds of CLOCK_MONOTONIC.
+ */
+struct stats_metric_view {
+    const struct stats_domain_spec* domain;
+    const struct stats_zone_spec* zone;
+    const struct stats_block_spec* block;
+    const struct stats_metric_spec* metric;
+    unsigned int index; // Position of the metric within its block.
+    struct timespec last_update;
+
+    size_t nvalues;
+    const uint64_t* u64;
+    const double* f64;
+    const uint64_t* generations;
+    const uint64_t* last_change;
+
+    const struct stats_label* labels;
+    size_t nlabels;
+};
+
+/*
+ * Filter evaluated by the stats engine while advancing a cursor. All conditions must be satisfied
+ * for a metric to be yielded. NULL string members and a NULL match callback act as wildcards.
+ */
+struct stats_cursor_filter {
+    const char* zone;   // Exact zone name.
+    const char* block;  // Exact block name.
+    const char* metric; // Exact metric name.
+
+    struct {
+        const char* key;   // Exact label key carried by at least one element.
+        const char* value; // Exact value for the label key. NULL matches any value.
+    } label;
+
+    bool non_zero; // Skip metrics where all values are zero.
+    uint64_t changed_since; // Skip metrics with no element changed after this generation.
+
+    // Present counters relative to the named baseline. Blocks without it yield the plain values.
+    const char* baseline;
+
+    /*
+     * match_block: Called once on entering each block, before any of its metrics are visited. Return
+     *              false to skip the entire block.
+     * match: Called for each metric which satisfies all other criteria of the filter.
+     */
+    bool (*match_block)(const struct stats_domain_spec* domain,
+                        const struct stats_zone_spec* zone,
+                        const struct stats_block_spec* block,
+                        void* arg);
+    bool (*match)(const struct stats_metric_view* view, void* arg);
+    void* arg;
+};
+
 //--------------------------------------------------------------------------------------------------
 struct stats_zone* stats_zone_alloc(struct stats_domain* domain,
                                     const struct stats_zone_spec* spec);
@@ -250,9 +322,36 @@ size_t stats_zone_get_values(struct stats_zone* zone,
                              struct stats_metric_value* values, size_t nvalues);
 void stats_zone_update_metrics(struct stats_zone* zone);
 void stats_zone_clear_metrics(struct stats_zone* zone, const struct stats_clear_filter* filter);
+/*
+ * Clear counters for cursors filtering on the named baseline only, without disturbing the totals or
+ * other baselines. A baseline expires after ttl_ms milliseconds, or never when ttl_ms is 0. At most
+ * STATS_BASELINES_MAX unexpired baselines are held at once, and clearing a new name beyond that
+ * fails until one of them expires. A zone has a baseline when any of its blocks holds it unexpired.
+ */
+#define STATS_BASELINES_MAX 16
+
+bool stats_zone_clear_baseline(struct stats_zone* zone, const char* name, unsigned int ttl_ms,
+                               const struct stats_clear_filter* filter);
+bool stats_zone_has_baseline(struct stats_zone* zone, const char* name);
 int stats_zone_for_each_metric(struct stats_zone* zone,
                                int (*callback)(const struct stats_for_each_spec* spec),
                                void* arg);
+struct stats_cursor* stats_zone_cursor_alloc(struct stats_zone* zone,
+                                             const struct stats_cursor_filter* filter);
+
+/*
+ * Live changes to the layout of an attached zone. Values of metrics carried over from a replaced
+ * block are preserved (for arrays, up to the smaller of the old and new sizes). Concurrent readers
+ * and updaters are not blocked; they complete against the layout in place when they started.
+ */
+bool stats_zone_add_block(struct stats_zone* zone, const struct stats_block_spec* spec);
+bool stats_zone_replace_block(struct stats_zone* zone, const struct stats_block_spec* spec);
+bool stats_zone_remove_block(struct stats_zone* zone, const char* name);
+bool stats_zone_add_metric(struct stats_zone* zone, const char* block,
+                           const struct stats_metric_spec* spec);
+bool stats_zone_remove_metric(struct stats_zone* zone, const char* block, const char* name);
+bool stats_zone_resize_metric(struct stats_zone* zone, const char* block, const char* name,
+                              size_t nelements);
 
 //--------------------------------------------------------------------------------------------------
 struct stats_domain* stats_domain_alloc(const struct stats_domain_spec* spec);
@@ -263,11 +362,62 @@ size_t stats_domain_number_of_values(struct stats_domain* domain);
 size_t stats_domain_get_values(struct stats_domain* domain,
                                struct stats_metric_value* values, size_t nvalues);
 void stats_domain_update_metrics(struct stats_domain* domain);
+/*
+ * Add a callback invoked after every update of the metrics in the domain, such as to record or
+ * publish the updated values. Hooks are run from the thread updating the domain and must not block.
+ * Once removal returns, the callback is no longer running and won't be invoked again.
+ */
+bool stats_domain_add_update_hook(struct stats_domain* domain,
+                                  void (*callback)(struct stats_domain* domain, void* arg),
+                                  void* arg);
+void stats_domain_remove_update_hook(struct stats_domain* domain,
+                                     void (*callback)(struct stats_domain* domain, void* arg),
+                                     void* arg);
 void stats_domain_clear_metrics(struct stats_domain* domain,
                                 const struct stats_clear_filter* filter);
+bool stats_domain_clear_baseline(struct stats_domain* domain, const char* name,
+                                 unsigned int ttl_ms, const struct stats_clear_filter* filter);
+bool stats_domain_has_baseline(struct stats_domain* domain, const char* name);
 int stats_domain_for_each_metric(struct stats_domain* domain,
                                  int (*callback)(const struct stats_for_each_spec* spec),
                                  void* arg);
+struct stats_cursor* stats_domain_cursor_alloc(struct stats_domain* domain,
+                                               const struct stats_cursor_filter* filter);
+
+//--------------------------------------------------------------------------------------------------
+const struct stats_metric_view* stats_cursor_next(struct stats_cursor* cursor);
+void stats_cursor_free(struct stats_cursor* cursor);
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Change generations are process wide and increase monotonically. Every change to an element, and
+ * every metric added or removed, is tagged with a generation. All changes tagged with a generation
+ * up to and including the value returned by stats_generation() are visible to readers.
+ */
+struct stats_removed_metric {
+    const struct stats_domain* domain; // Identity only, the domain may no longer exist.
+    const char* domain_name;
+    const char* zone;
+    const char* block;
+    const char* metric;
+    uint64_t generation;
+};
+
+uint64_t stats_generation(void);
+
+/*
+ * Only a bounded history of removed metrics is retained. stats_removed_metrics_since() reports
+ * whether the history still reaches back to the given generation. The for_each variants visit the
+ * metrics removed from a domain (optionally restricted to a single zone by name) after the given
+ * generation and return false when some removals may have been missed.
+ */
+bool stats_removed_metrics_since(uint64_t since);
+bool stats_domain_for_each_removed_metric(
+    const struct stats_domain* domain, const char* zone, uint64_t since,
+    void (*callback)(const struct stats_removed_metric* removed, void* arg), void* arg);
+bool stats_zone_for_each_removed_metric(
+    const struct stats_zone* zone, uint64_t since,
+    void (*callback)(const struct stats_removed_metric* removed, void* arg), void* arg);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,55 @@
+#ifndef INCLUDE_STATS_RECORD_H
+#define INCLUDE_STATS_RECORD_H
+
+#include "stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct stats_recorder;
+struct stats_replay;
+
+/*
+ * Recordings capture the values of a stats domain after every update, to files which are replayed
+ * offline through another stats domain.
+ *
+ * Each file is self-contained. It opens with the layout of the domain (zones, blocks, metrics and
+ * their labels), followed by one record per update holding the timestamp and the values which
+ * changed since the previous record as run-length and varint encoded deltas. The layout is written
+ * again whenever it changes.
+ */
+
+//--------------------------------------------------------------------------------------------------
+struct stats_recorder_spec {
+    const char* path;         // Files are named <path>.<sequence number>.
+    size_t max_file_size;     // Start a new file once a file grows past this size. 0 never rotates.
+    unsigned int max_files;   // Number of most recent files kept. 0 keeps all of them.
+};
+
+struct stats_recorder* stats_recorder_alloc(struct stats_domain* domain,
+                                            const struct stats_recorder_spec* spec);
+void stats_recorder_free(struct stats_recorder* recorder);
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Replay the given files in order through a new domain allocated from the spec, with zones created
+ * to match the recorded layout. Each call to stats_replay_next() loads the values of the next record
+ * and updates the metrics of the domain, then returns the time the record was taken. The domain is
+ * freed along with the replay.
+ */
+struct stats_replay* stats_replay_alloc(const struct stats_domain_spec* spec,
+                                        const char* const* paths, size_t npaths);
+void stats_replay_free(struct stats_replay* replay);
+struct stats_domain* stats_replay_domain(struct stats_replay* replay);
+bool stats_replay_next(struct stats_replay* replay, struct timespec* timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INCLUDE_STATS_RECORD_H
@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -22,11 +23,245 @@
     {log_err(_rv, _format,## _args); exit(EXIT_FAILURE);}
 
 //--------------------------------------------------------------------------------------------------
-struct stats_metric_element {
-    struct stats_metric_value value;
-    uint64_t last;
+/*
+ * Process wide change generations. Writers tag their changes with a generation taken on entry and
+ * release it once the changes are visible to readers. Each writer thread publishes the generation it
+ * holds in a slot of its own, and the stable generation is the one just below the lowest generation
+ * still held, so that readers are never handed a generation covering a change they can't see while
+ * a long running writer only holds back the generations issued after its own.
+ */
+#define STATS_GENERATION_WRITERS_MAX 256
+#define STATS_REMOVED_HISTORY_MAX 4096
+
+struct stats_generation_writer {
+    _Atomic bool claimed;
+    _Atomic uint64_t generation; // Lowest generation held by the writer, 0 while idle.
+};
+
+struct stats_removed_entry {
+    struct stats_removed_metric removed;
+    char names[]; // Storage for the domain, zone, block and metric names.
+};
+
+static struct {
+    pthread_mutex_t lock;
+    _Atomic uint64_t next;
+    _Atomic uint64_t stable; // Highest stable generation handed out so far.
+
+    struct stats_generation_writer writers[STATS_GENERATION_WRITERS_MAX];
+    _Atomic size_t nwriters; // Number of slots which have ever been claimed.
+
+    struct {
+        struct stats_removed_entry* entries[STATS_REMOVED_HISTORY_MAX]; // Ring, oldest at head.
+        size_t head;
+        size_t count;
+        uint64_t floor; // Highest generation among the discarded entries.
+    } removed;
+} stats_generations = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
 };
 
+static inline void stats_generations_lock(void) {
+    int rv = pthread_mutex_lock(&stats_generations.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_lock failed");
+    }
+}
+
+static inline void stats_generations_unlock(void) {
+    int rv = pthread_mutex_unlock(&stats_generations.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_unlock failed");
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static pthread_once_t stats_generation_writer_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_generation_writer_key;
+static __thread struct {
+    struct stats_generation_writer* slot;
+    unsigned int depth;
+} stats_generation_writer;
+
+static void stats_generation_writer_release(void* arg) {
+    struct stats_generation_writer* slot = arg;
+    atomic_store(&slot->generation, 0);
+    atomic_store(&slot->claimed, false);
+}
+
+static void stats_generation_writer_key_create(void) {
+    int rv = pthread_key_create(&stats_generation_writer_key, stats_generation_writer_release);
+    if (rv != 0) {
+        log_panic(rv, "pthread_key_create failed");
+    }
+}
+
+static struct stats_generation_writer* stats_generation_writer_slot(void) {
+    if (stats_generation_writer.slot != NULL) {
+        return stats_generation_writer.slot;
+    }
+
+    int rv = pthread_once(&stats_generation_writer_once, stats_generation_writer_key_create);
+    if (rv != 0) {
+        log_panic(rv, "pthread_once failed");
+    }
+
+    // Slots are returned when their thread exits, so wait for one if all are taken.
+    for (;;) {
+        for (size_t n = 0; n < STATS_GENERATION_WRITERS_MAX; ++n) {
+            bool claimed = false;
+            if (atomic_compare_exchange_strong(&stats_generations.writers[n].claimed, &claimed,
+                                               true)) {
+                size_t nwriters = atomic_load(&stats_generations.nwriters);
+                while (nwriters < n + 1 &&
+                       !atomic_compare_exchange_weak(&stats_generations.nwriters, &nwriters,
+                                                     n + 1)) {
+                }
+
+                stats_generation_writer.slot = &stats_generations.writers[n];
+                rv = pthread_setspecific(stats_generation_writer_key, stats_generation_writer.slot);
+                if (rv != 0) {
+                    log_panic(rv, "pthread_setspecific failed");
+                }
+                return stats_generation_writer.slot;
+            }
+        }
+        sched_yield();
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static uint64_t stats_generation_begin(void) {
+    struct stats_generation_writer* slot = stats_generation_writer_slot();
+    if (stats_generation_writer.depth++ > 0) {
+        // The generation held by the outer writer is lower and already holds back stable.
+        return atomic_fetch_add(&stats_generations.next, 1) + 1;
+    }
+
+    // Announce a lower bound before taking the generation, so that a reader which observes the
+    // new value of next is guaranteed to also observe the slot as being in use.
+    atomic_store(&slot->generation, atomic_load(&stats_generations.next) + 1);
+    uint64_t generation = atomic_fetch_add(&stats_generations.next, 1) + 1;
+    atomic_store(&slot->generation, generation);
+
+    return generation;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_generation_end(void) {
+    if (--stats_generation_writer.depth == 0) {
+        atomic_store(&stats_generation_writer.slot->generation, 0);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+uint64_t stats_generation(void) {
+    uint64_t generation = atomic_load(&stats_generations.next);
+    size_t nwriters = atomic_load(&stats_generations.nwriters);
+    for (size_t n = 0; n < nwriters; ++n) {
+        uint64_t held = atomic_load(&stats_generations.writers[n].generation);
+        if (held != 0 && held - 1 < generation) {
+            generation = held - 1;
+        }
+    }
+
+    // A writer may announce a bound below a generation which has already been handed out as stable.
+    // Every generation up to a previously stable one remains complete, so never go backwards.
+    uint64_t stable = atomic_load(&stats_generations.stable);
+    while (stable < generation &&
+           !atomic_compare_exchange_weak(&stats_generations.stable, &stable, generation)) {
+    }
+
+    return stable > generation ? stable : generation;
+}
+
+//--------------------------------------------------------------------------------------------------
+static uint64_t stats_monotonic_ns(void) {
+    struct timespec now;
+    int rv = clock_gettime(CLOCK_MONOTONIC, &now);
+    if (rv != 0) {
+        log_err(errno, "clock_gettime failed");
+        return 0;
+    }
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_generation_record_removed(const struct stats_domain* domain,
+                                            const char* domain_name,
+                                            const char* zone,
+                                            const char* block,
+                                            const char* metric,
+                                            uint64_t generation) {
+    size_t dlen = strlen(domain_name) + 1;
+    size_t zlen = strlen(zone) + 1;
+    size_t blen = strlen(block) + 1;
+    size_t mlen = strlen(metric) + 1;
+    struct stats_removed_entry* entry = malloc(sizeof(*entry) + dlen + zlen + blen + mlen);
+    if (entry == NULL) {
+        log_panic(ENOMEM, "failed to record removal of metric %s", metric);
+    }
+
+    char* names = entry->names;
+    entry->removed = (struct stats_removed_metric){
+        .domain = domain,
+        .domain_name = memcpy(names, domain_name, dlen),
+        .zone = memcpy(names + dlen, zone, zlen),
+        .block = memcpy(names + dlen + zlen, block, blen),
+        .metric = memcpy(names + dlen + zlen + blen, metric, mlen),
+        .generation = generation,
+    };
+
+    stats_generations_lock();
+    typeof(stats_generations.removed)* removed = &stats_generations.removed;
+    if (removed->count == STATS_REMOVED_HISTORY_MAX) {
+        struct stats_removed_entry* oldest = removed->entries[removed->head];
+        if (oldest->removed.generation > removed->floor) {
+            removed->floor = oldest->removed.generation;
+        }
+        free(oldest);
+
+        removed->head = (removed->head + 1) % STATS_REMOVED_HISTORY_MAX;
+        removed->count -= 1;
+    }
+
+    removed->entries[(removed->head + removed->count) % STATS_REMOVED_HISTORY_MAX] = entry;
+    removed->count += 1;
+    stats_generations_unlock();
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_removed_metrics_since(uint64_t since) {
+    stats_generations_lock();
+    bool complete = since >= stats_generations.removed.floor;
+    stats_generations_unlock();
+
+    return complete;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_domain_for_each_removed_metric(
+    const struct stats_domain* domain, const char* zone, uint64_t since,
+    void (*callback)(const struct stats_removed_metric* removed, void* arg), void* arg) {
+    stats_generations_lock();
+    typeof(stats_generations.removed)* removed = &stats_generations.removed;
+    bool complete = since >= removed->floor;
+    for (size_t n = 0; n < removed->count; ++n) {
+        const struct stats_removed_metric* r =
+            &removed->entries[(removed->head + n) % STATS_REMOVED_HISTORY_MAX]->removed;
+        if (r->generation > since &&
+            r->domain == domain &&
+            (zone == NULL || strcmp(r->zone, zone) == 0)) {
+            callback(r, arg);
+        }
+    }
+    stats_generations_unlock();
+
+    return complete;
+}
+
+//--------------------------------------------------------------------------------------------------
 struct stats_metric {
     struct stats_metric_spec spec;
     struct stats_block* block;
@@ -34,13 +269,18 @@ struct stats_metric {
     pthread_spinlock_t _spin;
     pthread_spinlock_t* lock;
 
-    struct stats_metric_element* elements;
+    size_t offset; // Index of the first element within the block's value arrays.
     size_t nelements;
+    struct stats_label* labels; // Per-element labels, nelements * spec.nlabels.
+    bool labelled;
+    size_t nuser_labels; // Labels from the caller's spec, placed at the end of spec.labels.
 
     uint64_t mask;
 
     struct {
         prom_metric_t* metric;
+        const char** label_values; // Per-element exported label values, nelements * nlabels.
+        size_t nlabels;
     } prometheus;
 };
 
@@ -59,15 +299,84 @@ static inline void stats_metric_unlock(struct stats_metric* metric) {
 }
 
 //--------------------------------------------------------------------------------------------------
+/*
+ * Element state touched by every update is kept apart from the metric metadata. Each array holds
+ * one entry per element of the block, ordered by metric, and starts on its own cache line so that
+ * an update streams linearly through memory regardless of how many metrics the block holds.
+ */
+#define STATS_CACHE_LINE_SIZE 64
+
+struct stats_block_values {
+    uint64_t* u64;
+    double* f64;
+    uint64_t* last;
+    uint64_t* raw; // Scratch for values read from the hardware during an update.
+    uint64_t* gen; // Generation of the last change to each element.
+    uint64_t* last_change; // Monotonic time in nanoseconds of the last change to each element.
+
+    /*
+     * Clearing never touches the hardware. Counters keep accumulating into acc, while a clear
+     * records the accumulated value as a baseline which is subtracted to give the exported value.
+     */
+    uint64_t* acc;
+    uint64_t* base;
+};
+
+/*
+ * Named baseline of a block, used to present counters relative to a point in time chosen by a client
+ * without clearing them for everyone else. Holds the accumulated value of each element of the block
+ * at the time the baseline was taken (adjusted for the initial value). Immutable once published in
+ * the block's list, with each snapshot holding a reference to the baselines current when it was
+ * published.
+ */
+struct stats_baseline {
+    struct stats_baseline* next;
+    unsigned int ref_count;
+    struct timespec expires; // CLOCK_MONOTONIC
+    char* name;
+    uint64_t acc[];
+};
+
+/*
+ * Immutable copy of a block's values, published at the end of each update. Readers hold a reference
+ * while accessing the values, allowing them to be used in place without taking the metric locks.
+ */
+struct stats_block_snapshot {
+    unsigned int ref_count;
+    struct timespec last_update;
+    uint64_t* u64;
+    double* f64;
+    uint64_t* gen;
+    uint64_t* last_change;
+    uint64_t* acc;
+    struct stats_baseline* baselines[STATS_BASELINES_MAX];
+    size_t nbaselines;
+};
+
 struct stats_block {
     struct stats_block_spec spec;
     struct stats_zone* zone;
+    unsigned int ref_count;
+    bool attached;
 
     struct stats_metric** metrics;
     size_t nvalues;
 
+    struct stats_block_values values;
+    size_t nelements;
+    size_t max_metric_nelements;
+    void* latch_data;
+
     struct timespec last_update;
 
+    struct {
+        struct stats_block_snapshot* published;
+        struct stats_block_snapshot* spare;
+        pthread_spinlock_t lock;
+    } snapshot;
+
+    struct stats_baseline* baselines; // Protected by the block lock, at most STATS_BASELINES_MAX.
+
     pthread_mutex_t _mutex;
     pthread_mutex_t* lock;
 
@@ -91,12 +400,39 @@ static inline void stats_block_unlock(struct stats_block* blk) {
 }
 
 //--------------------------------------------------------------------------------------------------
+/*
+ * Table of the blocks in a zone. Tables are never modified once published. Adding, removing or
+ * replacing blocks builds a new table which is swapped in, leaving readers holding a reference to
+ * the previous table to finish with it undisturbed.
+ */
+struct stats_zone_index;
+
+struct stats_metric_ref {
+    unsigned int block_idx;
+    unsigned int metric_idx;
+};
+
+struct stats_metric_refs {
+    struct stats_metric_ref* list;
+    size_t n;
+    size_t size;
+};
+
+struct stats_zone_blocks {
+    unsigned int ref_count;
+    struct stats_zone_index* index; // Built by the first lookup by metric name or label.
+    size_t nblocks;
+    struct stats_block* blocks[];
+};
+
 struct stats_zone {
     struct stats_zone_spec spec;
     struct stats_domain* domain;
     struct stats_zone* next;
 
-    struct stats_block** blocks;
+    struct stats_zone_blocks* blocks;
+    pthread_spinlock_t blocks_lock;
+    pthread_mutex_t writer_lock; // Serializes changes to the table of blocks.
     size_t nvalues;
 
     unsigned int ref_count;
@@ -104,6 +440,12 @@ struct stats_zone {
 };
 
 //--------------------------------------------------------------------------------------------------
+struct stats_domain_update_hook {
+    struct stats_domain_update_hook* next;
+    void (*callback)(struct stats_domain* domain, void* arg);
+    void* arg;
+};
+
 struct stats_domain {
     struct stats_domain_spec spec;
 
@@ -115,6 +457,11 @@ struct stats_domain {
         pthread_t handle;
         pthread_spinlock_t lock;
     } thread;
+
+    struct {
+        pthread_mutex_t lock; // Held while the hooks run, so that they can be removed safely.
+        struct stats_domain_update_hook* list;
+    } update_hooks;
 };
 
 static inline void stats_domain_lock(struct stats_domain* domain) {
@@ -229,11 +576,10 @@ static void stats_metric_attach(struct stats_metric* metric, struct stats_block*
         .metric = spec,
     };
 
+    struct stats_label* label = metric->labels;
+    const char** plv = metric->prometheus.label_values;
     for (unsigned int n = 0; n < metric->nelements; ++n) {
-        struct stats_metric_element* e = &metric->elements[n];
-
         fspec.idx = n;
-        struct stats_label* label = (typeof(label))e->value.labels;
         for (const struct stats_label_spec* lspec = spec->labels;
              lspec < &spec->labels[spec->nlabels];
              ++lspec, ++label) {
@@ -246,8 +592,13 @@ static void stats_metric_attach(struct stats_metric* metric, struct stats_block*
                 label->value = "";
             }
             label->key = lspec->key;
+
+            if (!STATS_LABEL_FLAG_TEST(lspec->flags, NO_EXPORT)) {
+                *plv++ = label->value;
+            }
         }
     }
+    metric->labelled = true;
 
     int rv = prom_collector_add_metric(blk->prometheus.collector, metric->prometheus.metric);
     if (rv != 0) {
@@ -257,21 +608,6 @@ static void stats_metric_attach(struct stats_metric* metric, struct stats_block*
 
 //--------------------------------------------------------------------------------------------------
 static void stats_metric_detach(struct stats_metric* metric) {
-    const struct stats_metric_spec* spec = &metric->spec;
-    for (struct stats_metric_element* e = metric->elements;
-         e < &metric->elements[metric->nelements];
-         ++e) {
-        struct stats_label* label = (typeof(label))e->value.labels;
-        for (const struct stats_label_spec* lspec = spec->labels;
-             lspec < &spec->labels[spec->nlabels];
-             ++lspec, ++label) {
-            if (lspec->value_free != NULL) {
-                lspec->value_free(label->value);
-                label->value = NULL;
-            }
-        }
-    }
-
     int rv = prom_collector_remove_metric(metric->block->prometheus.collector,
                                           metric->prometheus.metric);
     if (rv != 0) {
@@ -280,11 +616,29 @@ static void stats_metric_detach(struct stats_metric* metric) {
     metric->prometheus.metric = NULL; // Automatic free when metric is removed.
 
     metric->block->nvalues -= metric->nelements;
-    metric->block = NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
 static void stats_metric_free(struct stats_metric* metric) {
+    /*
+     * Labels are released here rather than on detach since readers holding a reference to a
+     * detached block may still be referring to them.
+     */
+    if (metric->labelled) {
+        const struct stats_metric_spec* spec = &metric->spec;
+        struct stats_label* label = metric->labels;
+        for (unsigned int n = 0; n < metric->nelements; ++n) {
+            for (const struct stats_label_spec* lspec = spec->labels;
+                 lspec < &spec->labels[spec->nlabels];
+                 ++lspec, ++label) {
+                if (lspec->value_free != NULL) {
+                    lspec->value_free(label->value);
+                    label->value = NULL;
+                }
+            }
+        }
+    }
+
     if (metric->prometheus.metric != NULL) {
         int rv = prom_gauge_destroy(metric->prometheus.metric);
         if (rv != 0) {
@@ -315,10 +669,18 @@ static struct stats_metric* stats_metric_alloc(const struct stats_metric_spec* s
         }
     }
 
+    size_t npublic_labels = 0;
+    for (unsigned int n = 0; n < spec->nlabels; ++n) {
+        if (!STATS_LABEL_FLAG_TEST(spec->labels[n].flags, NO_EXPORT)) {
+            npublic_labels += 1;
+        }
+    }
+    npublic_labels += DEFAULT_STATS_LABELS_COUNT + (is_array ? ARRAY_STATS_LABELS_COUNT : 0);
+
     struct stats_metric* metric = calloc(1, sizeof(*metric) +
-        nelements * sizeof(metric->elements[0]) +
         nlabels * sizeof(spec->labels[0]) +
-        nelements * nlabels * sizeof(metric->elements[0].value.labels[0]));
+        nelements * nlabels * sizeof(metric->labels[0]) +
+        nelements * npublic_labels * sizeof(metric->prometheus.label_values[0]));
     if (metric == NULL) {
         return NULL;
     }
@@ -327,20 +689,24 @@ static struct stats_metric* stats_metric_alloc(const struct stats_metric_spec* s
     if (spec->io.width > 0) {
         metric->mask = (1 << spec->io.width) - 1;
     }
-
-    metric->elements = (typeof(metric->elements))&metric[1];
     metric->nelements = nelements;
+    metric->nuser_labels = spec->nlabels;
 
-    struct stats_label_spec* lspec = (typeof(lspec))&metric->elements[nelements];
+    struct stats_label_spec* lspec = (typeof(lspec))&metric[1];
     metric->spec.labels = lspec;
     metric->spec.nlabels = nlabels;
 
-    const char* public_label_keys[nlabels];
-    unsigned int npublic_labels = 0;
+    metric->labels = (typeof(metric->labels))&lspec[nlabels];
+    metric->prometheus.label_values =
+        (typeof(metric->prometheus.label_values))&metric->labels[nelements * nlabels];
+    metric->prometheus.nlabels = npublic_labels;
+
+    const char* public_label_keys[npublic_labels];
+    const char** plk = public_label_keys;
     for (unsigned int n = 0; n < DEFAULT_STATS_LABELS_COUNT; ++n, ++lspec) {
         *lspec = default_stats_labels[n];
         if (!STATS_LABEL_FLAG_TEST(lspec->flags, NO_EXPORT)) {
-            public_label_keys[npublic_labels++] = lspec->key;
+            *plk++ = lspec->key;
         }
     }
 
@@ -348,7 +714,7 @@ static struct stats_metric* stats_metric_alloc(const struct stats_metric_spec* s
         for (unsigned int n = 0; n < ARRAY_STATS_LABELS_COUNT; ++n, ++lspec) {
             *lspec = array_stats_labels[n];
             if (!STATS_LABEL_FLAG_TEST(lspec->flags, NO_EXPORT)) {
-                public_label_keys[npublic_labels++] = lspec->key;
+                *plk++ = lspec->key;
             }
         }
     }
@@ -356,20 +722,10 @@ static struct stats_metric* stats_metric_alloc(const struct stats_metric_spec* s
     for (unsigned int n = 0; n < spec->nlabels; ++n, ++lspec) {
         *lspec = spec->labels[n];
         if (!STATS_LABEL_FLAG_TEST(lspec->flags, NO_EXPORT)) {
-            public_label_keys[npublic_labels++] = lspec->key;
+            *plk++ = lspec->key;
         }
     }
 
-    struct stats_label* labels = (typeof(labels))&metric->spec.labels[nlabels];
-    for (struct stats_metric_element* e = metric->elements; e < &metric->elements[nelements]; ++e) {
-        e->value.u64 = spec->init_value;
-        e->last = spec->init_value;
-
-        e->value.labels = labels;
-        e->value.nlabels = nlabels;
-        labels += nlabels;
-    }
-
     metric->prometheus.metric = prom_gauge_new(
         spec->name, spec->desc, npublic_labels, public_label_keys);
     if (metric->prometheus.metric == NULL) {
@@ -400,138 +756,566 @@ static size_t stats_metric_get_values(struct stats_metric* metric,
         nvalues = metric->nelements;
     }
 
-    for (struct stats_metric_element* e = metric->elements;
-         e < &metric->elements[nvalues];
-         ++e, ++values) {
-        stats_metric_lock(metric);
-        *values = e->value;
-        stats_metric_unlock(metric);
+    const struct stats_block_values* bv = &metric->block->values;
+    const uint64_t* u64 = &bv->u64[metric->offset];
+    const double* f64 = &bv->f64[metric->offset];
+    size_t nlabels = metric->spec.nlabels;
+
+    stats_metric_lock(metric);
+    for (unsigned int n = 0; n < nvalues; ++n) {
+        values[n].u64 = u64[n];
+        values[n].f64 = f64[n];
+        values[n].labels = &metric->labels[n * nlabels];
+        values[n].nlabels = nlabels;
     }
+    stats_metric_unlock(metric);
 
     return nvalues;
 }
 
 //--------------------------------------------------------------------------------------------------
-static void stats_block_attach(struct stats_block* blk, struct stats_zone* zone) {
-    blk->zone = zone;
-
-    const struct stats_block_spec* spec = &blk->spec;
-    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
-        stats_metric_attach(*m, blk);
+static struct stats_baseline* stats_baseline_alloc(const char* name,
+                                                   const struct timespec* expires,
+                                                   size_t nelements) {
+    struct stats_baseline* baseline = calloc(1, sizeof(*baseline) + nelements * sizeof(uint64_t));
+    if (baseline == NULL) {
+        return NULL;
     }
-    zone->nvalues += blk->nvalues;
 
-    int rv = prom_collector_registry_register_collector(
-        zone->domain->spec.prometheus.registry, blk->prometheus.collector);
-    if (rv != 0) {
-        log_panic(rv, "prom_collector_registry_register_collector failed for block %s", spec->name);
+    baseline->name = strdup(name);
+    if (baseline->name == NULL) {
+        free(baseline);
+        return NULL;
     }
+    baseline->ref_count = 1;
+    baseline->expires = *expires;
 
-    if (spec->attach_metrics != NULL) {
-        spec->attach_metrics(spec);
+    return baseline;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_baseline_put(struct stats_baseline* baseline) {
+    if (baseline != NULL && atomic_fetch_sub(&baseline->ref_count, 1) == 1) {
+        free(baseline->name);
+        free(baseline);
     }
 }
 
 //--------------------------------------------------------------------------------------------------
-static void stats_block_detach(struct stats_block* blk) {
-    const struct stats_block_spec* spec = &blk->spec;
-    if (spec->detach_metrics != NULL) {
-        spec->detach_metrics(spec);
+static bool stats_baseline_expired(const struct stats_baseline* baseline,
+                                   const struct timespec* now) {
+    if (baseline->expires.tv_sec == 0 && baseline->expires.tv_nsec == 0) {
+        return false;
     }
 
-    blk->zone->nvalues -= blk->nvalues;
-    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
-        stats_metric_detach(*m);
+    return now->tv_sec > baseline->expires.tv_sec ||
+        (now->tv_sec == baseline->expires.tv_sec && now->tv_nsec >= baseline->expires.tv_nsec);
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_block_snapshot* stats_block_snapshot_alloc(size_t nelements) {
+    size_t stride = nelements * sizeof(uint64_t);
+    stride = (stride + STATS_CACHE_LINE_SIZE - 1) & ~(size_t)(STATS_CACHE_LINE_SIZE - 1);
+
+    size_t header = sizeof(struct stats_block_snapshot);
+    header = (header + STATS_CACHE_LINE_SIZE - 1) & ~(size_t)(STATS_CACHE_LINE_SIZE - 1);
+
+    struct stats_block_snapshot* snap = aligned_alloc(STATS_CACHE_LINE_SIZE, header + 5 * stride);
+    if (snap == NULL) {
+        return NULL;
     }
 
-    int rv = prom_collector_registry_unregister_collector(
-        blk->zone->domain->spec.prometheus.registry, blk->prometheus.collector);
-    if (rv != 0) {
-        log_panic(rv, "prom_collector_registry_unregister_collector failed for block %s",
-                  spec->name);
+    snap->ref_count = 0;
+    snap->u64 = (void*)snap + header;
+    snap->f64 = (void*)snap->u64 + stride;
+    snap->gen = (void*)snap->f64 + stride;
+    snap->last_change = (void*)snap->gen + stride;
+    snap->acc = (void*)snap->last_change + stride;
+    snap->nbaselines = 0;
+
+    return snap;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_block_snapshot_put_baselines(struct stats_block_snapshot* snap) {
+    for (size_t n = 0; n < snap->nbaselines; ++n) {
+        stats_baseline_put(snap->baselines[n]);
     }
-    blk->prometheus.collector = NULL; // Automatic free when collector is unregistered
+    snap->nbaselines = 0;
+}
 
-    blk->zone = NULL;
+//--------------------------------------------------------------------------------------------------
+static void stats_block_snapshot_free(struct stats_block_snapshot* snap) {
+    if (snap != NULL) {
+        stats_block_snapshot_put_baselines(snap);
+        free(snap);
+    }
 }
 
 //--------------------------------------------------------------------------------------------------
-static void stats_block_free(struct stats_block* blk) {
-    const struct stats_block_spec* spec = &blk->spec;
-    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
-        if (*m != NULL) {
-            stats_metric_free(*m);
-        }
+static void stats_block_snapshot_put(struct stats_block_snapshot* snap) {
+    if (snap != NULL && atomic_fetch_sub(&snap->ref_count, 1) == 1) {
+        stats_block_snapshot_free(snap);
     }
+}
 
-    if (blk->prometheus.collector != NULL) {
-        int rv = prom_collector_destroy(blk->prometheus.collector);
-        if (rv != 0) {
-            log_panic(rv, "prom_collector_destroy failed for block %s", spec->name);
-        }
+//--------------------------------------------------------------------------------------------------
+/*
+ * Returns the unexpired baseline of the given name held by the snapshot, which remains valid for as
+ * long as the reference to the snapshot is held.
+ */
+static const struct stats_baseline* stats_block_snapshot_find_baseline(
+    const struct stats_block_snapshot* snap, const char* name) {
+    if (snap->nbaselines == 0) {
+        return NULL;
     }
 
-    if (blk->lock != NULL) {
-        int rv = pthread_mutex_destroy(blk->lock);
-        if (rv != 0) {
-            log_panic(rv, "pthread_mutex_destroy failed");
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t n = 0; n < snap->nbaselines; ++n) {
+        const struct stats_baseline* baseline = snap->baselines[n];
+        if (strcmp(baseline->name, name) == 0) {
+            return stats_baseline_expired(baseline, &now) ? NULL : baseline;
         }
     }
 
-    free(blk);
+    return NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
-static struct stats_block* stats_block_alloc(const struct stats_block_spec* spec) {
-    struct stats_block* blk = calloc(1, sizeof(*blk) + spec->nmetrics * sizeof(blk->metrics[0]));
-    if (blk == NULL) {
-        return NULL;
+static struct stats_block_snapshot* stats_block_snapshot_get(struct stats_block* blk) {
+    int rv = pthread_spin_lock(&blk->snapshot.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_lock failed");
     }
 
-#define COLLECTOR_NAME_FMT "block_%s_0x%" PRIxPTR "_0x%" PRIu64
-#define COLLECTOR_NAME_ARGS spec->name, (uintptr_t)spec->io.base, spec->io.data.u64
-    int len = snprintf(NULL, 0, COLLECTOR_NAME_FMT, COLLECTOR_NAME_ARGS);
-    char name[len + 1];
-    snprintf(name, len + 1, COLLECTOR_NAME_FMT, COLLECTOR_NAME_ARGS);
+    struct stats_block_snapshot* snap = blk->snapshot.published;
+    atomic_fetch_add(&snap->ref_count, 1);
 
-    blk->prometheus.collector = prom_collector_new(name);
-    if (blk->prometheus.collector == NULL) {
-        log_err(ENOMEM, "prom_collector_new failed for %s", name);
-        goto free_block;
+    rv = pthread_spin_unlock(&blk->snapshot.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_unlock failed");
     }
-#undef COLLECTOR_NAME_FMT
-#undef COLLECTOR_NAME_ARGS
 
-    /*
-     * Copy the block's specification, excluding the metric specification table (since it may have
-     * been allocated temporarily by the caller). Each metric specification is copied over below.
-     */
-    blk->spec = *spec;
-    blk->spec.metrics = NULL;
+    return snap;
+}
 
-    blk->metrics = (typeof(blk->metrics))&blk[1];
-    for (unsigned int n = 0; n < spec->nmetrics; ++n) {
-        struct stats_metric* metric = stats_metric_alloc(&spec->metrics[n]);
-        if (metric == NULL) {
-            goto free_block;
+//--------------------------------------------------------------------------------------------------
+/*
+ * Must be called with the block lock held, since the spare snapshot is owned by the updater. When a
+ * generation is given, elements whose value differs from the previously published snapshot are
+ * tagged with it, along with the current time.
+ */
+static void stats_block_snapshot_publish(struct stats_block* blk, uint64_t generation) {
+    const struct stats_block_snapshot* published = blk->snapshot.published;
+    if (generation != 0 && published != NULL) {
+        const uint64_t* u64 = blk->values.u64;
+        uint64_t* gen = blk->values.gen;
+        uint64_t* last_change = blk->values.last_change;
+        uint64_t now = stats_monotonic_ns();
+        for (size_t n = 0; n < blk->nelements; ++n) {
+            if (u64[n] != published->u64[n]) {
+                gen[n] = generation;
+                last_change[n] = now;
+            }
         }
-        blk->metrics[n] = metric;
     }
 
-    int rv = pthread_mutex_init(&blk->_mutex, NULL);
-    if (rv != 0) {
-        log_err(rv, "pthread_mutex_init failed");
-        goto free_block;
+    struct stats_block_snapshot* snap = blk->snapshot.spare;
+    blk->snapshot.spare = NULL;
+    if (snap == NULL) {
+        snap = stats_block_snapshot_alloc(blk->nelements);
+        if (snap == NULL) {
+            log_panic(ENOMEM, "failed to allocate snapshot of %zu values for block %s",
+                      blk->nelements, blk->spec.name);
+        }
     }
-    blk->lock = &blk->_mutex;
 
-    return blk;
+    snap->ref_count = 1; // Reference held by the block while published.
+    snap->last_update = blk->last_update;
+    stats_block_snapshot_put_baselines(snap); // Left over from when the spare was last published.
+    for (struct stats_baseline* baseline = blk->baselines;
+         baseline != NULL;
+         baseline = baseline->next) {
+        atomic_fetch_add(&baseline->ref_count, 1);
+        snap->baselines[snap->nbaselines++] = baseline;
+    }
+    memcpy(snap->u64, blk->values.u64, blk->nelements * sizeof(snap->u64[0]));
+    memcpy(snap->f64, blk->values.f64, blk->nelements * sizeof(snap->f64[0]));
+    memcpy(snap->gen, blk->values.gen, blk->nelements * sizeof(snap->gen[0]));
+    memcpy(snap->last_change, blk->values.last_change,
+           blk->nelements * sizeof(snap->last_change[0]));
+    memcpy(snap->acc, blk->values.acc, blk->nelements * sizeof(snap->acc[0]));
 
-free_block:
-    stats_block_free(blk);
+    int rv = pthread_spin_lock(&blk->snapshot.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_lock failed");
+    }
 
-    return NULL;
-}
+    struct stats_block_snapshot* prev = blk->snapshot.published;
+    blk->snapshot.published = snap;
+
+    rv = pthread_spin_unlock(&blk->snapshot.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_unlock failed");
+    }
+
+    /*
+     * Once unpublished, references to the previous snapshot can only be dropped. Recycle it as the
+     * spare when no readers remain, otherwise leave it to be freed by the last reader.
+     */
+    if (prev != NULL) {
+        if (atomic_load(&prev->ref_count) == 1) {
+            blk->snapshot.spare = prev;
+        } else {
+            stats_block_snapshot_put(prev);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * When a predecessor is given, the block takes over its already registered Prometheus collector so
+ * that the series of the block are replaced in place. The predecessor must have been detached. All
+ * elements are tagged with the given generation and the current time to mark them as added.
+ */
+static void stats_block_attach(struct stats_block* blk,
+                               struct stats_zone* zone,
+                               struct stats_block* predecessor,
+                               uint64_t generation) {
+    blk->zone = zone;
+    uint64_t now = stats_monotonic_ns();
+    for (size_t n = 0; n < blk->nelements; ++n) {
+        blk->values.gen[n] = generation;
+        blk->values.last_change[n] = now;
+    }
+
+    const struct stats_block_spec* spec = &blk->spec;
+    if (predecessor != NULL) {
+        int rv = prom_collector_destroy(blk->prometheus.collector);
+        if (rv != 0) {
+            log_panic(rv, "prom_collector_destroy failed for block %s", spec->name);
+        }
+        blk->prometheus.collector = predecessor->prometheus.collector;
+        predecessor->prometheus.collector = NULL;
+    }
+
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        stats_metric_attach(*m, blk);
+    }
+
+    if (predecessor == NULL) {
+        int rv = prom_collector_registry_register_collector(
+            zone->domain->spec.prometheus.registry, blk->prometheus.collector);
+        if (rv != 0) {
+            log_panic(rv, "prom_collector_registry_register_collector failed for block %s",
+                      spec->name);
+        }
+    }
+
+    if (spec->attach_metrics != NULL) {
+        spec->attach_metrics(spec);
+    }
+    blk->attached = true;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Must be called with the block lock held. The block remains readable until its last reference is
+ * dropped, but is skipped by further updates. When keep_collector is set, the Prometheus collector
+ * is left registered so that it can be handed over to a successor block.
+ */
+static void stats_block_detach(struct stats_block* blk, bool keep_collector) {
+    const struct stats_block_spec* spec = &blk->spec;
+    if (spec->detach_metrics != NULL) {
+        spec->detach_metrics(spec);
+    }
+    blk->attached = false;
+
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        stats_metric_detach(*m);
+    }
+
+    if (!keep_collector) {
+        int rv = prom_collector_registry_unregister_collector(
+            blk->zone->domain->spec.prometheus.registry, blk->prometheus.collector);
+        if (rv != 0) {
+            log_panic(rv, "prom_collector_registry_unregister_collector failed for block %s",
+                      spec->name);
+        }
+        blk->prometheus.collector = NULL; // Automatic free when collector is unregistered
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Must be called with the block lock held.
+ */
+static void stats_block_expire_baselines(struct stats_block* blk) {
+    if (blk->baselines == NULL) {
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct stats_baseline** link = &blk->baselines;
+    while (*link != NULL) {
+        struct stats_baseline* baseline = *link;
+        if (stats_baseline_expired(baseline, &now)) {
+            *link = baseline->next;
+            stats_baseline_put(baseline);
+        } else {
+            link = &baseline->next;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Returns the link to the unexpired baseline of the given name, or to the end of the list when there
+ * is none. Must be called with the block lock held.
+ */
+static struct stats_baseline** stats_block_find_baseline(struct stats_block* blk,
+                                                         const char* name) {
+    stats_block_expire_baselines(blk);
+
+    struct stats_baseline** link = &blk->baselines;
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+
+    return link;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Publish a baseline in place of any other of the same name. Must be called with the block lock held.
+ */
+static void stats_block_baseline_publish(struct stats_block* blk, struct stats_baseline* baseline) {
+    struct stats_baseline** link = stats_block_find_baseline(blk, baseline->name);
+    if (*link != NULL) {
+        struct stats_baseline* prev = *link;
+        baseline->next = prev->next;
+        *link = baseline;
+        stats_baseline_put(prev);
+    } else {
+        baseline->next = NULL;
+        *link = baseline;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_metric* stats_block_find_metric(const struct stats_block* blk,
+                                                    const char* name,
+                                                    enum stats_metric_type type) {
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[blk->spec.nmetrics]; ++m) {
+        if ((*m)->spec.type == type && strcmp((*m)->spec.name, name) == 0) {
+            return *m;
+        }
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Record the metrics of a block which are going away, skipping those carried over by a successor.
+ */
+static void stats_block_record_removed(const struct stats_block* blk,
+                                       const struct stats_block* successor,
+                                       uint64_t generation) {
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[blk->spec.nmetrics]; ++m) {
+        const struct stats_metric_spec* mspec = &(*m)->spec;
+        if (successor == NULL ||
+            stats_block_find_metric(successor, mspec->name, mspec->type) == NULL) {
+            const struct stats_zone* zone = blk->zone;
+            stats_generation_record_removed(zone->domain, zone->domain->spec.name, zone->spec.name,
+                                            blk->spec.name, mspec->name, generation);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_block_free(struct stats_block* blk) {
+    const struct stats_block_spec* spec = &blk->spec;
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        if (*m != NULL) {
+            stats_metric_free(*m);
+        }
+    }
+
+    if (blk->prometheus.collector != NULL) {
+        int rv = prom_collector_destroy(blk->prometheus.collector);
+        if (rv != 0) {
+            log_panic(rv, "prom_collector_destroy failed for block %s", spec->name);
+        }
+    }
+
+    while (blk->baselines != NULL) {
+        struct stats_baseline* baseline = blk->baselines;
+        blk->baselines = baseline->next;
+        stats_baseline_put(baseline);
+    }
+
+    free(blk->values.u64);
+    free(blk->latch_data);
+
+    stats_block_snapshot_put(blk->snapshot.published);
+    stats_block_snapshot_free(blk->snapshot.spare);
+
+    if (blk->lock != NULL) {
+        int rv = pthread_mutex_destroy(blk->lock);
+        if (rv != 0) {
+            log_panic(rv, "pthread_mutex_destroy failed");
+        }
+
+        rv = pthread_spin_destroy(&blk->snapshot.lock);
+        if (rv != 0) {
+            log_panic(rv, "pthread_spin_destroy failed");
+        }
+    }
+
+    free(blk);
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_block* stats_block_get(struct stats_block* blk) {
+    atomic_fetch_add(&blk->ref_count, 1);
+    return blk;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_block_put(struct stats_block* blk) {
+    if (atomic_fetch_sub(&blk->ref_count, 1) == 1) {
+        stats_block_free(blk);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_block_values_alloc(struct stats_block* blk) {
+    if (blk->nelements == 0) {
+        return true;
+    }
+
+    // All arrays share a single allocation, each padded out to a whole number of cache lines.
+    size_t stride = blk->nelements * sizeof(uint64_t);
+    stride = (stride + STATS_CACHE_LINE_SIZE - 1) & ~(size_t)(STATS_CACHE_LINE_SIZE - 1);
+
+    void* mem = aligned_alloc(STATS_CACHE_LINE_SIZE, 8 * stride);
+    if (mem == NULL) {
+        return false;
+    }
+
+    struct stats_block_values* bv = &blk->values;
+    bv->u64 = mem;
+    bv->f64 = mem + stride;
+    bv->last = mem + 2 * stride;
+    bv->raw = mem + 3 * stride;
+    bv->gen = mem + 4 * stride;
+    bv->last_change = mem + 5 * stride;
+    bv->acc = mem + 6 * stride;
+    bv->base = mem + 7 * stride;
+
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[blk->spec.nmetrics]; ++m) {
+        struct stats_metric* metric = *m;
+        uint64_t init_value = metric->spec.init_value;
+        for (size_t n = metric->offset; n < metric->offset + metric->nelements; ++n) {
+            bv->u64[n] = init_value;
+            bv->f64[n] = (double)init_value;
+            bv->last[n] = init_value;
+            bv->raw[n] = 0;
+            bv->gen[n] = 0;
+            bv->last_change[n] = 0;
+            bv->acc[n] = init_value;
+            bv->base[n] = 0;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_block* stats_block_alloc(const struct stats_block_spec* spec) {
+    struct stats_block* blk = calloc(1, sizeof(*blk) + spec->nmetrics * sizeof(blk->metrics[0]));
+    if (blk == NULL) {
+        return NULL;
+    }
+
+#define COLLECTOR_NAME_FMT "block_%s_0x%" PRIxPTR "_0x%" PRIu64
+#define COLLECTOR_NAME_ARGS spec->name, (uintptr_t)spec->io.base, spec->io.data.u64
+    int len = snprintf(NULL, 0, COLLECTOR_NAME_FMT, COLLECTOR_NAME_ARGS);
+    char name[len + 1];
+    snprintf(name, len + 1, COLLECTOR_NAME_FMT, COLLECTOR_NAME_ARGS);
+
+    blk->prometheus.collector = prom_collector_new(name);
+    if (blk->prometheus.collector == NULL) {
+        log_err(ENOMEM, "prom_collector_new failed for %s", name);
+        goto free_block;
+    }
+#undef COLLECTOR_NAME_FMT
+#undef COLLECTOR_NAME_ARGS
+
+    /*
+     * Copy the block's specification, excluding the metric specification table (since it may have
+     * been allocated temporarily by the caller). Each metric specification is copied over below.
+     */
+    blk->spec = *spec;
+    blk->spec.metrics = NULL;
+
+    blk->metrics = (typeof(blk->metrics))&blk[1];
+    for (unsigned int n = 0; n < spec->nmetrics; ++n) {
+        struct stats_metric* metric = stats_metric_alloc(&spec->metrics[n]);
+        if (metric == NULL) {
+            goto free_block;
+        }
+        blk->metrics[n] = metric;
+
+        metric->offset = blk->nelements;
+        blk->nelements += metric->nelements;
+        if (metric->nelements > blk->max_metric_nelements) {
+            blk->max_metric_nelements = metric->nelements;
+        }
+    }
+
+    if (!stats_block_values_alloc(blk)) {
+        log_err(ENOMEM, "failed to allocate %zu values for block %s", blk->nelements, spec->name);
+        goto free_block;
+    }
+
+    if (spec->latch.data_size > 0) {
+        blk->latch_data = malloc(spec->latch.data_size);
+        if (blk->latch_data == NULL) {
+            log_err(ENOMEM, "failed to allocate %zu bytes of latch data for block %s",
+                    spec->latch.data_size, spec->name);
+            goto free_block;
+        }
+    }
+
+    int rv = pthread_spin_init(&blk->snapshot.lock, PTHREAD_PROCESS_PRIVATE);
+    if (rv != 0) {
+        log_err(rv, "pthread_spin_init failed");
+        goto free_block;
+    }
+
+    rv = pthread_mutex_init(&blk->_mutex, NULL);
+    if (rv != 0) {
+        log_err(rv, "pthread_mutex_init failed");
+        pthread_spin_destroy(&blk->snapshot.lock);
+        goto free_block;
+    }
+    blk->lock = &blk->_mutex;
+
+    stats_block_snapshot_publish(blk, 0);
+
+    return blk;
+
+free_block:
+    stats_block_free(blk);
+
+    return NULL;
+}
 
 //--------------------------------------------------------------------------------------------------
 static size_t stats_block_get_values(struct stats_block* blk,
@@ -544,170 +1328,740 @@ static size_t stats_block_get_values(struct stats_block* blk,
         n += stats_metric_get_values(*m, &values[n], nvalues - n);
     }
 
-    return n;
+    return n;
+}
+
+
+//--------------------------------------------------------------------------------------------------
+static void stats_metric_update_values(struct stats_metric* metric, void* data) {
+    const struct stats_block_spec* spec = &metric->block->spec;
+    const struct stats_metric_spec* mspec = &metric->spec;
+    bool is_clear_on_read = STATS_METRIC_FLAG_TEST(mspec->flags, CLEAR_ON_READ);
+
+    struct stats_block_values* bv = &metric->block->values;
+    uint64_t* u64 = &bv->u64[metric->offset];
+    double* f64 = &bv->f64[metric->offset];
+    uint64_t* last = &bv->last[metric->offset];
+    uint64_t* acc = &bv->acc[metric->offset];
+    const uint64_t* base = &bv->base[metric->offset];
+    const uint64_t* raw = &bv->raw[metric->offset];
+
+    stats_metric_lock(metric);
+    for (unsigned int n = 0; n < metric->nelements; ++n) {
+        switch (mspec->type) {
+        case stats_metric_type_COUNTER: {
+            uint64_t value = raw[n];
+            uint64_t diff = value;
+            if (!is_clear_on_read) {
+                diff -= last[n];
+                last[n] = value;
+            }
+
+            acc[n] += diff;
+            u64[n] = acc[n] - base[n];
+            break;
+        }
+
+        case stats_metric_type_FLAG:
+            acc[n] = raw[n] ? 1 : 0;
+            u64[n] = acc[n];
+            break;
+
+        case stats_metric_type_GAUGE:
+        default:
+            acc[n] = raw[n];
+            u64[n] = acc[n];
+            break;
+        }
+
+        if (spec->convert_metric != NULL) {
+            f64[n] = spec->convert_metric(spec, mspec, u64[n], data);
+        } else {
+            f64[n] = (double)u64[n];
+        }
+    }
+    stats_metric_unlock(metric);
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_match_name(const char* pattern, const char* name) {
+    return pattern == NULL || strcmp(pattern, name) == 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Check whether at least one element of the metric carries the label key with the given value. A
+ * NULL key matches all metrics and a NULL value matches any value.
+ */
+static bool stats_metric_match_label(const struct stats_metric* metric,
+                                     const char* key,
+                                     const char* value) {
+    if (key == NULL) {
+        return true;
+    }
+
+    const struct stats_label* labels = metric->labels;
+    for (size_t n = 0; n < metric->nelements * metric->spec.nlabels; ++n) {
+        if (strcmp(labels[n].key, key) == 0 && stats_match_name(value, labels[n].value)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Counters are cleared by moving their baseline up to the accumulated value, leaving the running
+ * total intact. Gauges and flags are reset in place until overwritten by the next update.
+ */
+static void stats_metric_clear_values(struct stats_metric* metric,
+                                      const struct stats_clear_filter* filter,
+                                      const struct stats_clear_filter_spec* fspec,
+                                      void* UNUSED(arg)) {
+    const struct stats_block_spec* spec = &metric->block->spec;
+    const struct stats_metric_spec* mspec = &metric->spec;
+    uint64_t init_value = mspec->init_value;
+
+    struct stats_block_values* bv = &metric->block->values;
+    uint64_t* u64 = &bv->u64[metric->offset];
+    double* f64 = &bv->f64[metric->offset];
+    const uint64_t* acc = &bv->acc[metric->offset];
+    uint64_t* base = &bv->base[metric->offset];
+
+    // Evaluate the caller's filter up front, so that the spinlock is only held for the writes.
+    bool* selected = NULL;
+    if (filter->match != NULL) {
+        selected = malloc(metric->nelements * sizeof(*selected));
+        if (selected == NULL) {
+            log_panic(ENOMEM, "failed to allocate %zu clear selections for metric %s",
+                      metric->nelements, mspec->name);
+        }
+        for (unsigned int n = 0; n < metric->nelements; ++n) {
+            selected[n] = filter->match(fspec, n, filter->arg);
+        }
+    }
+
+    stats_metric_lock(metric);
+    for (unsigned int n = 0; n < metric->nelements; ++n) {
+        if (selected != NULL && !selected[n]) {
+            continue;
+        }
+
+        if (mspec->type == stats_metric_type_COUNTER) {
+            base[n] = acc[n] - init_value;
+        }
+        u64[n] = init_value;
+
+        if (spec->convert_metric != NULL) {
+            f64[n] = spec->convert_metric(spec, mspec, u64[n], NULL);
+        } else {
+            f64[n] = (double)u64[n];
+        }
+    }
+    stats_metric_unlock(metric);
+
+    free(selected);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_metric_export_values(struct stats_metric* metric) {
+    // Only the updater writes the values, which is serialized by the block lock held by the caller.
+    const double* f64 = &metric->block->values.f64[metric->offset];
+    const char** label_values = metric->prometheus.label_values;
+    size_t nlabels = metric->prometheus.nlabels;
+
+    for (unsigned int n = 0; n < metric->nelements; ++n, label_values += nlabels) {
+        prom_gauge_set(metric->prometheus.metric, f64[n], label_values);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_block_update_metrics(struct stats_block* blk) {
+    const struct stats_block_spec* spec = &blk->spec;
+
+    stats_block_lock(blk);
+    if (!blk->attached) {
+        // Replaced or removed since the caller looked it up.
+        stats_block_unlock(blk);
+        return;
+    }
+    uint64_t generation = stats_generation_begin();
+
+    int rv = clock_gettime(CLOCK_MONOTONIC, &blk->last_update);
+    if (rv != 0) {
+        log_err(errno, "clock_getttime failed for last update timestamp");
+    }
+
+    void* data = blk->latch_data;
+    if (data != NULL) {
+        memset(data, 0, spec->latch.data_size);
+    }
+
+    if (spec->latch_metrics != NULL) {
+        spec->latch_metrics(spec, data);
+    }
+
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        struct stats_metric* metric = *m;
+        const struct stats_metric_spec* mspec = &metric->spec;
+
+        uint64_t* values = &blk->values.raw[metric->offset];
+        if (spec->read_metric != NULL) {
+            spec->read_metric(spec, mspec, values, data);
+        } else {
+            stats_metric_read(metric, values);
+        }
+
+        stats_metric_update_values(metric, data);
+    }
+
+    // Publish to Prometheus in a separate pass to keep the label handling out of the update loop.
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        stats_metric_export_values(*m);
+    }
+    stats_block_snapshot_publish(blk, generation);
+
+    if (spec->release_metrics != NULL) {
+        spec->release_metrics(spec, data);
+    }
+    stats_block_unlock(blk);
+    stats_generation_end();
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Visit each metric of the block which can be cleared, with the clear filter set up for the metric.
+ * Must be called with the block lock held.
+ */
+static void stats_block_for_each_clearable_metric(
+    struct stats_block* blk,
+    const struct stats_clear_filter* filter,
+    void (*apply)(struct stats_metric* metric,
+                  const struct stats_clear_filter* filter,
+                  const struct stats_clear_filter_spec* fspec,
+                  void* arg),
+    void* arg) {
+    const struct stats_block_spec* spec = &blk->spec;
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        struct stats_metric* metric = *m;
+        const struct stats_metric_spec* mspec = &metric->spec;
+        if (STATS_METRIC_FLAG_TEST(mspec->flags, NEVER_CLEAR) ||
+            !stats_match_name(filter->metric, mspec->name) ||
+            !stats_metric_match_label(metric, filter->label.key, filter->label.value)) {
+            continue;
+        }
+
+        struct stats_metric_value* filter_values = NULL;
+        if (filter->match != NULL) {
+            filter_values = calloc(metric->nelements, sizeof(*filter_values));
+            if (filter_values == NULL) {
+                log_panic(ENOMEM, "failed to allocate %zu filter values for metric %s",
+                          metric->nelements, mspec->name);
+            }
+            stats_metric_get_values(metric, filter_values, metric->nelements);
+        }
+        const struct stats_clear_filter_spec fspec = {
+            .domain = &blk->zone->domain->spec,
+            .zone = &blk->zone->spec,
+            .block = spec,
+            .metric = mspec,
+            .values = filter_values,
+            .nvalues = metric->nelements,
+            .last_change = &blk->values.last_change[metric->offset],
+        };
+        if (filter->setup != NULL) {
+            filter->setup(&fspec, filter->arg);
+        }
+
+        apply(metric, filter, &fspec, arg);
+
+        if (filter->teardown != NULL) {
+            filter->teardown(&fspec, filter->arg);
+        }
+        free(filter_values);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_block_clear_metrics(struct stats_block* blk,
+                                      const struct stats_clear_filter* filter) {
+    const struct stats_block_spec* spec = &blk->spec;
+
+    stats_block_lock(blk);
+    if (!blk->attached) {
+        stats_block_unlock(blk);
+        return;
+    }
+    uint64_t generation = stats_generation_begin();
+
+    stats_block_for_each_clearable_metric(blk, filter, stats_metric_clear_values, NULL);
+
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
+        stats_metric_export_values(*m);
+    }
+    stats_block_snapshot_publish(blk, generation);
+
+    stats_block_unlock(blk);
+    stats_generation_end();
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_baseline_update {
+    struct stats_baseline* baseline;
+    uint64_t generation;
+};
+
+static void stats_metric_set_baseline(struct stats_metric* metric,
+                                      const struct stats_clear_filter* filter,
+                                      const struct stats_clear_filter_spec* fspec,
+                                      void* arg) {
+    const struct stats_metric_spec* mspec = &metric->spec;
+    if (mspec->type != stats_metric_type_COUNTER) {
+        return;
+    }
+
+    struct stats_baseline_update* update = arg;
+    struct stats_block_values* bv = &metric->block->values;
+    uint64_t* base = &update->baseline->acc[metric->offset];
+    const uint64_t* acc = &bv->acc[metric->offset];
+    uint64_t* gen = &bv->gen[metric->offset];
+
+    for (unsigned int n = 0; n < metric->nelements; ++n) {
+        if (filter->match == NULL || filter->match(fspec, n, filter->arg)) {
+            base[n] = acc[n] - mspec->init_value;
+            gen[n] = update->generation; // Values relative to the baseline have changed.
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Elements not selected by the filter keep their value from any previous baseline of the same name,
+ * or are taken relative to zero otherwise.
+ */
+static bool stats_block_clear_baseline(struct stats_block* blk,
+                                       const char* name,
+                                       const struct timespec* expires,
+                                       const struct stats_clear_filter* filter) {
+    struct stats_baseline* baseline = stats_baseline_alloc(name, expires, blk->nelements);
+    if (baseline == NULL) {
+        log_err(ENOMEM, "failed to allocate baseline %s for block %s", name, blk->spec.name);
+        return false;
+    }
+
+    stats_block_lock(blk);
+    if (!blk->attached) {
+        stats_block_unlock(blk);
+        stats_baseline_put(baseline);
+        return true;
+    }
+
+    const struct stats_baseline* prev = *stats_block_find_baseline(blk, name);
+    if (prev != NULL) {
+        memcpy(baseline->acc, prev->acc, blk->nelements * sizeof(baseline->acc[0]));
+    } else {
+        size_t nbaselines = 0;
+        for (const struct stats_baseline* b = blk->baselines; b != NULL; b = b->next) {
+            nbaselines += 1;
+        }
+        if (nbaselines >= STATS_BASELINES_MAX) {
+            stats_block_unlock(blk);
+            stats_baseline_put(baseline);
+            log_err(ENOSPC, "block %s already holds %u baselines, rejecting baseline %s",
+                    blk->spec.name, STATS_BASELINES_MAX, name);
+            return false;
+        }
+    }
+
+    struct stats_baseline_update update = {
+        .baseline = baseline,
+        .generation = stats_generation_begin(),
+    };
+    stats_block_for_each_clearable_metric(blk, filter, stats_metric_set_baseline, &update);
+    stats_block_baseline_publish(blk, baseline);
+    stats_block_snapshot_publish(blk, 0);
+
+    stats_block_unlock(blk);
+    stats_generation_end();
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int stats_block_for_each_metric(struct stats_block* blk,
+                                       int (*callback)(const struct stats_for_each_spec* spec),
+                                       void* arg) {
+    if (blk->max_metric_nelements == 0) {
+        return 0;
+    }
+
+    struct stats_metric_value* values = malloc(blk->max_metric_nelements * sizeof(*values));
+    if (values == NULL) {
+        log_panic(ENOMEM, "failed to allocate %zu values for block %s",
+                  blk->max_metric_nelements, blk->spec.name);
+    }
+
+    struct stats_block_snapshot* snap = stats_block_snapshot_get(blk);
+    struct stats_for_each_spec spec = {
+        .domain = &blk->zone->domain->spec,
+        .zone = &blk->zone->spec,
+        .block = &blk->spec,
+        .arg = arg,
+        .last_update = snap->last_update,
+    };
+
+    int rv = 0;
+    for (struct stats_metric** m = blk->metrics;
+         rv == 0 && m < &blk->metrics[blk->spec.nmetrics];
+         ++m) {
+        struct stats_metric* metric = *m;
+        size_t nlabels = metric->spec.nlabels;
+        for (unsigned int n = 0; n < metric->nelements; ++n) {
+            values[n].u64 = snap->u64[metric->offset + n];
+            values[n].f64 = snap->f64[metric->offset + n];
+            values[n].labels = &metric->labels[n * nlabels];
+            values[n].nlabels = nlabels;
+        }
+
+        spec.metric = &metric->spec;
+        spec.values = values;
+        spec.nvalues = metric->nelements;
+        rv = callback(&spec);
+    }
+
+    stats_block_snapshot_put(snap);
+    free(values);
+
+    return rv;
+}
+
+//--------------------------------------------------------------------------------------------------
+static inline void stats_zone_writer_lock(struct stats_zone* zone) {
+    int rv = pthread_mutex_lock(&zone->writer_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_lock failed");
+    }
+}
+
+static inline void stats_zone_writer_unlock(struct stats_zone* zone) {
+    int rv = pthread_mutex_unlock(&zone->writer_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_unlock failed");
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Lookup tables for the metrics in a table of blocks, keyed by metric name and by label. Since tables
+ * of blocks are immutable, the index is built once on the first lookup and shared by all readers of
+ * the table. Entries are sorted by key, then value, then position of the metric, so that all of the
+ * metrics matching a key (and value) are found in table order with a binary search.
+ */
+struct stats_index_entry {
+    const char* key;
+    const char* value; // NULL for entries keyed by metric name.
+    struct stats_metric_ref ref;
+};
+
+struct stats_zone_index {
+    struct stats_index_entry* names;
+    size_t nnames;
+    struct stats_index_entry* labels; // One entry per distinct label of each metric.
+    size_t nlabels;
+};
+
+//--------------------------------------------------------------------------------------------------
+static int stats_metric_ref_cmp(const void* a, const void* b) {
+    const struct stats_metric_ref* ra = a;
+    const struct stats_metric_ref* rb = b;
+
+    if (ra->block_idx != rb->block_idx) {
+        return ra->block_idx < rb->block_idx ? -1 : 1;
+    }
+    if (ra->metric_idx != rb->metric_idx) {
+        return ra->metric_idx < rb->metric_idx ? -1 : 1;
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int stats_index_entry_key_cmp(const struct stats_index_entry* entry,
+                                     const char* key,
+                                     const char* value) {
+    int rv = strcmp(entry->key, key);
+    if (rv == 0 && value != NULL) {
+        rv = strcmp(entry->value, value);
+    }
+
+    return rv;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int stats_index_entry_cmp(const void* a, const void* b) {
+    const struct stats_index_entry* ea = a;
+    const struct stats_index_entry* eb = b;
+
+    int rv = stats_index_entry_key_cmp(ea, eb->key, eb->value);
+    if (rv == 0) {
+        rv = stats_metric_ref_cmp(&ea->ref, &eb->ref);
+    }
+
+    return rv;
 }
 
+//--------------------------------------------------------------------------------------------------
+static void stats_zone_index_free(struct stats_zone_index* index) {
+    if (index != NULL) {
+        free(index->names);
+        free(index->labels);
+        free(index);
+    }
+}
 
 //--------------------------------------------------------------------------------------------------
-static void stats_block_update_metrics(struct stats_block* blk,
-                                       const struct stats_clear_filter* filter) {
-    const struct stats_block_spec* spec = &blk->spec;
+static struct stats_zone_index* stats_zone_index_alloc(const struct stats_zone_blocks* tbl) {
+    size_t nnames = 0;
+    size_t nlabels = 0;
+    for (struct stats_block* const* blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+        const struct stats_block* b = *blk;
+        for (struct stats_metric** m = b->metrics; m < &b->metrics[b->spec.nmetrics]; ++m) {
+            nnames += 1;
+            nlabels += (*m)->nelements * (*m)->spec.nlabels;
+        }
+    }
 
-    stats_block_lock(blk);
-    int rv = clock_gettime(CLOCK_MONOTONIC, &blk->last_update);
-    if (rv != 0) {
-        log_err(errno, "clock_getttime failed for last update timestamp");
+    struct stats_zone_index* index = calloc(1, sizeof(*index));
+    if (index == NULL) {
+        return NULL;
     }
 
-    uint64_t* data = NULL;
-    size_t nwords = (spec->latch.data_size + sizeof(*data) - 1) / sizeof(*data);
-    typeof(*data) words[nwords];
-    if (nwords > 0) {
-        memset(words, 0, nwords * sizeof(*data));
-        data = words;
+    index->names = calloc(nnames + 1, sizeof(*index->names));
+    index->labels = calloc(nlabels + 1, sizeof(*index->labels));
+    if (index->names == NULL || index->labels == NULL) {
+        stats_zone_index_free(index);
+        return NULL;
     }
 
-    if (spec->latch_metrics != NULL) {
-        spec->latch_metrics(spec, data);
+    struct stats_index_entry* name = index->names;
+    struct stats_index_entry* label = index->labels;
+    for (unsigned int b = 0; b < tbl->nblocks; ++b) {
+        const struct stats_block* blk = tbl->blocks[b];
+        for (unsigned int m = 0; m < blk->spec.nmetrics; ++m) {
+            const struct stats_metric* metric = blk->metrics[m];
+            const struct stats_metric_ref ref = {.block_idx = b, .metric_idx = m};
+            *name++ = (struct stats_index_entry){
+                .key = metric->spec.name,
+                .value = NULL,
+                .ref = ref,
+            };
+
+            const struct stats_label* labels = metric->labels;
+            for (size_t n = 0; n < metric->nelements * metric->spec.nlabels; ++n) {
+                *label++ = (struct stats_index_entry){
+                    .key = labels[n].key,
+                    .value = labels[n].value,
+                    .ref = ref,
+                };
+            }
+        }
     }
+    index->nnames = nnames;
+    qsort(index->names, nnames, sizeof(*index->names), stats_index_entry_cmp);
 
-    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[spec->nmetrics]; ++m) {
-        struct stats_metric* metric = *m;
-        const struct stats_metric_spec* mspec = &metric->spec;
-        bool is_clear_on_read = STATS_METRIC_FLAG_TEST(mspec->flags, CLEAR_ON_READ);
-        bool is_never_clear = STATS_METRIC_FLAG_TEST(mspec->flags, NEVER_CLEAR);
+    // Labels shared by all elements of a metric (such as those of its scope) are listed once.
+    qsort(index->labels, nlabels, sizeof(*index->labels), stats_index_entry_cmp);
+    size_t nunique = 0;
+    for (size_t n = 0; n < nlabels; ++n) {
+        if (nunique == 0 ||
+            stats_index_entry_cmp(&index->labels[nunique - 1], &index->labels[n]) != 0) {
+            index->labels[nunique++] = index->labels[n];
+        }
+    }
+    index->nlabels = nunique;
 
-        uint64_t values[metric->nelements];
-        if (spec->read_metric != NULL) {
-            spec->read_metric(spec, mspec, values, data);
+    return index;
+}
+
+//--------------------------------------------------------------------------------------------------
+static const struct stats_zone_index* stats_zone_blocks_index(struct stats_zone_blocks* tbl) {
+    struct stats_zone_index* index = atomic_load(&tbl->index);
+    if (index != NULL) {
+        return index;
+    }
+
+    index = stats_zone_index_alloc(tbl);
+    if (index == NULL) {
+        return NULL;
+    }
+
+    // Readers racing to build the index keep whichever was published first.
+    struct stats_zone_index* expected = NULL;
+    if (!atomic_compare_exchange_strong(&tbl->index, &expected, index)) {
+        stats_zone_index_free(index);
+        index = expected;
+    }
+
+    return index;
+}
+
+//--------------------------------------------------------------------------------------------------
+static size_t stats_index_lower_bound(const struct stats_index_entry* entries,
+                                      size_t nentries,
+                                      const char* key,
+                                      const char* value) {
+    size_t lo = 0;
+    size_t hi = nentries;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (stats_index_entry_key_cmp(&entries[mid], key, value) < 0) {
+            lo = mid + 1;
         } else {
-            stats_metric_read(metric, values);
+            hi = mid;
         }
+    }
 
-        struct stats_metric_value filter_values[metric->nelements];
-        if (filter != NULL) {
-            stats_metric_lock(metric);
-            for (unsigned int n = 0; n < metric->nelements; ++n) {
-                filter_values[n] = metric->elements[n].value;
-            }
-            stats_metric_unlock(metric);
+    return lo;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_metric_refs_append(struct stats_metric_refs* refs,
+                                     const struct stats_metric_ref* ref) {
+    if (refs->n >= refs->size) {
+        size_t size = refs->size > 0 ? refs->size * 2 : 16;
+        struct stats_metric_ref* list = realloc(refs->list, size * sizeof(*list));
+        if (list == NULL) {
+            log_panic(ENOMEM, "failed to allocate %zu metric references", size);
         }
-        const struct stats_clear_filter_spec fspec = {
-            .domain = &blk->zone->domain->spec,
-            .zone = &blk->zone->spec,
-            .block = spec,
-            .metric = mspec,
-            .values = filter_values,
-            .nvalues = metric->nelements,
-        };
-        if (filter != NULL && filter->setup != NULL) {
-            filter->setup(&fspec, filter->arg);
+        refs->list = list;
+        refs->size = size;
+    }
+
+    refs->list[refs->n++] = *ref;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Look up the metrics of a table with the given name and/or carrying the given label key (and value,
+ * unless NULL) through the index of the table. The selected metrics are returned in table order.
+ * Returns false when neither a name nor a label is given, or the index can't be built, in which case
+ * every metric remains a candidate. Metrics selected by name alone may still lack the label.
+ */
+static bool stats_zone_blocks_select(struct stats_zone_blocks* tbl,
+                                     const char* metric,
+                                     const char* label_key,
+                                     const char* label_value,
+                                     struct stats_metric_refs* refs) {
+    refs->n = 0;
+    if (metric == NULL && label_key == NULL) {
+        return false;
+    }
+
+    const struct stats_zone_index* index = stats_zone_blocks_index(tbl);
+    if (index == NULL) {
+        return false;
+    }
+
+    if (metric != NULL) {
+        const struct stats_index_entry* names = index->names;
+        for (size_t n = stats_index_lower_bound(names, index->nnames, metric, NULL);
+             n < index->nnames && strcmp(names[n].key, metric) == 0;
+             ++n) {
+            stats_metric_refs_append(refs, &names[n].ref);
         }
 
-        for (unsigned int n = 0; n < metric->nelements; ++n) {
-            struct stats_metric_element* e = &metric->elements[n];
-            bool do_clear =
-                !is_never_clear &&
-                filter != NULL &&
-                (
-                    filter->match == NULL ||              /* Wildcard to clear all. */
-                    filter->match(&fspec, n, filter->arg) /* Selective clear. */
-                );
-
-            stats_metric_lock(metric);
-            switch (mspec->type) {
-            case stats_metric_type_COUNTER: {
-                uint64_t value = values[n];
-                uint64_t diff = value;
-                if (!is_clear_on_read) {
-                    diff -= e->last;
-                    e->last = value;
-                }
+        return true;
+    }
 
-                if (do_clear) {
-                    e->value.u64 = mspec->init_value;
-                } else {
-                    e->value.u64 += diff;
-                }
-                break;
+    const struct stats_index_entry* labels = index->labels;
+    for (size_t n = stats_index_lower_bound(labels, index->nlabels, label_key, label_value);
+         n < index->nlabels && stats_index_entry_key_cmp(&labels[n], label_key, label_value) == 0;
+         ++n) {
+        stats_metric_refs_append(refs, &labels[n].ref);
+    }
+
+    // Any value of the key matches, so a metric is listed once for each of its distinct values.
+    if (label_value == NULL && refs->n > 1) {
+        qsort(refs->list, refs->n, sizeof(refs->list[0]), stats_metric_ref_cmp);
+        size_t nunique = 1;
+        for (size_t n = 1; n < refs->n; ++n) {
+            if (stats_metric_ref_cmp(&refs->list[nunique - 1], &refs->list[n]) != 0) {
+                refs->list[nunique++] = refs->list[n];
             }
+        }
+        refs->n = nunique;
+    }
 
-            case stats_metric_type_FLAG:
-                if (do_clear) {
-                    e->value.u64 = mspec->init_value;
-                } else {
-                    e->value.u64 = values[n] ? 1 : 0;
-                }
-                break;
+    return true;
+}
 
-            case stats_metric_type_GAUGE:
-            default:
-                if (do_clear) {
-                    e->value.u64 = mspec->init_value;
-                } else {
-                    e->value.u64 = values[n];
-                }
-                break;
-            }
+//--------------------------------------------------------------------------------------------------
+static struct stats_zone_blocks* stats_zone_blocks_alloc(size_t nblocks) {
+    struct stats_zone_blocks* tbl = calloc(1, sizeof(*tbl) + nblocks * sizeof(tbl->blocks[0]));
+    if (tbl != NULL) {
+        tbl->ref_count = 1;
+        tbl->nblocks = nblocks;
+    }
 
-            double f64;
-            if (spec->convert_metric != NULL) {
-                f64 = spec->convert_metric(spec, mspec, e->value.u64, data);
-            } else {
-                f64 = (double)e->value.u64;
-            }
-            e->value.f64 = f64;
-            stats_metric_unlock(metric);
-
-            const char* public_label_values[mspec->nlabels];
-            const char** plv = public_label_values;
-            for (unsigned int n = 0; n < mspec->nlabels; ++n) {
-                if (!STATS_LABEL_FLAG_TEST(mspec->labels[n].flags, NO_EXPORT)) {
-                    *plv = e->value.labels[n].value;
-                    plv += 1;
-                }
+    return tbl;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_zone_blocks_put(struct stats_zone_blocks* tbl) {
+    if (tbl != NULL && atomic_fetch_sub(&tbl->ref_count, 1) == 1) {
+        for (struct stats_block** blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+            if (*blk != NULL) {
+                stats_block_put(*blk);
             }
-            prom_gauge_set(metric->prometheus.metric, f64, public_label_values);
         }
+        stats_zone_index_free(tbl->index);
+        free(tbl);
+    }
+}
 
-        if (filter != NULL && filter->teardown != NULL) {
-            filter->teardown(&fspec, filter->arg);
-        }
+//--------------------------------------------------------------------------------------------------
+static struct stats_zone_blocks* stats_zone_blocks_get(struct stats_zone* zone) {
+    int rv = pthread_spin_lock(&zone->blocks_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_lock failed");
     }
 
-    if (spec->release_metrics != NULL) {
-        spec->release_metrics(spec, data);
+    struct stats_zone_blocks* tbl = zone->blocks;
+    atomic_fetch_add(&tbl->ref_count, 1);
+
+    rv = pthread_spin_unlock(&zone->blocks_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_unlock failed");
     }
-    stats_block_unlock(blk);
+
+    return tbl;
 }
 
 //--------------------------------------------------------------------------------------------------
-static int stats_block_for_each_metric(struct stats_block* blk,
-                                       int (*callback)(const struct stats_for_each_spec* spec),
-                                       void* arg) {
-    struct stats_for_each_spec spec = {
-        .domain = &blk->zone->domain->spec,
-        .zone = &blk->zone->spec,
-        .block = &blk->spec,
-        .arg = arg,
-        .last_update = blk->last_update,
-    };
+static void stats_zone_blocks_publish(struct stats_zone* zone, struct stats_zone_blocks* tbl) {
+    int rv = pthread_spin_lock(&zone->blocks_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_lock failed");
+    }
 
-    int rv = 0;
-    for (struct stats_metric** m = blk->metrics;
-         rv == 0 && m < &blk->metrics[blk->spec.nmetrics];
-         ++m) {
-        struct stats_metric* metric = *m;
-        struct stats_metric_value values[metric->nelements];
-        stats_metric_get_values(metric, values, metric->nelements);
+    struct stats_zone_blocks* prev = zone->blocks;
+    zone->blocks = tbl;
 
-        spec.metric = &metric->spec;
-        spec.values = values;
-        spec.nvalues = metric->nelements;
-        rv = callback(&spec);
+    rv = pthread_spin_unlock(&zone->blocks_lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_spin_unlock failed");
     }
 
-    return rv;
+    stats_zone_blocks_put(prev);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_zone_adjust_nvalues(struct stats_zone* zone, ssize_t delta) {
+    stats_domain_lock(zone->domain);
+    zone->nvalues += delta;
+    zone->domain->nvalues += delta;
+    stats_domain_unlock(zone->domain);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -724,21 +2078,33 @@ static void stats_zone_attach(struct stats_zone* zone, struct stats_domain* doma
     zone->enabled = true;
     stats_domain_unlock(domain);
 
-    for (struct stats_block** blk = zone->blocks; blk < &zone->blocks[zone->spec.nblocks]; ++blk) {
-        stats_block_attach(*blk, zone);
+    uint64_t generation = stats_generation_begin();
+    struct stats_zone_blocks* tbl = zone->blocks;
+    size_t nvalues = 0;
+    for (struct stats_block** blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+        stats_block_lock(*blk);
+        stats_block_attach(*blk, zone, NULL, generation);
+        stats_block_snapshot_publish(*blk, 0);
+        stats_block_unlock(*blk);
+        nvalues += (*blk)->nvalues;
     }
+    stats_generation_end();
 
-    stats_domain_lock(domain);
-    domain->nvalues += zone->nvalues;
-    stats_domain_unlock(domain);
+    stats_zone_adjust_nvalues(zone, nvalues);
 }
 
 //--------------------------------------------------------------------------------------------------
 static void stats_zone_detach(struct stats_zone* zone) {
     size_t nvalues = zone->nvalues;
-    for (struct stats_block** blk = zone->blocks; blk < &zone->blocks[zone->spec.nblocks]; ++blk) {
-        stats_block_detach(*blk);
+    uint64_t generation = stats_generation_begin();
+    struct stats_zone_blocks* tbl = zone->blocks;
+    for (struct stats_block** blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+        stats_block_lock(*blk);
+        stats_block_record_removed(*blk, NULL, generation);
+        stats_block_detach(*blk, false);
+        stats_block_unlock(*blk);
     }
+    stats_generation_end();
 
     struct stats_domain* domain = zone->domain;
     struct stats_zone** link = &domain->zones;
@@ -761,71 +2127,413 @@ static void stats_zone_detach(struct stats_zone* zone) {
 
 //--------------------------------------------------------------------------------------------------
 static void __stats_zone_free(struct stats_zone* zone) {
-    for (struct stats_block** blk = zone->blocks; blk < &zone->blocks[zone->spec.nblocks]; ++blk) {
-        if (*blk != NULL) {
-            stats_block_free(*blk);
+    stats_zone_blocks_put(zone->blocks);
+
+    pthread_mutex_destroy(&zone->writer_lock);
+    pthread_spin_destroy(&zone->blocks_lock);
+    free(zone);
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_zone* stats_zone_get(struct stats_zone* zone) {
+    if (zone != NULL) {
+        atomic_fetch_add(&zone->ref_count, 1);
+    }
+
+    return zone;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_zone_put(struct stats_zone* zone) {
+    if (zone != NULL) {
+        unsigned int ref_count = atomic_fetch_sub(&zone->ref_count, 1);
+        if (ref_count == 0) {
+            stats_zone_detach(zone);
+            __stats_zone_free(zone);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+void stats_zone_free(struct stats_zone* zone) {
+    stats_zone_put(zone);
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_zone* stats_zone_alloc(struct stats_domain* domain,
+                                    const struct stats_zone_spec* spec) {
+    struct stats_zone* zone = calloc(1, sizeof(*zone));
+    if (zone == NULL) {
+        return NULL;
+    }
+
+    /*
+     * Copy the zone's specification, excluding the block specification table (since it may have
+     * been allocated temporarily by the caller). Each block specification is copied over below.
+     */
+    zone->spec = *spec;
+    zone->spec.blocks = NULL;
+
+    int rv = pthread_spin_init(&zone->blocks_lock, PTHREAD_PROCESS_PRIVATE);
+    if (rv != 0) {
+        log_err(rv, "pthread_spin_init failed");
+        free(zone);
+        return NULL;
+    }
+
+    rv = pthread_mutex_init(&zone->writer_lock, NULL);
+    if (rv != 0) {
+        log_err(rv, "pthread_mutex_init failed");
+        pthread_spin_destroy(&zone->blocks_lock);
+        free(zone);
+        return NULL;
+    }
+
+    zone->blocks = stats_zone_blocks_alloc(spec->nblocks);
+    if (zone->blocks == NULL) {
+        goto free_zone;
+    }
+
+    for (unsigned int n = 0; n < spec->nblocks; ++n) {
+        struct stats_block* blk = stats_block_alloc(&spec->blocks[n]);
+        if (blk == NULL) {
+            goto free_zone;
         }
+        zone->blocks->blocks[n] = stats_block_get(blk);
     }
 
-    free(zone);
+    stats_zone_attach(zone, domain);
+    return stats_zone_get(zone);
+
+free_zone:
+    __stats_zone_free(zone);
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_block* stats_zone_find_block(struct stats_zone_blocks* tbl,
+                                                 const char* name,
+                                                 unsigned int* idx) {
+    for (unsigned int n = 0; n < tbl->nblocks; ++n) {
+        if (strcmp(tbl->blocks[n]->spec.name, name) == 0) {
+            if (idx != NULL) {
+                *idx = n;
+            }
+            return tbl->blocks[n];
+        }
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Copy the current values of each metric in the predecessor over to the metric of the same name and
+ * type in the new block. Arrays which have been resized keep the values of their common elements,
+ * but are otherwise treated as newly added so that their change generations cover the new shape.
+ */
+static void stats_block_inherit_values(struct stats_block* blk, struct stats_block* predecessor) {
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[blk->spec.nmetrics]; ++m) {
+        struct stats_metric* metric = *m;
+        struct stats_metric* pmetric =
+            stats_block_find_metric(predecessor, metric->spec.name, metric->spec.type);
+        if (pmetric == NULL) {
+            continue;
+        }
+
+        size_t n = metric->nelements < pmetric->nelements ? metric->nelements : pmetric->nelements;
+        const struct stats_block_values* from = &predecessor->values;
+        struct stats_block_values* to = &blk->values;
+        memcpy(&to->u64[metric->offset], &from->u64[pmetric->offset], n * sizeof(to->u64[0]));
+        memcpy(&to->f64[metric->offset], &from->f64[pmetric->offset], n * sizeof(to->f64[0]));
+        memcpy(&to->last[metric->offset], &from->last[pmetric->offset], n * sizeof(to->last[0]));
+        memcpy(&to->acc[metric->offset], &from->acc[pmetric->offset], n * sizeof(to->acc[0]));
+        memcpy(&to->base[metric->offset], &from->base[pmetric->offset], n * sizeof(to->base[0]));
+        if (metric->nelements == pmetric->nelements) {
+            memcpy(&to->gen[metric->offset], &from->gen[pmetric->offset], n * sizeof(to->gen[0]));
+            memcpy(&to->last_change[metric->offset], &from->last_change[pmetric->offset],
+                   n * sizeof(to->last_change[0]));
+        }
+    }
+
+    blk->last_update = predecessor->last_update;
+
+    // Carry over the named baselines for the metrics held in common.
+    stats_block_expire_baselines(predecessor);
+    struct stats_baseline** link = &blk->baselines;
+    for (struct stats_baseline* pbaseline = predecessor->baselines;
+         pbaseline != NULL;
+         pbaseline = pbaseline->next) {
+        struct stats_baseline* baseline =
+            stats_baseline_alloc(pbaseline->name, &pbaseline->expires, blk->nelements);
+        if (baseline == NULL) {
+            log_err(ENOMEM, "failed to carry over baseline %s", pbaseline->name);
+            continue;
+        }
+
+        for (struct stats_metric** m = blk->metrics; m < &blk->metrics[blk->spec.nmetrics]; ++m) {
+            struct stats_metric* metric = *m;
+            struct stats_metric* pmetric =
+                stats_block_find_metric(predecessor, metric->spec.name, metric->spec.type);
+            if (pmetric != NULL) {
+                size_t n = metric->nelements < pmetric->nelements ?
+                    metric->nelements : pmetric->nelements;
+                memcpy(&baseline->acc[metric->offset], &pbaseline->acc[pmetric->offset],
+                       n * sizeof(baseline->acc[0]));
+            }
+        }
+
+        *link = baseline;
+        link = &baseline->next;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Publish a copy of the zone's current table of blocks with the block at index idx replaced by blk.
+ * When idx is beyond the end of the table, blk is appended. When blk is NULL, the block at idx is
+ * removed. Must be called with the zone's writer lock held.
+ */
+static bool stats_zone_update_blocks(struct stats_zone* zone,
+                                     struct stats_zone_blocks* cur,
+                                     unsigned int idx,
+                                     struct stats_block* blk) {
+    size_t nblocks = cur->nblocks;
+    if (idx >= nblocks) {
+        nblocks += 1;
+    } else if (blk == NULL) {
+        nblocks -= 1;
+    }
+
+    struct stats_zone_blocks* tbl = stats_zone_blocks_alloc(nblocks);
+    if (tbl == NULL) {
+        return false;
+    }
+
+    struct stats_block** to = tbl->blocks;
+    for (unsigned int n = 0; n < cur->nblocks; ++n) {
+        if (n != idx) {
+            *to++ = stats_block_get(cur->blocks[n]);
+        } else if (blk != NULL) {
+            *to++ = stats_block_get(blk);
+        }
+    }
+    if (idx >= cur->nblocks) {
+        *to++ = stats_block_get(blk);
+    }
+
+    stats_zone_blocks_publish(zone, tbl);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool __stats_zone_replace_block(struct stats_zone* zone,
+                                       const struct stats_block_spec* spec,
+                                       bool add,
+                                       bool replace) {
+    struct stats_zone_blocks* cur = zone->blocks; // Stable while the writer lock is held.
+    unsigned int idx = cur->nblocks;
+    struct stats_block* predecessor = stats_zone_find_block(cur, spec->name, &idx);
+    if ((predecessor == NULL && !add) || (predecessor != NULL && !replace)) {
+        return false;
+    }
+
+    struct stats_block* blk = stats_block_alloc(spec);
+    if (blk == NULL) {
+        return false;
+    }
+    stats_block_get(blk);
+
+    // The predecessor may be freed once it is dropped from the table.
+    ssize_t nvalues = -(ssize_t)(predecessor != NULL ? predecessor->nvalues : 0);
+    uint64_t generation = stats_generation_begin();
+
+    if (predecessor != NULL) {
+        /*
+         * Hold the predecessor's lock across the hand over so that no update of it can interleave
+         * with copying its values. Any update attempted after this point finds it detached.
+         */
+        stats_block_lock(predecessor);
+        stats_block_detach(predecessor, true);
+        stats_block_attach(blk, zone, predecessor, generation);
+        stats_block_inherit_values(blk, predecessor);
+        stats_block_record_removed(predecessor, blk, generation);
+    } else {
+        stats_block_attach(blk, zone, NULL, generation);
+    }
+
+    stats_block_lock(blk);
+    stats_block_snapshot_publish(blk, 0);
+    stats_block_unlock(blk);
+    if (predecessor != NULL) {
+        stats_block_unlock(predecessor);
+    }
+
+    nvalues += blk->nvalues;
+
+    if (!stats_zone_update_blocks(zone, cur, idx, blk)) {
+        log_panic(ENOMEM, "failed to allocate block table for zone %s", zone->spec.name);
+    }
+    stats_generation_end();
+    stats_zone_adjust_nvalues(zone, nvalues);
+    stats_block_put(blk);
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_add_block(struct stats_zone* zone, const struct stats_block_spec* spec) {
+    stats_zone_writer_lock(zone);
+    bool ok = __stats_zone_replace_block(zone, spec, true, false);
+    stats_zone_writer_unlock(zone);
+
+    return ok;
 }
 
 //--------------------------------------------------------------------------------------------------
-static struct stats_zone* stats_zone_get(struct stats_zone* zone) {
-    if (zone != NULL) {
-        atomic_fetch_add(&zone->ref_count, 1);
-    }
+bool stats_zone_replace_block(struct stats_zone* zone, const struct stats_block_spec* spec) {
+    stats_zone_writer_lock(zone);
+    bool ok = __stats_zone_replace_block(zone, spec, false, true);
+    stats_zone_writer_unlock(zone);
 
-    return zone;
+    return ok;
 }
 
 //--------------------------------------------------------------------------------------------------
-static void stats_zone_put(struct stats_zone* zone) {
-    if (zone != NULL) {
-        unsigned int ref_count = atomic_fetch_sub(&zone->ref_count, 1);
-        if (ref_count == 0) {
-            stats_zone_detach(zone);
-            __stats_zone_free(zone);
+bool stats_zone_remove_block(struct stats_zone* zone, const char* name) {
+    stats_zone_writer_lock(zone);
+
+    struct stats_zone_blocks* cur = zone->blocks;
+    unsigned int idx;
+    struct stats_block* blk = stats_zone_find_block(cur, name, &idx);
+    bool ok = blk != NULL;
+    if (ok) {
+        size_t nvalues = blk->nvalues;
+        uint64_t generation = stats_generation_begin();
+        stats_block_lock(blk);
+        stats_block_record_removed(blk, NULL, generation);
+        stats_block_detach(blk, false);
+        stats_block_unlock(blk);
+
+        if (!stats_zone_update_blocks(zone, cur, idx, NULL)) {
+            log_panic(ENOMEM, "failed to allocate block table for zone %s", zone->spec.name);
         }
+        stats_generation_end();
+        stats_zone_adjust_nvalues(zone, -(ssize_t)nvalues);
     }
-}
 
-//--------------------------------------------------------------------------------------------------
-void stats_zone_free(struct stats_zone* zone) {
-    stats_zone_put(zone);
+    stats_zone_writer_unlock(zone);
+    return ok;
 }
 
 //--------------------------------------------------------------------------------------------------
-struct stats_zone* stats_zone_alloc(struct stats_domain* domain,
-                                    const struct stats_zone_spec* spec) {
-    struct stats_zone* zone = calloc(1, sizeof(*zone) + spec->nblocks * sizeof(zone->blocks[0]));
-    if (zone == NULL) {
-        return NULL;
+enum stats_zone_metric_op {
+    stats_zone_metric_op_ADD,
+    stats_zone_metric_op_REMOVE,
+    stats_zone_metric_op_RESIZE,
+};
+
+/*
+ * Rebuild the specification of an existing block with a single metric added, removed or resized,
+ * then replace the block with one allocated from it.
+ */
+static bool stats_zone_change_metric(struct stats_zone* zone,
+                                     const char* block,
+                                     enum stats_zone_metric_op op,
+                                     const struct stats_metric_spec* mspec,
+                                     const char* name,
+                                     size_t nelements) {
+    stats_zone_writer_lock(zone);
+
+    bool ok = false;
+    struct stats_metric_spec* mspecs = NULL;
+    struct stats_block* blk = stats_zone_find_block(zone->blocks, block, NULL);
+    if (blk == NULL) {
+        goto unlock;
     }
 
-    /*
-     * Copy the zone's specification, excluding the block specification table (since it may have
-     * been allocated temporarily by the caller). Each block specification is copied over below.
-     */
-    zone->spec = *spec;
-    zone->spec.blocks = NULL;
+    size_t nmetrics = blk->spec.nmetrics;
+    mspecs = calloc(nmetrics + 1, sizeof(*mspecs));
+    if (mspecs == NULL) {
+        goto unlock;
+    }
 
-    zone->blocks = (typeof(zone->blocks))&zone[1];
-    for (unsigned int n = 0; n < spec->nblocks; ++n) {
-        struct stats_block* blk = stats_block_alloc(&spec->blocks[n]);
-        if (blk == NULL) {
-            goto free_zone;
+    size_t n = 0;
+    bool found = false;
+    for (struct stats_metric** m = blk->metrics; m < &blk->metrics[nmetrics]; ++m) {
+        const struct stats_metric* metric = *m;
+        struct stats_metric_spec* spec = &mspecs[n];
+
+        // Strip the labels added by the engine, leaving those given by the original caller.
+        *spec = metric->spec;
+        spec->labels = &metric->spec.labels[metric->spec.nlabels - metric->nuser_labels];
+        spec->nlabels = metric->nuser_labels;
+
+        if (strcmp(spec->name, op == stats_zone_metric_op_ADD ? mspec->name : name) != 0) {
+            n += 1;
+            continue;
+        }
+
+        found = true;
+        switch (op) {
+        case stats_zone_metric_op_ADD:
+            goto unlock; // Metric names must be unique within a block.
+
+        case stats_zone_metric_op_REMOVE:
+            break;
+
+        case stats_zone_metric_op_RESIZE:
+            if (!STATS_METRIC_FLAG_TEST(spec->flags, ARRAY) || nelements == 0) {
+                goto unlock;
+            }
+            spec->nelements = nelements;
+            n += 1;
+            break;
         }
-        zone->blocks[n] = blk;
     }
 
-    stats_zone_attach(zone, domain);
-    return stats_zone_get(zone);
+    if (op == stats_zone_metric_op_ADD) {
+        mspecs[n++] = *mspec;
+    } else if (!found) {
+        goto unlock;
+    }
 
-free_zone:
-    __stats_zone_free(zone);
+    struct stats_block_spec bspec = blk->spec;
+    bspec.metrics = mspecs;
+    bspec.nmetrics = n;
+    ok = __stats_zone_replace_block(zone, &bspec, false, true);
 
-    return NULL;
+unlock:
+    stats_zone_writer_unlock(zone);
+    free(mspecs);
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_add_metric(struct stats_zone* zone, const char* block,
+                           const struct stats_metric_spec* spec) {
+    return stats_zone_change_metric(zone, block, stats_zone_metric_op_ADD, spec, NULL, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_remove_metric(struct stats_zone* zone, const char* block, const char* name) {
+    return stats_zone_change_metric(zone, block, stats_zone_metric_op_REMOVE, NULL, name, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_resize_metric(struct stats_zone* zone, const char* block, const char* name,
+                              size_t nelements) {
+    return stats_zone_change_metric(zone, block, stats_zone_metric_op_RESIZE, NULL, name,
+                                    nelements);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_for_each_removed_metric(
+    const struct stats_zone* zone, uint64_t since,
+    void (*callback)(const struct stats_removed_metric* removed, void* arg), void* arg) {
+    return stats_domain_for_each_removed_metric(zone->domain, zone->spec.name, since, callback, arg);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -855,12 +2563,14 @@ size_t stats_zone_number_of_values(struct stats_zone* zone) {
 size_t stats_zone_get_values(struct stats_zone* zone,
                              struct stats_metric_value* values,
                              size_t nvalues) {
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
     size_t n = 0;
-    for (struct stats_block** blk = zone->blocks;
-         n < nvalues && blk < &zone->blocks[zone->spec.nblocks];
+    for (struct stats_block** blk = tbl->blocks;
+         n < nvalues && blk < &tbl->blocks[tbl->nblocks];
          ++blk) {
         n += stats_block_get_values(*blk, &values[n], nvalues - n);
     }
+    stats_zone_blocks_put(tbl);
 
     return n;
 }
@@ -874,9 +2584,11 @@ void stats_zone_update_metrics(struct stats_zone* zone) {
         return;
     }
 
-    for (struct stats_block** blk = zone->blocks; blk < &zone->blocks[zone->spec.nblocks]; ++blk) {
-        stats_block_update_metrics(*blk, NULL);
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
+    for (struct stats_block** blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+        stats_block_update_metrics(*blk);
     }
+    stats_zone_blocks_put(tbl);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -886,21 +2598,106 @@ void stats_zone_clear_metrics(struct stats_zone* zone, const struct stats_clear_
         filter = &clear_all;
     }
 
-    for (struct stats_block** blk = zone->blocks; blk < &zone->blocks[zone->spec.nblocks]; ++blk) {
-        stats_block_update_metrics(*blk, filter);
+    // Blocks holding none of the metrics selected by name or label are left untouched.
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
+    struct stats_metric_refs selected = {0};
+    bool indexed = stats_zone_blocks_select(tbl, filter->metric,
+                                            filter->label.key, filter->label.value, &selected);
+    const struct stats_metric_ref* ref = selected.list;
+    for (unsigned int b = 0; b < tbl->nblocks; ++b) {
+        if (indexed) {
+            while (ref < &selected.list[selected.n] && ref->block_idx < b) {
+                ref += 1;
+            }
+            if (ref >= &selected.list[selected.n]) {
+                break;
+            }
+            if (ref->block_idx != b) {
+                continue;
+            }
+        }
+
+        stats_block_clear_metrics(tbl->blocks[b], filter);
+    }
+    free(selected.list);
+    stats_zone_blocks_put(tbl);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_baseline_expiry(unsigned int ttl_ms, struct timespec* expires) {
+    if (ttl_ms == 0) {
+        *expires = (struct timespec){0}; // Never expires.
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, expires);
+    expires->tv_sec += ttl_ms / 1000;
+    expires->tv_nsec += (long)(ttl_ms % 1000) * 1000000;
+    if (expires->tv_nsec >= 1000000000) {
+        expires->tv_sec += 1;
+        expires->tv_nsec -= 1000000000;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool __stats_zone_clear_baseline(struct stats_zone* zone,
+                                        const char* name,
+                                        const struct timespec* expires,
+                                        const struct stats_clear_filter* filter) {
+    struct stats_clear_filter clear_all = {.match = NULL};
+    if (filter == NULL) {
+        filter = &clear_all;
+    }
+
+    bool ok = true;
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
+    for (struct stats_block** blk = tbl->blocks; blk < &tbl->blocks[tbl->nblocks]; ++blk) {
+        ok &= stats_block_clear_baseline(*blk, name, expires, filter);
+    }
+    stats_zone_blocks_put(tbl);
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_clear_baseline(struct stats_zone* zone,
+                               const char* name,
+                               unsigned int ttl_ms,
+                               const struct stats_clear_filter* filter) {
+    struct timespec expires;
+    stats_baseline_expiry(ttl_ms, &expires);
+
+    return __stats_zone_clear_baseline(zone, name, &expires, filter);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_zone_has_baseline(struct stats_zone* zone, const char* name) {
+    bool found = false;
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
+    for (struct stats_block** blk = tbl->blocks;
+         !found && blk < &tbl->blocks[tbl->nblocks];
+         ++blk) {
+        struct stats_block_snapshot* snap = stats_block_snapshot_get(*blk);
+        found = stats_block_snapshot_find_baseline(snap, name) != NULL;
+        stats_block_snapshot_put(snap);
     }
+    stats_zone_blocks_put(tbl);
+
+    return found;
 }
 
 //--------------------------------------------------------------------------------------------------
 int stats_zone_for_each_metric(struct stats_zone* zone,
                                int (*callback)(const struct stats_for_each_spec* spec),
                                void* arg) {
+    struct stats_zone_blocks* tbl = stats_zone_blocks_get(zone);
     int rv = 0;
-    for (struct stats_block** blk = zone->blocks;
-         rv == 0 && blk < &zone->blocks[zone->spec.nblocks];
+    for (struct stats_block** blk = tbl->blocks;
+         rv == 0 && blk < &tbl->blocks[tbl->nblocks];
          ++blk) {
         rv = stats_block_for_each_metric(*blk, callback, arg);
     }
+    stats_zone_blocks_put(tbl);
 
     return rv;
 }
@@ -941,6 +2738,17 @@ void stats_domain_free(struct stats_domain* domain) {
         log_panic(rv, "pthread_spin_destroy failed");
     }
 
+    rv = pthread_mutex_destroy(&domain->update_hooks.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_destroy failed");
+    }
+
+    while (domain->update_hooks.list != NULL) {
+        struct stats_domain_update_hook* hook = domain->update_hooks.list;
+        domain->update_hooks.list = hook->next;
+        free(hook);
+    }
+
     free(domain);
 }
 
@@ -962,8 +2770,16 @@ struct stats_domain* stats_domain_alloc(const struct stats_domain_spec* spec) {
         goto free_domain;
     }
 
+    rv = pthread_mutex_init(&domain->update_hooks.lock, NULL);
+    if (rv != 0) {
+        log_err(rv, "pthread_mutex_init failed");
+        goto destroy_thread_lock;
+    }
+
     return domain;
 
+destroy_thread_lock:
+    pthread_spin_destroy(&domain->thread.lock);
 free_domain:
     free(domain);
 
@@ -996,12 +2812,74 @@ size_t stats_domain_get_values(struct stats_domain* domain,
     return n;
 }
 
+//--------------------------------------------------------------------------------------------------
+static inline void stats_domain_update_hooks_lock(struct stats_domain* domain) {
+    int rv = pthread_mutex_lock(&domain->update_hooks.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_lock failed");
+    }
+}
+
+static inline void stats_domain_update_hooks_unlock(struct stats_domain* domain) {
+    int rv = pthread_mutex_unlock(&domain->update_hooks.lock);
+    if (rv != 0) {
+        log_panic(rv, "pthread_mutex_unlock failed");
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_domain_add_update_hook(struct stats_domain* domain,
+                                  void (*callback)(struct stats_domain* domain, void* arg),
+                                  void* arg) {
+    struct stats_domain_update_hook* hook = calloc(1, sizeof(*hook));
+    if (hook == NULL) {
+        log_err(ENOMEM, "failed to allocate update hook");
+        return false;
+    }
+    hook->callback = callback;
+    hook->arg = arg;
+
+    stats_domain_update_hooks_lock(domain);
+    hook->next = domain->update_hooks.list;
+    domain->update_hooks.list = hook;
+    stats_domain_update_hooks_unlock(domain);
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+void stats_domain_remove_update_hook(struct stats_domain* domain,
+                                     void (*callback)(struct stats_domain* domain, void* arg),
+                                     void* arg) {
+    struct stats_domain_update_hook* hook = NULL;
+
+    stats_domain_update_hooks_lock(domain);
+    for (struct stats_domain_update_hook** prev = &domain->update_hooks.list; *prev != NULL;
+         prev = &(*prev)->next) {
+        if ((*prev)->callback == callback && (*prev)->arg == arg) {
+            hook = *prev;
+            *prev = hook->next;
+            break;
+        }
+    }
+    stats_domain_update_hooks_unlock(domain);
+
+    free(hook);
+}
+
 //--------------------------------------------------------------------------------------------------
 void stats_domain_update_metrics(struct stats_domain* domain) {
     struct stats_zone* zone = NULL;
     while (stats_domain_get_next_zone(domain, &zone)) {
         stats_zone_update_metrics(zone);
     }
+
+    stats_domain_update_hooks_lock(domain);
+    for (struct stats_domain_update_hook* hook = domain->update_hooks.list; hook != NULL;
+         hook = hook->next) {
+        hook->callback(domain, hook->arg);
+    }
+    stats_domain_update_hooks_unlock(domain);
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -1013,6 +2891,36 @@ void stats_domain_clear_metrics(struct stats_domain* domain,
     }
 }
 
+//--------------------------------------------------------------------------------------------------
+bool stats_domain_clear_baseline(struct stats_domain* domain,
+                                 const char* name,
+                                 unsigned int ttl_ms,
+                                 const struct stats_clear_filter* filter) {
+    struct timespec expires;
+    stats_baseline_expiry(ttl_ms, &expires);
+
+    bool ok = true;
+    struct stats_zone* zone = NULL;
+    while (stats_domain_get_next_zone(domain, &zone)) {
+        ok &= __stats_zone_clear_baseline(zone, name, &expires, filter);
+    }
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_domain_has_baseline(struct stats_domain* domain, const char* name) {
+    struct stats_zone* zone = NULL;
+    while (stats_domain_get_next_zone(domain, &zone)) {
+        if (stats_zone_has_baseline(zone, name)) {
+            stats_zone_put(zone);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 //--------------------------------------------------------------------------------------------------
 static void* stats_domain_thread(void* arg) {
     struct stats_domain* domain = arg;
@@ -1091,3 +2999,299 @@ int stats_domain_for_each_metric(struct stats_domain* domain,
 
     return rv;
 }
+
+//--------------------------------------------------------------------------------------------------
+struct stats_cursor {
+    struct stats_domain* domain; // NULL when iterating over a single zone.
+    struct stats_cursor_filter filter;
+
+    struct stats_zone* zone;
+    struct stats_zone_blocks* blocks; // Keeps the zone's blocks alive while views refer to them.
+    unsigned int block_idx;
+    unsigned int metric_idx;
+    bool block_entered;
+    bool done;
+
+    struct {
+        struct stats_metric_refs selected;
+        size_t idx;
+        bool active;
+    } refs; // Metrics of the zone found through its index, when the filter names a metric or label.
+
+    struct stats_block_snapshot* snapshot;
+    const struct stats_baseline* baseline; // Named by the filter, held by the snapshot.
+    struct stats_metric_view view;
+
+    struct {
+        uint64_t* u64;
+        double* f64;
+        size_t size;
+    } relative; // Values relative to the baseline, for the metric in the view.
+};
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_cursor_match_values(const struct stats_cursor_filter* filter,
+                                      const struct stats_metric_view* view) {
+    if (filter->changed_since > 0) {
+        size_t n = 0;
+        while (n < view->nvalues && view->generations[n] <= filter->changed_since) {
+            n += 1;
+        }
+
+        if (n >= view->nvalues) {
+            return false;
+        }
+    }
+
+    if (filter->non_zero) {
+        size_t n = 0;
+        while (n < view->nvalues && view->u64[n] == 0) {
+            n += 1;
+        }
+
+        if (n >= view->nvalues) {
+            return false;
+        }
+    }
+
+    return filter->match == NULL || filter->match(view, filter->arg);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_cursor_put_block(struct stats_cursor* cursor) {
+    stats_block_snapshot_put(cursor->snapshot);
+    cursor->snapshot = NULL;
+    cursor->baseline = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_cursor_release_block(struct stats_cursor* cursor) {
+    stats_cursor_put_block(cursor);
+    cursor->block_idx += 1;
+    cursor->metric_idx = 0;
+    cursor->block_entered = false;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_cursor_select(struct stats_cursor* cursor) {
+    const struct stats_cursor_filter* filter = &cursor->filter;
+    cursor->refs.idx = 0;
+    cursor->refs.active =
+        stats_match_name(filter->zone, cursor->zone->spec.name) &&
+        stats_zone_blocks_select(cursor->blocks, filter->metric,
+                                 filter->label.key, filter->label.value, &cursor->refs.selected);
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Advance the position of the cursor to the next selected metric at or after it. Returns false once
+ * all selected metrics of the zone have been visited.
+ */
+static bool stats_cursor_seek(struct stats_cursor* cursor) {
+    const struct stats_metric_refs* selected = &cursor->refs.selected;
+    for (; cursor->refs.idx < selected->n; ++cursor->refs.idx) {
+        const struct stats_metric_ref* ref = &selected->list[cursor->refs.idx];
+        if (ref->block_idx > cursor->block_idx) {
+            stats_cursor_put_block(cursor);
+            cursor->block_idx = ref->block_idx;
+            cursor->metric_idx = ref->metric_idx;
+            cursor->block_entered = false;
+            return true;
+        }
+
+        if (ref->block_idx == cursor->block_idx && ref->metric_idx >= cursor->metric_idx) {
+            cursor->metric_idx = ref->metric_idx;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Point the view at the values of a counter taken relative to the baseline held by the cursor.
+ */
+static void stats_cursor_relative_values(struct stats_cursor* cursor,
+                                         const struct stats_block* blk,
+                                         const struct stats_metric* metric) {
+    size_t nvalues = metric->nelements;
+    if (cursor->relative.size < nvalues) {
+        uint64_t* u64 = realloc(cursor->relative.u64, nvalues * sizeof(*u64));
+        if (u64 != NULL) {
+            cursor->relative.u64 = u64;
+        }
+
+        double* f64 = realloc(cursor->relative.f64, nvalues * sizeof(*f64));
+        if (f64 != NULL) {
+            cursor->relative.f64 = f64;
+        }
+
+        if (u64 == NULL || f64 == NULL) {
+            log_panic(ENOMEM, "failed to allocate %zu relative values", nvalues);
+        }
+        cursor->relative.size = nvalues;
+    }
+
+    const struct stats_block_spec* spec = &blk->spec;
+    const struct stats_metric_spec* mspec = &metric->spec;
+    const uint64_t* acc = &cursor->snapshot->acc[metric->offset];
+    const uint64_t* base = &cursor->baseline->acc[metric->offset];
+    for (size_t n = 0; n < nvalues; ++n) {
+        uint64_t value = acc[n] - base[n];
+        cursor->relative.u64[n] = value;
+        if (spec->convert_metric != NULL) {
+            cursor->relative.f64[n] = spec->convert_metric(spec, mspec, value, NULL);
+        } else {
+            cursor->relative.f64[n] = (double)value;
+        }
+    }
+
+    cursor->view.u64 = cursor->relative.u64;
+    cursor->view.f64 = cursor->relative.f64;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_cursor_next_zone(struct stats_cursor* cursor) {
+    stats_zone_blocks_put(cursor->blocks);
+    cursor->blocks = NULL;
+
+    if (cursor->domain == NULL || !stats_domain_get_next_zone(cursor->domain, &cursor->zone)) {
+        cursor->done = true;
+        return false;
+    }
+
+    cursor->block_idx = 0;
+    cursor->metric_idx = 0;
+    cursor->block_entered = false;
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+const struct stats_metric_view* stats_cursor_next(struct stats_cursor* cursor) {
+    const struct stats_cursor_filter* filter = &cursor->filter;
+
+    while (!cursor->done) {
+        struct stats_zone* zone = cursor->zone;
+        if (zone != NULL && cursor->blocks == NULL) {
+            cursor->blocks = stats_zone_blocks_get(zone);
+            stats_cursor_select(cursor);
+        }
+
+        if (zone == NULL ||
+            cursor->block_idx >= cursor->blocks->nblocks ||
+            !stats_match_name(filter->zone, zone->spec.name) ||
+            (cursor->refs.active && !stats_cursor_seek(cursor))) {
+            stats_cursor_put_block(cursor);
+            stats_cursor_next_zone(cursor);
+            continue;
+        }
+
+        struct stats_block* blk = cursor->blocks->blocks[cursor->block_idx];
+        if (cursor->metric_idx >= blk->spec.nmetrics ||
+            !stats_match_name(filter->block, blk->spec.name)) {
+            stats_cursor_release_block(cursor);
+            continue;
+        }
+
+        if (!cursor->block_entered) {
+            if (filter->match_block != NULL &&
+                !filter->match_block(&zone->domain->spec, &zone->spec, &blk->spec, filter->arg)) {
+                stats_cursor_release_block(cursor);
+                continue;
+            }
+            cursor->block_entered = true;
+        }
+
+        // Metrics selected through the index by label are known to carry it.
+        struct stats_metric* metric = blk->metrics[cursor->metric_idx++];
+        if (!stats_match_name(filter->metric, metric->spec.name) ||
+            (!(cursor->refs.active && filter->metric == NULL) &&
+             !stats_metric_match_label(metric, filter->label.key, filter->label.value))) {
+            continue;
+        }
+
+        if (cursor->snapshot == NULL) {
+            // The baseline comes from the same snapshot, so it is never newer than the values.
+            cursor->snapshot = stats_block_snapshot_get(blk);
+            if (filter->baseline != NULL) {
+                cursor->baseline =
+                    stats_block_snapshot_find_baseline(cursor->snapshot, filter->baseline);
+            }
+        }
+
+        struct stats_block_snapshot* snap = cursor->snapshot;
+        cursor->view = (struct stats_metric_view){
+            .domain = &zone->domain->spec,
+            .zone = &zone->spec,
+            .block = &blk->spec,
+            .metric = &metric->spec,
+            .index = cursor->metric_idx - 1,
+            .last_update = snap->last_update,
+            .nvalues = metric->nelements,
+            .u64 = &snap->u64[metric->offset],
+            .f64 = &snap->f64[metric->offset],
+            .generations = &snap->gen[metric->offset],
+            .last_change = &snap->last_change[metric->offset],
+            .labels = metric->labels,
+            .nlabels = metric->spec.nlabels,
+        };
+
+        if (cursor->baseline != NULL && metric->spec.type == stats_metric_type_COUNTER) {
+            stats_cursor_relative_values(cursor, blk, metric);
+        }
+
+        if (stats_cursor_match_values(filter, &cursor->view)) {
+            return &cursor->view;
+        }
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void stats_cursor_free(struct stats_cursor* cursor) {
+    stats_cursor_put_block(cursor);
+    stats_zone_blocks_put(cursor->blocks);
+    stats_zone_put(cursor->zone);
+    free(cursor->refs.selected.list);
+    free(cursor->relative.u64);
+    free(cursor->relative.f64);
+    free(cursor);
+}
+
+//--------------------------------------------------------------------------------------------------
+static struct stats_cursor* stats_cursor_alloc(const struct stats_cursor_filter* filter) {
+    struct stats_cursor* cursor = calloc(1, sizeof(*cursor));
+    if (cursor == NULL) {
+        return NULL;
+    }
+
+    if (filter != NULL) {
+        cursor->filter = *filter;
+    }
+
+    return cursor;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_cursor* stats_zone_cursor_alloc(struct stats_zone* zone,
+                                             const struct stats_cursor_filter* filter) {
+    struct stats_cursor* cursor = stats_cursor_alloc(filter);
+    if (cursor != NULL) {
+        cursor->zone = stats_zone_get(zone);
+    }
+
+    return cursor;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_cursor* stats_domain_cursor_alloc(struct stats_domain* domain,
+                                               const struct stats_cursor_filter* filter) {
+    struct stats_cursor* cursor = stats_cursor_alloc(filter);
+    if (cursor != NULL) {
+        cursor->domain = domain;
+    }
+
+    return cursor;
+}
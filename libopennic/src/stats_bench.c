@@ -0,0 +1,719 @@
+/*
+ * Stats engine benchmark suite.
+ *
+ * Builds synthetic stats domains over a file-backed BAR2 mapping which mirror the zone layouts used
+ * by the agents on real hardware (CMAC ports, switch probes, QDMA hosts and P4 counter blocks), then
+ * measures per-update latency, element throughput, reader contention and Prometheus export cost.
+ * Results are written as one JSON object per line to allow tracking regressions between builds.
+ */
+#include "array_size.h"
+#include "cmac.h"
+#include "esnet_smartnic_toplevel.h"
+#include "prom.h"
+#include "qdma.h"
+#include "smartnic.h"
+#include "stats.h"
+#include "switch.h"
+#include "unused.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//--------------------------------------------------------------------------------------------------
+#define log_err(_rv, _format, _args...) \
+    fprintf(stderr, "ERROR(%s)[%d (%s)]: " _format "\n", __func__, _rv, strerror(_rv),## _args)
+#define log_panic(_rv, _format, _args...) \
+    {log_err(_rv, _format,## _args); exit(EXIT_FAILURE);}
+
+#define NSECS_PER_SEC 1000000000ULL
+
+static uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct bench_args {
+    const char* bar2_path;
+    const char* output_path;
+    const size_t* scales;
+    size_t nscales;
+    unsigned int iterations;
+    unsigned int readers;
+    unsigned int exports;
+};
+
+struct bench_latency {
+    uint64_t min;
+    uint64_t max;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p99;
+};
+
+static int bench_latency_cmp(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void bench_latency_compute(uint64_t* samples, size_t nsamples, struct bench_latency* lat) {
+    memset(lat, 0, sizeof(*lat));
+    if (nsamples == 0) {
+        return;
+    }
+
+    qsort(samples, nsamples, sizeof(samples[0]), bench_latency_cmp);
+
+    uint64_t total = 0;
+    for (size_t n = 0; n < nsamples; ++n) {
+        total += samples[n];
+    }
+
+    lat->min = samples[0];
+    lat->max = samples[nsamples - 1];
+    lat->mean = total / nsamples;
+    lat->p50 = samples[nsamples / 2];
+    lat->p99 = samples[(nsamples * 99) / 100];
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Synthetic P4 counter blocks. On hardware, counter blocks are read through the vitisnetp4 driver
+ * into a latch buffer (see sn-p4/src/agent/counters.cpp). Here the driver collect operation is
+ * emulated by copying the counts out of a window in the upper half of the BAR2 mapping.
+ */
+#define P4_COUNTERS_PER_BLOCK_MAX 16384
+#define P4_COUNTER_NLABELS 2
+
+struct p4_counters_io_data {
+    volatile uint64_t* window;
+    size_t nwords;
+    size_t offset;
+    size_t ncounters;
+};
+
+struct p4_counters_latch_data {
+    uint64_t values[0]; // packets => values[0:ncounters-1], bytes => values[ncounters:2*ncounters-1]
+};
+
+static void p4_counters_latch_metrics(const struct stats_block_spec* bspec, void* data) {
+    const struct p4_counters_io_data* iod = bspec->io.data.ptr;
+    struct p4_counters_latch_data* ld = data;
+
+    size_t w = iod->offset;
+    for (size_t n = 0; n < 2 * iod->ncounters; ++n) {
+        ld->values[n] = iod->window[w];
+        if (++w >= iod->nwords) {
+            w = 0;
+        }
+    }
+}
+
+static void p4_counters_read_metric(const struct stats_block_spec* UNUSED(bspec),
+                                    const struct stats_metric_spec* mspec,
+                                    uint64_t* values,
+                                    void* data) {
+    const struct p4_counters_latch_data* ld = data;
+    memcpy(values, &ld->values[mspec->io.offset], mspec->nelements * sizeof(values[0]));
+}
+
+struct p4_counters_zone {
+    struct stats_zone* zone;
+    struct p4_counters_io_data* io_data;
+    char* names;
+};
+
+static void p4_counters_zone_free(struct p4_counters_zone* pcz) {
+    if (pcz->zone != NULL) {
+        stats_zone_free(pcz->zone);
+    }
+    free(pcz->io_data);
+    free(pcz->names);
+    memset(pcz, 0, sizeof(*pcz));
+}
+
+#define P4_COUNTER_NAME_LEN 32
+
+static struct stats_zone* p4_counters_zone_build(struct p4_counters_zone* pcz,
+                                                 struct stats_domain* domain,
+                                                 size_t nblocks,
+                                                 size_t ncounters) {
+    struct stats_block_spec bspecs[nblocks];
+    struct stats_metric_spec mspecs[nblocks * 2];
+    struct stats_label_spec lspecs[nblocks * 2 * P4_COUNTER_NLABELS];
+    memset(bspecs, 0, sizeof(bspecs));
+    memset(mspecs, 0, sizeof(mspecs));
+    memset(lspecs, 0, sizeof(lspecs));
+
+    static const char* const names[] = {"p4_counter_packets", "p4_counter_bytes"};
+    static const char* const units[] = {"packets", "bytes"};
+
+    size_t remaining = ncounters;
+    for (size_t b = 0; b < nblocks; ++b) {
+        size_t n = remaining < P4_COUNTERS_PER_BLOCK_MAX ? remaining : P4_COUNTERS_PER_BLOCK_MAX;
+        remaining -= n;
+        pcz->io_data[b].ncounters = n;
+
+        char* name = &pcz->names[b * P4_COUNTER_NAME_LEN];
+        snprintf(name, P4_COUNTER_NAME_LEN, "p4_counter_block%zu", b);
+
+        for (unsigned int m = 0; m < ARRAY_SIZE(names); ++m) {
+            struct stats_metric_spec* mspec = &mspecs[b * 2 + m];
+            struct stats_label_spec* labels = &lspecs[(b * 2 + m) * P4_COUNTER_NLABELS];
+
+            labels[0].key = "pipeline";
+            labels[0].value = "bench";
+            labels[1].key = "units";
+            labels[1].value = units[m];
+            labels[1].flags = STATS_LABEL_FLAG_MASK(NO_EXPORT);
+
+            mspec->name = names[m];
+            mspec->type = stats_metric_type_COUNTER;
+            mspec->flags = STATS_METRIC_FLAG_MASK(CLEAR_ON_READ) | STATS_METRIC_FLAG_MASK(ARRAY);
+            mspec->nelements = n;
+            mspec->io.offset = m * n;
+            mspec->labels = labels;
+            mspec->nlabels = P4_COUNTER_NLABELS;
+        }
+
+        bspecs[b] = (struct stats_block_spec){
+            .name = name,
+            .metrics = &mspecs[b * 2],
+            .nmetrics = 2,
+            .io.data.ptr = &pcz->io_data[b],
+            .latch.data_size = sizeof(struct p4_counters_latch_data) + 2 * n * sizeof(uint64_t),
+            .latch_metrics = p4_counters_latch_metrics,
+            .read_metric = p4_counters_read_metric,
+        };
+    }
+
+    struct stats_zone_spec zspec = {
+        .name = "pipeline0",
+        .blocks = bspecs,
+        .nblocks = nblocks,
+    };
+    return stats_zone_alloc(domain, &zspec);
+}
+
+static bool p4_counters_zone_alloc(struct p4_counters_zone* pcz,
+                                   struct stats_domain* domain,
+                                   volatile struct esnet_smartnic_bar2* bar2,
+                                   size_t nelements) {
+    memset(pcz, 0, sizeof(*pcz));
+
+    // Each block holds a packets and a bytes array metric, mirroring a combo P4 counter extern.
+    size_t ncounters = (nelements + 1) / 2;
+    size_t nblocks = (ncounters + P4_COUNTERS_PER_BLOCK_MAX - 1) / P4_COUNTERS_PER_BLOCK_MAX;
+    if (nblocks == 0) {
+        nblocks = 1;
+    }
+
+    pcz->io_data = calloc(nblocks, sizeof(pcz->io_data[0]));
+    pcz->names = calloc(nblocks, P4_COUNTER_NAME_LEN);
+    if (pcz->io_data == NULL || pcz->names == NULL) {
+        goto free_zone;
+    }
+
+    volatile uint64_t* window = (volatile void*)bar2 + ESNET_SMARTNIC_BAR2_SIZE_BYTES / 2;
+    size_t nwords = ESNET_SMARTNIC_BAR2_SIZE_BYTES / 2 / sizeof(window[0]);
+    for (size_t b = 0; b < nblocks; ++b) {
+        struct p4_counters_io_data* iod = &pcz->io_data[b];
+        iod->window = window;
+        iod->nwords = nwords;
+        iod->offset = (b * 2 * P4_COUNTERS_PER_BLOCK_MAX) % nwords;
+    }
+
+    pcz->zone = p4_counters_zone_build(pcz, domain, nblocks, ncounters);
+    if (pcz->zone == NULL) {
+        goto free_zone;
+    }
+
+    return true;
+
+free_zone:
+    p4_counters_zone_free(pcz);
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+enum bench_layout {
+    bench_layout_CMAC,
+    bench_layout_SWITCH,
+    bench_layout_QDMA,
+    bench_layout_P4_COUNTERS,
+};
+
+static const char* bench_layout_name(enum bench_layout layout) {
+    switch (layout) {
+    case bench_layout_CMAC: return "cmac";
+    case bench_layout_SWITCH: return "switch";
+    case bench_layout_QDMA: return "qdma";
+    case bench_layout_P4_COUNTERS: return "p4_counters";
+    }
+    return "unknown";
+}
+
+struct bench_domain {
+    enum bench_layout layout;
+    prom_collector_registry_t* registry;
+    struct stats_domain* domain;
+    struct stats_zone* zones[2];
+    struct p4_counters_zone p4;
+};
+
+static void bench_domain_free(struct bench_domain* bd) {
+    for (unsigned int n = 0; n < ARRAY_SIZE(bd->zones); ++n) {
+        struct stats_zone* zone = bd->zones[n];
+        if (zone == NULL) {
+            continue;
+        }
+
+        switch (bd->layout) {
+        case bench_layout_CMAC: cmac_stats_zone_free(zone); break;
+        case bench_layout_SWITCH: switch_stats_zone_free(zone); break;
+        case bench_layout_QDMA: qdma_stats_zone_free(zone); break;
+        case bench_layout_P4_COUNTERS: stats_zone_free(zone); break;
+        }
+    }
+    p4_counters_zone_free(&bd->p4);
+
+    if (bd->domain != NULL) {
+        stats_domain_free(bd->domain);
+    }
+    if (bd->registry != NULL) {
+        prom_collector_registry_destroy(bd->registry);
+    }
+    memset(bd, 0, sizeof(*bd));
+}
+
+static bool bench_domain_alloc(struct bench_domain* bd,
+                               enum bench_layout layout,
+                               volatile struct esnet_smartnic_bar2* bar2,
+                               size_t nelements) {
+    memset(bd, 0, sizeof(*bd));
+    bd->layout = layout;
+
+    // Use a private registry per domain so that export costs only cover the domain under test.
+    bd->registry = prom_collector_registry_new("bench");
+    if (bd->registry == NULL) {
+        log_err(ENOMEM, "prom_collector_registry_new failed");
+        return false;
+    }
+
+    struct stats_domain_spec spec = {
+        .name = "bench",
+        .thread = {
+            .name = NULL,
+            .interval_ms = 0,
+        },
+        .prometheus = {
+            .registry = bd->registry,
+        },
+    };
+    bd->domain = stats_domain_alloc(&spec);
+    if (bd->domain == NULL) {
+        log_err(ENOMEM, "stats_domain_alloc failed");
+        goto free_domain;
+    }
+
+    switch (layout) {
+    case bench_layout_CMAC:
+        bd->zones[0] = cmac_stats_zone_alloc(bd->domain, &bar2->cmac0, "port0");
+        bd->zones[1] = cmac_stats_zone_alloc(bd->domain, &bar2->cmac1, "port1");
+        break;
+
+    case bench_layout_SWITCH:
+        bd->zones[0] = switch_stats_zone_alloc(bd->domain, bar2, "switch");
+        break;
+
+    case bench_layout_QDMA:
+        bd->zones[0] = qdma_stats_zone_alloc(bd->domain, &bar2->cmac_adapter0, "host0");
+        bd->zones[1] = qdma_stats_zone_alloc(bd->domain, &bar2->cmac_adapter1, "host1");
+        break;
+
+    case bench_layout_P4_COUNTERS:
+        if (!p4_counters_zone_alloc(&bd->p4, bd->domain, bar2, nelements)) {
+            log_err(ENOMEM, "failed to alloc P4 counters zone of %zu elements", nelements);
+            goto free_domain;
+        }
+        break;
+    }
+
+    if (layout != bench_layout_P4_COUNTERS && bd->zones[0] == NULL) {
+        log_err(ENOMEM, "failed to alloc zone for layout %s", bench_layout_name(layout));
+        goto free_domain;
+    }
+
+    stats_domain_clear_metrics(bd->domain, NULL);
+    return true;
+
+free_domain:
+    bench_domain_free(bd);
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct bench_reader {
+    pthread_t handle;
+    struct stats_domain* domain;
+    pthread_barrier_t* start;
+    atomic_bool* stop;
+    uint64_t passes;
+    uint64_t elements;
+};
+
+static int bench_reader_for_each_metric(const struct stats_for_each_spec* spec) {
+    struct bench_reader* rdr = spec->arg;
+    rdr->elements += spec->nvalues;
+    return 0;
+}
+
+static void* bench_reader_thread(void* arg) {
+    struct bench_reader* rdr = arg;
+    pthread_barrier_wait(rdr->start);
+    while (!atomic_load(rdr->stop)) {
+        stats_domain_for_each_metric(rdr->domain, bench_reader_for_each_metric, rdr);
+        rdr->passes += 1;
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_update(const struct bench_args* args,
+                         struct bench_domain* bd,
+                         unsigned int nreaders,
+                         FILE* out) {
+    size_t nvalues = stats_domain_number_of_values(bd->domain);
+    uint64_t samples[args->iterations];
+
+    // Release all readers together with the first update to measure contention from the start.
+    pthread_barrier_t start_barrier;
+    pthread_barrier_init(&start_barrier, NULL, nreaders + 1);
+
+    atomic_bool stop = false;
+    struct bench_reader readers[nreaders > 0 ? nreaders : 1];
+    for (unsigned int r = 0; r < nreaders; ++r) {
+        readers[r] = (struct bench_reader){
+            .domain = bd->domain,
+            .start = &start_barrier,
+            .stop = &stop,
+        };
+        int rv = pthread_create(&readers[r].handle, NULL, bench_reader_thread, &readers[r]);
+        if (rv != 0) {
+            log_panic(rv, "pthread_create failed for reader %u", r);
+        }
+    }
+    pthread_barrier_wait(&start_barrier);
+
+    uint64_t start = bench_now_ns();
+    for (unsigned int i = 0; i < args->iterations; ++i) {
+        uint64_t t0 = bench_now_ns();
+        stats_domain_update_metrics(bd->domain);
+        samples[i] = bench_now_ns() - t0;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    atomic_store(&stop, true);
+    uint64_t reader_passes = 0;
+    uint64_t reader_elements = 0;
+    for (unsigned int r = 0; r < nreaders; ++r) {
+        int rv = pthread_join(readers[r].handle, NULL);
+        if (rv != 0) {
+            log_panic(rv, "pthread_join failed for reader %u", r);
+        }
+        reader_passes += readers[r].passes;
+        reader_elements += readers[r].elements;
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    struct bench_latency lat;
+    bench_latency_compute(samples, args->iterations, &lat);
+
+    double secs = (double)elapsed / NSECS_PER_SEC;
+    fprintf(out,
+            "{\"bench\":\"%s\",\"layout\":\"%s\",\"elements\":%zu,\"readers\":%u,"
+            "\"iterations\":%u,\"update_ns\":{\"min\":%" PRIu64 ",\"mean\":%" PRIu64 ","
+            "\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "},"
+            "\"ns_per_element\":%.3f,\"elements_per_sec\":%.1f,"
+            "\"reader_passes_per_sec\":%.1f,\"reader_elements_per_sec\":%.1f}\n",
+            nreaders > 0 ? "contention" : "update",
+            bench_layout_name(bd->layout), nvalues, nreaders, args->iterations,
+            lat.min, lat.mean, lat.p50, lat.p99, lat.max,
+            nvalues > 0 ? (double)lat.mean / nvalues : 0.0,
+            secs > 0 ? (double)nvalues * args->iterations / secs : 0.0,
+            secs > 0 ? (double)reader_passes / secs : 0.0,
+            secs > 0 ? (double)reader_elements / secs : 0.0);
+    fflush(out);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int bench_read_for_each_metric(const struct stats_for_each_spec* spec) {
+    uint64_t* sum = spec->arg;
+    for (size_t n = 0; n < spec->nvalues; ++n) {
+        *sum += spec->values[n].u64;
+    }
+
+    return 0;
+}
+
+static void bench_read(const struct bench_args* args, struct bench_domain* bd, FILE* out) {
+    size_t nvalues = stats_domain_number_of_values(bd->domain);
+    uint64_t for_each_samples[args->iterations];
+    uint64_t cursor_samples[args->iterations];
+    uint64_t sum = 0;
+
+    for (unsigned int i = 0; i < args->iterations; ++i) {
+        uint64_t t0 = bench_now_ns();
+        stats_domain_for_each_metric(bd->domain, bench_read_for_each_metric, &sum);
+        for_each_samples[i] = bench_now_ns() - t0;
+
+        t0 = bench_now_ns();
+        struct stats_cursor* cursor = stats_domain_cursor_alloc(bd->domain, NULL);
+        if (cursor == NULL) {
+            log_panic(ENOMEM, "stats_domain_cursor_alloc failed");
+        }
+
+        const struct stats_metric_view* view;
+        while ((view = stats_cursor_next(cursor)) != NULL) {
+            for (size_t n = 0; n < view->nvalues; ++n) {
+                sum += view->u64[n];
+            }
+        }
+        stats_cursor_free(cursor);
+        cursor_samples[i] = bench_now_ns() - t0;
+    }
+
+    static const char* const methods[] = {"for_each", "cursor"};
+    uint64_t* samples[] = {for_each_samples, cursor_samples};
+    for (unsigned int m = 0; m < ARRAY_SIZE(methods); ++m) {
+        struct bench_latency lat;
+        bench_latency_compute(samples[m], args->iterations, &lat);
+
+        fprintf(out,
+                "{\"bench\":\"read\",\"method\":\"%s\",\"layout\":\"%s\",\"elements\":%zu,"
+                "\"iterations\":%u,\"read_ns\":{\"min\":%" PRIu64 ",\"mean\":%" PRIu64 ","
+                "\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "},"
+                "\"ns_per_element\":%.3f,\"checksum\":%" PRIu64 "}\n",
+                methods[m], bench_layout_name(bd->layout), nvalues, args->iterations,
+                lat.min, lat.mean, lat.p50, lat.p99, lat.max,
+                nvalues > 0 ? (double)lat.mean / nvalues : 0.0, sum);
+    }
+    fflush(out);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_export(const struct bench_args* args, struct bench_domain* bd, FILE* out) {
+    size_t nvalues = stats_domain_number_of_values(bd->domain);
+    uint64_t samples[args->exports];
+    size_t nbytes = 0;
+
+    for (unsigned int i = 0; i < args->exports; ++i) {
+        uint64_t t0 = bench_now_ns();
+        const char* text = prom_collector_registry_bridge(bd->registry);
+        samples[i] = bench_now_ns() - t0;
+
+        if (text == NULL) {
+            log_panic(ENOMEM, "prom_collector_registry_bridge failed");
+        }
+        nbytes = strlen(text);
+        free((void*)text);
+    }
+
+    struct bench_latency lat;
+    bench_latency_compute(samples, args->exports, &lat);
+
+    fprintf(out,
+            "{\"bench\":\"prometheus_export\",\"layout\":\"%s\",\"elements\":%zu,"
+            "\"iterations\":%u,\"export_ns\":{\"min\":%" PRIu64 ",\"mean\":%" PRIu64 ","
+            "\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "},"
+            "\"bytes\":%zu,\"ns_per_element\":%.3f}\n",
+            bench_layout_name(bd->layout), nvalues, args->exports,
+            lat.min, lat.mean, lat.p50, lat.p99, lat.max,
+            nbytes, nvalues > 0 ? (double)lat.mean / nvalues : 0.0);
+    fflush(out);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_run(const struct bench_args* args,
+                      volatile struct esnet_smartnic_bar2* bar2,
+                      enum bench_layout layout,
+                      size_t nelements,
+                      FILE* out) {
+    struct bench_domain bd;
+
+    uint64_t t0 = bench_now_ns();
+    if (!bench_domain_alloc(&bd, layout, bar2, nelements)) {
+        log_panic(ENOMEM, "failed to setup %s domain", bench_layout_name(layout));
+    }
+    uint64_t setup_ns = bench_now_ns() - t0;
+
+    fprintf(out,
+            "{\"bench\":\"setup\",\"layout\":\"%s\",\"elements\":%zu,\"setup_ns\":%" PRIu64 "}\n",
+            bench_layout_name(layout), stats_domain_number_of_values(bd.domain), setup_ns);
+
+    bench_update(args, &bd, 0, out);
+    bench_read(args, &bd, out);
+    if (args->readers > 0) {
+        bench_update(args, &bd, args->readers, out);
+    }
+    bench_export(args, &bd, out);
+
+    t0 = bench_now_ns();
+    bench_domain_free(&bd);
+    fprintf(out,
+            "{\"bench\":\"teardown\",\"layout\":\"%s\",\"teardown_ns\":%" PRIu64 "}\n",
+            bench_layout_name(layout), bench_now_ns() - t0);
+    fflush(out);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_seed_bar2(volatile struct esnet_smartnic_bar2* bar2) {
+    // Fill the P4 counter window with non-zero counts so that updates perform real arithmetic.
+    volatile uint64_t* window = (volatile void*)bar2 + ESNET_SMARTNIC_BAR2_SIZE_BYTES / 2;
+    size_t nwords = ESNET_SMARTNIC_BAR2_SIZE_BYTES / 2 / sizeof(window[0]);
+
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (size_t n = 0; n < nwords; ++n) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        window[n] = x & 0xffff;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static const size_t default_scales[] = {100, 1000, 10000, 100000, 1000000};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -b, --bar2 PATH        File used to back the BAR2 mapping (created if missing).\n"
+            "  -o, --output PATH      Write JSON lines results to PATH instead of stdout.\n"
+            "  -s, --scales LIST      Comma-separated P4 counter element counts.\n"
+            "                         Default: 100,1000,10000,100000,1000000\n"
+            "  -i, --iterations N     Number of timed updates per measurement. Default: 20\n"
+            "  -r, --readers N        Number of concurrent readers for contention. Default: 4\n"
+            "  -e, --exports N        Number of timed Prometheus exports. Default: 5\n",
+            prog);
+}
+
+static size_t parse_scales(char* list, size_t* scales, size_t max) {
+    size_t n = 0;
+    for (char* tok = strtok(list, ","); tok != NULL && n < max; tok = strtok(NULL, ",")) {
+        char* end;
+        unsigned long long v = strtoull(tok, &end, 0);
+        if (*end != '\0' || v == 0) {
+            return 0;
+        }
+        scales[n++] = v;
+    }
+
+    return n;
+}
+
+int main(int argc, char* argv[]) {
+    size_t scales[32];
+    struct bench_args args = {
+        .bar2_path = NULL,
+        .output_path = NULL,
+        .scales = default_scales,
+        .nscales = ARRAY_SIZE(default_scales),
+        .iterations = 20,
+        .readers = 4,
+        .exports = 5,
+    };
+
+    static const struct option long_opts[] = {
+        {"bar2", required_argument, NULL, 'b'},
+        {"output", required_argument, NULL, 'o'},
+        {"scales", required_argument, NULL, 's'},
+        {"iterations", required_argument, NULL, 'i'},
+        {"readers", required_argument, NULL, 'r'},
+        {"exports", required_argument, NULL, 'e'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:o:s:i:r:e:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'b': args.bar2_path = optarg; break;
+        case 'o': args.output_path = optarg; break;
+        case 's':
+            args.nscales = parse_scales(optarg, scales, ARRAY_SIZE(scales));
+            args.scales = scales;
+            if (args.nscales == 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i': args.iterations = strtoul(optarg, NULL, 0); break;
+        case 'r': args.readers = strtoul(optarg, NULL, 0); break;
+        case 'e': args.exports = strtoul(optarg, NULL, 0); break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (args.iterations == 0 || args.exports == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char tmp_path[] = "/tmp/stats-bench-bar2.XXXXXX";
+    if (args.bar2_path == NULL) {
+        int fd = mkstemp(tmp_path);
+        if (fd < 0) {
+            log_panic(errno, "failed to create temporary BAR2 file");
+        }
+        close(fd);
+        args.bar2_path = tmp_path;
+    }
+
+    volatile struct esnet_smartnic_bar2* bar2 = smartnic_map_bar2_by_path(args.bar2_path, true);
+    if (bar2 == NULL) {
+        log_panic(errno, "failed to map BAR2 from file %s", args.bar2_path);
+    }
+    bench_seed_bar2(bar2);
+
+    FILE* out = stdout;
+    if (args.output_path != NULL) {
+        out = fopen(args.output_path, "w");
+        if (out == NULL) {
+            log_panic(errno, "failed to open output file %s", args.output_path);
+        }
+    }
+
+    bench_run(&args, bar2, bench_layout_CMAC, 0, out);
+    bench_run(&args, bar2, bench_layout_SWITCH, 0, out);
+    bench_run(&args, bar2, bench_layout_QDMA, 0, out);
+    for (size_t n = 0; n < args.nscales; ++n) {
+        bench_run(&args, bar2, bench_layout_P4_COUNTERS, args.scales[n], out);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    smartnic_unmap_bar2(bar2);
+    if (args.bar2_path == tmp_path) {
+        unlink(tmp_path);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1130 @@
+#include "stats_record.h"
+#include "stats.h"
+#include "unused.h"
+
+#include <errno.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//--------------------------------------------------------------------------------------------------
+#define log_err(_rv, _format, _args...) \
+    fprintf(stderr, "ERROR(%s)[%d (%s)]: " _format "\n", __func__, _rv, strerror(_rv),## _args)
+#define log_panic(_rv, _format, _args...) \
+    {log_err(_rv, _format,## _args); exit(EXIT_FAILURE);}
+
+#define NSECS_PER_SEC 1000000000ULL
+
+/*
+ * File layout:
+ *     header:  STATS_RECORD_MAGIC
+ *     record:  <type:u8> <payload length:varint> <payload>
+ *
+ * Layout payload:
+ *     <nmetrics:varint>, then for each metric:
+ *         <zone:str> <block:str> <name:str> <desc:str>
+ *         <type:u8> <flags:varint> <nelements:varint> <converted:u8>
+ *         <nlabels:varint> {<key:str> <flags:varint>}[nlabels]
+ *         {<value:str>}[nelements * nlabels]
+ *
+ * Values payload:
+ *     <timestamp ns:varint> <u64 deltas> <f64 deltas>
+ *
+ * Strings are encoded as <length:varint> <bytes>. Deltas are taken against the previous values
+ * record of the same file (or zero following a layout record) and encoded as runs of unchanged
+ * elements, each followed by the delta of the next changed element. Integer deltas are zigzag
+ * encoded differences. Floating point deltas are the XOR of the IEEE-754 representations and are
+ * only present for the elements of metrics from blocks with a convert_metric method.
+ */
+#define STATS_RECORD_MAGIC "SNSTATS\x01"
+#define STATS_RECORD_MAGIC_LEN (sizeof(STATS_RECORD_MAGIC) - 1)
+
+enum stats_record_type {
+    stats_record_type_LAYOUT = 'L',
+    stats_record_type_VALUES = 'V',
+};
+
+//--------------------------------------------------------------------------------------------------
+struct stats_record_buf {
+    uint8_t* data;
+    size_t len;
+    size_t size;
+};
+
+static void stats_record_buf_reserve(struct stats_record_buf* buf, size_t len) {
+    if (buf->len + len <= buf->size) {
+        return;
+    }
+
+    size_t size = buf->size > 0 ? buf->size : 4096;
+    while (size < buf->len + len) {
+        size *= 2;
+    }
+
+    uint8_t* data = realloc(buf->data, size);
+    if (data == NULL) {
+        log_panic(ENOMEM, "failed to grow record buffer to %zu bytes", size);
+    }
+    buf->data = data;
+    buf->size = size;
+}
+
+static void stats_record_put_u8(struct stats_record_buf* buf, uint8_t value) {
+    stats_record_buf_reserve(buf, 1);
+    buf->data[buf->len++] = value;
+}
+
+static void stats_record_put_varint(struct stats_record_buf* buf, uint64_t value) {
+    stats_record_buf_reserve(buf, 10);
+    while (value >= 0x80) {
+        buf->data[buf->len++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    buf->data[buf->len++] = (uint8_t)value;
+}
+
+static void stats_record_put_string(struct stats_record_buf* buf, const char* str) {
+    size_t len = str != NULL ? strlen(str) : 0;
+    stats_record_put_varint(buf, len);
+    stats_record_buf_reserve(buf, len);
+    if (len > 0) {
+        memcpy(&buf->data[buf->len], str, len);
+    }
+    buf->len += len;
+}
+
+static inline uint64_t stats_record_zigzag(uint64_t diff) {
+    return (diff << 1) ^ (uint64_t)((int64_t)diff >> 63);
+}
+
+static inline uint64_t stats_record_unzigzag(uint64_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+/*
+ * Encode the changes from prev to cur, then update prev to match.
+ */
+static void stats_record_put_deltas(struct stats_record_buf* buf,
+                                    const uint64_t* cur, uint64_t* prev, size_t n,
+                                    bool is_float) {
+    uint64_t run = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (cur[i] == prev[i]) {
+            run += 1;
+            continue;
+        }
+
+        stats_record_put_varint(buf, run);
+        uint64_t delta = is_float ? cur[i] ^ prev[i] : stats_record_zigzag(cur[i] - prev[i]);
+        stats_record_put_varint(buf, delta);
+        prev[i] = cur[i];
+        run = 0;
+    }
+
+    if (run > 0) {
+        stats_record_put_varint(buf, run);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_record_reader {
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    bool error;
+};
+
+static uint8_t stats_record_get_u8(struct stats_record_reader* rd) {
+    if (rd->pos >= rd->len) {
+        rd->error = true;
+        return 0;
+    }
+
+    return rd->data[rd->pos++];
+}
+
+static uint64_t stats_record_get_varint(struct stats_record_reader* rd) {
+    uint64_t value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = stats_record_get_u8(rd);
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+
+    rd->error = true;
+    return 0;
+}
+
+/*
+ * Copy a string out to the arena, which is sized by the caller to the full length of the record
+ * (each string consumes at least as many bytes from the record as it needs in the arena).
+ */
+static const char* stats_record_get_string(struct stats_record_reader* rd, char** arena) {
+    uint64_t len = stats_record_get_varint(rd);
+    if (rd->error || len > rd->len - rd->pos) {
+        rd->error = true;
+        return "";
+    }
+
+    char* str = *arena;
+    memcpy(str, &rd->data[rd->pos], len);
+    str[len] = '\0';
+    *arena += len + 1;
+    rd->pos += len;
+
+    return str;
+}
+
+static void stats_record_get_deltas(struct stats_record_reader* rd,
+                                    uint64_t* values, size_t n,
+                                    bool is_float) {
+    size_t i = 0;
+    while (i < n && !rd->error) {
+        uint64_t run = stats_record_get_varint(rd);
+        if (run > n - i) {
+            rd->error = true;
+            break;
+        }
+
+        i += run;
+        if (i == n) {
+            break;
+        }
+
+        uint64_t delta = stats_record_get_varint(rd);
+        values[i] = is_float ? values[i] ^ delta : values[i] + stats_record_unzigzag(delta);
+        i += 1;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Identity of a metric in the layout of a domain. Metrics are compared by the addresses of their
+ * specifications along with their names and sizes, which is enough to detect blocks and metrics
+ * being added, removed or replaced without re-encoding the layout on every update.
+ */
+struct stats_recorder_key {
+    const void* zone;
+    const void* block;
+    const void* metric;
+    const char* name;
+    size_t nelements;
+};
+
+struct stats_recorder_scan {
+    struct stats_recorder_key* keys;
+    size_t nkeys;
+    size_t keys_size;
+
+    uint64_t* u64;
+    size_t nvalues;
+    size_t u64_size;
+
+    uint64_t* f64;
+    size_t nconverted;
+    size_t f64_size;
+};
+
+struct stats_recorder {
+    struct stats_domain* domain;
+    char* path;
+    size_t max_file_size;
+    unsigned int max_files;
+
+    pthread_mutex_t lock;
+    FILE* file;
+    size_t file_size;
+    unsigned long seq;
+    bool failed;
+
+    struct stats_recorder_scan scan[2]; // Current and previous layout and values.
+    unsigned int cur;
+    bool has_layout; // The current file holds the layout of the previous scan.
+
+    struct stats_record_buf layout;
+    struct stats_record_buf values;
+};
+
+//--------------------------------------------------------------------------------------------------
+static void* stats_recorder_grow(void* array, size_t* size, size_t need, size_t elem_size) {
+    if (need <= *size) {
+        return array;
+    }
+
+    size_t size_new = *size > 0 ? *size : 64;
+    while (size_new < need) {
+        size_new *= 2;
+    }
+
+    array = realloc(array, size_new * elem_size);
+    if (array == NULL) {
+        log_panic(ENOMEM, "failed to grow recorder array to %zu elements", size_new);
+    }
+    *size = size_new;
+
+    return array;
+}
+
+//--------------------------------------------------------------------------------------------------
+static size_t stats_recorder_user_labels(const struct stats_metric_view* view) {
+    // The labels of the domain, zone, block and array index are regenerated on replay.
+    size_t nbuiltin = 3;
+    if (STATS_METRIC_FLAG_TEST(view->metric->flags, ARRAY)) {
+        nbuiltin += 1;
+    }
+
+    return view->nlabels > nbuiltin ? view->nlabels - nbuiltin : 0;
+}
+
+static void stats_recorder_put_layout(struct stats_record_buf* buf,
+                                      const struct stats_metric_view* view) {
+    const struct stats_metric_spec* mspec = view->metric;
+    size_t nlabels = stats_recorder_user_labels(view);
+    size_t first = view->nlabels - nlabels;
+
+    stats_record_put_string(buf, view->zone->name);
+    stats_record_put_string(buf, view->block->name);
+    stats_record_put_string(buf, mspec->name);
+    stats_record_put_string(buf, mspec->desc);
+    stats_record_put_u8(buf, mspec->type);
+    stats_record_put_varint(buf, mspec->flags);
+    stats_record_put_varint(buf, view->nvalues);
+    stats_record_put_u8(buf, view->block->convert_metric != NULL);
+
+    stats_record_put_varint(buf, nlabels);
+    for (size_t k = 0; k < nlabels; ++k) {
+        const struct stats_label_spec* lspec = &mspec->labels[first + k];
+        stats_record_put_string(buf, lspec->key);
+        stats_record_put_varint(buf, lspec->flags);
+    }
+
+    for (size_t n = 0; n < view->nvalues; ++n) {
+        const struct stats_label* labels = &view->labels[n * view->nlabels + first];
+        for (size_t k = 0; k < nlabels; ++k) {
+            stats_record_put_string(buf, labels[k].value);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Gather the current layout and values of the domain. The layout record is only encoded when
+ * requested, since it is normally unchanged between updates.
+ */
+static void stats_recorder_scan(struct stats_recorder* recorder,
+                                struct stats_recorder_scan* scan,
+                                struct stats_record_buf* layout) {
+    scan->nkeys = 0;
+    scan->nvalues = 0;
+    scan->nconverted = 0;
+
+    struct stats_cursor_filter filter = {.zone = NULL};
+    struct stats_cursor* cursor = stats_domain_cursor_alloc(recorder->domain, &filter);
+    if (cursor == NULL) {
+        log_panic(ENOMEM, "failed to allocate cursor for recording");
+    }
+
+    const struct stats_metric_view* view;
+    while ((view = stats_cursor_next(cursor)) != NULL) {
+        scan->keys = stats_recorder_grow(scan->keys, &scan->keys_size, scan->nkeys + 1,
+                                         sizeof(scan->keys[0]));
+        scan->keys[scan->nkeys++] = (struct stats_recorder_key){
+            .zone = view->zone,
+            .block = view->block,
+            .metric = view->metric,
+            .name = view->metric->name,
+            .nelements = view->nvalues,
+        };
+
+        scan->u64 = stats_recorder_grow(scan->u64, &scan->u64_size,
+                                        scan->nvalues + view->nvalues, sizeof(scan->u64[0]));
+        memcpy(&scan->u64[scan->nvalues], view->u64, view->nvalues * sizeof(scan->u64[0]));
+        scan->nvalues += view->nvalues;
+
+        if (view->block->convert_metric != NULL) {
+            scan->f64 = stats_recorder_grow(scan->f64, &scan->f64_size,
+                                            scan->nconverted + view->nvalues,
+                                            sizeof(scan->f64[0]));
+            memcpy(&scan->f64[scan->nconverted], view->f64, view->nvalues * sizeof(scan->f64[0]));
+            scan->nconverted += view->nvalues;
+        }
+
+        if (layout != NULL) {
+            stats_recorder_put_layout(layout, view);
+        }
+    }
+
+    stats_cursor_free(cursor);
+}
+
+static bool stats_recorder_same_layout(const struct stats_recorder_scan* a,
+                                       const struct stats_recorder_scan* b) {
+    return a->nkeys == b->nkeys && memcmp(a->keys, b->keys, a->nkeys * sizeof(a->keys[0])) == 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_recorder_open(struct stats_recorder* recorder) {
+    if (recorder->file != NULL) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+        recorder->seq += 1;
+    }
+
+    char* path;
+    if (recorder->max_files > 0 && recorder->seq >= recorder->max_files) {
+        if (asprintf(&path, "%s.%06lu", recorder->path, recorder->seq - recorder->max_files) >= 0) {
+            remove(path);
+            free(path);
+        }
+    }
+
+    if (asprintf(&path, "%s.%06lu", recorder->path, recorder->seq) < 0) {
+        log_err(ENOMEM, "failed to format recording path");
+        return false;
+    }
+
+    recorder->file = fopen(path, "w");
+    if (recorder->file == NULL) {
+        log_err(errno, "failed to create recording file %s", path);
+        free(path);
+        return false;
+    }
+    free(path);
+
+    if (fwrite(STATS_RECORD_MAGIC, STATS_RECORD_MAGIC_LEN, 1, recorder->file) != 1) {
+        log_err(errno, "failed to write recording header");
+        return false;
+    }
+    recorder->file_size = STATS_RECORD_MAGIC_LEN;
+    recorder->has_layout = false;
+
+    return true;
+}
+
+/*
+ * Write a record whose payload is made of an optional prefix followed by the body.
+ */
+static bool stats_recorder_write(struct stats_recorder* recorder,
+                                 enum stats_record_type type,
+                                 const struct stats_record_buf* prefix,
+                                 const struct stats_record_buf* body) {
+    size_t len = (prefix != NULL ? prefix->len : 0) + body->len;
+    struct stats_record_buf head = {.data = NULL};
+    stats_record_put_u8(&head, type);
+    stats_record_put_varint(&head, len);
+
+    bool ok = fwrite(head.data, head.len, 1, recorder->file) == 1 &&
+        (prefix == NULL || fwrite(prefix->data, prefix->len, 1, recorder->file) == 1) &&
+        (body->len == 0 || fwrite(body->data, body->len, 1, recorder->file) == 1);
+    if (ok) {
+        recorder->file_size += head.len + len;
+    } else {
+        log_err(errno, "failed to write %zu byte record", len);
+    }
+    free(head.data);
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_recorder_record(struct stats_domain* UNUSED(domain), void* arg) {
+    struct stats_recorder* recorder = arg;
+
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->failed) {
+        goto unlock;
+    }
+
+    if (recorder->file == NULL ||
+        (recorder->max_file_size > 0 && recorder->file_size >= recorder->max_file_size)) {
+        if (!stats_recorder_open(recorder)) {
+            goto fail;
+        }
+    }
+
+    struct stats_recorder_scan* prev = &recorder->scan[recorder->cur];
+    struct stats_recorder_scan* scan = &recorder->scan[recorder->cur ^ 1];
+    stats_recorder_scan(recorder, scan, NULL);
+
+    if (!recorder->has_layout || !stats_recorder_same_layout(scan, prev)) {
+        // Scan again to capture the layout along with values consistent with it.
+        recorder->layout.len = 0;
+        stats_recorder_scan(recorder, scan, &recorder->layout);
+
+        struct stats_record_buf count = {.data = NULL};
+        stats_record_put_varint(&count, scan->nkeys);
+        bool ok = stats_recorder_write(recorder, stats_record_type_LAYOUT, &count,
+                                       &recorder->layout);
+        free(count.data);
+        if (!ok) {
+            goto fail;
+        }
+        recorder->has_layout = true;
+
+        // Values following a layout are encoded relative to zero.
+        prev->u64 = stats_recorder_grow(prev->u64, &prev->u64_size, scan->nvalues,
+                                        sizeof(prev->u64[0]));
+        memset(prev->u64, 0, scan->nvalues * sizeof(prev->u64[0]));
+        prev->f64 = stats_recorder_grow(prev->f64, &prev->f64_size, scan->nconverted,
+                                        sizeof(prev->f64[0]));
+        memset(prev->f64, 0, scan->nconverted * sizeof(prev->f64[0]));
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    recorder->values.len = 0;
+    stats_record_put_varint(&recorder->values,
+                            (uint64_t)now.tv_sec * NSECS_PER_SEC + (uint64_t)now.tv_nsec);
+    stats_record_put_deltas(&recorder->values, scan->u64, prev->u64, scan->nvalues, false);
+    stats_record_put_deltas(&recorder->values, scan->f64, prev->f64, scan->nconverted, true);
+    if (!stats_recorder_write(recorder, stats_record_type_VALUES, NULL, &recorder->values) ||
+        fflush(recorder->file) != 0) {
+        goto fail;
+    }
+
+    recorder->cur ^= 1;
+    goto unlock;
+
+fail:
+    log_err(EIO, "recording to %s stopped", recorder->path);
+    recorder->failed = true;
+unlock:
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Continue the numbering of any files left by an earlier recording to the same path, so that they
+ * are neither overwritten nor mistaken for part of the new recording on replay.
+ */
+static unsigned long stats_recorder_next_seq(const char* path) {
+    char* pattern;
+    if (asprintf(&pattern, "%s.[0-9][0-9][0-9][0-9][0-9][0-9]*", path) < 0) {
+        return 0;
+    }
+
+    unsigned long seq = 0;
+    glob_t g;
+    if (glob(pattern, GLOB_NOSORT, NULL, &g) == 0) {
+        size_t len = strlen(path) + 1;
+        for (size_t n = 0; n < g.gl_pathc; ++n) {
+            char* end;
+            unsigned long s = strtoul(&g.gl_pathv[n][len], &end, 10);
+            if (*end == '\0' && s >= seq) {
+                seq = s + 1;
+            }
+        }
+        globfree(&g);
+    }
+    free(pattern);
+
+    return seq;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_recorder* stats_recorder_alloc(struct stats_domain* domain,
+                                            const struct stats_recorder_spec* spec) {
+    struct stats_recorder* recorder = calloc(1, sizeof(*recorder));
+    if (recorder == NULL) {
+        return NULL;
+    }
+
+    recorder->path = strdup(spec->path);
+    if (recorder->path == NULL) {
+        goto free_recorder;
+    }
+
+    int rv = pthread_mutex_init(&recorder->lock, NULL);
+    if (rv != 0) {
+        log_err(rv, "pthread_mutex_init failed");
+        goto free_path;
+    }
+
+    recorder->domain = domain;
+    recorder->max_file_size = spec->max_file_size;
+    recorder->max_files = spec->max_files;
+    recorder->seq = stats_recorder_next_seq(spec->path);
+
+    if (!stats_domain_add_update_hook(domain, stats_recorder_record, recorder)) {
+        goto destroy_lock;
+    }
+
+    return recorder;
+
+destroy_lock:
+    pthread_mutex_destroy(&recorder->lock);
+free_path:
+    free(recorder->path);
+free_recorder:
+    free(recorder);
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void stats_recorder_free(struct stats_recorder* recorder) {
+    stats_domain_remove_update_hook(recorder->domain, stats_recorder_record, recorder);
+
+    if (recorder->file != NULL) {
+        fclose(recorder->file);
+    }
+
+    for (struct stats_recorder_scan* scan = recorder->scan;
+         scan < &recorder->scan[2];
+         ++scan) {
+        free(scan->keys);
+        free(scan->u64);
+        free(scan->f64);
+    }
+    free(recorder->layout.data);
+    free(recorder->values.data);
+
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder->path);
+    free(recorder);
+}
+
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Specifications decoded from a layout record. They are kept until the replay is freed, since the
+ * zones and blocks created from them reference their strings.
+ */
+struct stats_replay_layout {
+    struct stats_replay_layout* next;
+    struct stats_record_buf record;
+
+    char* strings;
+    struct stats_zone_spec* zones;
+    size_t nzones;
+    struct stats_block_spec* blocks;
+    struct stats_metric_spec* metrics;
+    struct stats_label_spec* labels;
+    const char** label_values;
+
+    size_t nvalues;
+    size_t nconverted;
+};
+
+struct stats_replay_zone {
+    const char* name;
+    struct stats_zone* zone;
+};
+
+struct stats_replay_latch {
+    const struct stats_metric_spec* metric;
+    size_t idx; // Element of the metric to be converted next.
+};
+
+#define STATS_REPLAY_NOT_CONVERTED UINT64_MAX
+
+struct stats_replay {
+    struct stats_domain* domain;
+    const char* const* paths;
+    size_t npaths;
+    size_t path_idx;
+    FILE* file;
+
+    struct stats_record_buf record;
+    struct stats_replay_layout* layout; // Most recent first.
+
+    struct stats_replay_zone* zones; // Zones ever created in the domain, in order of creation.
+    size_t nzones;
+
+    uint64_t* u64;
+    size_t u64_size;
+    uint64_t* f64;
+    size_t f64_size;
+};
+
+//--------------------------------------------------------------------------------------------------
+static void stats_replay_read_metric(const struct stats_block_spec* bspec,
+                                     const struct stats_metric_spec* mspec,
+                                     uint64_t* values,
+                                     void* UNUSED(data)) {
+    const struct stats_replay* replay = bspec->io.data.ptr;
+    size_t nelements = STATS_METRIC_FLAG_TEST(mspec->flags, ARRAY) ? mspec->nelements : 1;
+    memcpy(values, &replay->u64[mspec->io.offset], nelements * sizeof(values[0]));
+}
+
+static double stats_replay_convert_metric(const struct stats_block_spec* bspec,
+                                          const struct stats_metric_spec* mspec,
+                                          uint64_t value,
+                                          void* data) {
+    const struct stats_replay* replay = bspec->io.data.ptr;
+    struct stats_replay_latch* latch = data;
+    if (latch == NULL || mspec->io.data.u64 == STATS_REPLAY_NOT_CONVERTED) {
+        return (double)value;
+    }
+
+    // Elements of a metric are converted in order following the read of the metric.
+    if (latch->metric != mspec) {
+        latch->metric = mspec;
+        latch->idx = 0;
+    }
+
+    double f64;
+    memcpy(&f64, &replay->f64[mspec->io.data.u64 + latch->idx++], sizeof(f64));
+    return f64;
+}
+
+static const char* stats_replay_label_value(const struct stats_label_format_spec* spec) {
+    const char* const* values = spec->label->data;
+    return values[spec->idx];
+}
+
+//--------------------------------------------------------------------------------------------------
+static void stats_replay_layout_free(struct stats_replay_layout* layout) {
+    free(layout->record.data);
+    free(layout->strings);
+    free(layout->zones);
+    free(layout->blocks);
+    free(layout->metrics);
+    free(layout->labels);
+    free(layout->label_values);
+    free(layout);
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Decode a layout record into specifications for zones of the domain. Metrics are grouped into
+ * blocks and zones by runs of equal names, following the order in which they were recorded.
+ */
+static bool stats_replay_layout_decode(struct stats_replay* replay,
+                                       struct stats_replay_layout* layout) {
+    size_t len = layout->record.len;
+    struct stats_record_reader rd = {.data = layout->record.data, .len = len};
+
+    uint64_t nmetrics = stats_record_get_varint(&rd);
+    if (rd.error || nmetrics > len) {
+        return false;
+    }
+
+    // Every metric, label and string takes at least one byte of the record, bounding allocations.
+    layout->strings = malloc(len + 1);
+    layout->zones = calloc(nmetrics + 1, sizeof(*layout->zones));
+    layout->blocks = calloc(nmetrics + 1, sizeof(*layout->blocks));
+    layout->metrics = calloc(nmetrics + 1, sizeof(*layout->metrics));
+    layout->labels = calloc(len + 1, sizeof(*layout->labels));
+    layout->label_values = calloc(len + 1, sizeof(*layout->label_values));
+    if (layout->strings == NULL || layout->zones == NULL || layout->blocks == NULL ||
+        layout->metrics == NULL || layout->labels == NULL || layout->label_values == NULL) {
+        log_err(ENOMEM, "failed to allocate replay layout of %" PRIu64 " metrics", nmetrics);
+        return false;
+    }
+
+    char* arena = layout->strings;
+    struct stats_label_spec* lspec = layout->labels;
+    const char** lvalue = layout->label_values;
+    struct stats_zone_spec* zspec = NULL;
+    struct stats_block_spec* bspec = NULL;
+    size_t nblocks = 0;
+    for (uint64_t m = 0; m < nmetrics && !rd.error; ++m) {
+        const char* zone = stats_record_get_string(&rd, &arena);
+        const char* block = stats_record_get_string(&rd, &arena);
+
+        if (zspec == NULL || strcmp(zspec->name, zone) != 0) {
+            zspec = &layout->zones[layout->nzones++];
+            zspec->name = zone;
+            zspec->blocks = &layout->blocks[nblocks];
+            bspec = NULL;
+        }
+
+        if (bspec == NULL || strcmp(bspec->name, block) != 0) {
+            bspec = &layout->blocks[nblocks++];
+            zspec->nblocks += 1;
+            *bspec = (struct stats_block_spec){
+                .name = block,
+                .metrics = &layout->metrics[m],
+                .io.data.ptr = replay,
+                .latch.data_size = sizeof(struct stats_replay_latch),
+                .read_metric = stats_replay_read_metric,
+            };
+        }
+
+        struct stats_metric_spec* mspec = &layout->metrics[m];
+        bspec->nmetrics += 1;
+        mspec->name = stats_record_get_string(&rd, &arena);
+        mspec->desc = stats_record_get_string(&rd, &arena);
+        mspec->type = stats_record_get_u8(&rd);
+        // Recorded values are totals, which the engine takes as-is without clear on read.
+        mspec->flags = stats_record_get_varint(&rd) & ~STATS_METRIC_FLAG_MASK(CLEAR_ON_READ);
+        uint64_t nelements = stats_record_get_varint(&rd);
+        bool converted = stats_record_get_u8(&rd) != 0;
+        uint64_t nlabels = stats_record_get_varint(&rd);
+        if (rd.error || nelements == 0 || nelements > len ||
+            nlabels > (uint64_t)(&layout->labels[len] - lspec) ||
+            nelements * nlabels > (uint64_t)(&layout->label_values[len] - lvalue)) {
+            rd.error = true;
+            break;
+        }
+
+        mspec->nelements = nelements;
+        mspec->io.offset = layout->nvalues;
+        layout->nvalues += nelements;
+        mspec->io.data.u64 = STATS_REPLAY_NOT_CONVERTED;
+        if (converted) {
+            mspec->io.data.u64 = layout->nconverted;
+            layout->nconverted += nelements;
+            bspec->convert_metric = stats_replay_convert_metric;
+        }
+
+        mspec->labels = lspec;
+        mspec->nlabels = nlabels;
+        for (uint64_t k = 0; k < nlabels; ++k, ++lspec) {
+            lspec->key = stats_record_get_string(&rd, &arena);
+            lspec->flags = stats_record_get_varint(&rd);
+            lspec->value_alloc = stats_replay_label_value;
+            lspec->data = &lvalue[k * nelements];
+        }
+
+        // Label values are recorded element by element, but looked up by label then element.
+        for (uint64_t n = 0; n < nelements; ++n) {
+            for (uint64_t k = 0; k < nlabels; ++k) {
+                lvalue[k * nelements + n] = stats_record_get_string(&rd, &arena);
+            }
+        }
+        lvalue += nelements * nlabels;
+    }
+
+    if (rd.error || rd.pos != rd.len) {
+        log_err(EINVAL, "malformed layout record");
+        return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+static const struct stats_zone_spec* stats_replay_layout_find_zone(
+    const struct stats_replay_layout* layout, const char* name, unsigned int occurrence) {
+    if (layout != NULL) {
+        for (size_t n = 0; n < layout->nzones; ++n) {
+            if (strcmp(layout->zones[n].name, name) == 0 && occurrence-- == 0) {
+                return &layout->zones[n];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static bool stats_replay_zone_has_block(const struct stats_zone_spec* zspec, const char* name) {
+    if (zspec != NULL) {
+        for (size_t n = 0; n < zspec->nblocks; ++n) {
+            if (strcmp(zspec->blocks[n].name, name) == 0) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Morph a zone from its previous layout to the next. Zones can't be removed from a domain, so the
+ * zones which are no longer recorded are left empty.
+ */
+static bool stats_replay_update_zone(struct stats_zone* zone,
+                                     const struct stats_zone_spec* prev,
+                                     const struct stats_zone_spec* next) {
+    bool ok = true;
+    if (prev != NULL) {
+        for (size_t n = 0; n < prev->nblocks; ++n) {
+            if (!stats_replay_zone_has_block(next, prev->blocks[n].name)) {
+                ok &= stats_zone_remove_block(zone, prev->blocks[n].name);
+            }
+        }
+    }
+
+    if (next != NULL) {
+        for (size_t n = 0; n < next->nblocks; ++n) {
+            const struct stats_block_spec* bspec = &next->blocks[n];
+            if (stats_replay_zone_has_block(prev, bspec->name)) {
+                ok &= stats_zone_replace_block(zone, bspec);
+            } else {
+                ok &= stats_zone_add_block(zone, bspec);
+            }
+        }
+    }
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Apply a new layout to the domain. Zones are matched by name (and by order of appearance among
+ * zones of the same name) to those created for earlier layouts, with their blocks replaced through
+ * the live layout changes of the engine so that the domain carries on from its current state.
+ */
+static bool stats_replay_apply_layout(struct stats_replay* replay,
+                                      struct stats_replay_layout* layout) {
+    const struct stats_replay_layout* prev = replay->layout;
+    bool ok = true;
+
+    struct stats_replay_zone* zones =
+        realloc(replay->zones, (replay->nzones + layout->nzones) * sizeof(*zones));
+    if (zones == NULL && replay->nzones + layout->nzones > 0) {
+        log_err(ENOMEM, "failed to allocate %zu replay zones", replay->nzones + layout->nzones);
+        return false;
+    }
+    replay->zones = zones;
+
+    // Update the zones known from earlier layouts.
+    for (size_t n = 0; n < replay->nzones; ++n) {
+        struct stats_replay_zone* rz = &replay->zones[n];
+        unsigned int occurrence = 0;
+        for (size_t p = 0; p < n; ++p) {
+            occurrence += strcmp(replay->zones[p].name, rz->name) == 0;
+        }
+
+        ok &= stats_replay_update_zone(rz->zone,
+                                       stats_replay_layout_find_zone(prev, rz->name, occurrence),
+                                       stats_replay_layout_find_zone(layout, rz->name, occurrence));
+    }
+
+    // Create the zones appearing for the first time.
+    for (size_t n = 0; n < layout->nzones; ++n) {
+        const struct stats_zone_spec* zspec = &layout->zones[n];
+        unsigned int occurrence = 0;
+        for (size_t p = 0; p < n; ++p) {
+            occurrence += strcmp(layout->zones[p].name, zspec->name) == 0;
+        }
+
+        unsigned int known = 0;
+        for (size_t p = 0; p < replay->nzones; ++p) {
+            known += strcmp(replay->zones[p].name, zspec->name) == 0;
+        }
+
+        if (occurrence < known) {
+            continue;
+        }
+
+        struct stats_zone* zone = stats_zone_alloc(replay->domain, zspec);
+        if (zone == NULL) {
+            log_err(ENOMEM, "failed to allocate replay zone %s", zspec->name);
+            ok = false;
+            continue;
+        }
+
+        replay->zones[replay->nzones++] = (struct stats_replay_zone){
+            .name = zspec->name,
+            .zone = zone,
+        };
+    }
+
+    replay->u64 = stats_recorder_grow(replay->u64, &replay->u64_size, layout->nvalues + 1,
+                                      sizeof(replay->u64[0]));
+    replay->f64 = stats_recorder_grow(replay->f64, &replay->f64_size, layout->nconverted + 1,
+                                      sizeof(replay->f64[0]));
+
+    return ok;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Read the next record of the current file, moving on to the next file at the end of each one. A
+ * truncated record, such as left behind by an interrupted recording, ends the file.
+ */
+static int stats_replay_read_record(struct stats_replay* replay) {
+    while (true) {
+        if (replay->file == NULL) {
+            if (replay->path_idx >= replay->npaths) {
+                return EOF;
+            }
+
+            const char* path = replay->paths[replay->path_idx++];
+            replay->file = fopen(path, "r");
+            if (replay->file == NULL) {
+                log_err(errno, "failed to open recording %s", path);
+                continue;
+            }
+
+            char magic[STATS_RECORD_MAGIC_LEN];
+            if (fread(magic, sizeof(magic), 1, replay->file) != 1 ||
+                memcmp(magic, STATS_RECORD_MAGIC, sizeof(magic)) != 0) {
+                log_err(EINVAL, "%s is not a stats recording", path);
+                fclose(replay->file);
+                replay->file = NULL;
+                continue;
+            }
+        }
+
+        int type = fgetc(replay->file);
+        uint64_t len = 0;
+        bool ok = type != EOF;
+        for (unsigned int shift = 0; ok && shift < 64; shift += 7) {
+            int byte = fgetc(replay->file);
+            if (byte == EOF) {
+                ok = false;
+                break;
+            }
+
+            len |= (uint64_t)(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+
+        if (ok && len > SIZE_MAX / 2) {
+            ok = false;
+        }
+
+        if (ok) {
+            replay->record.len = 0;
+            stats_record_buf_reserve(&replay->record, len);
+            ok = len == 0 || fread(replay->record.data, len, 1, replay->file) == 1;
+            replay->record.len = len;
+        }
+
+        if (ok) {
+            return type;
+        }
+
+        fclose(replay->file);
+        replay->file = NULL;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_replay_load_layout(struct stats_replay* replay) {
+    struct stats_replay_layout* cur = replay->layout;
+    const struct stats_record_buf* record = &replay->record;
+
+    // Keep the zones as they are when the layout is unchanged, such as across file rotation.
+    if (cur != NULL && cur->record.len == record->len &&
+        memcmp(cur->record.data, record->data, record->len) == 0) {
+        memset(replay->u64, 0, cur->nvalues * sizeof(replay->u64[0]));
+        memset(replay->f64, 0, cur->nconverted * sizeof(replay->f64[0]));
+        return true;
+    }
+
+    struct stats_replay_layout* layout = calloc(1, sizeof(*layout));
+    if (layout == NULL) {
+        log_err(ENOMEM, "failed to allocate replay layout");
+        return false;
+    }
+
+    // Take over the record buffer, the replay allocates a new one for the next record.
+    layout->record = replay->record;
+    replay->record = (struct stats_record_buf){.data = NULL};
+
+    if (!stats_replay_layout_decode(replay, layout) || !stats_replay_apply_layout(replay, layout)) {
+        stats_replay_layout_free(layout);
+        return false;
+    }
+
+    layout->next = replay->layout;
+    replay->layout = layout;
+    memset(replay->u64, 0, layout->nvalues * sizeof(replay->u64[0]));
+    memset(replay->f64, 0, layout->nconverted * sizeof(replay->f64[0]));
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool stats_replay_next(struct stats_replay* replay, struct timespec* timestamp) {
+    while (true) {
+        int type = stats_replay_read_record(replay);
+        switch (type) {
+        case EOF:
+            return false;
+
+        case stats_record_type_LAYOUT:
+            if (!stats_replay_load_layout(replay)) {
+                return false;
+            }
+            break;
+
+        case stats_record_type_VALUES: {
+            const struct stats_replay_layout* layout = replay->layout;
+            if (layout == NULL) {
+                log_err(EINVAL, "values recorded without a layout");
+                return false;
+            }
+
+            struct stats_record_reader rd = {
+                .data = replay->record.data,
+                .len = replay->record.len,
+            };
+            uint64_t ns = stats_record_get_varint(&rd);
+            stats_record_get_deltas(&rd, replay->u64, layout->nvalues, false);
+            stats_record_get_deltas(&rd, replay->f64, layout->nconverted, true);
+            if (rd.error) {
+                log_err(EINVAL, "malformed values record");
+                return false;
+            }
+
+            stats_domain_update_metrics(replay->domain);
+            if (timestamp != NULL) {
+                timestamp->tv_sec = ns / NSECS_PER_SEC;
+                timestamp->tv_nsec = ns % NSECS_PER_SEC;
+            }
+            return true;
+        }
+
+        default:
+            break; // Skip records from newer versions of the format.
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_domain* stats_replay_domain(struct stats_replay* replay) {
+    return replay->domain;
+}
+
+//--------------------------------------------------------------------------------------------------
+struct stats_replay* stats_replay_alloc(const struct stats_domain_spec* spec,
+                                        const char* const* paths,
+                                        size_t npaths) {
+    struct stats_replay* replay = calloc(1, sizeof(*replay));
+    if (replay == NULL) {
+        return NULL;
+    }
+
+    replay->domain = stats_domain_alloc(spec);
+    if (replay->domain == NULL) {
+        free(replay);
+        return NULL;
+    }
+
+    replay->paths = paths;
+    replay->npaths = npaths;
+
+    return replay;
+}
+
+//--------------------------------------------------------------------------------------------------
+void stats_replay_free(struct stats_replay* replay) {
+    // The zones reference the layouts, which are only released once the domain is gone.
+    for (size_t n = 0; n < replay->nzones; ++n) {
+        stats_zone_free(replay->zones[n].zone);
+    }
+    stats_domain_free(replay->domain);
+    while (replay->layout != NULL) {
+        struct stats_replay_layout* layout = replay->layout;
+        replay->layout = layout->next;
+        stats_replay_layout_free(layout);
+    }
+
+    if (replay->file != NULL) {
+        fclose(replay->file);
+    }
+
+    free(replay->zones);
+    free(replay->u64);
+    free(replay->f64);
+    free(replay->record.data);
+    free(replay);
+}
@@ -0,0 +1,154 @@
+/*
+ * Stats recording replay tool.
+ *
+ * Feeds recordings made by a stats recorder back through a stats domain, exercising the update and
+ * Prometheus export paths of the engine offline. Optionally paces the replay at the recorded rate
+ * and writes the final Prometheus exposition. Timings are reported as a JSON object on completion.
+ */
+#include "prom.h"
+#include "stats.h"
+#include "stats_record.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//--------------------------------------------------------------------------------------------------
+#define log_err(_rv, _format, _args...) \
+    fprintf(stderr, "ERROR(%s)[%d (%s)]: " _format "\n", __func__, _rv, strerror(_rv),## _args)
+#define log_panic(_rv, _format, _args...) \
+    {log_err(_rv, _format,## _args); exit(EXIT_FAILURE);}
+
+#define NSECS_PER_SEC 1000000000ULL
+
+static uint64_t replay_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t replay_ts_ns(const struct timespec* ts) {
+    return (uint64_t)ts->tv_sec * NSECS_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options] FILE...\n"
+            "  -r, --realtime         Pace the replay at the rate the records were taken.\n"
+            "  -e, --export           Render the Prometheus exposition after every record.\n"
+            "  -o, --output PATH      Write the Prometheus exposition of the final record to PATH.\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    bool realtime = false;
+    bool export = false;
+    const char* output_path = NULL;
+
+    static const struct option long_opts[] = {
+        {"realtime", no_argument, NULL, 'r'},
+        {"export", no_argument, NULL, 'e'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "reo:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'r': realtime = true; break;
+        case 'e': export = true; break;
+        case 'o': output_path = optarg; break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    prom_collector_registry_t* registry = prom_collector_registry_new("stats_replay");
+    if (registry == NULL) {
+        log_panic(ENOMEM, "failed to allocate prometheus registry");
+    }
+
+    struct stats_domain_spec spec = {
+        .name = "replay",
+        .prometheus.registry = registry,
+    };
+    struct stats_replay* replay =
+        stats_replay_alloc(&spec, (const char* const*)&argv[optind], argc - optind);
+    if (replay == NULL) {
+        log_panic(ENOMEM, "failed to allocate replay");
+    }
+
+    uint64_t nrecords = 0;
+    uint64_t update_ns = 0;
+    uint64_t export_ns = 0;
+    uint64_t first_ns = 0;
+    uint64_t start_ns = replay_now_ns();
+    while (true) {
+        uint64_t begin = replay_now_ns();
+        struct timespec ts;
+        if (!stats_replay_next(replay, &ts)) {
+            break;
+        }
+        update_ns += replay_now_ns() - begin;
+
+        if (export) {
+            begin = replay_now_ns();
+            free((void*)prom_collector_registry_bridge(registry));
+            export_ns += replay_now_ns() - begin;
+        }
+
+        if (nrecords++ == 0) {
+            first_ns = replay_ts_ns(&ts);
+        } else if (realtime) {
+            uint64_t due = start_ns + (replay_ts_ns(&ts) - first_ns);
+            uint64_t now = replay_now_ns();
+            if (due > now) {
+                struct timespec delay = {
+                    .tv_sec = (due - now) / NSECS_PER_SEC,
+                    .tv_nsec = (due - now) % NSECS_PER_SEC,
+                };
+                nanosleep(&delay, NULL);
+            }
+        }
+    }
+
+    if (output_path != NULL) {
+        FILE* out = fopen(output_path, "w");
+        if (out == NULL) {
+            log_panic(errno, "failed to open output file %s", output_path);
+        }
+
+        const char* text = prom_collector_registry_bridge(registry);
+        if (text != NULL) {
+            fputs(text, out);
+            free((void*)text);
+        }
+        fclose(out);
+    }
+
+    printf("{\"records\": %" PRIu64 ", \"values\": %zu, \"update_ns\": %" PRIu64
+           ", \"export_ns\": %" PRIu64 "}\n",
+           nrecords, stats_domain_number_of_values(stats_replay_domain(replay)),
+           nrecords > 0 ? update_ns / nrecords : 0,
+           nrecords > 0 && export ? export_ns / nrecords : 0);
+
+    stats_replay_free(replay);
+    prom_collector_registry_destroy(registry);
+
+    return nrecords > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,59 @@ extern "C"
 #include <stddef.h>		/* size_t */
 #include <stdio.h>		/* FILE */
 
+enum snp4_status {
+  SNP4_STATUS_OK,
+  SNP4_STATUS_NULL_PIPELINE,
+  SNP4_STATUS_NULL_ENTRY,
+  SNP4_STATUS_NULL_PACK,
+  SNP4_STATUS_MALLOC_FAIL,
+  SNP4_STATUS_NULL_RULE,
+  SNP4_STATUS_FIELD_SPEC_OVERFLOW,
+  SNP4_STATUS_FIELD_SPEC_FORMAT_INVALID,
+  SNP4_STATUS_FIELD_SPEC_UNKNOWN_TYPE,
+  SNP4_STATUS_FIELD_SPEC_SIZE_MISMATCH,
+
+  SNP4_STATUS_PACK_KEY_TOO_BIG,
+  SNP4_STATUS_PACK_MASK_TOO_BIG,
+  SNP4_STATUS_PACK_PARAMS_TOO_BIG,
+
+  SNP4_STATUS_MATCH_INVALID_FORMAT,
+  SNP4_STATUS_MATCH_MASK_TOO_WIDE,
+  SNP4_STATUS_MATCH_INVALID_BITFIELD_MASK,
+  SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK,
+  SNP4_STATUS_MATCH_INVALID_PREFIX_MASK,
+  SNP4_STATUS_MATCH_INVALID_RANGE_MASK,
+  SNP4_STATUS_MATCH_INVALID_UNUSED_MASK,
+  SNP4_STATUS_MATCH_KEY_TOO_BIG,
+  SNP4_STATUS_MATCH_MASK_TOO_BIG,
+
+  SNP4_STATUS_INVALID_TABLE_NAME,
+  SNP4_STATUS_INVALID_TABLE_CONFIG,
+  SNP4_STATUS_INVALID_ACTION_FOR_TABLE,
+
+  SNP4_STATUS_PARAM_INVALID_FORMAT,
+  SNP4_STATUS_PARAM_SPEC_OVERFLOW,
+  SNP4_STATUS_PARAM_SPEC_SIZE_MISMATCH,
+  SNP4_STATUS_PARAM_TOO_BIG,
+
+  SNP4_STATUS_INFO_TOO_MANY_TABLES,
+  SNP4_STATUS_INFO_TOO_MANY_MATCHES,
+  SNP4_STATUS_INFO_TOO_MANY_ACTIONS,
+  SNP4_STATUS_INFO_TOO_MANY_PARAMS,
+  SNP4_STATUS_INFO_INVALID_ENDIAN,
+  SNP4_STATUS_INFO_INVALID_MODE,
+
+  SNP4_STATUS_INFO_TOO_MANY_COUNTER_BLOCKS,
+  SNP4_STATUS_INFO_INVALID_COUNTER_TYPE,
+
+  SNP4_STATUS_TABLE_DUPLICATE_ENTRY,
+  SNP4_STATUS_TABLE_ENTRY_NOT_FOUND,
+  SNP4_STATUS_TABLE_DRIVER_ERROR,
+  SNP4_STATUS_TABLE_FULL,
+
+  SNP4_STATUS_TXN_ROLLBACK_FAILED,
+};
+
 extern size_t snp4_sdnet_count(void);
 extern bool snp4_sdnet_present(unsigned int sdnet_idx);
 extern void * snp4_init(unsigned int sdnet_idx, uintptr_t snp4_base_addr);
@@ -44,6 +97,105 @@ extern bool snp4_table_delete_k(void * snp4_handle,
 				size_t    key_len,
 				uint8_t * mask,
 				size_t    mask_len);
+
+// Tables and their actions are resolved once when the snp4 handle is initialized.  Callers
+// programming many rules should look up the table and action IDs once and use the handle-based
+// variants below, which avoid the by-name searches done in the driver for every rule.
+struct snp4_table;
+extern const struct snp4_table * snp4_table_lookup(void * snp4_handle, const char * table_name);
+extern bool snp4_table_lookup_action(const struct snp4_table * table_h,
+				     const char * action_name,
+				     uint32_t * action_id);
+extern bool snp4_table_insert_kma_h(void * snp4_handle,
+				    const struct snp4_table * table_h,
+				    uint8_t * key,
+				    size_t key_len,
+				    uint8_t * mask,
+				    size_t mask_len,
+				    uint32_t action_id,
+				    uint8_t * params,
+				    size_t params_len,
+				    uint32_t priority,
+				    bool replace);
+extern bool snp4_table_delete_k_h(void * snp4_handle,
+				  const struct snp4_table * table_h,
+				  uint8_t * key,
+				  size_t    key_len,
+				  uint8_t * mask,
+				  size_t    mask_len);
+
+// Packed rule for the batch operations.  The key, mask and params are laid out as produced by
+// snp4_rule_pack().  Only the key and mask are used when deleting.
+struct snp4_table_rule {
+  uint8_t * key;
+  uint8_t * mask;
+  uint32_t action_id;
+  uint8_t * params;
+  size_t params_len;
+  uint32_t priority;
+};
+
+// Apply an array of rules to a single table.  Every rule is attempted, with the outcome of each
+// recorded in the optional status array (SNP4_STATUS_OK on success, or one of the
+// SNP4_STATUS_TABLE_* errors).  Returns the number of rules applied.
+extern size_t snp4_table_insert_batch(void * snp4_handle,
+				      const struct snp4_table * table_h,
+				      const struct snp4_table_rule * rules,
+				      size_t num_rules,
+				      bool replace,
+				      enum snp4_status * status);
+extern size_t snp4_table_delete_batch(void * snp4_handle,
+				      const struct snp4_table * table_h,
+				      const struct snp4_table_rule * rules,
+				      size_t num_rules,
+				      enum snp4_status * status);
+
+// Optional host-side shadow of the entries programmed into a table, disabled by default.  Enabling
+// the shadow seeds it from the hardware, after which it is kept in step by the insert, delete and
+// reset operations of this library.  While enabled, conflicting inserts and deletes are refused
+// without touching the hardware, and snp4_table_for_each_entry() is served from the shadow (use
+// snp4_table_hw_for_each_entry() to read the hardware).  Only changes made through this handle are
+// tracked.  Inserts which can't be recorded for lack of memory are refused with
+// SNP4_STATUS_MALLOC_FAIL.  The table operations of a handle are serialized by a lock, so they may
+// be called from several threads.
+extern bool snp4_table_shadow_enable(void * snp4_handle, const struct snp4_table * table_h);
+extern void snp4_table_shadow_disable(void * snp4_handle, const struct snp4_table * table_h);
+extern bool snp4_table_shadow_enabled(const struct snp4_table * table_h);
+extern size_t snp4_table_shadow_count(const struct snp4_table * table_h);
+extern bool snp4_table_shadow_contains(const struct snp4_table * table_h,
+				       const uint8_t * key,
+				       const uint8_t * mask);
+
+// Transactions stage inserts and deletes of packed rules, across any number of tables, and apply
+// them as a whole.  On commit, the staged operations are first checked against each other and the
+// capacity of their tables, and for shadowed tables against the entries already present, before
+// anything is sent to the hardware.  They are then applied in order.  Should one fail, those
+// already applied are rolled back in reverse order.
+//
+// Tables without a shadow get no up-front check against their existing entries: an insert of an
+// entry already in the hardware, or a replacement or deletion of one missing from it, is only
+// caught when applied, at the cost of applying and rolling back the operations staged before it.
+// Capacity checks on such tables only count the entries staged by the transaction.
+//
+// snp4_txn_commit() returns SNP4_STATUS_OK once every operation is applied.  Otherwise, the status
+// of the offending operation is returned (SNP4_STATUS_TABLE_* or SNP4_STATUS_MALLOC_FAIL), with
+// its index in the optional failed_op (or the number of operations when the failure isn't tied to
+// one), and nothing remains applied.  SNP4_STATUS_TXN_ROLLBACK_FAILED is returned instead when
+// some of the operations already applied couldn't be rolled back, leaving the tables in an
+// inconsistent state which the caller should recover from, e.g. by resetting them.  The
+// transaction is released by snp4_txn_commit() or snp4_txn_abort().
+struct snp4_txn;
+extern struct snp4_txn * snp4_txn_begin(void * snp4_handle);
+extern bool snp4_txn_insert(struct snp4_txn * txn,
+			    const struct snp4_table * table_h,
+			    const struct snp4_table_rule * rule,
+			    bool replace);
+extern bool snp4_txn_delete(struct snp4_txn * txn,
+			    const struct snp4_table * table_h,
+			    const struct snp4_table_rule * rule);
+extern enum snp4_status snp4_txn_commit(struct snp4_txn * txn, size_t * failed_op);
+extern void snp4_txn_abort(struct snp4_txn * txn);
+
 extern bool snp4_table_ecc_counters_read(void * snp4_handle,
                                          const char * table_name,
                                          uint32_t * corrected_single_bit_errors,
@@ -70,32 +222,43 @@ struct snp4_table_entry {
   } action;
 };
 
+// The callback is invoked with the lock of the handle held, and so must not call back into the
+// table operations of the same handle.
 extern bool snp4_table_for_each_entry(void * snp4_handle,
                                       const char * table_name,
                                       bool (*callback)(const struct snp4_table_entry * entry,
                                                        void * arg),
                                       void * arg);
+extern bool snp4_table_hw_for_each_entry(void * snp4_handle,
+                                         const char * table_name,
+                                         bool (*callback)(const struct snp4_table_entry * entry,
+                                                          void * arg),
+                                         void * arg);
 
-// Define some limits for the supported pipeline properties handled by this library
+// Define some limits for the rules handled by this library
 // NOTE: These are not necessarily related to the limits of the underlying hardware
-#define SNP4_MAX_PIPELINE_TABLES 64
-#define SNP4_MAX_PIPELINE_COUNTER_BLOCKS 64
 #define SNP4_MAX_TABLE_MATCHES 64
-#define SNP4_MAX_TABLE_ACTIONS 64
 #define SNP4_MAX_ACTION_PARAMS 64
 
+// The pipeline info is held in a single contiguous allocation which starts with the
+// snp4_info_pipeline header.  All names and arrays are referenced by their byte offset from the
+// start of the pipeline rather than by pointer, so that the complete description can be copied
+// with memcpy or placed in memory shared between processes.  An offset of 0 is never a valid
+// reference and denotes an absent name or array.
+typedef uint32_t snp4_info_off_t;
+
 struct snp4_info_param {
-  const char * name;
+  snp4_info_off_t name;
 
   uint16_t bits;
 };
 
 struct snp4_info_action {
-  const char * name;
+  snp4_info_off_t name;
 
   uint16_t param_bits;
-  struct snp4_info_param params[SNP4_MAX_ACTION_PARAMS];
   uint16_t num_params;
+  snp4_info_off_t params; // struct snp4_info_param[num_params]
 };
 
 enum snp4_info_match_type {
@@ -128,7 +291,7 @@ enum snp4_info_table_mode {
 };
 
 struct snp4_info_table {
-  const char * name;
+  snp4_info_off_t name;
   uint32_t num_entries;
 
   enum snp4_info_table_endian endian;
@@ -136,13 +299,13 @@ struct snp4_info_table {
   uint32_t num_masks; // Only valid when mode is SNP4_INFO_TABLE_MODE_STCAM.
 
   uint16_t key_bits;
-  struct snp4_info_match matches[SNP4_MAX_TABLE_MATCHES];
   uint16_t num_matches;
+  snp4_info_off_t matches; // struct snp4_info_match[num_matches]
 
   uint16_t response_bits;
   uint16_t actionid_bits;
-  struct snp4_info_action actions[SNP4_MAX_TABLE_ACTIONS];
   uint16_t num_actions;
+  snp4_info_off_t actions; // struct snp4_info_action[num_actions]
 
   bool priority_required;
   uint16_t priority_bits;
@@ -156,72 +319,74 @@ enum snp4_info_counter_type {
 };
 
 struct snp4_info_counter_block {
-  const char * name;
+  snp4_info_off_t name;
   enum snp4_info_counter_type type;
   uint32_t width;
   uint32_t num_counters;
 
-  const char* const* aliases;
-  size_t num_aliases;
+  uint32_t num_aliases;
+  snp4_info_off_t aliases; // snp4_info_off_t[num_aliases], each the name of a counter or 0
 };
 
 struct snp4_info_pipeline {
-  const char * name;
-  struct snp4_info_table tables[SNP4_MAX_PIPELINE_TABLES];
+  uint32_t size; // Total size in bytes of the allocation holding the pipeline info.
+  snp4_info_off_t name;
+
   uint16_t num_tables;
-  struct snp4_info_counter_block counter_blocks[SNP4_MAX_PIPELINE_COUNTER_BLOCKS];
+  snp4_info_off_t tables; // struct snp4_info_table[num_tables]
+
   uint16_t num_counter_blocks;
+  snp4_info_off_t counter_blocks; // struct snp4_info_counter_block[num_counter_blocks]
 };
 
-enum snp4_status {
-  SNP4_STATUS_OK,
-  SNP4_STATUS_NULL_PIPELINE,
-  SNP4_STATUS_NULL_ENTRY,
-  SNP4_STATUS_NULL_PACK,
-  SNP4_STATUS_MALLOC_FAIL,
-  SNP4_STATUS_NULL_RULE,
-  SNP4_STATUS_FIELD_SPEC_OVERFLOW,
-  SNP4_STATUS_FIELD_SPEC_FORMAT_INVALID,
-  SNP4_STATUS_FIELD_SPEC_UNKNOWN_TYPE,
-  SNP4_STATUS_FIELD_SPEC_SIZE_MISMATCH,
+static inline const void * snp4_info_at(const struct snp4_info_pipeline * pipeline, snp4_info_off_t off)
+{
+  return off != 0 ? (const char *)pipeline + off : NULL;
+}
 
-  SNP4_STATUS_PACK_KEY_TOO_BIG,
-  SNP4_STATUS_PACK_MASK_TOO_BIG,
-  SNP4_STATUS_PACK_PARAMS_TOO_BIG,
+static inline const char * snp4_info_name(const struct snp4_info_pipeline * pipeline, snp4_info_off_t name)
+{
+  return (const char *)snp4_info_at(pipeline, name);
+}
 
-  SNP4_STATUS_MATCH_INVALID_FORMAT,
-  SNP4_STATUS_MATCH_MASK_TOO_WIDE,
-  SNP4_STATUS_MATCH_INVALID_BITFIELD_MASK,
-  SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK,
-  SNP4_STATUS_MATCH_INVALID_PREFIX_MASK,
-  SNP4_STATUS_MATCH_INVALID_RANGE_MASK,
-  SNP4_STATUS_MATCH_INVALID_UNUSED_MASK,
-  SNP4_STATUS_MATCH_KEY_TOO_BIG,
-  SNP4_STATUS_MATCH_MASK_TOO_BIG,
+static inline const struct snp4_info_table * snp4_info_tables(const struct snp4_info_pipeline * pipeline)
+{
+  return (const struct snp4_info_table *)snp4_info_at(pipeline, pipeline->tables);
+}
 
-  SNP4_STATUS_INVALID_TABLE_NAME,
-  SNP4_STATUS_INVALID_TABLE_CONFIG,
-  SNP4_STATUS_INVALID_ACTION_FOR_TABLE,
+static inline const struct snp4_info_match * snp4_info_table_matches(const struct snp4_info_pipeline * pipeline, const struct snp4_info_table * table)
+{
+  return (const struct snp4_info_match *)snp4_info_at(pipeline, table->matches);
+}
 
-  SNP4_STATUS_PARAM_INVALID_FORMAT,
-  SNP4_STATUS_PARAM_SPEC_OVERFLOW,
-  SNP4_STATUS_PARAM_SPEC_SIZE_MISMATCH,
-  SNP4_STATUS_PARAM_TOO_BIG,
+static inline const struct snp4_info_action * snp4_info_table_actions(const struct snp4_info_pipeline * pipeline, const struct snp4_info_table * table)
+{
+  return (const struct snp4_info_action *)snp4_info_at(pipeline, table->actions);
+}
 
-  SNP4_STATUS_INFO_TOO_MANY_TABLES,
-  SNP4_STATUS_INFO_TOO_MANY_MATCHES,
-  SNP4_STATUS_INFO_TOO_MANY_ACTIONS,
-  SNP4_STATUS_INFO_TOO_MANY_PARAMS,
-  SNP4_STATUS_INFO_INVALID_ENDIAN,
-  SNP4_STATUS_INFO_INVALID_MODE,
+static inline const struct snp4_info_param * snp4_info_action_params(const struct snp4_info_pipeline * pipeline, const struct snp4_info_action * action)
+{
+  return (const struct snp4_info_param *)snp4_info_at(pipeline, action->params);
+}
 
-  SNP4_STATUS_INFO_TOO_MANY_COUNTER_BLOCKS,
-  SNP4_STATUS_INFO_INVALID_COUNTER_TYPE,
-};
+static inline const struct snp4_info_counter_block * snp4_info_counter_blocks(const struct snp4_info_pipeline * pipeline)
+{
+  return (const struct snp4_info_counter_block *)snp4_info_at(pipeline, pipeline->counter_blocks);
+}
+
+static inline const char * snp4_info_counter_block_alias(const struct snp4_info_pipeline * pipeline, const struct snp4_info_counter_block * block, uint32_t idx)
+{
+  if (idx >= block->num_aliases) {
+    return NULL;
+  }
+  const snp4_info_off_t * aliases = (const snp4_info_off_t *)snp4_info_at(pipeline, block->aliases);
+  return snp4_info_name(pipeline, aliases[idx]);
+}
 
-extern enum snp4_status snp4_info_get_pipeline(unsigned int sdnet_idx, struct snp4_info_pipeline * pipeline);
+extern enum snp4_status snp4_info_get_pipeline(unsigned int sdnet_idx, struct snp4_info_pipeline ** pipeline);
+extern void snp4_info_free_pipeline(struct snp4_info_pipeline * pipeline);
 extern const struct snp4_info_table * snp4_info_get_table_by_name(const struct snp4_info_pipeline * pipeline, const char * table_name);
-extern const struct snp4_info_action * snp4_info_get_action_by_name(const struct snp4_info_table * table, const char * action_name);
+extern const struct snp4_info_action * snp4_info_get_action_by_name(const struct snp4_info_pipeline * pipeline, const struct snp4_info_table * table, const char * action_name);
 
 enum sn_match_format {
   SN_MATCH_FORMAT_UNSET,
@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * State of the mock vitisnetp4 driver provided by snp4_drv_ut.c.  The mock pipeline has two tables
+ * with 8-bit keys and 12-bit action params, each accepting the actions "nop" and "set":
+ *   - UT_DRV_TABLE_TCAM: "tcam", a TCAM table of unbounded capacity.
+ *   - UT_DRV_TABLE_BCAM: "bcam", a BCAM table of UT_DRV_BCAM_NUM_ENTRIES entries.
+ */
+#define UT_DRV_TABLE_TCAM 0
+#define UT_DRV_TABLE_BCAM 1
+#define UT_DRV_NUM_TABLES 2
+#define UT_DRV_MAX_ENTRIES 256
+#define UT_DRV_BCAM_NUM_ENTRIES 4
+
+struct ut_drv_entry {
+  bool used;
+  uint8_t key;
+  uint8_t mask;	// 0xff for the tables without a mask
+  uint32_t priority;
+  uint32_t action_id;
+  uint8_t params[2];
+};
+
+struct ut_drv {
+  struct ut_drv_entry entries[UT_DRV_NUM_TABLES][UT_DRV_MAX_ENTRIES];
+
+  unsigned int num_ops;	// Number of inserts, updates and deletes attempted
+  int fail_op;		// Index of the operation to fail with a driver error, or -1
+  unsigned int num_resets;
+};
+
+extern struct ut_drv ut_drv;
+
+extern void ut_drv_reset(void);
+extern size_t ut_drv_count(unsigned int table);
+extern const struct ut_drv_entry * ut_drv_find(unsigned int table, uint8_t key, uint8_t mask);
@@ -0,0 +1,24 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "snp4.h"
+
+/*
+ * Helpers for laying out an snp4_info_pipeline in a single contiguous allocation.  The buffer is
+ * grown as items are appended, which may move it, so items must be referenced by their offset and
+ * any pointer obtained from snp4_info_build_at() is only valid until the next append.
+ */
+struct snp4_info_builder {
+  char * buf;
+  size_t len;
+  size_t cap;
+};
+
+#define SNP4_INFO_BUILD_AT(_b, _type, _off) ((_type *)snp4_info_build_at((_b), (_off)))
+#define SNP4_INFO_BUILD_ARRAY(_b, _type, _n) snp4_info_build_alloc((_b), sizeof(_type) * (_n), _Alignof(_type))
+
+extern enum snp4_status snp4_info_build_begin(struct snp4_info_builder * b);
+extern snp4_info_off_t snp4_info_build_alloc(struct snp4_info_builder * b, size_t size, size_t align);
+extern snp4_info_off_t snp4_info_build_string(struct snp4_info_builder * b, const char * str);
+extern void * snp4_info_build_at(struct snp4_info_builder * b, snp4_info_off_t off);
+extern struct snp4_info_pipeline * snp4_info_build_finish(struct snp4_info_builder * b);
+extern void snp4_info_build_abort(struct snp4_info_builder * b);
@@ -0,0 +1,39 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Host-side record of the entries programmed into a single table.  Entries are identified by their
+ * key, together with their mask for the table modes which take one.  Masked keys are recorded with
+ * the bits outside of the mask cleared, so that keys differing only in those bits are treated as
+ * the same entry.  Entries are held in a dense array for iteration and indexed by an open
+ * addressing hash of their identity for constant time lookups.
+ */
+struct snp4_shadow_entry {
+  uint8_t * key;	// Followed by the mask, if the table has one
+  uint8_t * params;
+  size_t params_len;
+  uint32_t action_id;
+  uint32_t priority;
+  uint32_t hash;
+};
+
+struct snp4_shadow {
+  size_t key_len;
+  size_t mask_len;	// 0 if the table has no mask
+
+  struct snp4_shadow_entry * entries;
+  size_t num_entries;
+  size_t max_entries;
+
+  uint32_t * slots;	// Index of the entry + 1, or 0 if the slot is free
+  size_t num_slots;	// Power of 2
+};
+
+extern bool snp4_shadow_init(struct snp4_shadow * shadow, size_t key_len, size_t mask_len);
+extern void snp4_shadow_deinit(struct snp4_shadow * shadow);
+extern void snp4_shadow_clear(struct snp4_shadow * shadow);
+extern const struct snp4_shadow_entry * snp4_shadow_find(const struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask);
+extern bool snp4_shadow_insert(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask, uint32_t action_id, const uint8_t * params, size_t params_len, uint32_t priority);
+extern bool snp4_shadow_update(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask, uint32_t action_id, const uint8_t * params, size_t params_len);
+extern bool snp4_shadow_remove(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask);
@@ -0,0 +1,10 @@
+#include <stddef.h>
+#include "snp4.h"
+
+/*
+ * Multi-precision packing of rule keys, masks and params.  snp4_rule_pack_matches() and
+ * snp4_rule_pack_params() only fall back to these for fields which do not fit in 128 bits, and
+ * they are exposed here so that the fixed-width path can be validated against them.
+ */
+extern enum snp4_status snp4_rule_pack_matches_mpz(const struct snp4_info_match match_info_specs[], unsigned int key_size_bits, const struct sn_match matches[], size_t num_matches, struct sn_pack * pack);
+extern enum snp4_status snp4_rule_pack_params_mpz(const struct snp4_info_param param_info_specs[], unsigned int table_param_size_bits, unsigned int action_param_size_bits, const struct sn_param params[], size_t num_params, struct sn_pack * pack);
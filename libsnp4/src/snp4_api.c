@@ -5,10 +5,14 @@
 // reserved.
 //
 
-#include <stdio.h>		/* fprintf */
-#include <string.h>		/* memset, strcmp */
+#include <pthread.h>		/* pthread_mutex_* */
+#include <stdarg.h>		/* va_list, va_start, va_end */
+#include <stdio.h>		/* fprintf, vfprintf */
+#include <stdlib.h>		/* calloc, free */
+#include <string.h>		/* memset, strcmp, strdup */
 #include "snp4.h"		/* API */
 #include "snp4_io.h"		/* snp4_io_reg_* */
+#include "snp4_shadow.h"	/* snp4_shadow_* */
 #include "unused.h"		/* UNUSED() */
 
 #include "vitisnetp4drv-intf.h"	/* Vitis driver wrapper */
@@ -18,6 +22,24 @@ struct snp4_counter_block {
   size_t num_counters;
 };
 
+struct snp4_table {
+  const char * name;
+  XilVitisNetP4TableCtx * ctx;
+  XilVitisNetP4TableMode mode;
+  uint32_t num_entries;
+
+  uint32_t key_bits;
+  size_t key_len;
+  uint32_t params_bits;
+  size_t params_len;
+
+  char ** action_names; // Indexed by action ID.
+  uint32_t num_actions;
+
+  struct snp4_shadow * shadow; // NULL unless enabled with snp4_table_shadow_enable().
+  struct snp4_user_context * user; // Owner of the table, whose lock guards the shadow.
+};
+
 struct snp4_user_context {
   struct {
     bool enabled;
@@ -28,8 +50,14 @@ struct snp4_user_context {
   XilVitisNetP4EnvIf env;
   XilVitisNetP4TargetCtx target;
   struct snp4_counter_block * counter_blocks;
+  struct snp4_table * tables;
+  uint32_t num_tables;
   unsigned int sdnet_idx;
   const struct vitis_net_p4_drv_intf* intf;
+
+  // Serializes the operations on the tables, so that their shadows stay in step with the hardware
+  // when rules are programmed from several threads.
+  pthread_mutex_t lock;
 };
 
 static XilVitisNetP4ReturnType device_write(XilVitisNetP4EnvIf *EnvIfPtr, XilVitisNetP4AddressType address, uint32_t data) {
@@ -93,6 +121,18 @@ static XilVitisNetP4ReturnType log_error(XilVitisNetP4EnvIf *EnvIfPtr, const cha
   return XIL_VITIS_NET_P4_SUCCESS;
 }
 
+// Errors of the library itself are always reported, as they leave the caller with a degraded table.
+static void snp4_log_err(const struct snp4_user_context * snp4_user, const char * fmt, ...)
+{
+  va_list args;
+
+  fprintf(stderr, "%s", snp4_user->log.prefix != NULL ? snp4_user->log.prefix : "");
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fprintf(stderr, "\n");
+}
+
 size_t snp4_sdnet_count(void)
 {
   return vitis_net_p4_drv_intf_count();
@@ -162,6 +202,108 @@ static void snp4_deinit_counter_blocks(struct snp4_user_context * snp4_user)
   snp4_user->counter_blocks = NULL;
 }
 
+static void snp4_table_shadow_free(struct snp4_table * table)
+{
+  if (table->shadow != NULL) {
+    snp4_shadow_deinit(table->shadow);
+    free(table->shadow);
+    table->shadow = NULL;
+  }
+}
+
+static void snp4_deinit_tables(struct snp4_user_context * snp4_user)
+{
+  for (uint32_t n = 0; n < snp4_user->num_tables; ++n) {
+    struct snp4_table * table = &snp4_user->tables[n];
+    snp4_table_shadow_free(table);
+    for (uint32_t a = 0; a < table->num_actions; ++a) {
+      free(table->action_names[a]);
+    }
+    free(table->action_names);
+  }
+
+  free(snp4_user->tables);
+  snp4_user->tables = NULL;
+  snp4_user->num_tables = 0;
+}
+
+static bool snp4_init_table(struct snp4_user_context * snp4_user, struct snp4_table * table, const XilVitisNetP4TargetTableConfig * cfg)
+{
+  const struct vitis_net_p4_drv_intf * intf = snp4_user->intf;
+
+  table->name = cfg->NameStringPtr;
+  table->user = snp4_user;
+  table->num_entries = cfg->Config.CamConfig.NumEntries;
+  if (intf->target.get_table_by_name(&snp4_user->target, cfg->NameStringPtr, &table->ctx) != XIL_VITIS_NET_P4_SUCCESS) {
+    return false;
+  }
+
+  if (intf->table.get_mode(table->ctx, &table->mode) != XIL_VITIS_NET_P4_SUCCESS) {
+    return false;
+  }
+
+  if (intf->table.get_key_size_bits(table->ctx, &table->key_bits) != XIL_VITIS_NET_P4_SUCCESS) {
+    return false;
+  }
+  table->key_len = (table->key_bits + 8 - 1) / 8;
+
+  if (intf->table.get_action_params_size_bits(table->ctx, &table->params_bits) != XIL_VITIS_NET_P4_SUCCESS) {
+    return false;
+  }
+  table->params_len = (table->params_bits + 8 - 1) / 8;
+
+  uint32_t num_actions;
+  if (intf->table.get_num_actions(table->ctx, &num_actions) != XIL_VITIS_NET_P4_SUCCESS) {
+    return false;
+  }
+
+  table->action_names = calloc(num_actions, sizeof(*table->action_names));
+  if (num_actions > 0 && table->action_names == NULL) {
+    return false;
+  }
+
+  for (uint32_t a = 0; a < num_actions; ++a) {
+    char action_name[256] = {0};
+    if (intf->table.get_action_name(table->ctx, a, action_name, sizeof(action_name)) != XIL_VITIS_NET_P4_SUCCESS) {
+      return false;
+    }
+
+    table->action_names[a] = strdup(action_name);
+    if (table->action_names[a] == NULL) {
+      return false;
+    }
+    table->num_actions += 1;
+  }
+
+  return true;
+}
+
+static bool snp4_init_tables(struct snp4_user_context * snp4_user)
+{
+  const XilVitisNetP4TargetConfig * tcfg = snp4_user->intf->target.config;
+
+  if (tcfg->TableListSize == 0) {
+    return true;
+  }
+
+  snp4_user->tables = calloc(tcfg->TableListSize, sizeof(*snp4_user->tables));
+  if (snp4_user->tables == NULL) {
+    return false;
+  }
+
+  // Resolve the driver context, mode and action IDs of every table once, so that rule operations
+  // only need to walk this cache rather than the driver's by-name lookups.
+  for (uint32_t n = 0; n < tcfg->TableListSize; ++n) {
+    snp4_user->num_tables += 1;
+    if (!snp4_init_table(snp4_user, &snp4_user->tables[n], tcfg->TableListPtr[n])) {
+      snp4_deinit_tables(snp4_user);
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void * snp4_init(unsigned int sdnet_idx, uintptr_t snp4_base_addr)
 {
   struct snp4_user_context * snp4_user;
@@ -175,11 +317,14 @@ void * snp4_init(unsigned int sdnet_idx, uintptr_t snp4_base_addr)
     goto out_fail_user;
   }
   snp4_user->sdnet_idx = sdnet_idx;
+  if (pthread_mutex_init(&snp4_user->lock, NULL) != 0) {
+    goto out_fail_user;
+  }
   snp4_user->base_addr = snp4_base_addr + snp4_user->intf->info.offset;
 
   // Initialize the vitisnetp4 env
   if (snp4_user->intf->common.stub_env_if(&snp4_user->env) != XIL_VITIS_NET_P4_SUCCESS) {
-    goto out_fail_user;
+    goto out_fail_lock;
   }
   snp4_user->env.WordWrite32 = (XilVitisNetP4WordWrite32Fp) &device_write;
   snp4_user->env.WordRead32  = (XilVitisNetP4WordRead32Fp)  &device_read;
@@ -190,7 +335,11 @@ void * snp4_init(unsigned int sdnet_idx, uintptr_t snp4_base_addr)
   // Initialize the vitisnetp4 target
   snp4_log_enable(snp4_user, true, NULL);
   if (snp4_user->intf->target.init(&snp4_user->target, &snp4_user->env, snp4_user->intf->target.config) != XIL_VITIS_NET_P4_SUCCESS) {
-    goto out_fail_user;
+    goto out_fail_lock;
+  }
+
+  if (!snp4_init_tables(snp4_user)) {
+    goto out_fail_tables;
   }
 
   if (!snp4_init_counter_blocks(snp4_user)) {
@@ -201,7 +350,11 @@ void * snp4_init(unsigned int sdnet_idx, uintptr_t snp4_base_addr)
   return (void *) snp4_user;
 
  out_fail_counters:
+  snp4_deinit_tables(snp4_user);
+ out_fail_tables:
   snp4_user->intf->target.exit(&snp4_user->target);
+ out_fail_lock:
+  pthread_mutex_destroy(&snp4_user->lock);
  out_fail_user:
   free(snp4_user);
  out_fail:
@@ -213,9 +366,11 @@ bool snp4_deinit(void * snp4_handle)
   struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
 
   snp4_deinit_counter_blocks(snp4_user);
+  snp4_deinit_tables(snp4_user);
   if (snp4_user->intf->target.exit(&snp4_user->target) != XIL_VITIS_NET_P4_SUCCESS) {
     return false;
   }
+  pthread_mutex_destroy(&snp4_user->lock);
   free(snp4_user);
 
   return true;
@@ -231,140 +386,360 @@ void snp4_log_enable(void * snp4_handle, bool enable, const char * prefix)
 bool snp4_reset_all_tables(void * snp4_handle)
 {
   struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
-
-  // Look up the number of tables in the design
-  uint32_t num_tables;
-  if (snp4_user->intf->target.get_table_count(&snp4_user->target, &num_tables) != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
-  }
+  bool ok = true;
 
   // Reset all of the tables in the design
-  for (uint32_t i = 0; i < num_tables; i++) {
-    XilVitisNetP4TableCtx * table;
-    if (snp4_user->intf->target.get_table_by_index(&snp4_user->target, i, &table) != XIL_VITIS_NET_P4_SUCCESS) {
-      return false;
-    }
-    if (snp4_user->intf->table.reset(table) != XIL_VITIS_NET_P4_SUCCESS) {
-      return false;
+  pthread_mutex_lock(&snp4_user->lock);
+  for (uint32_t n = 0; n < snp4_user->num_tables && ok; n++) {
+    struct snp4_table * table = &snp4_user->tables[n];
+    if (snp4_user->intf->table.reset(table->ctx) != XIL_VITIS_NET_P4_SUCCESS) {
+      ok = false;
+    } else if (table->shadow != NULL) {
+      snp4_shadow_clear(table->shadow);
     }
   }
+  pthread_mutex_unlock(&snp4_user->lock);
 
-  return true;
+  return ok;
 }
 
 bool snp4_reset_one_table(void * snp4_handle, const char * table_name)
 {
   struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
 
-  XilVitisNetP4TableCtx * table;
-  if (snp4_user->intf->target.get_table_by_name(&snp4_user->target, (char *)table_name, &table) != XIL_VITIS_NET_P4_SUCCESS) {
+  const struct snp4_table * table = snp4_table_lookup(snp4_handle, table_name);
+  if (table == NULL) {
     return false;
   }
 
-  if (snp4_user->intf->table.reset(table) != XIL_VITIS_NET_P4_SUCCESS) {
+  bool ok = true;
+  pthread_mutex_lock(&snp4_user->lock);
+  if (snp4_user->intf->table.reset(table->ctx) != XIL_VITIS_NET_P4_SUCCESS) {
+    ok = false;
+  } else if (table->shadow != NULL) {
+    snp4_shadow_clear(table->shadow);
+  }
+  pthread_mutex_unlock(&snp4_user->lock);
+
+  return ok;
+}
+
+const struct snp4_table * snp4_table_lookup(void * snp4_handle, const char * table_name)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  for (uint32_t n = 0; n < snp4_user->num_tables; ++n) {
+    if (strcmp(snp4_user->tables[n].name, table_name) == 0) {
+      return &snp4_user->tables[n];
+    }
+  }
+
+  return NULL;
+}
+
+bool snp4_table_lookup_action(const struct snp4_table * table_h,
+			      const char * action_name,
+			      uint32_t * action_id)
+{
+  for (uint32_t a = 0; a < table_h->num_actions; ++a) {
+    if (strcmp(table_h->action_names[a], action_name) == 0) {
+      *action_id = a;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool snp4_table_uses_mask(const struct snp4_table * table_h)
+{
+  // Certain table modes insist on a NULL mask parameter
+  switch (table_h->mode) {
+  case XIL_VITIS_NET_P4_TABLE_MODE_DCAM:
+  case XIL_VITIS_NET_P4_TABLE_MODE_BCAM:
+  case XIL_VITIS_NET_P4_TABLE_MODE_TINY_BCAM:
+    // Mask parameter must be NULL for these table modes
     return false;
+  default:
+    // All other table modes require the mask
+    return true;
   }
+}
 
-  return true;
+static struct snp4_table * snp4_table_mut(struct snp4_user_context * snp4_user, const struct snp4_table * table_h)
+{
+  return &snp4_user->tables[table_h - snp4_user->tables];
+}
+
+static enum snp4_status snp4_table_status(XilVitisNetP4ReturnType rt)
+{
+  switch (rt) {
+  case XIL_VITIS_NET_P4_SUCCESS:
+    return SNP4_STATUS_OK;
+  case XIL_VITIS_NET_P4_CAM_ERR_DUPLICATE_FOUND:
+    return SNP4_STATUS_TABLE_DUPLICATE_ENTRY;
+  case XIL_VITIS_NET_P4_CAM_ERR_KEY_NOT_FOUND:
+    return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+  default:
+    return SNP4_STATUS_TABLE_DRIVER_ERROR;
+  }
+}
+
+// Copy the params of a shadow entry into a buffer of the width of the table's params.  Params are
+// packed into the lsbs of the table's params.
+static void snp4_table_shadow_params(const struct snp4_table * table,
+				     const struct snp4_shadow_entry * se,
+				     uint8_t * params)
+{
+  size_t params_len = se->params_len < table->params_len ? se->params_len : table->params_len;
+  memset(params, 0, table->params_len);
+  memcpy(&params[table->params_len - params_len], &se->params[se->params_len - params_len], params_len);
+}
+
+// Insert or replace a single entry, with the mask already discarded for the table modes without
+// one.  The shadow of a table holds every entry programmed into it, so inserts of existing entries
+// and replacements of missing ones are refused without going to the hardware.  The caller holds
+// the lock of the handle.
+static enum snp4_status _snp4_table_insert(struct snp4_user_context * snp4_user,
+					   const struct snp4_table * table_h,
+					   uint8_t * key,
+					   uint8_t * mask,
+					   uint32_t action_id,
+					   uint8_t * params,
+					   size_t params_len,
+					   uint32_t priority,
+					   bool replace)
+{
+  const struct vitis_net_p4_drv_intf * intf = snp4_user->intf;
+  struct snp4_shadow * shadow = table_h->shadow;
+  XilVitisNetP4ReturnType rt;
+
+  if (shadow == NULL) {
+    if (replace) {
+      rt = intf->table.update(table_h->ctx, key, mask, action_id, params);
+    } else {
+      rt = intf->table.insert(table_h->ctx, key, mask, priority, action_id, params);
+    }
+    return snp4_table_status(rt);
+  }
+
+  const struct snp4_shadow_entry * se = snp4_shadow_find(shadow, key, mask);
+  if (!replace) {
+    if (se != NULL) {
+      return SNP4_STATUS_TABLE_DUPLICATE_ENTRY;
+    }
+
+    // The entry is recorded ahead of the hardware, so that running out of memory for it leaves
+    // the table untouched.
+    if (!snp4_shadow_insert(shadow, key, mask, action_id, params, params_len, priority)) {
+      snp4_log_err(snp4_user, "snp4: out of memory recording an entry in the shadow of table '%s'",
+		   table_h->name);
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+
+    rt = intf->table.insert(table_h->ctx, key, mask, priority, action_id, params);
+    if (rt != XIL_VITIS_NET_P4_SUCCESS) {
+      snp4_shadow_remove(shadow, key, mask);
+    }
+    return snp4_table_status(rt);
+  }
+
+  if (se == NULL) {
+    return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+  }
+
+  rt = intf->table.update(table_h->ctx, key, mask, action_id, params);
+  if (rt != XIL_VITIS_NET_P4_SUCCESS) {
+    return snp4_table_status(rt);
+  }
+
+  if (!snp4_shadow_update(shadow, key, mask, action_id, params, params_len)) {
+    // The shadow entry is left as it was, so put the previous entry back into the hardware.  Should
+    // that fail too, the shadow no longer matches the hardware and is dropped.
+    snp4_log_err(snp4_user, "snp4: out of memory recording an entry in the shadow of table '%s'",
+		 table_h->name);
+
+    uint8_t prev_params[table_h->params_len + 1];
+    snp4_table_shadow_params(table_h, se, prev_params);
+    if (intf->table.update(table_h->ctx, key, mask, se->action_id, prev_params) != XIL_VITIS_NET_P4_SUCCESS) {
+      snp4_log_err(snp4_user, "snp4: failed to restore an entry of table '%s', disabling its shadow",
+		   table_h->name);
+      snp4_table_shadow_free(snp4_table_mut(snp4_user, table_h));
+    }
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  return SNP4_STATUS_OK;
+}
+
+// Delete a single entry, with the mask already discarded for the table modes without one.  The
+// caller holds the lock of the handle.
+static enum snp4_status _snp4_table_delete(struct snp4_user_context * snp4_user,
+					   const struct snp4_table * table_h,
+					   uint8_t * key,
+					   uint8_t * mask)
+{
+  struct snp4_shadow * shadow = table_h->shadow;
+
+  if (shadow != NULL && snp4_shadow_find(shadow, key, mask) == NULL) {
+    return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+  }
+
+  XilVitisNetP4ReturnType rt = snp4_user->intf->table.delete(table_h->ctx, key, mask);
+  if (rt == XIL_VITIS_NET_P4_SUCCESS && shadow != NULL) {
+    snp4_shadow_remove(shadow, key, mask);
+  }
+
+  return snp4_table_status(rt);
+}
+
+bool snp4_table_insert_kma_h(void * snp4_handle,
+			     const struct snp4_table * table_h,
+			     uint8_t * key,
+			     size_t UNUSED(key_len),
+			     uint8_t * mask,
+			     size_t UNUSED(mask_len),
+			     uint32_t action_id,
+			     uint8_t * params,
+			     size_t params_len,
+			     uint32_t priority,
+			     bool replace)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  if (!snp4_table_uses_mask(table_h)) {
+    mask = NULL;
+  }
+
+  pthread_mutex_lock(&snp4_user->lock);
+  enum snp4_status status = _snp4_table_insert(snp4_user, table_h, key, mask, action_id,
+					       params, params_len, priority, replace);
+  pthread_mutex_unlock(&snp4_user->lock);
+
+  return status == SNP4_STATUS_OK;
 }
 
 bool snp4_table_insert_kma(void * snp4_handle,
 			   const char * table_name,
 			   uint8_t * key,
-			   size_t UNUSED(key_len),
+			   size_t key_len,
 			   uint8_t * mask,
-			   size_t UNUSED(mask_len),
+			   size_t mask_len,
 			   const char * action_name,
 			   uint8_t * params,
-			   size_t UNUSED(params_len),
+			   size_t params_len,
 			   uint32_t priority,
 			   bool replace)
 {
-  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
-
   // Get a handle for the target table
-  XilVitisNetP4TableCtx * table;
-  if (snp4_user->intf->target.get_table_by_name(&snp4_user->target, (char *)table_name, &table) != XIL_VITIS_NET_P4_SUCCESS) {
+  const struct snp4_table * table = snp4_table_lookup(snp4_handle, table_name);
+  if (table == NULL) {
     return false;
   }
 
   // Convert the action name to an id
   uint32_t action_id;
-  if (snp4_user->intf->table.get_action_id(table, (char *)action_name, &action_id) != XIL_VITIS_NET_P4_SUCCESS) {
+  if (!snp4_table_lookup_action(table, action_name, &action_id)) {
     return false;
   }
 
-  XilVitisNetP4TableMode table_mode;
-  if (snp4_user->intf->table.get_mode(table, &table_mode) != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
-  }
+  return snp4_table_insert_kma_h(snp4_handle, table, key, key_len, mask, mask_len,
+				 action_id, params, params_len, priority, replace);
+}
 
-  // Certain table modes insist on a NULL mask parameter
-  switch (table_mode) {
-  case XIL_VITIS_NET_P4_TABLE_MODE_DCAM:
-  case XIL_VITIS_NET_P4_TABLE_MODE_BCAM:
-  case XIL_VITIS_NET_P4_TABLE_MODE_TINY_BCAM:
-    // Mask parameter must be NULL for these table modes
+bool snp4_table_delete_k_h(void * snp4_handle,
+			   const struct snp4_table * table_h,
+			   uint8_t * key,
+			   size_t    UNUSED(key_len),
+			   uint8_t * mask,
+			   size_t    UNUSED(mask_len))
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  if (!snp4_table_uses_mask(table_h)) {
     mask = NULL;
-    break;
-  default:
-    // All other table modes require the mask
-    break;
   }
 
-  if (replace) {
-    /* Replace an existing entry */
-    if (snp4_user->intf->table.update(table, key, mask, action_id, params) != XIL_VITIS_NET_P4_SUCCESS) {
-      return false;
-    }
-  } else {
-    /* Insert an entirely new entry */
-    if (snp4_user->intf->table.insert(table, key, mask, priority, action_id, params) != XIL_VITIS_NET_P4_SUCCESS) {
-      return false;
-    }
-  }
+  pthread_mutex_lock(&snp4_user->lock);
+  enum snp4_status status = _snp4_table_delete(snp4_user, table_h, key, mask);
+  pthread_mutex_unlock(&snp4_user->lock);
 
-  return true;
+  return status == SNP4_STATUS_OK;
 }
 
 bool snp4_table_delete_k(void * snp4_handle,
 			 const char * table_name,
 			 uint8_t * key,
-			 size_t    UNUSED(key_len),
+			 size_t    key_len,
 			 uint8_t * mask,
-			 size_t    UNUSED(mask_len))
+			 size_t    mask_len)
 {
-  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
-
   // Get a handle for the target table
-  XilVitisNetP4TableCtx * table;
-  if (snp4_user->intf->target.get_table_by_name(&snp4_user->target, (char *)table_name, &table) != XIL_VITIS_NET_P4_SUCCESS) {
+  const struct snp4_table * table = snp4_table_lookup(snp4_handle, table_name);
+  if (table == NULL) {
     return false;
   }
 
-  XilVitisNetP4TableMode table_mode;
-  if (snp4_user->intf->table.get_mode(table, &table_mode) != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
-  }
+  return snp4_table_delete_k_h(snp4_handle, table, key, key_len, mask, mask_len);
+}
 
-  // Certain table modes insist on a NULL mask parameter
-  switch (table_mode) {
-  case XIL_VITIS_NET_P4_TABLE_MODE_DCAM:
-  case XIL_VITIS_NET_P4_TABLE_MODE_BCAM:
-  case XIL_VITIS_NET_P4_TABLE_MODE_TINY_BCAM:
-    // Mask parameter must be NULL for these table modes
-    mask = NULL;
-    break;
-  default:
-    // All other table modes require the mask
-    break;
+size_t snp4_table_insert_batch(void * snp4_handle,
+			       const struct snp4_table * table_h,
+			       const struct snp4_table_rule * rules,
+			       size_t num_rules,
+			       bool replace,
+			       enum snp4_status * status)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  // Everything about the table is resolved once for the whole batch, which is applied under a
+  // single acquisition of the lock.
+  bool use_mask = snp4_table_uses_mask(table_h);
+
+  size_t num_ok = 0;
+  pthread_mutex_lock(&snp4_user->lock);
+  for (size_t n = 0; n < num_rules; ++n) {
+    const struct snp4_table_rule * rule = &rules[n];
+    enum snp4_status st = _snp4_table_insert(snp4_user, table_h, rule->key,
+					     use_mask ? rule->mask : NULL, rule->action_id,
+					     rule->params, rule->params_len, rule->priority, replace);
+    if (status != NULL) {
+      status[n] = st;
+    }
+    if (st == SNP4_STATUS_OK) {
+      num_ok += 1;
+    }
   }
+  pthread_mutex_unlock(&snp4_user->lock);
 
-  if (snp4_user->intf->table.delete(table, key, mask) != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
+  return num_ok;
+}
+
+size_t snp4_table_delete_batch(void * snp4_handle,
+			       const struct snp4_table * table_h,
+			       const struct snp4_table_rule * rules,
+			       size_t num_rules,
+			       enum snp4_status * status)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+  bool use_mask = snp4_table_uses_mask(table_h);
+
+  size_t num_ok = 0;
+  pthread_mutex_lock(&snp4_user->lock);
+  for (size_t n = 0; n < num_rules; ++n) {
+    const struct snp4_table_rule * rule = &rules[n];
+    enum snp4_status st = _snp4_table_delete(snp4_user, table_h, rule->key,
+					     use_mask ? rule->mask : NULL);
+    if (status != NULL) {
+      status[n] = st;
+    }
+    if (st == SNP4_STATUS_OK) {
+      num_ok += 1;
+    }
   }
+  pthread_mutex_unlock(&snp4_user->lock);
 
-  return true;
+  return num_ok;
 }
 
 struct snp4_table_get_response {
@@ -394,11 +769,12 @@ static bool _snp4_table_get_by_response(struct snp4_table_get_context * ctx)
   const struct vitis_net_p4_drv_intf * intf = ctx->user->intf;
   XilVitisNetP4ReturnType rt;
 
-  rt = intf->target.get_table_by_name(
-    &ctx->user->target, (char *)ctx->table.name, &ctx->table.handle);
-  if (rt != XIL_VITIS_NET_P4_SUCCESS) {
+  const struct snp4_table * table = snp4_table_lookup(ctx->user, ctx->table.name);
+  if (table == NULL) {
     return false;
   }
+  ctx->table.handle = table->ctx;
+  ctx->table.mode = table->mode;
 
   struct snp4_table_get_response resp = {0};
   rt = intf->table.get_key_size_bits(ctx->table.handle, &resp.key.width);
@@ -424,11 +800,6 @@ static bool _snp4_table_get_by_response(struct snp4_table_get_context * ctx)
   resp.action.params.mask = &params[resp.action.params.len];
 
   // Certain table modes insist on a NULL mask parameter
-  rt = intf->table.get_mode(ctx->table.handle, &ctx->table.mode);
-  if (rt != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
-  }
-
   switch (ctx->table.mode) {
   case XIL_VITIS_NET_P4_TABLE_MODE_DCAM:
   case XIL_VITIS_NET_P4_TABLE_MODE_BCAM:
@@ -441,13 +812,7 @@ static bool _snp4_table_get_by_response(struct snp4_table_get_context * ctx)
     break;
   }
 
-  uint32_t num_actions = 0;
-  rt = intf->table.get_num_actions(ctx->table.handle, &num_actions);
-  if (rt != XIL_VITIS_NET_P4_SUCCESS) {
-    return false;
-  }
-
-  for (resp.action.id = 0; resp.action.id < num_actions; ++resp.action.id) {
+  for (resp.action.id = 0; resp.action.id < table->num_actions; ++resp.action.id) {
     uint32_t position = 0;
     while (1) {
       rt = intf->table.get_by_response(
@@ -540,17 +905,69 @@ static bool _snp4_table_for_each_entry(struct snp4_table_get_context * gctx,
   return fctx->callback(&entry, fctx->arg);
 }
 
-bool snp4_table_for_each_entry(void * snp4_handle,
-                               const char * table_name,
-                               bool (*callback)(const struct snp4_table_entry * entry, void * arg),
-                               void * arg)
+static bool _snp4_table_shadow_for_each_entry(const struct snp4_table * table,
+                                              bool (*callback)(const struct snp4_table_entry * entry, void * arg),
+                                              void * arg)
+{
+  const struct snp4_shadow * shadow = table->shadow;
+  bool use_mask = snp4_table_uses_mask(table);
+
+  uint8_t key[table->key_len * 2];
+  uint8_t params[table->params_len * 2];
+  struct snp4_table_entry entry = {
+    .table_name = table->name,
+    .key = {
+      .value = key,
+      .mask = &key[table->key_len],
+      .width = table->key_bits,
+      .len = table->key_len,
+    },
+    .action = {
+      .params = {
+        .value = params,
+        .mask = &params[table->params_len],
+        .width = table->params_bits,
+        .len = table->params_len,
+      },
+    },
+  };
+  memset(entry.action.params.mask, 0xff, table->params_len);
+
+  for (size_t idx = 0; idx < shadow->num_entries; ++idx) {
+    const struct snp4_shadow_entry * se = &shadow->entries[idx];
+
+    memcpy(entry.key.value, se->key, table->key_len);
+    if (use_mask) {
+      memcpy(entry.key.mask, &se->key[table->key_len], table->key_len);
+      entry.priority = se->priority;
+    } else {
+      memset(entry.key.mask, 0xff, table->key_len); // Make sure the callback always has a key mask.
+      entry.priority = 0;
+    }
+
+    snp4_table_shadow_params(table, se, entry.action.params.value);
+
+    entry.action.name = se->action_id < table->num_actions ? table->action_names[se->action_id] : "<unknown>";
+
+    if (!callback(&entry, arg)) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+static bool _snp4_table_hw_for_each_entry(struct snp4_user_context * snp4_user,
+					  const char * table_name,
+					  bool (*callback)(const struct snp4_table_entry * entry, void * arg),
+					  void * arg)
 {
   struct snp4_table_for_each_context fctx = {
     .callback = callback,
     .arg = arg,
   };
   struct snp4_table_get_context gctx = {
-    .user = (struct snp4_user_context *)snp4_handle,
+    .user = snp4_user,
     .table = {
       .name = table_name,
     },
@@ -560,18 +977,515 @@ bool snp4_table_for_each_entry(void * snp4_handle,
   return _snp4_table_get_by_response(&gctx);
 }
 
+bool snp4_table_for_each_entry(void * snp4_handle,
+                               const char * table_name,
+                               bool (*callback)(const struct snp4_table_entry * entry, void * arg),
+                               void * arg)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+  bool ok;
+
+  // Entries of shadowed tables are served from host memory rather than read back from the hardware
+  pthread_mutex_lock(&snp4_user->lock);
+  const struct snp4_table * table = snp4_table_lookup(snp4_handle, table_name);
+  if (table != NULL && table->shadow != NULL) {
+    ok = _snp4_table_shadow_for_each_entry(table, callback, arg);
+  } else {
+    ok = _snp4_table_hw_for_each_entry(snp4_user, table_name, callback, arg);
+  }
+  pthread_mutex_unlock(&snp4_user->lock);
+
+  return ok;
+}
+
+bool snp4_table_hw_for_each_entry(void * snp4_handle,
+                                  const char * table_name,
+                                  bool (*callback)(const struct snp4_table_entry * entry, void * arg),
+                                  void * arg)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  pthread_mutex_lock(&snp4_user->lock);
+  bool ok = _snp4_table_hw_for_each_entry(snp4_user, table_name, callback, arg);
+  pthread_mutex_unlock(&snp4_user->lock);
+
+  return ok;
+}
+
+struct snp4_table_shadow_seed_context {
+  const struct snp4_table * table;
+  struct snp4_shadow * shadow;
+  bool ok;
+};
+
+static bool _snp4_table_shadow_seed(const struct snp4_table_entry * entry, void * arg)
+{
+  struct snp4_table_shadow_seed_context * ctx = arg;
+
+  uint32_t action_id;
+  if (!snp4_table_lookup_action(ctx->table, entry->action.name, &action_id) ||
+      !snp4_shadow_insert(ctx->shadow, entry->key.value, entry->key.mask, action_id,
+                          entry->action.params.value, entry->action.params.len, entry->priority)) {
+    ctx->ok = false;
+  }
+
+  return ctx->ok;
+}
+
+static bool _snp4_table_shadow_enable(struct snp4_user_context * snp4_user, struct snp4_table * table)
+{
+  if (table->shadow != NULL) {
+    return true;
+  }
+
+  struct snp4_shadow * shadow = calloc(1, sizeof(*shadow));
+  if (shadow == NULL) {
+    return false;
+  }
+  if (!snp4_shadow_init(shadow, table->key_len, snp4_table_uses_mask(table) ? table->key_len : 0)) {
+    free(shadow);
+    return false;
+  }
+
+  // Seed the shadow with any entries which are already in the hardware
+  struct snp4_table_shadow_seed_context ctx = {
+    .table = table,
+    .shadow = shadow,
+    .ok = true,
+  };
+  if (!_snp4_table_hw_for_each_entry(snp4_user, table->name, _snp4_table_shadow_seed, &ctx) || !ctx.ok) {
+    snp4_shadow_deinit(shadow);
+    free(shadow);
+    return false;
+  }
+
+  table->shadow = shadow;
+  return true;
+}
+
+bool snp4_table_shadow_enable(void * snp4_handle, const struct snp4_table * table_h)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  pthread_mutex_lock(&snp4_user->lock);
+  bool ok = _snp4_table_shadow_enable(snp4_user, snp4_table_mut(snp4_user, table_h));
+  pthread_mutex_unlock(&snp4_user->lock);
+
+  return ok;
+}
+
+void snp4_table_shadow_disable(void * snp4_handle, const struct snp4_table * table_h)
+{
+  struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
+
+  pthread_mutex_lock(&snp4_user->lock);
+  snp4_table_shadow_free(snp4_table_mut(snp4_user, table_h));
+  pthread_mutex_unlock(&snp4_user->lock);
+}
+
+bool snp4_table_shadow_enabled(const struct snp4_table * table_h)
+{
+  pthread_mutex_lock(&table_h->user->lock);
+  bool enabled = table_h->shadow != NULL;
+  pthread_mutex_unlock(&table_h->user->lock);
+
+  return enabled;
+}
+
+size_t snp4_table_shadow_count(const struct snp4_table * table_h)
+{
+  pthread_mutex_lock(&table_h->user->lock);
+  size_t count = table_h->shadow != NULL ? table_h->shadow->num_entries : 0;
+  pthread_mutex_unlock(&table_h->user->lock);
+
+  return count;
+}
+
+bool snp4_table_shadow_contains(const struct snp4_table * table_h, const uint8_t * key, const uint8_t * mask)
+{
+  pthread_mutex_lock(&table_h->user->lock);
+  bool found = table_h->shadow != NULL &&
+    snp4_shadow_find(table_h->shadow, key, snp4_table_uses_mask(table_h) ? mask : NULL) != NULL;
+  pthread_mutex_unlock(&table_h->user->lock);
+
+  return found;
+}
+
+enum snp4_txn_op_type {
+  SNP4_TXN_OP_INSERT,
+  SNP4_TXN_OP_REPLACE,
+  SNP4_TXN_OP_DELETE,
+};
+
+struct snp4_txn_op {
+  enum snp4_txn_op_type type;
+  const struct snp4_table * table;
+
+  uint8_t * key;
+  uint8_t * mask; // NULL if the table has no mask
+  uint8_t * params;
+  size_t params_len;
+  uint32_t action_id;
+  uint32_t priority;
+
+  // Entry replaced or deleted by the operation, restored when rolling back
+  struct {
+    uint8_t * params;
+    size_t params_len;
+    uint32_t action_id;
+    uint32_t priority;
+  } prev;
+};
+
+struct snp4_txn {
+  struct snp4_user_context * user;
+
+  struct snp4_txn_op * ops;
+  size_t num_ops;
+  size_t max_ops;
+};
+
+struct snp4_txn * snp4_txn_begin(void * snp4_handle)
+{
+  struct snp4_txn * txn = calloc(1, sizeof(*txn));
+  if (txn == NULL) {
+    return NULL;
+  }
+
+  txn->user = (struct snp4_user_context *) snp4_handle;
+  return txn;
+}
+
+void snp4_txn_abort(struct snp4_txn * txn)
+{
+  for (size_t n = 0; n < txn->num_ops; ++n) {
+    free(txn->ops[n].key);
+    free(txn->ops[n].prev.params);
+  }
+
+  free(txn->ops);
+  free(txn);
+}
+
+static bool snp4_txn_stage(struct snp4_txn * txn,
+			   enum snp4_txn_op_type type,
+			   const struct snp4_table * table_h,
+			   const struct snp4_table_rule * rule)
+{
+  if (txn->num_ops == txn->max_ops) {
+    size_t max_ops = txn->max_ops > 0 ? txn->max_ops * 2 : 16;
+    struct snp4_txn_op * ops = realloc(txn->ops, max_ops * sizeof(*ops));
+    if (ops == NULL) {
+      return false;
+    }
+
+    txn->ops = ops;
+    txn->max_ops = max_ops;
+  }
+
+  // The rule is copied so that the caller may release it as soon as it has been staged
+  size_t mask_len = snp4_table_uses_mask(table_h) ? table_h->key_len : 0;
+  size_t params_len = type != SNP4_TXN_OP_DELETE ? rule->params_len : 0;
+  uint8_t * data = malloc(table_h->key_len + mask_len + params_len + 1);
+  if (data == NULL) {
+    return false;
+  }
+
+  struct snp4_txn_op * op = &txn->ops[txn->num_ops++];
+  memset(op, 0, sizeof(*op));
+  op->type = type;
+  op->table = table_h;
+
+  op->key = data;
+  memcpy(op->key, rule->key, table_h->key_len);
+  if (mask_len > 0) {
+    op->mask = &data[table_h->key_len];
+    memcpy(op->mask, rule->mask, mask_len);
+  }
+  op->params = &data[table_h->key_len + mask_len];
+  op->params_len = params_len;
+  if (params_len > 0) {
+    memcpy(op->params, rule->params, params_len);
+  }
+  op->action_id = rule->action_id;
+  op->priority = rule->priority;
+
+  return true;
+}
+
+bool snp4_txn_insert(struct snp4_txn * txn,
+		     const struct snp4_table * table_h,
+		     const struct snp4_table_rule * rule,
+		     bool replace)
+{
+  return snp4_txn_stage(txn, replace ? SNP4_TXN_OP_REPLACE : SNP4_TXN_OP_INSERT, table_h, rule);
+}
+
+bool snp4_txn_delete(struct snp4_txn * txn,
+		     const struct snp4_table * table_h,
+		     const struct snp4_table_rule * rule)
+{
+  return snp4_txn_stage(txn, SNP4_TXN_OP_DELETE, table_h, rule);
+}
+
+enum snp4_txn_presence {
+  SNP4_TXN_ABSENT,
+  SNP4_TXN_PRESENT,
+  SNP4_TXN_UNKNOWN,
+};
+
+// Entries touched by the operations of a transaction on a single table.  The shadow only indexes
+// their identities, with the presence of each kept alongside at the same index.
+struct snp4_txn_staged {
+  struct snp4_shadow index;
+  enum snp4_txn_presence * presence;
+  size_t max_presence;
+};
+
+struct snp4_txn_table_state {
+  bool init;
+  struct snp4_txn_staged staged;
+  size_t num_entries;	     // Exact for shadowed tables, otherwise a lower bound
+};
+
+static bool snp4_txn_staged_set(struct snp4_txn_staged * staged,
+				const struct snp4_shadow_entry * se,
+				const struct snp4_txn_op * op,
+				enum snp4_txn_presence presence)
+{
+  if (se == NULL) {
+    if (staged->index.num_entries == staged->max_presence) {
+      size_t max_presence = staged->max_presence > 0 ? staged->max_presence * 2 : 16;
+      enum snp4_txn_presence * p = realloc(staged->presence, max_presence * sizeof(*p));
+      if (p == NULL) {
+	return false;
+      }
+
+      staged->presence = p;
+      staged->max_presence = max_presence;
+    }
+
+    if (!snp4_shadow_insert(&staged->index, op->key, op->mask, 0, NULL, 0, 0)) {
+      return false;
+    }
+    se = snp4_shadow_find(&staged->index, op->key, op->mask);
+  }
+
+  staged->presence[se - staged->index.entries] = presence;
+  return true;
+}
+
+static enum snp4_status snp4_txn_validate_op(struct snp4_txn_table_state * state, const struct snp4_txn_op * op)
+{
+  const struct snp4_table * table = op->table;
+
+  if (!state->init) {
+    if (!snp4_shadow_init(&state->staged.index, table->key_len, op->mask != NULL ? table->key_len : 0)) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+    state->init = true;
+    state->num_entries = table->shadow != NULL ? table->shadow->num_entries : 0;
+  }
+
+  // Entries which haven't been touched yet are only known to be present or absent in shadowed tables
+  const struct snp4_shadow_entry * se = snp4_shadow_find(&state->staged.index, op->key, op->mask);
+  enum snp4_txn_presence presence;
+  if (se != NULL) {
+    presence = state->staged.presence[se - state->staged.index.entries];
+  } else if (table->shadow != NULL) {
+    presence = snp4_shadow_find(table->shadow, op->key, op->mask) != NULL ? SNP4_TXN_PRESENT : SNP4_TXN_ABSENT;
+  } else {
+    presence = SNP4_TXN_UNKNOWN;
+  }
+
+  switch (op->type) {
+  case SNP4_TXN_OP_INSERT:
+    if (presence == SNP4_TXN_PRESENT) {
+      return SNP4_STATUS_TABLE_DUPLICATE_ENTRY;
+    }
+    state->num_entries += 1;
+    if (table->num_entries > 0 && state->num_entries > table->num_entries) {
+      return SNP4_STATUS_TABLE_FULL;
+    }
+    presence = SNP4_TXN_PRESENT;
+    break;
+  case SNP4_TXN_OP_REPLACE:
+    if (presence == SNP4_TXN_ABSENT) {
+      return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+    }
+    presence = SNP4_TXN_PRESENT;
+    break;
+  case SNP4_TXN_OP_DELETE:
+    if (presence == SNP4_TXN_ABSENT) {
+      return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+    }
+    if (state->num_entries > 0) {
+      state->num_entries -= 1;
+    }
+    presence = SNP4_TXN_ABSENT;
+    break;
+  }
+
+  if (!snp4_txn_staged_set(&state->staged, se, op, presence)) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+  return SNP4_STATUS_OK;
+}
+
+// Check the staged operations against each other and against the capacity of their tables and,
+// for shadowed tables, the entries already present.  Nothing is sent to the hardware.
+static enum snp4_status snp4_txn_validate(struct snp4_txn * txn, size_t * failed_op)
+{
+  struct snp4_txn_table_state * states = calloc(txn->user->num_tables, sizeof(*states));
+  if (states == NULL) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  enum snp4_status status = SNP4_STATUS_OK;
+  for (size_t n = 0; n < txn->num_ops && status == SNP4_STATUS_OK; ++n) {
+    const struct snp4_txn_op * op = &txn->ops[n];
+    status = snp4_txn_validate_op(&states[op->table - txn->user->tables], op);
+    if (status != SNP4_STATUS_OK) {
+      *failed_op = n;
+    }
+  }
+
+  for (uint32_t t = 0; t < txn->user->num_tables; ++t) {
+    if (states[t].init) {
+      snp4_shadow_deinit(&states[t].staged.index);
+      free(states[t].staged.presence);
+    }
+  }
+  free(states);
+
+  return status;
+}
+
+// Record the entry about to be replaced or deleted so that it can be restored
+static enum snp4_status snp4_txn_save_prev(struct snp4_txn * txn, struct snp4_txn_op * op)
+{
+  const struct snp4_table * table = op->table;
+
+  op->prev.params = calloc(1, table->params_len + 1);
+  if (op->prev.params == NULL) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+  op->prev.params_len = table->params_len;
+
+  if (table->shadow != NULL) {
+    const struct snp4_shadow_entry * se = snp4_shadow_find(table->shadow, op->key, op->mask);
+    if (se == NULL) {
+      return SNP4_STATUS_TABLE_ENTRY_NOT_FOUND;
+    }
+
+    snp4_table_shadow_params(table, se, op->prev.params);
+    op->prev.action_id = se->action_id;
+    op->prev.priority = se->priority;
+    return SNP4_STATUS_OK;
+  }
+
+  // Mask and priority parameters must be NULL for the table modes without a mask
+  XilVitisNetP4ReturnType rt = txn->user->intf->table.get_by_key(
+    table->ctx, op->key, op->mask, op->mask != NULL ? &op->prev.priority : NULL,
+    &op->prev.action_id, op->prev.params);
+  return snp4_table_status(rt);
+}
+
+static enum snp4_status snp4_txn_apply_op(struct snp4_txn * txn, struct snp4_txn_op * op)
+{
+  enum snp4_status status = SNP4_STATUS_OK;
+
+  switch (op->type) {
+  case SNP4_TXN_OP_INSERT:
+    return _snp4_table_insert(txn->user, op->table, op->key, op->mask, op->action_id,
+			      op->params, op->params_len, op->priority, false);
+  case SNP4_TXN_OP_REPLACE:
+    status = snp4_txn_save_prev(txn, op);
+    if (status != SNP4_STATUS_OK) {
+      return status;
+    }
+    return _snp4_table_insert(txn->user, op->table, op->key, op->mask, op->action_id,
+			      op->params, op->params_len, op->priority, true);
+  case SNP4_TXN_OP_DELETE:
+    status = snp4_txn_save_prev(txn, op);
+    if (status != SNP4_STATUS_OK) {
+      return status;
+    }
+    return _snp4_table_delete(txn->user, op->table, op->key, op->mask);
+  }
+
+  return SNP4_STATUS_TABLE_DRIVER_ERROR;
+}
+
+static enum snp4_status snp4_txn_rollback_op(struct snp4_txn * txn, struct snp4_txn_op * op)
+{
+  switch (op->type) {
+  case SNP4_TXN_OP_INSERT:
+    return _snp4_table_delete(txn->user, op->table, op->key, op->mask);
+  case SNP4_TXN_OP_REPLACE:
+    return _snp4_table_insert(txn->user, op->table, op->key, op->mask, op->prev.action_id,
+			      op->prev.params, op->prev.params_len, op->prev.priority, true);
+  case SNP4_TXN_OP_DELETE:
+    return _snp4_table_insert(txn->user, op->table, op->key, op->mask, op->prev.action_id,
+			      op->prev.params, op->prev.params_len, op->prev.priority, false);
+  }
+
+  return SNP4_STATUS_TABLE_DRIVER_ERROR;
+}
+
+enum snp4_status snp4_txn_commit(struct snp4_txn * txn, size_t * failed_op)
+{
+  size_t failed = txn->num_ops;
+
+  // The lock is held throughout, so that the checks made against the shadows still hold while the
+  // operations are applied.
+  pthread_mutex_lock(&txn->user->lock);
+  enum snp4_status status = snp4_txn_validate(txn, &failed);
+
+  if (status == SNP4_STATUS_OK) {
+    for (size_t n = 0; n < txn->num_ops; ++n) {
+      status = snp4_txn_apply_op(txn, &txn->ops[n]);
+      if (status == SNP4_STATUS_OK) {
+	continue;
+      }
+      failed = n;
+
+      // Undo the operations already applied, most recent first.  Every one of them is attempted,
+      // even once one has failed, to leave the tables as close as possible to their prior state.
+      while (n-- > 0) {
+	enum snp4_status rb_status = snp4_txn_rollback_op(txn, &txn->ops[n]);
+	if (rb_status != SNP4_STATUS_OK) {
+	  snp4_log_err(txn->user, "snp4: failed to roll back operation %zu of transaction on table '%s' (%d)",
+		       n, txn->ops[n].table->name, rb_status);
+	  status = SNP4_STATUS_TXN_ROLLBACK_FAILED;
+	}
+      }
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&txn->user->lock);
+
+  if (status != SNP4_STATUS_OK && failed_op != NULL) {
+    *failed_op = failed;
+  }
+
+  snp4_txn_abort(txn);
+  return status;
+}
+
 bool snp4_table_ecc_counters_read(void * snp4_handle,
                                   const char * table_name,
                                   uint32_t * corrected_single_bit_errors,
                                   uint32_t * detected_double_bit_errors)
 {
   struct snp4_user_context * snp4_user = (struct snp4_user_context *) snp4_handle;
-  XilVitisNetP4TableCtx * table;
-  if (snp4_user->intf->target.get_table_by_name(&snp4_user->target, (char *)table_name, &table) != XIL_VITIS_NET_P4_SUCCESS) {
+  const struct snp4_table * table = snp4_table_lookup(snp4_handle, table_name);
+  if (table == NULL) {
     return false;
   }
 
-  XilVitisNetP4ReturnType rt = snp4_user->intf->table.get_ecc_counters(table, corrected_single_bit_errors, detected_double_bit_errors);
+  XilVitisNetP4ReturnType rt = snp4_user->intf->table.get_ecc_counters(table->ctx, corrected_single_bit_errors, detected_double_bit_errors);
   if (rt == XIL_VITIS_NET_P4_TABLE_ERR_FUNCTION_NOT_SUPPORTED) {
     /* Not all CAM IPs support ECC error counters. Rather than try to figure out which do, let the driver tell us and handle it. */
     *corrected_single_bit_errors = 0;
@@ -0,0 +1,222 @@
+#include "gtest/gtest.h"
+#include <gmp.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "snp4.h"		/* API */
+#include "snp4_drv_ut.h"	/* ut_drv_* */
+}
+
+class SNP4ApiTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    ut_drv_reset();
+    handle = snp4_init(0, 0);
+    ASSERT_NE(nullptr, handle);
+    tcam = snp4_table_lookup(handle, "tcam");
+    ASSERT_NE(nullptr, tcam);
+    bcam = snp4_table_lookup(handle, "bcam");
+    ASSERT_NE(nullptr, bcam);
+  }
+
+  void TearDown() override {
+    ASSERT_TRUE(snp4_deinit(handle));
+  }
+
+  bool insert(const struct snp4_table * table, uint8_t key, uint8_t mask, uint32_t action_id, uint8_t param, bool replace = false) {
+    uint8_t params[2] = {0, param};
+    return snp4_table_insert_kma_h(handle, table, &key, 1, &mask, 1, action_id, params, sizeof(params), 7, replace);
+  }
+
+  bool remove(const struct snp4_table * table, uint8_t key, uint8_t mask) {
+    return snp4_table_delete_k_h(handle, table, &key, 1, &mask, 1);
+  }
+
+  void * handle;
+  const struct snp4_table * tcam;
+  const struct snp4_table * bcam;
+};
+
+struct dump_entry {
+  uint8_t key;
+  uint8_t mask;
+  uint8_t param;
+  std::string action;
+  uint32_t priority;
+};
+
+static bool dump_cb(const struct snp4_table_entry * entry, void * arg)
+{
+  auto dump = static_cast<std::vector<dump_entry> *>(arg);
+  dump->push_back({entry->key.value[0], entry->key.mask[0], entry->action.params.value[1],
+		   entry->action.name, entry->priority});
+  return true;
+}
+
+TEST_F(SNP4ApiTest, ShadowIsOptIn) {
+  ASSERT_FALSE(snp4_table_shadow_enabled(tcam));
+  ASSERT_FALSE(snp4_table_shadow_enabled(bcam));
+
+  // Without a shadow, every operation goes to the driver
+  ASSERT_TRUE(insert(tcam, 0x13, 0xff, 1, 0x42));
+  ASSERT_FALSE(insert(tcam, 0x13, 0xff, 1, 0x42));
+  ASSERT_EQ(2, ut_drv.num_ops);
+  ASSERT_EQ(0, snp4_table_shadow_count(tcam));
+}
+
+TEST_F(SNP4ApiTest, ShadowRefusesConflictsWithoutDriver) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+  ASSERT_TRUE(snp4_table_shadow_enabled(tcam));
+
+  ASSERT_TRUE(insert(tcam, 0x13, 0xf0, 1, 0x42));
+  ASSERT_EQ(1, ut_drv.num_ops);
+
+  // Keys differing only outside of the mask are the same entry
+  ASSERT_FALSE(insert(tcam, 0x1f, 0xf0, 1, 0x42));
+  ASSERT_FALSE(insert(tcam, 0x13, 0xff, 1, 0x42, true));
+  ASSERT_FALSE(remove(tcam, 0x13, 0xff));
+  ASSERT_EQ(1, ut_drv.num_ops);
+
+  uint8_t key = 0x1f, mask = 0xf0, other_mask = 0xff;
+  ASSERT_TRUE(snp4_table_shadow_contains(tcam, &key, &mask));
+  ASSERT_FALSE(snp4_table_shadow_contains(tcam, &key, &other_mask));
+
+  ASSERT_TRUE(insert(tcam, 0x13, 0xf0, 0, 0x55, true));
+  ASSERT_EQ(0x55, ut_drv_find(UT_DRV_TABLE_TCAM, 0x10, 0xf0)->params[1]);
+  ASSERT_TRUE(remove(tcam, 0x13, 0xf0));
+  ASSERT_EQ(0, snp4_table_shadow_count(tcam));
+  ASSERT_EQ(0, ut_drv_count(UT_DRV_TABLE_TCAM));
+}
+
+TEST_F(SNP4ApiTest, ShadowSeededFromHardware) {
+  for (unsigned int k = 0; k < 10; k++) {
+    ASSERT_TRUE(insert(tcam, k, 0xff, k % 2, k));
+  }
+
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+  ASSERT_EQ(10, snp4_table_shadow_count(tcam));
+  ASSERT_FALSE(insert(tcam, 3, 0xff, 1, 3));
+  ASSERT_EQ(10, ut_drv.num_ops);
+
+  snp4_table_shadow_disable(handle, tcam);
+  ASSERT_FALSE(snp4_table_shadow_enabled(tcam));
+  ASSERT_EQ(0, snp4_table_shadow_count(tcam));
+}
+
+TEST_F(SNP4ApiTest, DumpFromShadowOrHardware) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+  ASSERT_TRUE(insert(tcam, 0x13, 0xf0, 1, 0x42));
+
+  std::vector<dump_entry> dump;
+  ASSERT_TRUE(snp4_table_for_each_entry(handle, "tcam", dump_cb, &dump));
+  ASSERT_EQ(1, dump.size());
+  ASSERT_EQ(0x10, dump[0].key);
+  ASSERT_EQ(0xf0, dump[0].mask);
+  ASSERT_EQ(0x42, dump[0].param);
+  ASSERT_EQ("set", dump[0].action);
+  ASSERT_EQ(7, dump[0].priority);
+
+  // An entry changed behind the library's back only shows up when reading the hardware
+  ut_drv.entries[UT_DRV_TABLE_TCAM][1] = {true, 0x20, 0xff, 0, 0, {0, 0}};
+
+  dump.clear();
+  ASSERT_TRUE(snp4_table_for_each_entry(handle, "tcam", dump_cb, &dump));
+  ASSERT_EQ(1, dump.size());
+
+  dump.clear();
+  ASSERT_TRUE(snp4_table_hw_for_each_entry(handle, "tcam", dump_cb, &dump));
+  ASSERT_EQ(2, dump.size());
+}
+
+TEST_F(SNP4ApiTest, BatchReportsStatusPerRule) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+
+  uint8_t keys[3] = {1, 2, 1};
+  uint8_t mask = 0xff;
+  uint8_t params[2] = {0, 0};
+  struct snp4_table_rule rules[3];
+  for (unsigned int n = 0; n < 3; n++) {
+    rules[n] = {&keys[n], &mask, 0, params, sizeof(params), 1};
+  }
+
+  enum snp4_status status[3];
+  ASSERT_EQ(2, snp4_table_insert_batch(handle, tcam, rules, 3, false, status));
+  ASSERT_EQ(SNP4_STATUS_OK, status[0]);
+  ASSERT_EQ(SNP4_STATUS_OK, status[1]);
+  ASSERT_EQ(SNP4_STATUS_TABLE_DUPLICATE_ENTRY, status[2]);
+  ASSERT_EQ(2, ut_drv.num_ops);
+
+  ut_drv.fail_op = ut_drv.num_ops;
+  ASSERT_EQ(1, snp4_table_insert_batch(handle, tcam, rules, 2, true, status));
+  ASSERT_EQ(SNP4_STATUS_TABLE_DRIVER_ERROR, status[0]);
+  ASSERT_EQ(SNP4_STATUS_OK, status[1]);
+  ut_drv.fail_op = -1;
+
+  ASSERT_EQ(2, snp4_table_delete_batch(handle, tcam, rules, 3, status));
+  ASSERT_EQ(SNP4_STATUS_TABLE_ENTRY_NOT_FOUND, status[2]);
+  ASSERT_EQ(0, snp4_table_shadow_count(tcam));
+  ASSERT_EQ(0, ut_drv_count(UT_DRV_TABLE_TCAM));
+}
+
+TEST_F(SNP4ApiTest, DriverFailureLeavesShadowUntouched) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, bcam));
+
+  ut_drv.fail_op = 0;
+  ASSERT_FALSE(insert(bcam, 0x13, 0, 1, 0x42));
+  ASSERT_EQ(0, snp4_table_shadow_count(bcam));
+
+  ASSERT_TRUE(insert(bcam, 0x13, 0, 1, 0x42));
+  ut_drv.fail_op = ut_drv.num_ops;
+  ASSERT_FALSE(remove(bcam, 0x13, 0));
+  ASSERT_EQ(1, snp4_table_shadow_count(bcam));
+  ASSERT_EQ(1, ut_drv_count(UT_DRV_TABLE_BCAM));
+}
+
+TEST_F(SNP4ApiTest, ResetClearsShadow) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, bcam));
+  ASSERT_TRUE(insert(tcam, 1, 0xff, 0, 0));
+  ASSERT_TRUE(insert(bcam, 1, 0xff, 0, 0));
+
+  ASSERT_TRUE(snp4_reset_one_table(handle, "tcam"));
+  ASSERT_EQ(0, snp4_table_shadow_count(tcam));
+  ASSERT_EQ(1, snp4_table_shadow_count(bcam));
+
+  ASSERT_TRUE(snp4_reset_all_tables(handle));
+  ASSERT_EQ(0, snp4_table_shadow_count(bcam));
+  ASSERT_EQ(3, ut_drv.num_resets);
+}
+
+TEST_F(SNP4ApiTest, ConcurrentInsertsAndDeletes) {
+  ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+
+  // Each thread owns a disjoint range of keys, which it inserts, partially deletes and re-inserts
+  const unsigned int num_threads = 4;
+  const unsigned int keys_per_thread = 50;
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < num_threads; t++) {
+    threads.emplace_back([this, t]() {
+      for (unsigned int iter = 0; iter < 20; iter++) {
+	for (unsigned int k = 0; k < keys_per_thread; k++) {
+	  insert(tcam, t * keys_per_thread + k, 0xff, 1, k);
+	}
+	for (unsigned int k = 0; k < keys_per_thread; k += 2) {
+	  remove(tcam, t * keys_per_thread + k, 0xff);
+	}
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(num_threads * keys_per_thread / 2, snp4_table_shadow_count(tcam));
+  ASSERT_EQ(num_threads * keys_per_thread / 2, ut_drv_count(UT_DRV_TABLE_TCAM));
+  for (unsigned int k = 0; k < num_threads * keys_per_thread; k++) {
+    uint8_t key = k, mask = 0xff;
+    ASSERT_EQ(k % 2 == 1, snp4_table_shadow_contains(tcam, &key, &mask));
+    ASSERT_EQ(k % 2 == 1, ut_drv_find(UT_DRV_TABLE_TCAM, key, mask) != NULL);
+  }
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>		/* snprintf */
+#include <string.h>		/* memset, strcmp */
+#include "snp4_drv_ut.h"	/* API */
+#include "snp4_io.h"		/* snp4_io_reg_* */
+#include "unused.h"		/* UNUSED */
+
+#include "vitisnetp4drv-intf.h"	/* Vitis driver wrapper */
+
+/*
+ * This file provides a mock of the vitisnetp4 driver wrapper for exercising the table operations of
+ * the snp4 API without any hardware.  Entries are kept in fixed arrays per table, which the tests
+ * inspect directly to check what the library actually programmed.
+ */
+
+struct ut_drv ut_drv = {
+  .fail_op = -1,
+};
+
+static XilVitisNetP4Action ut_drv_action_nop = {
+  .NameStringPtr = "nop",
+};
+
+static XilVitisNetP4Attribute ut_drv_action_set_params[] = {
+  {
+    .NameStringPtr = "value",
+    .Value = 12,
+  },
+};
+
+static XilVitisNetP4Action ut_drv_action_set = {
+  .NameStringPtr = "set",
+  .ParamListSize = 1,
+  .ParamListPtr = ut_drv_action_set_params,
+};
+
+static XilVitisNetP4Action * ut_drv_actions[] = {
+  &ut_drv_action_nop,
+  &ut_drv_action_set,
+};
+#define UT_DRV_NUM_ACTIONS (sizeof(ut_drv_actions) / sizeof(ut_drv_actions[0]))
+
+static XilVitisNetP4TargetTableConfig ut_drv_table_tcam = {
+  .NameStringPtr = "tcam",
+  .Config = {
+    .Mode = XIL_VITIS_NET_P4_TABLE_MODE_TCAM,
+    .KeySizeBits = 8,
+    .ActionListSize = UT_DRV_NUM_ACTIONS,
+    .ActionListPtr = ut_drv_actions,
+  },
+};
+
+static XilVitisNetP4TargetTableConfig ut_drv_table_bcam = {
+  .NameStringPtr = "bcam",
+  .Config = {
+    .Mode = XIL_VITIS_NET_P4_TABLE_MODE_BCAM,
+    .KeySizeBits = 8,
+    .CamConfig = {
+      .NumEntries = UT_DRV_BCAM_NUM_ENTRIES,
+    },
+    .ActionListSize = UT_DRV_NUM_ACTIONS,
+    .ActionListPtr = ut_drv_actions,
+  },
+};
+
+static XilVitisNetP4TargetTableConfig * ut_drv_tables[UT_DRV_NUM_TABLES] = {
+  [UT_DRV_TABLE_TCAM] = &ut_drv_table_tcam,
+  [UT_DRV_TABLE_BCAM] = &ut_drv_table_bcam,
+};
+
+static XilVitisNetP4TargetConfig ut_drv_config = {
+  .TableListSize = UT_DRV_NUM_TABLES,
+  .TableListPtr = ut_drv_tables,
+};
+
+static XilVitisNetP4TableCtx ut_drv_table_ctx[UT_DRV_NUM_TABLES];
+
+void ut_drv_reset(void)
+{
+  memset(&ut_drv, 0, sizeof(ut_drv));
+  ut_drv.fail_op = -1;
+}
+
+size_t ut_drv_count(unsigned int table)
+{
+  size_t count = 0;
+  for (unsigned int n = 0; n < UT_DRV_MAX_ENTRIES; ++n) {
+    count += ut_drv.entries[table][n].used ? 1 : 0;
+  }
+
+  return count;
+}
+
+const struct ut_drv_entry * ut_drv_find(unsigned int table, uint8_t key, uint8_t mask)
+{
+  for (unsigned int n = 0; n < UT_DRV_MAX_ENTRIES; ++n) {
+    const struct ut_drv_entry * entry = &ut_drv.entries[table][n];
+    if (entry->used && entry->key == (key & mask) && entry->mask == mask) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static unsigned int ut_drv_table_index(const XilVitisNetP4TableCtx * ctx)
+{
+  return ctx - ut_drv_table_ctx;
+}
+
+static uint8_t ut_drv_mask(const XilVitisNetP4TableCtx * ctx, const uint8_t * mask)
+{
+  return ut_drv_table_index(ctx) == UT_DRV_TABLE_TCAM ? *mask : 0xff;
+}
+
+static struct ut_drv_entry * ut_drv_lookup(XilVitisNetP4TableCtx * ctx, const uint8_t * key, const uint8_t * mask)
+{
+  uint8_t m = ut_drv_mask(ctx, mask);
+  return (struct ut_drv_entry *) ut_drv_find(ut_drv_table_index(ctx), *key & m, m);
+}
+
+static bool ut_drv_fail(void)
+{
+  bool fail = ut_drv.fail_op >= 0 && ut_drv.num_ops == (unsigned int) ut_drv.fail_op;
+  ut_drv.num_ops += 1;
+  return fail;
+}
+
+static XilVitisNetP4ReturnType ut_drv_stub_env_if(XilVitisNetP4EnvIf * env)
+{
+  memset(env, 0, sizeof(*env));
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_target_init(XilVitisNetP4TargetCtx * UNUSED(ctx),
+						  XilVitisNetP4EnvIf * UNUSED(env),
+						  XilVitisNetP4TargetConfig * UNUSED(config))
+{
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_target_exit(XilVitisNetP4TargetCtx * UNUSED(ctx))
+{
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_table_by_name(XilVitisNetP4TargetCtx * UNUSED(ctx),
+							char * name,
+							XilVitisNetP4TableCtx ** table_ctx)
+{
+  for (unsigned int n = 0; n < UT_DRV_NUM_TABLES; ++n) {
+    if (strcmp(name, ut_drv_tables[n]->NameStringPtr) == 0) {
+      *table_ctx = &ut_drv_table_ctx[n];
+      return XIL_VITIS_NET_P4_SUCCESS;
+    }
+  }
+
+  return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+}
+
+static XilVitisNetP4ReturnType ut_drv_reset_table(XilVitisNetP4TableCtx * ctx)
+{
+  ut_drv.num_resets += 1;
+  memset(ut_drv.entries[ut_drv_table_index(ctx)], 0, sizeof(ut_drv.entries[0]));
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_insert(XilVitisNetP4TableCtx * ctx, uint8_t * key, uint8_t * mask,
+					     uint32_t priority, uint32_t action_id, uint8_t * params)
+{
+  if (ut_drv_fail()) {
+    return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+  }
+  if (ut_drv_lookup(ctx, key, mask) != NULL) {
+    return XIL_VITIS_NET_P4_CAM_ERR_DUPLICATE_FOUND;
+  }
+
+  unsigned int table = ut_drv_table_index(ctx);
+  for (unsigned int n = 0; n < UT_DRV_MAX_ENTRIES; ++n) {
+    struct ut_drv_entry * entry = &ut_drv.entries[table][n];
+    if (!entry->used) {
+      uint8_t m = ut_drv_mask(ctx, mask);
+      *entry = (struct ut_drv_entry) {
+	.used = true,
+	.key = *key & m,
+	.mask = m,
+	.priority = priority,
+	.action_id = action_id,
+	.params = {params[0], params[1]},
+      };
+      return XIL_VITIS_NET_P4_SUCCESS;
+    }
+  }
+
+  return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+}
+
+static XilVitisNetP4ReturnType ut_drv_update(XilVitisNetP4TableCtx * ctx, uint8_t * key, uint8_t * mask,
+					     uint32_t action_id, uint8_t * params)
+{
+  if (ut_drv_fail()) {
+    return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+  }
+
+  struct ut_drv_entry * entry = ut_drv_lookup(ctx, key, mask);
+  if (entry == NULL) {
+    return XIL_VITIS_NET_P4_CAM_ERR_KEY_NOT_FOUND;
+  }
+  entry->action_id = action_id;
+  entry->params[0] = params[0];
+  entry->params[1] = params[1];
+
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_delete(XilVitisNetP4TableCtx * ctx, uint8_t * key, uint8_t * mask)
+{
+  if (ut_drv_fail()) {
+    return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+  }
+
+  struct ut_drv_entry * entry = ut_drv_lookup(ctx, key, mask);
+  if (entry == NULL) {
+    return XIL_VITIS_NET_P4_CAM_ERR_KEY_NOT_FOUND;
+  }
+  entry->used = false;
+
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_mode(XilVitisNetP4TableCtx * ctx, XilVitisNetP4TableMode * mode)
+{
+  *mode = ut_drv_tables[ut_drv_table_index(ctx)]->Config.Mode;
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_action_name(XilVitisNetP4TableCtx * UNUSED(ctx), uint32_t action_id,
+						      char * name, uint32_t name_len)
+{
+  if (action_id >= UT_DRV_NUM_ACTIONS) {
+    return XIL_VITIS_NET_P4_GENERAL_ERR_INTERNAL_ASSERTION;
+  }
+
+  snprintf(name, name_len, "%s", ut_drv_actions[action_id]->NameStringPtr);
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_num_actions(XilVitisNetP4TableCtx * UNUSED(ctx), uint32_t * num_actions)
+{
+  *num_actions = UT_DRV_NUM_ACTIONS;
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_key_size_bits(XilVitisNetP4TableCtx * UNUSED(ctx), uint32_t * bits)
+{
+  *bits = 8;
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_action_params_size_bits(XilVitisNetP4TableCtx * UNUSED(ctx), uint32_t * bits)
+{
+  *bits = 12;
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_by_key(XilVitisNetP4TableCtx * ctx, uint8_t * key, uint8_t * mask,
+						 uint32_t * priority, uint32_t * action_id, uint8_t * params)
+{
+  const struct ut_drv_entry * entry = ut_drv_lookup(ctx, key, mask);
+  if (entry == NULL) {
+    return XIL_VITIS_NET_P4_CAM_ERR_KEY_NOT_FOUND;
+  }
+
+  if (priority != NULL) {
+    *priority = entry->priority;
+  }
+  *action_id = entry->action_id;
+  params[0] = entry->params[0];
+  params[1] = entry->params[1];
+
+  return XIL_VITIS_NET_P4_SUCCESS;
+}
+
+static XilVitisNetP4ReturnType ut_drv_get_by_response(XilVitisNetP4TableCtx * ctx, uint32_t action_id,
+						      uint8_t * params, uint8_t * UNUSED(params_mask),
+						      uint32_t * position, uint8_t * key, uint8_t * mask)
+{
+  unsigned int table = ut_drv_table_index(ctx);
+  for (; *position < UT_DRV_MAX_ENTRIES; *position += 1) {
+    const struct ut_drv_entry * entry = &ut_drv.entries[table][*position];
+    if (entry->used && entry->action_id == action_id) {
+      *key = entry->key;
+      if (mask != NULL) {
+	*mask = entry->mask;
+      }
+      params[0] = entry->params[0];
+      params[1] = entry->params[1];
+      *position += 1;
+      return XIL_VITIS_NET_P4_SUCCESS;
+    }
+  }
+
+  return XIL_VITIS_NET_P4_CAM_ERR_KEY_NOT_FOUND;
+}
+
+static const struct vitis_net_p4_drv_intf ut_drv_intf = {
+  .info = {
+    .name = "ut",
+  },
+  .common = {
+    .stub_env_if = ut_drv_stub_env_if,
+  },
+  .table = {
+    .reset = ut_drv_reset_table,
+    .update = ut_drv_update,
+    .insert = ut_drv_insert,
+    .delete = ut_drv_delete,
+    .get_mode = ut_drv_get_mode,
+    .get_action_name = ut_drv_get_action_name,
+    .get_num_actions = ut_drv_get_num_actions,
+    .get_key_size_bits = ut_drv_get_key_size_bits,
+    .get_action_params_size_bits = ut_drv_get_action_params_size_bits,
+    .get_by_key = ut_drv_get_by_key,
+    .get_by_response = ut_drv_get_by_response,
+  },
+  .target = {
+    .config = &ut_drv_config,
+    .init = ut_drv_target_init,
+    .exit = ut_drv_target_exit,
+    .get_table_by_name = ut_drv_get_table_by_name,
+  },
+};
+
+size_t vitis_net_p4_drv_intf_count(void)
+{
+  return 1;
+}
+
+const struct vitis_net_p4_drv_intf * vitis_net_p4_drv_intf_get(unsigned int sdnet_idx)
+{
+  return sdnet_idx == 0 ? &ut_drv_intf : NULL;
+}
+
+bool snp4_io_reg_write(uintptr_t UNUSED(base), uintptr_t UNUSED(offset), uint32_t UNUSED(data))
+{
+  return true;
+}
+
+bool snp4_io_reg_read(uintptr_t UNUSED(base), uintptr_t UNUSED(offset), uint32_t * data)
+{
+  *data = 0;
+  return true;
+}
@@ -1,7 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>		/* free */
 #include <string.h>		/* strdup */
 #include "snp4.h"		/* API */
-#include "array_size.h"		/* ARRAY_SIZE */
+#include "snp4_info_build.h"	/* snp4_info_build_* */
 
 #include "vitisnetp4drv-intf.h"	/* Vitis driver wrapper */
 
@@ -138,51 +139,70 @@ void snp4_print_target_config(unsigned int sdnet_idx)
   }
 }
 
-static enum snp4_status snp4_info_get_params(struct snp4_info_param * params, uint16_t max_params, uint16_t * num_params, uint16_t * param_bits, XilVitisNetP4Attribute cfg_params[], unsigned int size)
+static enum snp4_status snp4_info_get_params(struct snp4_info_builder * b, snp4_info_off_t action_off, XilVitisNetP4Attribute cfg_params[], unsigned int size)
 {
-  if (size > max_params) {
+  if (size > UINT16_MAX) {
     return SNP4_STATUS_INFO_TOO_MANY_PARAMS;
   }
 
-  *num_params = size;
+  snp4_info_off_t params_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_param, size);
+  if (params_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
 
-  *param_bits = 0;
+  uint16_t param_bits = 0;
   for (unsigned int pidx = 0; pidx < size; pidx++) {
     XilVitisNetP4Attribute *xp = &cfg_params[pidx];
-    struct snp4_info_param * param = &params[pidx];
 
-    param->name = xp->NameStringPtr;
+    snp4_info_off_t name = snp4_info_build_string(b, xp->NameStringPtr);
+    if (name == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+
+    struct snp4_info_param * param = &SNP4_INFO_BUILD_AT(b, struct snp4_info_param, params_off)[pidx];
+    param->name = name;
     param->bits = xp->Value;
 
     // Accumulate the total number of bits in the parameters for this action
-    *param_bits += xp->Value;
+    param_bits += xp->Value;
   }
 
+  struct snp4_info_action * action = SNP4_INFO_BUILD_AT(b, struct snp4_info_action, action_off);
+  action->params = params_off;
+  action->num_params = size;
+  action->param_bits = param_bits;
+
   return SNP4_STATUS_OK;
 }
 
-static enum snp4_status snp4_info_get_actions(struct snp4_info_action * actions, uint16_t max_actions, uint16_t * num_actions, XilVitisNetP4Action * cfg_actions[], unsigned int size)
+static enum snp4_status snp4_info_get_actions(struct snp4_info_builder * b, snp4_info_off_t table_off, XilVitisNetP4Action * cfg_actions[], unsigned int size)
 {
-  static enum snp4_status rc;
+  enum snp4_status rc;
 
-  if (size > max_actions) {
+  if (size > UINT16_MAX) {
     return SNP4_STATUS_INFO_TOO_MANY_ACTIONS;
   }
 
-  *num_actions = size;
+  snp4_info_off_t actions_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_action, size);
+  if (actions_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  struct snp4_info_table * table = SNP4_INFO_BUILD_AT(b, struct snp4_info_table, table_off);
+  table->actions = actions_off;
+  table->num_actions = size;
 
   for (unsigned int aidx = 0; aidx < size; aidx++) {
     XilVitisNetP4Action *xa = cfg_actions[aidx];
-    struct snp4_info_action * action = &actions[aidx];
+    snp4_info_off_t action_off = actions_off + aidx * sizeof(struct snp4_info_action);
 
-    action->name = xa->NameStringPtr;
+    snp4_info_off_t name = snp4_info_build_string(b, xa->NameStringPtr);
+    if (name == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+    SNP4_INFO_BUILD_AT(b, struct snp4_info_action, action_off)->name = name;
 
-    rc = snp4_info_get_params(action->params,
-			      ARRAY_SIZE(action->params),
-			      &action->num_params,
-			      &action->param_bits,
-			      xa->ParamListPtr,
-			      xa->ParamListSize);
+    rc = snp4_info_get_params(b, action_off, xa->ParamListPtr, xa->ParamListSize);
     if (rc != SNP4_STATUS_OK) {
       return rc;
     }
@@ -191,35 +211,47 @@ static enum snp4_status snp4_info_get_actions(struct snp4_info_action * actions,
   return SNP4_STATUS_OK;
 }
 
-static enum snp4_status snp4_info_get_matches(struct snp4_info_match * matches, uint16_t max_matches, uint16_t * num_matches, bool * priority_required, XilVitisNetP4CamConfig *cfg_cam) {
+static enum snp4_status snp4_info_get_matches(struct snp4_info_builder * b, snp4_info_off_t table_off, XilVitisNetP4CamConfig *cfg_cam) {
+  unsigned int num_matches;
 
   // Pass 1:
   //   Parse this table's FormatString once to determine the number of match fields only
   if (cfg_cam->FormatStringPtr[0] == '\0') {
     // Empty format string means no fields
-    *num_matches = 0;
+    num_matches = 0;
   } else {
     // We have at least 1 match field
-    *num_matches = 1;
+    num_matches = 1;
     // Now add 1 for every field separator
     for (unsigned int i = 0; cfg_cam->FormatStringPtr[i]; i++) {
       if (cfg_cam->FormatStringPtr[i] == ':') {
-	(*num_matches)++;
+	num_matches++;
       }
     }
   }
 
-  if (*num_matches > max_matches) {
+  if (num_matches > UINT16_MAX) {
     return SNP4_STATUS_INFO_TOO_MANY_MATCHES;
   }
 
+  snp4_info_off_t matches_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_match, num_matches);
+  if (matches_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  // No more items are appended below, so the table and its matches stay in place.
+  struct snp4_info_table * table = SNP4_INFO_BUILD_AT(b, struct snp4_info_table, table_off);
+  struct snp4_info_match * matches = SNP4_INFO_BUILD_AT(b, struct snp4_info_match, matches_off);
+  table->matches = matches_off;
+  table->num_matches = num_matches;
+
   // Pass 2:
   //   Record the field format and size for each field spec in the FormatString
   char *table_fmt = strdup(cfg_cam->FormatStringPtr);
   char *table_fmt_cursor = table_fmt;
 
   // Assume no priority field is required
-  *priority_required = false;
+  table->priority_required = false;
 
   // NOTE: The HW format string describes the fields of the key from lsbs up to msbs.
   //       The p4 table definitions (which the user sees) describe the fields from msbs down to lsbs.
@@ -227,8 +259,8 @@ static enum snp4_status snp4_info_get_matches(struct snp4_info_match * matches,
   //       since that is most natural to the user *and* the code in snp4_table.c that packs the matches
   //       also wants to pack the fields from the user from msbs down to lsbs.  Pack the matches[] array
   //       in reverse order relative to the HW format string.
-  for (unsigned int i = 0; i < *num_matches; i++) {
-    struct snp4_info_match * match = &matches[*num_matches - 1 - i];
+  for (unsigned int i = 0; i < num_matches; i++) {
+    struct snp4_info_match * match = &matches[num_matches - 1 - i];
 
     char * field_fmt = strsep(&table_fmt_cursor, ":");
     if (field_fmt == NULL) {
@@ -262,17 +294,17 @@ static enum snp4_status snp4_info_get_matches(struct snp4_info_match * matches,
     case 'p':
       // Prefix Field Type
       match->type = SNP4_INFO_MATCH_TYPE_PREFIX;
-      *priority_required = true;
+      table->priority_required = true;
       break;
     case 'r':
       // Range Field Type
       match->type = SNP4_INFO_MATCH_TYPE_RANGE;
-      *priority_required = true;
+      table->priority_required = true;
       break;
     case 't':
       // Ternary Field Type
       match->type = SNP4_INFO_MATCH_TYPE_TERNARY;
-      *priority_required = true;
+      table->priority_required = true;
       break;
     case 'u':
       // Unused Field Type
@@ -289,20 +321,35 @@ static enum snp4_status snp4_info_get_matches(struct snp4_info_match * matches,
   return SNP4_STATUS_OK;
 }
 
-static enum snp4_status snp4_info_get_tables(struct snp4_info_table * tables, uint16_t max_tables, uint16_t * num_tables, XilVitisNetP4TargetTableConfig * cfg_tables[], unsigned int size) {
+static enum snp4_status snp4_info_get_tables(struct snp4_info_builder * b, XilVitisNetP4TargetTableConfig * cfg_tables[], unsigned int size) {
   enum snp4_status rc;
 
-  // Make sure our info struct will hold all of this pipeline's tables
-  if (size > max_tables) {
+  if (size > UINT16_MAX) {
     return SNP4_STATUS_INFO_TOO_MANY_TABLES;
   }
-  *num_tables = size;
+
+  // Lay out all of the tables back to back ahead of their matches and actions so that walking
+  // the tables of the pipeline stays within a single array.
+  snp4_info_off_t tables_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_table, size);
+  if (tables_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  struct snp4_info_pipeline * pipeline = SNP4_INFO_BUILD_AT(b, struct snp4_info_pipeline, 0);
+  pipeline->tables = tables_off;
+  pipeline->num_tables = size;
 
   for (unsigned int tidx = 0; tidx < size; tidx++) {
     XilVitisNetP4TargetTableConfig *xt = cfg_tables[tidx];
-    struct snp4_info_table * table = &tables[tidx];
+    snp4_info_off_t table_off = tables_off + tidx * sizeof(struct snp4_info_table);
+
+    snp4_info_off_t name = snp4_info_build_string(b, xt->NameStringPtr);
+    if (name == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
 
-    table->name = xt->NameStringPtr;
+    struct snp4_info_table * table = SNP4_INFO_BUILD_AT(b, struct snp4_info_table, table_off);
+    table->name = name;
     table->num_entries = xt->Config.CamConfig.NumEntries;
 
     switch (xt->Config.Endian) {
@@ -352,20 +399,12 @@ static enum snp4_status snp4_info_get_tables(struct snp4_info_table * tables, ui
     table->priority_bits = xt->Config.CamConfig.PrioritySizeBits;
     table->actionid_bits = xt->Config.ActionIdWidthBits;
 
-    rc = snp4_info_get_matches(table->matches,
-			       ARRAY_SIZE(table->matches),
-			       &table->num_matches,
-			       &table->priority_required,
-			       &xt->Config.CamConfig);
+    rc = snp4_info_get_matches(b, table_off, &xt->Config.CamConfig);
     if (rc != SNP4_STATUS_OK) {
       return rc;
     }
 
-    rc = snp4_info_get_actions(table->actions,
-			       ARRAY_SIZE(table->actions),
-			       &table->num_actions,
-			       xt->Config.ActionListPtr,
-			       xt->Config.ActionListSize);
+    rc = snp4_info_get_actions(b, table_off, xt->Config.ActionListPtr, xt->Config.ActionListSize);
     if (rc != SNP4_STATUS_OK) {
       return rc;
     }
@@ -374,23 +413,69 @@ static enum snp4_status snp4_info_get_tables(struct snp4_info_table * tables, ui
   return SNP4_STATUS_OK;
 }
 
-static enum snp4_status snp4_info_get_counter_blocks(struct snp4_info_counter_block * counter_blocks,
-                                                     uint16_t max_counter_blocks,
-                                                     uint16_t * num_counter_blocks,
+static enum snp4_status snp4_info_get_counter_block_aliases(struct snp4_info_builder * b,
+                                                            snp4_info_off_t block_off,
+                                                            const char * const * aliases,
+                                                            size_t num_aliases) {
+  if (num_aliases > UINT32_MAX) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  snp4_info_off_t aliases_off = SNP4_INFO_BUILD_ARRAY(b, snp4_info_off_t, num_aliases);
+  if (aliases_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  for (size_t idx = 0; idx < num_aliases; idx++) {
+    // Counters without an alias are left with a zero (absent) name.
+    if (aliases[idx] == NULL) {
+      continue;
+    }
+
+    snp4_info_off_t name = snp4_info_build_string(b, aliases[idx]);
+    if (name == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+    SNP4_INFO_BUILD_AT(b, snp4_info_off_t, aliases_off)[idx] = name;
+  }
+
+  struct snp4_info_counter_block * block = SNP4_INFO_BUILD_AT(b, struct snp4_info_counter_block, block_off);
+  block->aliases = aliases_off;
+  block->num_aliases = num_aliases;
+
+  return SNP4_STATUS_OK;
+}
+
+static enum snp4_status snp4_info_get_counter_blocks(struct snp4_info_builder * b,
                                                      XilVitisNetP4TargetCounterConfig * cfg_counters[],
                                                      unsigned int size,
                                                      const struct vitis_net_p4_drv_metadata * metadata) {
-  // Make sure our info struct will hold all of this pipeline's counter blocks
-  if (size > max_counter_blocks) {
+  enum snp4_status rc;
+
+  if (size > UINT16_MAX) {
     return SNP4_STATUS_INFO_TOO_MANY_COUNTER_BLOCKS;
   }
-  *num_counter_blocks = size;
+
+  snp4_info_off_t blocks_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_counter_block, size);
+  if (blocks_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  struct snp4_info_pipeline * pipeline = SNP4_INFO_BUILD_AT(b, struct snp4_info_pipeline, 0);
+  pipeline->counter_blocks = blocks_off;
+  pipeline->num_counter_blocks = size;
 
   for (unsigned int idx = 0; idx < size; idx++) {
     XilVitisNetP4TargetCounterConfig *xc = cfg_counters[idx];
-    struct snp4_info_counter_block * block = &counter_blocks[idx];
+    snp4_info_off_t block_off = blocks_off + idx * sizeof(struct snp4_info_counter_block);
 
-    block->name = xc->NameStringPtr;
+    snp4_info_off_t name = snp4_info_build_string(b, xc->NameStringPtr);
+    if (name == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+
+    struct snp4_info_counter_block * block = SNP4_INFO_BUILD_AT(b, struct snp4_info_counter_block, block_off);
+    block->name = name;
     block->width = xc->Config.Width;
     block->num_counters = xc->Config.NumCounters;
 
@@ -413,11 +498,15 @@ static enum snp4_status snp4_info_get_counter_blocks(struct snp4_info_counter_bl
     }
 
     if (metadata != NULL) {
-      for (unsigned int b = 0; b < metadata->num_counter_blocks; ++b) {
-        const struct vitis_net_p4_drv_metadata_counter_block * mcb = metadata->counter_blocks[b];
-        if (strcmp(block->name, mcb->name) == 0) {
-          block->aliases = mcb->aliases;
-          block->num_aliases = mcb->num_aliases;
+      for (unsigned int b_idx = 0; b_idx < metadata->num_counter_blocks; ++b_idx) {
+        const struct vitis_net_p4_drv_metadata_counter_block * mcb = metadata->counter_blocks[b_idx];
+        if (strcmp(xc->NameStringPtr, mcb->name) == 0) {
+          if (mcb->aliases != NULL) {
+            rc = snp4_info_get_counter_block_aliases(b, block_off, mcb->aliases, mcb->num_aliases);
+            if (rc != SNP4_STATUS_OK) {
+              return rc;
+            }
+          }
           break;
         }
       }
@@ -427,31 +516,42 @@ static enum snp4_status snp4_info_get_counter_blocks(struct snp4_info_counter_bl
   return SNP4_STATUS_OK;
 }
 
-enum snp4_status snp4_info_get_pipeline(unsigned int sdnet_idx, struct snp4_info_pipeline * pipeline)
+enum snp4_status snp4_info_get_pipeline(unsigned int sdnet_idx, struct snp4_info_pipeline ** pipeline)
 {
   const struct vitis_net_p4_drv_intf *intf = vitis_net_p4_drv_intf_get(sdnet_idx);
   if (intf == NULL) {
     return SNP4_STATUS_NULL_PIPELINE;
   }
 
-  pipeline->name = intf->info.name;
-
   struct XilVitisNetP4TargetConfig *cfg = intf->target.config;
 
-  enum snp4_status rc;
-  rc = snp4_info_get_tables(pipeline->tables,
-                            ARRAY_SIZE(pipeline->tables),
-                            &pipeline->num_tables,
-                            cfg->TableListPtr,
-                            cfg->TableListSize);
+  struct snp4_info_builder b;
+  enum snp4_status rc = snp4_info_build_begin(&b);
   if (rc != SNP4_STATUS_OK) {
-      return rc;
+    return rc;
+  }
+
+  snp4_info_off_t name = snp4_info_build_string(&b, intf->info.name);
+  if (name == 0) {
+    rc = SNP4_STATUS_MALLOC_FAIL;
+    goto out_abort;
+  }
+  SNP4_INFO_BUILD_AT(&b, struct snp4_info_pipeline, 0)->name = name;
+
+  rc = snp4_info_get_tables(&b, cfg->TableListPtr, cfg->TableListSize);
+  if (rc != SNP4_STATUS_OK) {
+    goto out_abort;
+  }
+
+  rc = snp4_info_get_counter_blocks(&b, cfg->CounterListPtr, cfg->CounterListSize, intf->info.metadata);
+  if (rc != SNP4_STATUS_OK) {
+    goto out_abort;
   }
 
-  return snp4_info_get_counter_blocks(pipeline->counter_blocks,
-                                      ARRAY_SIZE(pipeline->counter_blocks),
-                                      &pipeline->num_counter_blocks,
-                                      cfg->CounterListPtr,
-                                      cfg->CounterListSize,
-                                      intf->info.metadata);
+  *pipeline = snp4_info_build_finish(&b);
+  return SNP4_STATUS_OK;
+
+ out_abort:
+  snp4_info_build_abort(&b);
+  return rc;
 }
@@ -1,13 +1,55 @@
-#include <string.h>		/* strcmp */
+#include <stdint.h>		/* uint16_t */
+#include <string.h>		/* memcpy */
 #include "snp4.h"		/* snp4_info_* */
+#include "snp4_info_build.h"	/* snp4_info_build_* */
 #include "unused.h"		/* UNUSED */
 
 /*
  * This file provides a mock for describing the valid table and action configuration
- * for a fixed, test pipeline.
+ * for a fixed, test pipeline.  The mock is written out with fixed arrays for readability
+ * and laid out into the compact pipeline info on each call to snp4_info_get_pipeline().
  */
 
-static struct snp4_info_pipeline snp4_info_pipeline = {
+#define UT_MAX_PIPELINE_TABLES 8
+#define UT_MAX_TABLE_MATCHES 8
+#define UT_MAX_TABLE_ACTIONS 8
+#define UT_MAX_ACTION_PARAMS 8
+
+struct ut_info_param {
+  const char * name;
+  uint16_t bits;
+};
+
+struct ut_info_action {
+  const char * name;
+  uint16_t param_bits;
+  struct ut_info_param params[UT_MAX_ACTION_PARAMS];
+  uint16_t num_params;
+};
+
+struct ut_info_table {
+  const char * name;
+  enum snp4_info_table_endian endian;
+
+  uint16_t key_bits;
+  struct snp4_info_match matches[UT_MAX_TABLE_MATCHES];
+  uint16_t num_matches;
+
+  uint16_t response_bits;
+  uint16_t actionid_bits;
+  struct ut_info_action actions[UT_MAX_TABLE_ACTIONS];
+  uint16_t num_actions;
+
+  bool priority_required;
+  uint16_t priority_bits;
+};
+
+struct ut_info_pipeline {
+  struct ut_info_table tables[UT_MAX_PIPELINE_TABLES];
+  uint16_t num_tables;
+};
+
+static const struct ut_info_pipeline ut_info_pipeline = {
   .tables = {
     {
       .name = "t_p128",
@@ -204,9 +246,103 @@ static struct snp4_info_pipeline snp4_info_pipeline = {
   .num_tables = 7,
 };
 
-extern enum snp4_status snp4_info_get_pipeline(unsigned int UNUSED(sdnet_idx), struct snp4_info_pipeline * pipeline)
+static enum snp4_status ut_info_build_action(struct snp4_info_builder * b, snp4_info_off_t action_off, const struct ut_info_action * ua)
 {
-  memcpy(pipeline, &snp4_info_pipeline, sizeof(*pipeline));
+  snp4_info_off_t name = snp4_info_build_string(b, ua->name);
+  snp4_info_off_t params_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_param, ua->num_params);
+  if (name == 0 || params_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  for (unsigned int pidx = 0; pidx < ua->num_params; pidx++) {
+    snp4_info_off_t pname = snp4_info_build_string(b, ua->params[pidx].name);
+    if (pname == 0) {
+      return SNP4_STATUS_MALLOC_FAIL;
+    }
+
+    struct snp4_info_param * param = &SNP4_INFO_BUILD_AT(b, struct snp4_info_param, params_off)[pidx];
+    param->name = pname;
+    param->bits = ua->params[pidx].bits;
+  }
+
+  struct snp4_info_action * action = SNP4_INFO_BUILD_AT(b, struct snp4_info_action, action_off);
+  action->name = name;
+  action->param_bits = ua->param_bits;
+  action->num_params = ua->num_params;
+  action->params = params_off;
 
   return SNP4_STATUS_OK;
 }
+
+static enum snp4_status ut_info_build_table(struct snp4_info_builder * b, snp4_info_off_t table_off, const struct ut_info_table * ut)
+{
+  enum snp4_status rc;
+
+  snp4_info_off_t name = snp4_info_build_string(b, ut->name);
+  snp4_info_off_t matches_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_match, ut->num_matches);
+  snp4_info_off_t actions_off = SNP4_INFO_BUILD_ARRAY(b, struct snp4_info_action, ut->num_actions);
+  if (name == 0 || matches_off == 0 || actions_off == 0) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  memcpy(SNP4_INFO_BUILD_AT(b, struct snp4_info_match, matches_off), ut->matches,
+	 sizeof(struct snp4_info_match) * ut->num_matches);
+
+  struct snp4_info_table * table = SNP4_INFO_BUILD_AT(b, struct snp4_info_table, table_off);
+  table->name = name;
+  table->endian = ut->endian;
+  table->key_bits = ut->key_bits;
+  table->num_matches = ut->num_matches;
+  table->matches = matches_off;
+  table->response_bits = ut->response_bits;
+  table->actionid_bits = ut->actionid_bits;
+  table->num_actions = ut->num_actions;
+  table->actions = actions_off;
+  table->priority_required = ut->priority_required;
+  table->priority_bits = ut->priority_bits;
+
+  for (unsigned int aidx = 0; aidx < ut->num_actions; aidx++) {
+    rc = ut_info_build_action(b, actions_off + aidx * sizeof(struct snp4_info_action), &ut->actions[aidx]);
+    if (rc != SNP4_STATUS_OK) {
+      return rc;
+    }
+  }
+
+  return SNP4_STATUS_OK;
+}
+
+extern enum snp4_status snp4_info_get_pipeline(unsigned int UNUSED(sdnet_idx), struct snp4_info_pipeline ** pipeline)
+{
+  struct snp4_info_builder b;
+  enum snp4_status rc = snp4_info_build_begin(&b);
+  if (rc != SNP4_STATUS_OK) {
+    return rc;
+  }
+
+  snp4_info_off_t tables_off = SNP4_INFO_BUILD_ARRAY(&b, struct snp4_info_table, ut_info_pipeline.num_tables);
+  snp4_info_off_t blocks_off = SNP4_INFO_BUILD_ARRAY(&b, struct snp4_info_counter_block, 0);
+  if (tables_off == 0 || blocks_off == 0) {
+    rc = SNP4_STATUS_MALLOC_FAIL;
+    goto out_abort;
+  }
+
+  struct snp4_info_pipeline * pi = SNP4_INFO_BUILD_AT(&b, struct snp4_info_pipeline, 0);
+  pi->num_tables = ut_info_pipeline.num_tables;
+  pi->tables = tables_off;
+  pi->num_counter_blocks = 0;
+  pi->counter_blocks = blocks_off;
+
+  for (unsigned int tidx = 0; tidx < ut_info_pipeline.num_tables; tidx++) {
+    rc = ut_info_build_table(&b, tables_off + tidx * sizeof(struct snp4_info_table), &ut_info_pipeline.tables[tidx]);
+    if (rc != SNP4_STATUS_OK) {
+      goto out_abort;
+    }
+  }
+
+  *pipeline = snp4_info_build_finish(&b);
+  return SNP4_STATUS_OK;
+
+ out_abort:
+  snp4_info_build_abort(&b);
+  return rc;
+}
@@ -1,5 +1,7 @@
-#include <string.h>		/* strcmp */
+#include <stdlib.h>		/* calloc, free, realloc */
+#include <string.h>		/* memcpy, memset, strcmp, strlen */
 #include "snp4.h"		/* API, snp4_info_* */
+#include "snp4_info_build.h"	/* snp4_info_build_* */
 
 /*
  * Common helper functions for processing an snp4_info_pipeline struct.  They are
@@ -17,17 +19,21 @@ const struct snp4_info_table * snp4_info_get_table_by_name(const struct snp4_inf
   }
 
   // Find the requested table
+  const struct snp4_info_table * tables = snp4_info_tables(pipeline);
   for (unsigned int i = 0; i < pipeline->num_tables; i++) {
-    const struct snp4_info_table *info_table = &pipeline->tables[i];
-    if (strcmp(info_table->name, table_name) == 0) {
+    const struct snp4_info_table *info_table = &tables[i];
+    if (strcmp(snp4_info_name(pipeline, info_table->name), table_name) == 0) {
       return info_table;
     }
   }
   return NULL;
 }
 
-const struct snp4_info_action * snp4_info_get_action_by_name(const struct snp4_info_table * table, const char * action_name)
+const struct snp4_info_action * snp4_info_get_action_by_name(const struct snp4_info_pipeline * pipeline, const struct snp4_info_table * table, const char * action_name)
 {
+  if (!pipeline) {
+    return NULL;
+  }
   if (!table) {
     return NULL;
   }
@@ -36,12 +42,101 @@ const struct snp4_info_action * snp4_info_get_action_by_name(const struct snp4_i
   }
 
   // Find the requested action
+  const struct snp4_info_action * actions = snp4_info_table_actions(pipeline, table);
   for (unsigned int i = 0; i < table->num_actions; i++) {
-    const struct snp4_info_action *info_action = &table->actions[i];
-    if (strcmp(info_action->name, action_name) == 0) {
+    const struct snp4_info_action *info_action = &actions[i];
+    if (strcmp(snp4_info_name(pipeline, info_action->name), action_name) == 0) {
       return info_action;
     }
   }
   return NULL;
 }
 
+
+void snp4_info_free_pipeline(struct snp4_info_pipeline * pipeline)
+{
+  free(pipeline);
+}
+
+enum snp4_status snp4_info_build_begin(struct snp4_info_builder * b)
+{
+  // The pipeline header always comes first so that no other item is ever found at offset 0.
+  b->cap = 4096;
+  b->len = sizeof(struct snp4_info_pipeline);
+  b->buf = calloc(1, b->cap);
+  if (b->buf == NULL) {
+    return SNP4_STATUS_MALLOC_FAIL;
+  }
+
+  return SNP4_STATUS_OK;
+}
+
+snp4_info_off_t snp4_info_build_alloc(struct snp4_info_builder * b, size_t size, size_t align)
+{
+  size_t off = (b->len + align - 1) & ~(align - 1);
+  if (off + size > UINT32_MAX) {
+    return 0;
+  }
+
+  if (off + size > b->cap) {
+    size_t cap = b->cap;
+    while (cap < off + size) {
+      cap *= 2;
+    }
+
+    char * buf = realloc(b->buf, cap);
+    if (buf == NULL) {
+      return 0;
+    }
+    b->buf = buf;
+    b->cap = cap;
+  }
+
+  // Zero the padding along with the item so that the layout is fully initialized.
+  memset(&b->buf[b->len], 0, off + size - b->len);
+  b->len = off + size;
+
+  return off;
+}
+
+snp4_info_off_t snp4_info_build_string(struct snp4_info_builder * b, const char * str)
+{
+  size_t size = strlen(str) + 1;
+  snp4_info_off_t off = snp4_info_build_alloc(b, size, 1);
+  if (off != 0) {
+    memcpy(&b->buf[off], str, size);
+  }
+
+  return off;
+}
+
+void * snp4_info_build_at(struct snp4_info_builder * b, snp4_info_off_t off)
+{
+  return &b->buf[off];
+}
+
+struct snp4_info_pipeline * snp4_info_build_finish(struct snp4_info_builder * b)
+{
+  // Trim the buffer to the final layout now that nothing more will be appended.
+  char * buf = realloc(b->buf, b->len);
+  if (buf == NULL) {
+    buf = b->buf;
+  }
+
+  struct snp4_info_pipeline * pipeline = (struct snp4_info_pipeline *)buf;
+  pipeline->size = b->len;
+
+  b->buf = NULL;
+  b->len = 0;
+  b->cap = 0;
+
+  return pipeline;
+}
+
+void snp4_info_build_abort(struct snp4_info_builder * b)
+{
+  free(b->buf);
+  b->buf = NULL;
+  b->len = 0;
+  b->cap = 0;
+}
@@ -0,0 +1,239 @@
+#include <stdlib.h>		/* calloc, free, malloc, realloc */
+#include <string.h>		/* memcpy, memset */
+#include "snp4_shadow.h"	/* API */
+
+#define SNP4_SHADOW_MIN_SLOTS 16
+
+static uint8_t shadow_key_byte(const struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask, size_t i)
+{
+  return shadow->mask_len > 0 ? key[i] & mask[i] : key[i];
+}
+
+// FNV-1a over the key (with bits outside the mask cleared) and the mask
+static uint32_t shadow_hash(const struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask)
+{
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < shadow->key_len; ++i) {
+    hash = (hash ^ shadow_key_byte(shadow, key, mask, i)) * 16777619u;
+  }
+  for (size_t i = 0; i < shadow->mask_len; ++i) {
+    hash = (hash ^ mask[i]) * 16777619u;
+  }
+
+  return hash;
+}
+
+static bool shadow_entry_matches(const struct snp4_shadow * shadow, const struct snp4_shadow_entry * entry, uint32_t hash, const uint8_t * key, const uint8_t * mask)
+{
+  if (entry->hash != hash) {
+    return false;
+  }
+
+  for (size_t i = 0; i < shadow->key_len; ++i) {
+    if (entry->key[i] != shadow_key_byte(shadow, key, mask, i)) {
+      return false;
+    }
+  }
+
+  return shadow->mask_len == 0 || memcmp(&entry->key[shadow->key_len], mask, shadow->mask_len) == 0;
+}
+
+// Returns the slot holding the matching entry, or the free slot which ends its probe sequence
+static size_t shadow_probe(const struct snp4_shadow * shadow, uint32_t hash, const uint8_t * key, const uint8_t * mask)
+{
+  size_t slot_mask = shadow->num_slots - 1;
+
+  for (size_t s = hash & slot_mask; ; s = (s + 1) & slot_mask) {
+    uint32_t idx = shadow->slots[s];
+    if (idx == 0 || shadow_entry_matches(shadow, &shadow->entries[idx - 1], hash, key, mask)) {
+      return s;
+    }
+  }
+}
+
+static size_t shadow_slot_of_index(const struct snp4_shadow * shadow, size_t idx)
+{
+  size_t slot_mask = shadow->num_slots - 1;
+
+  for (size_t s = shadow->entries[idx].hash & slot_mask; ; s = (s + 1) & slot_mask) {
+    if (shadow->slots[s] == idx + 1) {
+      return s;
+    }
+  }
+}
+
+static bool shadow_grow(struct snp4_shadow * shadow)
+{
+  // Keep the hash at most half full to bound the length of the probe sequences
+  if ((shadow->num_entries + 1) * 2 > shadow->num_slots) {
+    size_t num_slots = shadow->num_slots * 2;
+    uint32_t * slots = calloc(num_slots, sizeof(*slots));
+    if (slots == NULL) {
+      return false;
+    }
+
+    free(shadow->slots);
+    shadow->slots = slots;
+    shadow->num_slots = num_slots;
+    for (size_t idx = 0; idx < shadow->num_entries; ++idx) {
+      size_t s = shadow->entries[idx].hash & (num_slots - 1);
+      while (slots[s] != 0) {
+	s = (s + 1) & (num_slots - 1);
+      }
+      slots[s] = idx + 1;
+    }
+  }
+
+  if (shadow->num_entries == shadow->max_entries) {
+    size_t max_entries = shadow->max_entries * 2;
+    struct snp4_shadow_entry * entries = realloc(shadow->entries, max_entries * sizeof(*entries));
+    if (entries == NULL) {
+      return false;
+    }
+
+    shadow->entries = entries;
+    shadow->max_entries = max_entries;
+  }
+
+  return true;
+}
+
+static bool shadow_entry_set(const struct snp4_shadow * shadow, struct snp4_shadow_entry * entry, uint32_t action_id, const uint8_t * params, size_t params_len)
+{
+  // The key, mask and params share a single allocation
+  uint8_t * key = realloc(entry->key, shadow->key_len + shadow->mask_len + params_len + 1);
+  if (key == NULL) {
+    return false;
+  }
+
+  entry->key = key;
+  entry->params = &key[shadow->key_len + shadow->mask_len];
+  entry->params_len = params_len;
+  if (params_len > 0) {
+    memcpy(entry->params, params, params_len);
+  }
+  entry->action_id = action_id;
+
+  return true;
+}
+
+bool snp4_shadow_init(struct snp4_shadow * shadow, size_t key_len, size_t mask_len)
+{
+  memset(shadow, 0, sizeof(*shadow));
+  shadow->key_len = key_len;
+  shadow->mask_len = mask_len;
+
+  shadow->num_slots = SNP4_SHADOW_MIN_SLOTS;
+  shadow->slots = calloc(shadow->num_slots, sizeof(*shadow->slots));
+  shadow->max_entries = SNP4_SHADOW_MIN_SLOTS / 2;
+  shadow->entries = calloc(shadow->max_entries, sizeof(*shadow->entries));
+  if (shadow->slots == NULL || shadow->entries == NULL) {
+    snp4_shadow_deinit(shadow);
+    return false;
+  }
+
+  return true;
+}
+
+void snp4_shadow_deinit(struct snp4_shadow * shadow)
+{
+  for (size_t idx = 0; idx < shadow->num_entries; ++idx) {
+    free(shadow->entries[idx].key);
+  }
+
+  free(shadow->entries);
+  free(shadow->slots);
+  memset(shadow, 0, sizeof(*shadow));
+}
+
+void snp4_shadow_clear(struct snp4_shadow * shadow)
+{
+  for (size_t idx = 0; idx < shadow->num_entries; ++idx) {
+    free(shadow->entries[idx].key);
+  }
+
+  shadow->num_entries = 0;
+  memset(shadow->slots, 0, shadow->num_slots * sizeof(*shadow->slots));
+}
+
+const struct snp4_shadow_entry * snp4_shadow_find(const struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask)
+{
+  size_t s = shadow_probe(shadow, shadow_hash(shadow, key, mask), key, mask);
+  return shadow->slots[s] != 0 ? &shadow->entries[shadow->slots[s] - 1] : NULL;
+}
+
+bool snp4_shadow_insert(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask, uint32_t action_id, const uint8_t * params, size_t params_len, uint32_t priority)
+{
+  uint32_t hash = shadow_hash(shadow, key, mask);
+  if (shadow->slots[shadow_probe(shadow, hash, key, mask)] != 0) {
+    // Already present
+    return false;
+  }
+
+  if (!shadow_grow(shadow)) {
+    return false;
+  }
+
+  struct snp4_shadow_entry * entry = &shadow->entries[shadow->num_entries];
+  memset(entry, 0, sizeof(*entry));
+  if (!shadow_entry_set(shadow, entry, action_id, params, params_len)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < shadow->key_len; ++i) {
+    entry->key[i] = shadow_key_byte(shadow, key, mask, i);
+  }
+  if (shadow->mask_len > 0) {
+    memcpy(&entry->key[shadow->key_len], mask, shadow->mask_len);
+  }
+  entry->priority = priority;
+  entry->hash = hash;
+
+  // The hash may have been resized, so probe again for the free slot
+  shadow->slots[shadow_probe(shadow, hash, key, mask)] = ++shadow->num_entries;
+
+  return true;
+}
+
+bool snp4_shadow_update(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask, uint32_t action_id, const uint8_t * params, size_t params_len)
+{
+  size_t s = shadow_probe(shadow, shadow_hash(shadow, key, mask), key, mask);
+  if (shadow->slots[s] == 0) {
+    return false;
+  }
+
+  return shadow_entry_set(shadow, &shadow->entries[shadow->slots[s] - 1], action_id, params, params_len);
+}
+
+bool snp4_shadow_remove(struct snp4_shadow * shadow, const uint8_t * key, const uint8_t * mask)
+{
+  size_t slot_mask = shadow->num_slots - 1;
+  size_t s = shadow_probe(shadow, shadow_hash(shadow, key, mask), key, mask);
+  if (shadow->slots[s] == 0) {
+    return false;
+  }
+
+  size_t idx = shadow->slots[s] - 1;
+  free(shadow->entries[idx].key);
+
+  // Close the gap left in the hash by shifting back any following entries of the probe sequence
+  // which would no longer be reachable from their home slot.
+  for (size_t next = (s + 1) & slot_mask; shadow->slots[next] != 0; next = (next + 1) & slot_mask) {
+    size_t home = shadow->entries[shadow->slots[next] - 1].hash & slot_mask;
+    if (((next - home) & slot_mask) >= ((next - s) & slot_mask)) {
+      shadow->slots[s] = shadow->slots[next];
+      s = next;
+    }
+  }
+  shadow->slots[s] = 0;
+
+  // Keep the entries dense by moving the last one into the hole
+  size_t last = --shadow->num_entries;
+  if (idx != last) {
+    shadow->slots[shadow_slot_of_index(shadow, last)] = idx + 1;
+    shadow->entries[idx] = shadow->entries[last];
+  }
+
+  return true;
+}
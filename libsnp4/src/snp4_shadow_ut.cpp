@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+#include <map>
+#include <random>
+#include <string.h>
+#include <utility>
+
+extern "C" {
+#include "snp4_shadow.h"	/* API */
+}
+
+class SNP4ShadowTest : public ::testing::Test {
+protected:
+  void TearDown() override {
+    snp4_shadow_deinit(&shadow);
+  }
+
+  struct snp4_shadow shadow;
+};
+
+TEST_F(SNP4ShadowTest, InsertFindRemove) {
+  ASSERT_TRUE(snp4_shadow_init(&shadow, 2, 0));
+
+  uint8_t key[2] = {0x12, 0x34};
+  uint8_t params[3] = {0xa, 0xb, 0xc};
+  ASSERT_EQ(nullptr, snp4_shadow_find(&shadow, key, NULL));
+  ASSERT_TRUE(snp4_shadow_insert(&shadow, key, NULL, 3, params, sizeof(params), 9));
+  ASSERT_FALSE(snp4_shadow_insert(&shadow, key, NULL, 3, params, sizeof(params), 9));
+
+  const struct snp4_shadow_entry * entry = snp4_shadow_find(&shadow, key, NULL);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(3, entry->action_id);
+  ASSERT_EQ(9, entry->priority);
+  ASSERT_EQ(sizeof(params), entry->params_len);
+  ASSERT_EQ(0, memcmp(params, entry->params, sizeof(params)));
+
+  ASSERT_TRUE(snp4_shadow_update(&shadow, key, NULL, 1, NULL, 0));
+  entry = snp4_shadow_find(&shadow, key, NULL);
+  ASSERT_EQ(1, entry->action_id);
+  ASSERT_EQ(0, entry->params_len);
+
+  ASSERT_TRUE(snp4_shadow_remove(&shadow, key, NULL));
+  ASSERT_FALSE(snp4_shadow_remove(&shadow, key, NULL));
+  ASSERT_FALSE(snp4_shadow_update(&shadow, key, NULL, 1, NULL, 0));
+  ASSERT_EQ(0, shadow.num_entries);
+}
+
+TEST_F(SNP4ShadowTest, MaskedKeyIgnoresBitsOutsideMask) {
+  ASSERT_TRUE(snp4_shadow_init(&shadow, 1, 1));
+
+  uint8_t key = 0x5a;
+  uint8_t mask = 0xf0;
+  ASSERT_TRUE(snp4_shadow_insert(&shadow, &key, &mask, 0, NULL, 0, 0));
+
+  uint8_t other_key = 0x53;
+  const struct snp4_shadow_entry * entry = snp4_shadow_find(&shadow, &other_key, &mask);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(0x50, entry->key[0]);
+  ASSERT_EQ(0xf0, entry->key[1]);
+
+  uint8_t other_mask = 0xff;
+  ASSERT_EQ(nullptr, snp4_shadow_find(&shadow, &key, &other_mask));
+  ASSERT_TRUE(snp4_shadow_insert(&shadow, &key, &other_mask, 0, NULL, 0, 0));
+  ASSERT_EQ(2, shadow.num_entries);
+}
+
+TEST_F(SNP4ShadowTest, RandomOperationsMatchReference) {
+  ASSERT_TRUE(snp4_shadow_init(&shadow, 2, 0));
+
+  // Small key space so that inserts, updates and removals frequently collide
+  std::map<uint16_t, std::pair<uint32_t, uint8_t>> ref;
+  std::mt19937 rng(49);
+  for (unsigned int iter = 0; iter < 200000; iter++) {
+    uint16_t k = rng() % 4096;
+    uint8_t key[2] = {uint8_t(k >> 8), uint8_t(k)};
+    uint32_t action_id = rng() % 4;
+    uint8_t param = rng();
+    bool present = ref.count(k) != 0;
+
+    switch (rng() % 3) {
+    case 0:
+      ASSERT_EQ(!present, snp4_shadow_insert(&shadow, key, NULL, action_id, &param, 1, 0));
+      if (!present) {
+	ref[k] = {action_id, param};
+      }
+      break;
+    case 1:
+      ASSERT_EQ(present, snp4_shadow_update(&shadow, key, NULL, action_id, &param, 1));
+      if (present) {
+	ref[k] = {action_id, param};
+      }
+      break;
+    default:
+      ASSERT_EQ(present, snp4_shadow_remove(&shadow, key, NULL));
+      ref.erase(k);
+      break;
+    }
+    ASSERT_EQ(ref.size(), shadow.num_entries);
+  }
+
+  for (unsigned int k = 0; k < 4096; k++) {
+    uint8_t key[2] = {uint8_t(k >> 8), uint8_t(k)};
+    const struct snp4_shadow_entry * entry = snp4_shadow_find(&shadow, key, NULL);
+    auto it = ref.find(k);
+    if (it == ref.end()) {
+      ASSERT_EQ(nullptr, entry);
+    } else {
+      ASSERT_NE(nullptr, entry);
+      ASSERT_EQ(it->second.first, entry->action_id);
+      ASSERT_EQ(it->second.second, entry->params[0]);
+    }
+  }
+
+  snp4_shadow_clear(&shadow);
+  ASSERT_EQ(0, shadow.num_entries);
+  uint8_t key[2] = {0, 1};
+  ASSERT_EQ(nullptr, snp4_shadow_find(&shadow, key, NULL));
+}
@@ -6,6 +6,7 @@
 
 #include "array_size.h"
 #include "snp4.h"		/* API */
+#include "snp4_table_pack.h"	/* snp4_rule_pack_*_mpz */
 
 static enum snp4_status pack_partial_key_mask(mpz_t *key_part, mpz_t *mask_part, const struct sn_match *match, const struct snp4_info_match *match_info_spec) {
   enum snp4_status rc;
@@ -195,7 +196,7 @@ static enum snp4_status pack_partial_key_mask(mpz_t *key_part, mpz_t *mask_part,
   return rc;
 }
 
-enum snp4_status snp4_rule_pack_matches(const struct snp4_info_match match_info_specs[], unsigned int key_size_bits, const struct sn_match matches[], size_t num_matches, struct sn_pack * pack)
+enum snp4_status snp4_rule_pack_matches_mpz(const struct snp4_info_match match_info_specs[], unsigned int key_size_bits, const struct sn_match matches[], size_t num_matches, struct sn_pack * pack)
 {
   enum snp4_status rc;
 
@@ -290,10 +291,10 @@ static enum snp4_status pack_partial_param(mpz_t *param_part, const struct sn_pa
   // Fill in the param based on the information provided by the user
   switch (param->t) {
   case SN_PARAM_FORMAT_UI:
-    mpz_init_set_ui(*param_part, param->v.ui);
+    mpz_set_ui(*param_part, param->v.ui);
     break;
   case SN_PARAM_FORMAT_MPZ:
-    mpz_init_set(*param_part, param->v.mpz);
+    mpz_set(*param_part, param->v.mpz);
     break;
   default:
     return SNP4_STATUS_PARAM_INVALID_FORMAT;
@@ -308,7 +309,7 @@ static enum snp4_status pack_partial_param(mpz_t *param_part, const struct sn_pa
   return SNP4_STATUS_OK;
 }
 
-enum snp4_status snp4_rule_pack_params(const struct snp4_info_param param_info_specs[], unsigned int table_param_size_bits, unsigned int action_param_size_bits, const struct sn_param params[], size_t num_params, struct sn_pack * pack) {
+enum snp4_status snp4_rule_pack_params_mpz(const struct snp4_info_param param_info_specs[], unsigned int table_param_size_bits, unsigned int action_param_size_bits, const struct sn_param params[], size_t num_params, struct sn_pack * pack) {
   enum snp4_status rc;
   
   // Check if we even require parameters for this action
@@ -375,6 +376,329 @@ enum snp4_status snp4_rule_pack_params(const struct snp4_info_param param_info_s
   return rc;
 }
 
+/*
+ * Fixed-width packing for rules whose fields add up to no more than 128 bits, which covers nearly
+ * all tables.  This mirrors the multi-precision packing above check for check and produces the
+ * same key, mask and params bytes, without allocating and operating on mpz_t values per field.
+ * Rules which hold values that don't fit (or are negative) are left to the multi-precision path.
+ */
+typedef unsigned __int128 u128_t;
+#define U128_BITS 128
+
+static inline u128_t u128_ones(unsigned int bits)
+{
+  return bits >= U128_BITS ? ~(u128_t)0 : (((u128_t)1 << bits) - 1);
+}
+
+static inline u128_t u128_shl(u128_t v, unsigned int bits)
+{
+  return bits >= U128_BITS ? 0 : v << bits;
+}
+
+static inline unsigned int u128_ctz(u128_t v)
+{
+  uint64_t lo = (uint64_t)v;
+  return lo != 0 ? (unsigned int)__builtin_ctzll(lo) : 64 + (unsigned int)__builtin_ctzll((uint64_t)(v >> 64));
+}
+
+// Equivalent to mpz_sizeinbase(v, 2) > bits, which counts a zero value as one bit wide
+static inline bool u128_wider_than(u128_t v, unsigned int bits)
+{
+  return bits == 0 || (bits < U128_BITS && (v >> bits) != 0);
+}
+
+static bool u128_from_mpz(u128_t *v, const mpz_t z)
+{
+  if (mpz_sgn(z) < 0 || mpz_sizeinbase(z, 2) > U128_BITS) {
+    return false;
+  }
+
+  *v = 0;
+  for (size_t i = mpz_size(z); i > 0; i--) {
+    *v = u128_shl(*v, GMP_NUMB_BITS) | mpz_getlimbn(z, i - 1);
+  }
+  return true;
+}
+
+// Store big-endian into the lsbs of a zeroed buffer, as done by mpz_export() after the pad bytes
+static void u128_export(uint8_t *buf, size_t len, u128_t v)
+{
+  for (size_t i = len; i > 0 && v != 0; i--) {
+    buf[i - 1] = (uint8_t)v;
+    v >>= 8;
+  }
+}
+
+static bool pack_partial_key_mask_u128(u128_t *key_part, u128_t *mask_part, const struct sn_match *match, const struct snp4_info_match *match_info_spec, enum snp4_status *rc)
+{
+  const unsigned int bits = match_info_spec->bits;
+  const u128_t ones_mask = u128_ones(bits);
+  u128_t mask_default;
+  bool has_mask;
+
+  switch (match->t) {
+  case SN_MATCH_FORMAT_KEY_MASK:
+    if (!u128_from_mpz(key_part, match->v.key_mask.key) ||
+	!u128_from_mpz(mask_part, match->v.key_mask.mask)) {
+      return false;
+    }
+    has_mask = true;
+    break;
+  case SN_MATCH_FORMAT_KEY_ONLY:
+    if (!u128_from_mpz(key_part, match->v.key_only.key)) {
+      return false;
+    }
+    has_mask = false;
+    break;
+  case SN_MATCH_FORMAT_PREFIX:
+    if (!u128_from_mpz(key_part, match->v.prefix.key)) {
+      return false;
+    }
+    if (match->v.prefix.prefix_len > bits) {
+      *rc = SNP4_STATUS_MATCH_MASK_TOO_WIDE;
+      return true;
+    }
+    *mask_part = u128_shl(u128_ones(match->v.prefix.prefix_len), bits - match->v.prefix.prefix_len);
+    has_mask = true;
+    break;
+  case SN_MATCH_FORMAT_RANGE:
+    *key_part = match->v.range.lower;
+    *mask_part = match->v.range.upper;
+    has_mask = true;
+    break;
+  case SN_MATCH_FORMAT_UNUSED:
+    *key_part = 0;
+    *mask_part = 0;
+    has_mask = true;
+    break;
+  default:
+    *rc = SNP4_STATUS_MATCH_INVALID_FORMAT;
+    return true;
+  }
+
+  switch (match_info_spec->type) {
+  case SNP4_INFO_MATCH_TYPE_BITFIELD:
+  case SNP4_INFO_MATCH_TYPE_CONSTANT:
+  case SNP4_INFO_MATCH_TYPE_PREFIX:
+  case SNP4_INFO_MATCH_TYPE_TERNARY:
+    mask_default = ones_mask;
+    break;
+  case SNP4_INFO_MATCH_TYPE_RANGE:
+    mask_default = *key_part;
+    break;
+  case SNP4_INFO_MATCH_TYPE_UNUSED:
+    mask_default = 0;
+    break;
+  default:
+    *rc = SNP4_STATUS_FIELD_SPEC_UNKNOWN_TYPE;
+    return true;
+  }
+
+  if (!has_mask) {
+    *mask_part = mask_default;
+  }
+
+  switch (match_info_spec->type) {
+  case SNP4_INFO_MATCH_TYPE_BITFIELD:
+    if (!(*mask_part == 0 || *mask_part == ones_mask)) {
+      *rc = SNP4_STATUS_MATCH_INVALID_BITFIELD_MASK;
+      return true;
+    }
+    break;
+  case SNP4_INFO_MATCH_TYPE_CONSTANT:
+    if (*mask_part != ones_mask) {
+      *rc = SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK;
+      return true;
+    }
+    break;
+  case SNP4_INFO_MATCH_TYPE_PREFIX:
+    if (*mask_part != 0) {
+      // Adding the lowest one bit carries through the run of ones above it, leaving the first
+      // zero bit above the run set (or wrapping to zero when the run reaches the msb).
+      u128_t carried = *mask_part + (*mask_part & -*mask_part);
+      unsigned int first_zero_pos = carried != 0 ? u128_ctz(carried) : U128_BITS;
+      if (first_zero_pos < bits) {
+	*rc = SNP4_STATUS_MATCH_INVALID_PREFIX_MASK;
+	return true;
+      }
+    }
+    break;
+  case SNP4_INFO_MATCH_TYPE_RANGE:
+    if (*mask_part < *key_part) {
+      *rc = SNP4_STATUS_MATCH_INVALID_RANGE_MASK;
+      return true;
+    }
+    break;
+  case SNP4_INFO_MATCH_TYPE_TERNARY:
+    break;
+  case SNP4_INFO_MATCH_TYPE_UNUSED:
+    if (*mask_part != 0) {
+      *rc = SNP4_STATUS_MATCH_INVALID_UNUSED_MASK;
+      return true;
+    }
+    break;
+  default:
+    // Unknown field types were rejected above
+    break;
+  }
+
+  if (u128_wider_than(*key_part, bits)) {
+    *rc = SNP4_STATUS_MATCH_KEY_TOO_BIG;
+    return true;
+  }
+
+  if (u128_wider_than(*mask_part, bits)) {
+    *rc = SNP4_STATUS_MATCH_MASK_TOO_BIG;
+    return true;
+  }
+
+  *rc = SNP4_STATUS_OK;
+  return true;
+}
+
+// Returns false when the rule must be packed by the multi-precision path instead
+static bool pack_matches_u128(const struct snp4_info_match match_info_specs[], unsigned int key_size_bits, const struct sn_match matches[], size_t num_matches, struct sn_pack * pack, enum snp4_status * rc)
+{
+  unsigned int fields_bits = 0;
+  for (unsigned int i = 0; i < num_matches; i++) {
+    fields_bits += match_info_specs[i].bits;
+  }
+  if (fields_bits > U128_BITS) {
+    return false;
+  }
+
+  u128_t key = 0;
+  u128_t mask = 0;
+  for (unsigned int i = 0; i < num_matches; i++) {
+    const struct snp4_info_match * match_info_spec = &match_info_specs[i];
+    u128_t key_part;
+    u128_t mask_part;
+
+    if (!pack_partial_key_mask_u128(&key_part, &mask_part, &matches[i], match_info_spec, rc)) {
+      return false;
+    }
+    if (*rc != SNP4_STATUS_OK) {
+      return true;
+    }
+
+    key = u128_shl(key, match_info_spec->bits) | key_part;
+    mask = u128_shl(mask, match_info_spec->bits) | mask_part;
+  }
+
+  if (u128_wider_than(key, key_size_bits)) {
+    *rc = SNP4_STATUS_PACK_KEY_TOO_BIG;
+    return true;
+  }
+  if (u128_wider_than(mask, key_size_bits)) {
+    *rc = SNP4_STATUS_PACK_MASK_TOO_BIG;
+    return true;
+  }
+
+  unsigned int key_size_padded_bytes = (key_size_bits + 7) / 8;
+  pack->key = (uint8_t *) calloc(1, key_size_padded_bytes);
+  pack->key_len = key_size_padded_bytes;
+  pack->mask = (uint8_t *) calloc(1, key_size_padded_bytes);
+  pack->mask_len = key_size_padded_bytes;
+  if (pack->key == NULL || pack->mask == NULL) {
+    free(pack->key);
+    free(pack->mask);
+    pack->key = NULL;
+    pack->mask = NULL;
+    *rc = SNP4_STATUS_MALLOC_FAIL;
+    return true;
+  }
+
+  u128_export(pack->key, pack->key_len, key);
+  u128_export(pack->mask, pack->mask_len, mask);
+
+  *rc = SNP4_STATUS_OK;
+  return true;
+}
+
+// Returns false when the params must be packed by the multi-precision path instead
+static bool pack_params_u128(const struct snp4_info_param param_info_specs[], unsigned int table_param_size_bits, unsigned int action_param_size_bits, const struct sn_param params[], size_t num_params, struct sn_pack * pack, enum snp4_status * rc)
+{
+  // Actions without params are packed without any multi-precision work already
+  if (action_param_size_bits == 0) {
+    return false;
+  }
+
+  unsigned int fields_bits = 0;
+  for (unsigned int i = 0; i < num_params; i++) {
+    fields_bits += param_info_specs[i].bits;
+  }
+  if (fields_bits > U128_BITS) {
+    return false;
+  }
+
+  u128_t params_all = 0;
+  for (unsigned int i = 0; i < num_params; i++) {
+    const struct snp4_info_param * param_spec = &param_info_specs[i];
+    u128_t param_part;
+
+    switch (params[i].t) {
+    case SN_PARAM_FORMAT_UI:
+      param_part = params[i].v.ui;
+      break;
+    case SN_PARAM_FORMAT_MPZ:
+      if (!u128_from_mpz(&param_part, params[i].v.mpz)) {
+	return false;
+      }
+      break;
+    default:
+      *rc = SNP4_STATUS_PARAM_INVALID_FORMAT;
+      return true;
+    }
+
+    if (u128_wider_than(param_part, param_spec->bits)) {
+      *rc = SNP4_STATUS_PARAM_TOO_BIG;
+      return true;
+    }
+
+    params_all = u128_shl(params_all, param_spec->bits) | param_part;
+  }
+
+  if (u128_wider_than(params_all, action_param_size_bits)) {
+    *rc = SNP4_STATUS_PACK_PARAMS_TOO_BIG;
+    return true;
+  }
+
+  unsigned int param_size_padded_bytes = (table_param_size_bits + 7) / 8;
+  pack->params = (uint8_t *) calloc(1, param_size_padded_bytes);
+  pack->params_len = param_size_padded_bytes;
+  if (pack->params == NULL) {
+    *rc = SNP4_STATUS_MALLOC_FAIL;
+    return true;
+  }
+
+  u128_export(pack->params, pack->params_len, params_all);
+
+  *rc = SNP4_STATUS_OK;
+  return true;
+}
+
+enum snp4_status snp4_rule_pack_matches(const struct snp4_info_match match_info_specs[], unsigned int key_size_bits, const struct sn_match matches[], size_t num_matches, struct sn_pack * pack)
+{
+  enum snp4_status rc;
+
+  if (pack_matches_u128(match_info_specs, key_size_bits, matches, num_matches, pack, &rc)) {
+    return rc;
+  }
+
+  return snp4_rule_pack_matches_mpz(match_info_specs, key_size_bits, matches, num_matches, pack);
+}
+
+enum snp4_status snp4_rule_pack_params(const struct snp4_info_param param_info_specs[], unsigned int table_param_size_bits, unsigned int action_param_size_bits, const struct sn_param params[], size_t num_params, struct sn_pack * pack)
+{
+  enum snp4_status rc;
+
+  if (pack_params_u128(param_info_specs, table_param_size_bits, action_param_size_bits, params, num_params, pack, &rc)) {
+    return rc;
+  }
+
+  return snp4_rule_pack_params_mpz(param_info_specs, table_param_size_bits, action_param_size_bits, params, num_params, pack);
+}
+
 void snp4_rule_param_clear(struct sn_param *param)
 {
     switch (param->t) {
@@ -492,7 +816,7 @@ enum snp4_status snp4_rule_pack(const struct snp4_info_pipeline * pipeline, cons
     return SNP4_STATUS_INVALID_TABLE_NAME;
   }
 
-  const struct snp4_info_action * action_info = snp4_info_get_action_by_name(table_info, rule->action_name);
+  const struct snp4_info_action * action_info = snp4_info_get_action_by_name(pipeline, table_info, rule->action_name);
   if (!action_info) {
     return SNP4_STATUS_INVALID_ACTION_FOR_TABLE;
   }
@@ -510,7 +834,7 @@ enum snp4_status snp4_rule_pack(const struct snp4_info_pipeline * pipeline, cons
   }
   
   // Pack the key and mask
-  rc = snp4_rule_pack_matches(table_info->matches,
+  rc = snp4_rule_pack_matches(snp4_info_table_matches(pipeline, table_info),
 			      table_info->key_bits,
 			      rule->matches,
 			      rule->num_matches,
@@ -520,7 +844,7 @@ enum snp4_status snp4_rule_pack(const struct snp4_info_pipeline * pipeline, cons
   }
 
   // Pack the params
-  rc = snp4_rule_pack_params(action_info->params,
+  rc = snp4_rule_pack_params(snp4_info_action_params(pipeline, action_info),
 			     table_info->response_bits - table_info->actionid_bits,
 			     action_info->param_bits,
 			     rule->params,
@@ -1,9 +1,11 @@
 #include "gtest/gtest.h"
 #include <gmp.h>
 #include <string.h>
+#include <stdlib.h>
 
 extern "C" {
 #include "snp4.h"		/* API */
+#include "snp4_table_pack.h"	/* snp4_rule_pack_*_mpz */
 }
 
 static void display_pack(struct sn_pack * pack)
@@ -52,6 +54,10 @@ protected:
     snp4_info_get_pipeline(0, &pipeline);
   }
 
+  ~SNP4TableTest() {
+    snp4_info_free_pipeline(pipeline);
+  }
+
   void TearDown() override {
     display_pack(&pack);
   }
@@ -61,7 +67,7 @@ protected:
 
   enum snp4_status rc;
 
-  struct snp4_info_pipeline pipeline;
+  struct snp4_info_pipeline * pipeline;
 };
 
 class SNP4TablePrefixTest : public ::SNP4TableTest {
@@ -80,7 +86,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsKeyMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x000aabbccddeeff00112233445566778", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0xffffe000000000000000000000000000", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMin) {
@@ -91,7 +97,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMin) {
   mpz_init_set_str(m->v.prefix.key,  "0xaabbccddeeff00112233445566778", 0);
   m->v.prefix.prefix_len = 0;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMax) {
@@ -102,7 +108,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMax) {
   mpz_init_set_str(m->v.prefix.key,  "0xaabbccddeeff00112233445566778", 0);
   m->v.prefix.prefix_len = 128;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMid) {
@@ -113,7 +119,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsPrefixMid) {
   mpz_init_set_str(m->v.prefix.key,  "0xaabbccddeeff00112233445566778", 0);
   m->v.prefix.prefix_len = 19;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsKeyMaskTooWide) {
@@ -124,7 +130,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsKeyMaskTooWide) {
   mpz_init_set_str(m->v.key_mask.key,  "0x000aabbccddeeff00112233445566778", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x1ffffe000000000000000000000000000", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_BIG, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_BIG, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsKey) {
@@ -134,7 +140,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixFieldAsKey) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0xaabbccddeeff00112233445566778", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TablePrefixTest, PackPrefixWithSparseMask) {
@@ -145,7 +151,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixWithSparseMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x000aabbccddeeff00112233445566778", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0xffffe00000000000ffff000000000000", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_PREFIX_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_PREFIX_MASK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TablePrefixTest, PackPrefixWithInvalidPrefixLen) {
@@ -156,7 +162,7 @@ TEST_F(SNP4TablePrefixTest, PackPrefixWithInvalidPrefixLen) {
   mpz_init_set_str(m->v.prefix.key,  "0xaabbccddeeff00112233445566778", 0);
   m->v.prefix.prefix_len = 999;
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_WIDE, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_WIDE, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 class SNP4TableBitfieldTest : public ::SNP4TableTest {
@@ -175,7 +181,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKeyMaskOnes) {
   mpz_init_set_str(m->v.key_mask.key,  "0x0103e", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x1ffff", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKeyMaskZero) {
@@ -186,7 +192,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKeyMaskZero) {
   mpz_init_set_str(m->v.key_mask.key,  "0x0103e", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x00000", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKeyTooWide) {
@@ -196,7 +202,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKeyTooWide) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0x3e0fe", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_KEY_TOO_BIG, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_KEY_TOO_BIG, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsSparseKeyMask) {
@@ -207,7 +213,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsSparseKeyMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x0103e", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x0ff00", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_BITFIELD_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_BITFIELD_MASK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKey) {
@@ -217,7 +223,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsKey) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0xee", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsPrefixOnes) {
@@ -228,7 +234,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsPrefixOnes) {
   mpz_init_set_str(m->v.prefix.key,  "0x1111", 0);
   m->v.prefix.prefix_len = 17;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsPrefixZero) {
@@ -239,7 +245,7 @@ TEST_F(SNP4TableBitfieldTest, PackBitfieldFieldAsPrefixZero) {
   mpz_init_set_str(m->v.prefix.key,  "0x1111", 0);
   m->v.prefix.prefix_len = 0;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 class SNP4TableConstantTest : public ::SNP4TableTest {
@@ -257,7 +263,7 @@ TEST_F(SNP4TableConstantTest, PackConstantFieldAsKey) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0x7bcdef01", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 };
 
 TEST_F(SNP4TableConstantTest, PackConstantFieldAsSparseKeyMask) {
@@ -268,7 +274,7 @@ TEST_F(SNP4TableConstantTest, PackConstantFieldAsSparseKeyMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x7bcdef01", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x00ffff00", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableConstantTest, PackConstantFieldAsKeyMaskZero) {
@@ -279,7 +285,7 @@ TEST_F(SNP4TableConstantTest, PackConstantFieldAsKeyMaskZero) {
   mpz_init_set_str(m->v.key_mask.key,  "0x7bcdef01", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x00000000", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_CONSTANT_MASK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 class SNP4TableRangeTest : public ::SNP4TableTest {
@@ -298,7 +304,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsRange) {
   m->v.range.lower = 0x1234;
   m->v.range.upper = 0x1239;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableRangeTest, PackRangeFieldAsKeyMask) {
@@ -309,7 +315,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsKeyMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x1234", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x1239", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableRangeTest, PackRangeFieldAsKey) {
@@ -319,7 +325,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsKey) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0x1234", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableRangeTest, PackRangeFieldAsRangeEqual) {
@@ -330,7 +336,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsRangeEqual) {
   m->v.range.lower = 0x1234;
   m->v.range.upper = 0x1234;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableRangeTest, PackRangeFieldAsRangeFlipped) {
@@ -341,7 +347,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsRangeFlipped) {
   m->v.range.lower = 0x1239;
   m->v.range.upper = 0x1234;
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_RANGE_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_RANGE_MASK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableRangeTest, PackRangeFieldAsKeyMaskTooBig) {
@@ -352,7 +358,7 @@ TEST_F(SNP4TableRangeTest, PackRangeFieldAsKeyMaskTooBig) {
   mpz_init_set_str(m->v.key_mask.key,  "0x1234", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0xf1239", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_BIG, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_MASK_TOO_BIG, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 class SNP4TableTernaryTest : public ::SNP4TableTest {
@@ -371,7 +377,7 @@ TEST_F(SNP4TableTernaryTest, PackTernaryFieldAsKeyMask) {
   mpz_init_set_str(m->v.key_mask.key,  "0x030", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x101", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 class SNP4TableUnusedTest : public ::SNP4TableTest {
@@ -389,7 +395,7 @@ TEST_F(SNP4TableUnusedTest, PackUnusedFieldAsKey) {
   m->t = SN_MATCH_FORMAT_KEY_ONLY;
   mpz_init_set_str(m->v.key_only.key,  "0x2", 0);
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableUnusedTest, PackUnusedFieldUnused) {
@@ -398,7 +404,7 @@ TEST_F(SNP4TableUnusedTest, PackUnusedFieldUnused) {
   m = &rule.matches[rule.num_matches++];
   m->t = SN_MATCH_FORMAT_UNUSED;
 
-  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(pipeline, &rule, &pack));
 }
 
 TEST_F(SNP4TableUnusedTest, PackUnusedFieldAsKeyMaskNonZero) {
@@ -409,6 +415,244 @@ TEST_F(SNP4TableUnusedTest, PackUnusedFieldAsKeyMaskNonZero) {
   mpz_init_set_str(m->v.key_mask.key,  "0x2", 0);
   mpz_init_set_str(m->v.key_mask.mask, "0x3", 0);
 
-  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_UNUSED_MASK, snp4_rule_pack(&pipeline, &rule, &pack));
+  ASSERT_EQ(SNP4_STATUS_MATCH_INVALID_UNUSED_MASK, snp4_rule_pack(pipeline, &rule, &pack));
+}
+
+
+class SNP4TableRelocatedTest : public ::SNP4TableTest {
+protected:
+  void SetUp() override {
+    rule.table_name = strdup("t_u3");
+    rule.action_name = strdup("a_nop");
+
+    // The pipeline info holds no pointers, so a byte-wise copy is a complete description.
+    copy = (struct snp4_info_pipeline *)malloc(pipeline->size);
+    memcpy(copy, pipeline, pipeline->size);
+    memset(pipeline, 0, pipeline->size);
+  }
+
+  ~SNP4TableRelocatedTest() {
+    free(copy);
+  }
+
+  struct snp4_info_pipeline * copy;
+};
+
+TEST_F(SNP4TableRelocatedTest, LookupInCopy) {
+  const struct snp4_info_table * table = snp4_info_get_table_by_name(copy, "t_multi");
+  ASSERT_NE(nullptr, table);
+  ASSERT_EQ(6, table->num_matches);
+  ASSERT_EQ(SNP4_INFO_MATCH_TYPE_RANGE, snp4_info_table_matches(copy, table)[3].type);
+
+  const struct snp4_info_action * action = snp4_info_get_action_by_name(copy, table, "a_three");
+  ASSERT_NE(nullptr, action);
+  ASSERT_EQ(3, action->num_params);
+  ASSERT_STREQ("c", snp4_info_name(copy, snp4_info_action_params(copy, action)[2].name));
+  ASSERT_EQ(8, snp4_info_action_params(copy, action)[2].bits);
+}
+
+TEST_F(SNP4TableRelocatedTest, PackWithCopy) {
+  struct sn_match * m;
+
+  m = &rule.matches[rule.num_matches++];
+  m->t = SN_MATCH_FORMAT_KEY_ONLY;
+  mpz_init_set_str(m->v.key_only.key,  "0x2", 0);
+
+  ASSERT_EQ(SNP4_STATUS_OK, snp4_rule_pack(copy, &rule, &pack));
+}
+
+class SNP4TablePackPathTest : public ::SNP4TableTest {
+protected:
+  void SetUp() override {
+    snp4_rule_init(&rule);
+    snp4_pack_init(&pack);
+    gmp_randinit_default(rand_state);
+    gmp_randseed_ui(rand_state, 48);
+  }
+
+  void TearDown() override {
+    snp4_rule_clear(&rule);
+    gmp_randclear(rand_state);
+  }
+
+  // Pack the rule's matches with both the fixed-width and multi-precision paths and expect the same result.
+  void ExpectSameMatches(const char * table_name) {
+    const struct snp4_info_table * table = snp4_info_get_table_by_name(pipeline, table_name);
+    ASSERT_NE(nullptr, table);
+    const struct snp4_info_match * specs = snp4_info_table_matches(pipeline, table);
+
+    struct sn_pack fast;
+    struct sn_pack slow;
+    snp4_pack_init(&fast);
+    snp4_pack_init(&slow);
+
+    enum snp4_status fast_rc = snp4_rule_pack_matches(specs, table->key_bits, rule.matches, rule.num_matches, &fast);
+    enum snp4_status slow_rc = snp4_rule_pack_matches_mpz(specs, table->key_bits, rule.matches, rule.num_matches, &slow);
+    ASSERT_EQ(slow_rc, fast_rc);
+    if (slow_rc == SNP4_STATUS_OK) {
+      ASSERT_EQ(slow.key_len, fast.key_len);
+      ASSERT_EQ(0, memcmp(slow.key, fast.key, slow.key_len));
+      ASSERT_EQ(slow.mask_len, fast.mask_len);
+      ASSERT_EQ(0, memcmp(slow.mask, fast.mask, slow.mask_len));
+      snp4_pack_clear(&fast);
+      snp4_pack_clear(&slow);
+    }
+  }
+
+  // Pack the rule's params with both the fixed-width and multi-precision paths and expect the same result.
+  void ExpectSameParams(const char * table_name, const char * action_name) {
+    const struct snp4_info_table * table = snp4_info_get_table_by_name(pipeline, table_name);
+    ASSERT_NE(nullptr, table);
+    const struct snp4_info_action * action = snp4_info_get_action_by_name(pipeline, table, action_name);
+    ASSERT_NE(nullptr, action);
+    const struct snp4_info_param * specs = snp4_info_action_params(pipeline, action);
+    unsigned int table_param_bits = table->response_bits - table->actionid_bits;
+
+    struct sn_pack fast;
+    struct sn_pack slow;
+    snp4_pack_init(&fast);
+    snp4_pack_init(&slow);
+
+    enum snp4_status fast_rc = snp4_rule_pack_params(specs, table_param_bits, action->param_bits, rule.params, rule.num_params, &fast);
+    enum snp4_status slow_rc = snp4_rule_pack_params_mpz(specs, table_param_bits, action->param_bits, rule.params, rule.num_params, &slow);
+    ASSERT_EQ(slow_rc, fast_rc);
+    if (slow_rc == SNP4_STATUS_OK) {
+      ASSERT_EQ(slow.params_len, fast.params_len);
+      ASSERT_EQ(0, memcmp(slow.params, fast.params, slow.params_len));
+      snp4_pack_clear(&fast);
+      snp4_pack_clear(&slow);
+    }
+  }
+
+  // Random value which is usually within the field but is occasionally one bit too wide
+  void RandomValue(mpz_t v, unsigned int bits) {
+    mpz_init(v);
+    mpz_urandomb(v, rand_state, bits + (gmp_urandomm_ui(rand_state, 8) == 0 ? 1 : 0));
+  }
+
+  // Random match with a random format, which may or may not be valid for the field
+  void RandomMatch(struct sn_match * m, const struct snp4_info_match * spec) {
+    switch (gmp_urandomm_ui(rand_state, 5)) {
+    case 0:
+      m->t = SN_MATCH_FORMAT_KEY_MASK;
+      RandomValue(m->v.key_mask.key, spec->bits);
+      switch (gmp_urandomm_ui(rand_state, 3)) {
+      case 0:
+	RandomValue(m->v.key_mask.mask, spec->bits);
+	break;
+      case 1:
+	mpz_init_set_ui(m->v.key_mask.mask, 0);
+	break;
+      default:
+	mpz_init_set_ui(m->v.key_mask.mask, 1);
+	mpz_mul_2exp(m->v.key_mask.mask, m->v.key_mask.mask, spec->bits);
+	mpz_sub_ui(m->v.key_mask.mask, m->v.key_mask.mask, 1);
+	break;
+      }
+      break;
+    case 1:
+      m->t = SN_MATCH_FORMAT_KEY_ONLY;
+      RandomValue(m->v.key_only.key, spec->bits);
+      break;
+    case 2:
+      m->t = SN_MATCH_FORMAT_PREFIX;
+      RandomValue(m->v.prefix.key, spec->bits);
+      m->v.prefix.prefix_len = gmp_urandomm_ui(rand_state, spec->bits + 2);
+      break;
+    case 3:
+      m->t = SN_MATCH_FORMAT_RANGE;
+      m->v.range.lower = gmp_urandomm_ui(rand_state, 1 << 14);
+      m->v.range.upper = gmp_urandomm_ui(rand_state, 1 << 14);
+      break;
+    default:
+      m->t = SN_MATCH_FORMAT_UNUSED;
+      break;
+    }
+  }
+
+  gmp_randstate_t rand_state;
+};
+
+TEST_F(SNP4TablePackPathTest, RandomMatchesAgreeWithMpz) {
+  const struct snp4_info_table * table = snp4_info_get_table_by_name(pipeline, "t_multi");
+  ASSERT_NE(nullptr, table);
+  const struct snp4_info_match * specs = snp4_info_table_matches(pipeline, table);
+
+  for (unsigned int iter = 0; iter < 20000; iter++) {
+    for (unsigned int i = 0; i < table->num_matches; i++) {
+      RandomMatch(&rule.matches[i], &specs[i]);
+    }
+    rule.num_matches = table->num_matches;
+
+    ExpectSameMatches("t_multi");
+    snp4_rule_clear(&rule);
+  }
 }
 
+TEST_F(SNP4TablePackPathTest, RandomParamsAgreeWithMpz) {
+  const char * action_names[] = { "a_nop", "a_one", "a_two", "a_three" };
+  const struct snp4_info_table * table = snp4_info_get_table_by_name(pipeline, "t_multi");
+  ASSERT_NE(nullptr, table);
+
+  for (unsigned int iter = 0; iter < 20000; iter++) {
+    const char * action_name = action_names[iter % 4];
+    const struct snp4_info_action * action = snp4_info_get_action_by_name(pipeline, table, action_name);
+    ASSERT_NE(nullptr, action);
+    const struct snp4_info_param * specs = snp4_info_action_params(pipeline, action);
+
+    for (unsigned int i = 0; i < action->num_params; i++) {
+      struct sn_param * p = &rule.params[i];
+      if (gmp_urandomm_ui(rand_state, 2) == 0) {
+	p->t = SN_PARAM_FORMAT_UI;
+	p->v.ui = gmp_urandomb_ui(rand_state, specs[i].bits < 40 ? specs[i].bits + 1 : 40);
+      } else {
+	p->t = SN_PARAM_FORMAT_MPZ;
+	RandomValue(p->v.mpz, specs[i].bits);
+      }
+    }
+    rule.num_params = action->num_params;
+
+    ExpectSameParams("t_multi", action_name);
+    snp4_rule_clear(&rule);
+  }
+}
+
+TEST_F(SNP4TablePackPathTest, FullWidthPrefixAgreesWithMpz) {
+  struct sn_match * m = &rule.matches[rule.num_matches++];
+  m->t = SN_MATCH_FORMAT_PREFIX;
+  mpz_init_set_str(m->v.prefix.key, "0xffeeddccbbaa99887766554433221100", 0);
+
+  for (unsigned int len = 0; len <= 128; len++) {
+    m->v.prefix.prefix_len = len;
+    ExpectSameMatches("t_p128");
+  }
+}
+
+TEST_F(SNP4TablePackPathTest, FullWidthKeyMaskAgreesWithMpz) {
+  struct sn_match * m = &rule.matches[rule.num_matches++];
+  m->t = SN_MATCH_FORMAT_KEY_MASK;
+  mpz_init_set_str(m->v.key_mask.key, "0x80000000000000000000000000000001", 0);
+  mpz_init_set_str(m->v.key_mask.mask, "0xfffffffffffffffffffffffffffffff0", 0);
+  ExpectSameMatches("t_p128");
+
+  // Not a prefix: a zero bit sits above the lowest one bit
+  mpz_set_str(m->v.key_mask.mask, "0xfffffffffffffffffffffffffffffef0", 0);
+  ExpectSameMatches("t_p128");
+
+  // Wider than 128 bits, handled by the multi-precision path
+  mpz_set_str(m->v.key_mask.key, "0x100000000000000000000000000000000", 0);
+  mpz_set_str(m->v.key_mask.mask, "0xffffffffffffffffffffffffffffffff", 0);
+  ExpectSameMatches("t_p128");
+}
+
+TEST_F(SNP4TablePackPathTest, WideKeyFallsBackToMpz) {
+  struct sn_match * m = &rule.matches[rule.num_matches++];
+  m->t = SN_MATCH_FORMAT_KEY_ONLY;
+  mpz_init_set_str(m->v.key_only.key, "0x100000000000000000000000000000000", 0);
+
+  struct sn_pack fast;
+  snp4_pack_init(&fast);
+  const struct snp4_info_table * table = snp4_info_get_table_by_name(pipeline, "t_p128");
+  ASSERT_EQ(SNP4_STATUS_MATCH_KEY_TOO_BIG,
+	    snp4_rule_pack_matches(snp4_info_table_matches(pipeline, table), table->key_bits, rule.matches, rule.num_matches, &fast));
+}
@@ -0,0 +1,200 @@
+#include "gtest/gtest.h"
+#include <gmp.h>
+#include <string.h>
+
+extern "C" {
+#include "snp4.h"		/* API */
+#include "snp4_drv_ut.h"	/* ut_drv_* */
+}
+
+// Every test is run with and without shadows on the tables
+class SNP4TxnTest : public ::testing::TestWithParam<bool> {
+protected:
+  void SetUp() override {
+    ut_drv_reset();
+    handle = snp4_init(0, 0);
+    ASSERT_NE(nullptr, handle);
+    tcam = snp4_table_lookup(handle, "tcam");
+    ASSERT_NE(nullptr, tcam);
+    bcam = snp4_table_lookup(handle, "bcam");
+    ASSERT_NE(nullptr, bcam);
+
+    shadow = GetParam();
+    if (shadow) {
+      ASSERT_TRUE(snp4_table_shadow_enable(handle, tcam));
+      ASSERT_TRUE(snp4_table_shadow_enable(handle, bcam));
+    }
+  }
+
+  void TearDown() override {
+    ASSERT_TRUE(snp4_deinit(handle));
+  }
+
+  struct snp4_table_rule rule(uint8_t key, uint32_t action_id = 1, uint8_t param = 0) {
+    keys[key] = key;
+    params[key][0] = 0;
+    params[key][1] = param;
+    return {&keys[key], &mask, action_id, params[key], sizeof(params[key]), 10u + key};
+  }
+
+  void stage_insert(struct snp4_txn * txn, const struct snp4_table * table, uint8_t key, uint32_t action_id = 1, uint8_t param = 0, bool replace = false) {
+    struct snp4_table_rule r = rule(key, action_id, param);
+    ASSERT_TRUE(snp4_txn_insert(txn, table, &r, replace));
+  }
+
+  void stage_delete(struct snp4_txn * txn, const struct snp4_table * table, uint8_t key) {
+    struct snp4_table_rule r = rule(key);
+    ASSERT_TRUE(snp4_txn_delete(txn, table, &r));
+  }
+
+  // Commit three entries in the tcam and one in the bcam
+  void populate() {
+    struct snp4_txn * txn = snp4_txn_begin(handle);
+    ASSERT_NE(nullptr, txn);
+    for (uint8_t k = 0; k < 3; k++) {
+      stage_insert(txn, tcam, k, 1, 0x10 + k);
+    }
+    stage_insert(txn, bcam, 5, 0);
+    ASSERT_EQ(SNP4_STATUS_OK, snp4_txn_commit(txn, NULL));
+  }
+
+  void * handle;
+  const struct snp4_table * tcam;
+  const struct snp4_table * bcam;
+  bool shadow;
+
+  uint8_t keys[256];
+  uint8_t mask = 0xff;
+  uint8_t params[256][2];
+};
+
+TEST_P(SNP4TxnTest, CommitAcrossTables) {
+  populate();
+  ASSERT_EQ(3, ut_drv_count(UT_DRV_TABLE_TCAM));
+  ASSERT_EQ(1, ut_drv_count(UT_DRV_TABLE_BCAM));
+  ASSERT_EQ(0x12, ut_drv_find(UT_DRV_TABLE_TCAM, 2, 0xff)->params[1]);
+  ASSERT_EQ(shadow ? 3 : 0, snp4_table_shadow_count(tcam));
+}
+
+TEST_P(SNP4TxnTest, ConflictWithinTransactionRefusedUpFront) {
+  populate();
+  unsigned int num_ops = ut_drv.num_ops;
+
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  stage_insert(txn, tcam, 7);
+  stage_delete(txn, tcam, 7);
+  stage_insert(txn, tcam, 7);
+  stage_insert(txn, tcam, 7);
+
+  size_t failed_op;
+  ASSERT_EQ(SNP4_STATUS_TABLE_DUPLICATE_ENTRY, snp4_txn_commit(txn, &failed_op));
+  ASSERT_EQ(3, failed_op);
+  ASSERT_EQ(num_ops, ut_drv.num_ops);
+  ASSERT_EQ(3, ut_drv_count(UT_DRV_TABLE_TCAM));
+}
+
+TEST_P(SNP4TxnTest, CapacityRefusedUpFront) {
+  populate();
+  unsigned int num_ops = ut_drv.num_ops;
+
+  // Only shadowed tables know of the entry already in the bcam, otherwise only the staged inserts
+  // are counted.
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  unsigned int num_inserts = shadow ? UT_DRV_BCAM_NUM_ENTRIES : UT_DRV_BCAM_NUM_ENTRIES + 1;
+  for (unsigned int k = 0; k < num_inserts; k++) {
+    stage_insert(txn, bcam, 8 + k, 0);
+  }
+
+  size_t failed_op;
+  ASSERT_EQ(SNP4_STATUS_TABLE_FULL, snp4_txn_commit(txn, &failed_op));
+  ASSERT_EQ(num_inserts - 1, failed_op);
+  ASSERT_EQ(num_ops, ut_drv.num_ops);
+  ASSERT_EQ(1, ut_drv_count(UT_DRV_TABLE_BCAM));
+}
+
+TEST_P(SNP4TxnTest, ConflictWithExistingEntry) {
+  populate();
+  unsigned int num_ops = ut_drv.num_ops;
+
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  stage_insert(txn, tcam, 1);
+
+  // Only shadowed tables catch the conflict before going to the hardware
+  size_t failed_op;
+  ASSERT_EQ(SNP4_STATUS_TABLE_DUPLICATE_ENTRY, snp4_txn_commit(txn, &failed_op));
+  ASSERT_EQ(0, failed_op);
+  ASSERT_EQ(shadow ? num_ops : num_ops + 1, ut_drv.num_ops);
+}
+
+TEST_P(SNP4TxnTest, FailureRollsBackInReverse) {
+  populate();
+
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  stage_insert(txn, tcam, 12, 1, 0x77);
+  stage_insert(txn, tcam, 0, 0, 0x99, true);
+  stage_delete(txn, tcam, 1);
+  stage_insert(txn, tcam, 13, 1, 0x55);
+
+  ut_drv.fail_op = ut_drv.num_ops + 3;
+  size_t failed_op;
+  ASSERT_EQ(SNP4_STATUS_TABLE_DRIVER_ERROR, snp4_txn_commit(txn, &failed_op));
+  ASSERT_EQ(3, failed_op);
+  ut_drv.fail_op = -1;
+
+  ASSERT_EQ(3, ut_drv_count(UT_DRV_TABLE_TCAM));
+  ASSERT_EQ(nullptr, ut_drv_find(UT_DRV_TABLE_TCAM, 12, 0xff));
+  ASSERT_EQ(nullptr, ut_drv_find(UT_DRV_TABLE_TCAM, 13, 0xff));
+
+  const struct ut_drv_entry * entry = ut_drv_find(UT_DRV_TABLE_TCAM, 0, 0xff);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(1, entry->action_id);
+  ASSERT_EQ(0x10, entry->params[1]);
+
+  entry = ut_drv_find(UT_DRV_TABLE_TCAM, 1, 0xff);
+  ASSERT_NE(nullptr, entry);
+  ASSERT_EQ(1, entry->action_id);
+  ASSERT_EQ(0x11, entry->params[1]);
+  ASSERT_EQ(11, entry->priority);
+
+  if (shadow) {
+    uint8_t key = 1;
+    ASSERT_EQ(3, snp4_table_shadow_count(tcam));
+    ASSERT_TRUE(snp4_table_shadow_contains(tcam, &key, &mask));
+  }
+}
+
+TEST_P(SNP4TxnTest, RollbackFailureReported) {
+  populate();
+
+  // An entry added behind the library's back makes the second insert fail in the hardware, and
+  // the rollback of the first is made to fail too.
+  ut_drv.entries[UT_DRV_TABLE_TCAM][10] = {true, 21, 0xff, 0, 0, {0, 0}};
+
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  stage_insert(txn, tcam, 20);
+  stage_insert(txn, tcam, 21);
+
+  ut_drv.fail_op = ut_drv.num_ops + 2;
+  size_t failed_op;
+  ASSERT_EQ(SNP4_STATUS_TXN_ROLLBACK_FAILED, snp4_txn_commit(txn, &failed_op));
+  ASSERT_EQ(1, failed_op);
+  ut_drv.fail_op = -1;
+
+  // The entry which couldn't be rolled back is still in the hardware, and in the shadow
+  ASSERT_NE(nullptr, ut_drv_find(UT_DRV_TABLE_TCAM, 20, 0xff));
+  if (shadow) {
+    uint8_t key = 20;
+    ASSERT_TRUE(snp4_table_shadow_contains(tcam, &key, &mask));
+  }
+}
+
+TEST_P(SNP4TxnTest, AbortDiscards) {
+  struct snp4_txn * txn = snp4_txn_begin(handle);
+  stage_insert(txn, tcam, 14);
+  snp4_txn_abort(txn);
+
+  ASSERT_EQ(0, ut_drv.num_ops);
+  ASSERT_EQ(0, ut_drv_count(UT_DRV_TABLE_TCAM));
+}
+
+INSTANTIATE_TEST_SUITE_P(Shadow, SNP4TxnTest, ::testing::Bool());
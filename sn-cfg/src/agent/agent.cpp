@@ -23,6 +23,7 @@
 
 #include "smartnic.h"
 #include "stats.h"
+#include "stats_record.h"
 
 using namespace google::protobuf;
 using namespace grpc;
@@ -83,6 +84,13 @@ using namespace std;
 #define ENV_VAR_AUTH_TOKENS         "SN_CFG_SERVER_AUTH_TOKENS"
 #define ENV_VAR_DEBUG_FLAGS         "SN_CFG_SERVER_DEBUG_FLAGS"
 #define ENV_VAR_STATS_FLAGS_DISABLE "SN_CFG_SERVER_STATS_FLAGS_DISABLE"
+#define ENV_VAR_STATS_RECORD_DIR    "SN_CFG_SERVER_STATS_RECORD_DIR"
+
+#define PROMETHEUS_HTTP_THREADS    4    // Number of concurrent scrapes served.
+#define PROMETHEUS_HTTP_MAX_AGE_MS 1000 // Scrapes within this interval share the rendered metrics.
+
+#define STATS_RECORD_MAX_FILE_SIZE (64 * 1024 * 1024) // Size at which recordings are rotated.
+#define STATS_RECORD_MAX_FILES     16                 // Number of recordings kept per domain.
 
 //--------------------------------------------------------------------------------------------------
 struct Arguments {
@@ -93,6 +101,7 @@ struct Arguments {
         unsigned int port;
 
         unsigned int prometheus_port;
+        string stats_record_dir;
 
         string tls_cert_chain;
         string tls_key;
@@ -116,7 +125,8 @@ struct Command {
 SmartnicConfigImpl::SmartnicConfigImpl(const vector<string>& bus_ids,
                                        const vector<string>& debug_flags,
                                        const vector<string>& stats_flags_disable,
-                                       unsigned int prometheus_port) {
+                                       unsigned int prometheus_port,
+                                       const string& stats_record_dir) {
     int rv = prom_collector_registry_default_init();
     if (rv != 0) {
         SERVER_LOG_LINE_INIT(ctor, ERROR, "Failed to init default prometheus registry.");
@@ -196,6 +206,27 @@ SmartnicConfigImpl::SmartnicConfigImpl(const vector<string>& bus_ids,
                     "Failed to allocate statistics domain '" << dname << "' on device " << bus_id);
                 exit(EXIT_FAILURE);
             }
+
+            dev->stats.recorders[dom] = NULL;
+            if (!stats_record_dir.empty()) {
+                auto path = stats_record_dir + "/" + bus_id + "-" + dname;
+                struct stats_recorder_spec rspec = {
+                    .path = path.c_str(),
+                    .max_file_size = STATS_RECORD_MAX_FILE_SIZE,
+                    .max_files = STATS_RECORD_MAX_FILES,
+                };
+
+                SERVER_LOG_LINE_INIT(ctor, INFO,
+                    "Recording statistics domain '" << dname << "' on device " << bus_id <<
+                    " to " << path);
+                dev->stats.recorders[dom] = stats_recorder_alloc(dev->stats.domains[dom], &rspec);
+                if (dev->stats.recorders[dom] == NULL) {
+                    SERVER_LOG_LINE_INIT(ctor, ERROR,
+                        "Failed to record statistics domain '" << dname << "' on device " <<
+                        bus_id);
+                    exit(EXIT_FAILURE);
+                }
+            }
         }
 
         init_device(dev);
@@ -241,10 +272,9 @@ SmartnicConfigImpl::SmartnicConfigImpl(const vector<string>& bus_ids,
     stats_domain_start(server_stats.domain);
 
     SERVER_LOG_LINE_INIT(ctor, INFO, "Starting Prometheus daemon on port " << prometheus_port);
-    promhttp_set_active_collector_registry(prometheus.registry);
-    prometheus.daemon = promhttp_start_daemon(
-        MHD_USE_SELECT_INTERNALLY, prometheus_port, NULL, NULL);
-    if (prometheus.daemon == NULL) {
+    prometheus.http = prometheus_http_start(prometheus.registry, prometheus_port,
+                                            PROMETHEUS_HTTP_THREADS, PROMETHEUS_HTTP_MAX_AGE_MS);
+    if (prometheus.http == NULL) {
         SERVER_LOG_LINE_INIT(ctor, ERROR, "Failed to start prometheus daemon");
         exit(EXIT_FAILURE);
     }
@@ -252,7 +282,7 @@ SmartnicConfigImpl::SmartnicConfigImpl(const vector<string>& bus_ids,
 
 //--------------------------------------------------------------------------------------------------
 SmartnicConfigImpl::~SmartnicConfigImpl() {
-    MHD_stop_daemon(prometheus.daemon);
+    prometheus_http_stop(prometheus.http);
 
     deinit_server();
     stats_domain_free(server_stats.domain);
@@ -266,8 +296,11 @@ SmartnicConfigImpl::~SmartnicConfigImpl() {
         deinit_port(dev);
         deinit_switch(dev);
 
-        for (auto domain : dev->stats.domains) {
-            stats_domain_free(domain);
+        for (auto dom = 0; dom < DeviceStatsDomain::NDOMAINS; ++dom) {
+            if (dev->stats.recorders[dom] != NULL) {
+                stats_recorder_free(dev->stats.recorders[dom]);
+            }
+            stats_domain_free(dev->stats.domains[dom]);
         }
 
         smartnic_unmap_bar2(dev->bar2);
@@ -511,7 +544,7 @@ static int agent_server_run(const Arguments& args) {
 
     // Attach the gRPC configuration service.
     SmartnicConfigImpl service(args.server.bus_ids, debug_flags, stats_flags_disable,
-                               args.server.prometheus_port);
+                               args.server.prometheus_port, args.server.stats_record_dir);
     builder.RegisterService(&service);
 
     // Create the server and bind it's address.
@@ -560,6 +593,14 @@ static void agent_server_add(CLI::App& app, Arguments::Server& args, vector<Comm
         ENV_VAR_PROMETHEUS_PORT " environment variable.")->
         envname(ENV_VAR_PROMETHEUS_PORT)->
         default_val(args.prometheus_port);
+    cmd->add_option(
+        "--stats-record-dir", args.stats_record_dir,
+        "Directory in which to continuously record the statistics of each device, for offline "
+        "replay with the stats-replay tool. Recordings are rotated at " +
+        to_string(STATS_RECORD_MAX_FILE_SIZE >> 20) + "MiB, with the most recent " +
+        to_string(STATS_RECORD_MAX_FILES) + " kept per statistics domain. Disabled by default. Can "
+        "also be set via the " ENV_VAR_STATS_RECORD_DIR " environment variable.")->
+        envname(ENV_VAR_STATS_RECORD_DIR);
 
     cmd->add_option(
         "--tls-cert-chain", args.tls_cert_chain,
@@ -632,6 +673,7 @@ int main(int argc, char *argv[]) {
             .port = 50100,
 
             .prometheus_port = 8000,
+            .stats_record_dir = "",
 
             .tls_cert_chain = "",
             .tls_key = "",
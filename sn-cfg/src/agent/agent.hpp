@@ -7,6 +7,8 @@
 
 #include <bitset>
 #include <ctime>
+#include <google/protobuf/arena.h>
+#include <memory>
 #include <string>
 #include <time.h>
 #include <vector>
@@ -14,6 +16,12 @@
 using namespace grpc;
 using namespace sn_cfg::v2;
 using namespace std;
+using google::protobuf::Arena;
+
+//--------------------------------------------------------------------------------------------------
+// Size of the initial block of the arenas on which the messages of a stream are built. The block is
+// reused by the arena of each message in turn, so that building a message seldom allocates.
+#define AGENT_ARENA_BLOCK_SIZE (64 * 1024)
 
 //--------------------------------------------------------------------------------------------------
 class SmartnicConfigImpl final : public SmartnicConfig::Service {
@@ -22,7 +30,8 @@ public:
         const vector<string>& bus_ids,
         const vector<string>& debug_flags,
         const vector<string>& stats_flags_disable,
-        unsigned int prometheus_port);
+        unsigned int prometheus_port,
+        const string& stats_record_dir);
     ~SmartnicConfigImpl();
 
     // Batching of multiple RPCs.
@@ -85,6 +94,10 @@ public:
     // Statistics configuration.
     Status GetStats(ServerContext*, const StatsRequest*, ServerWriter<StatsResponse>*) override;
     Status ClearStats(ServerContext*, const StatsRequest*, ServerWriter<StatsResponse>*) override;
+    Status WatchStats(
+        ServerContext*, const WatchStatsRequest*, ServerWriter<StatsResponse>*) override;
+    Status TopStats(
+        ServerContext*, const TopStatsRequest*, ServerWriter<TopStatsResponse>*) override;
 
     // Switch configuration.
     Status GetSwitchConfig(
@@ -103,7 +116,7 @@ private:
 
     struct {
         prom_collector_registry_t* registry;
-        struct MHD_Daemon* daemon;
+        PrometheusHttp* http;
     } prometheus;
 
     struct ServerStats {
@@ -46,8 +46,10 @@ Status SmartnicConfigImpl::Batch(
     [[maybe_unused]] ServerContext* ctx,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
     ServerDebugFlag debug_flag = ServerDebugFlag::DEBUG_FLAG_BATCH;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
     while (true) {
-        BatchRequest req;
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& req = *Arena::CreateMessage<BatchRequest>(&arena);
         if (!rdwr->Read(&req)) {
             break;
         }
@@ -7,6 +7,7 @@
 #include "cms.h"
 #include "esnet_smartnic_toplevel.h"
 #include "stats.h"
+#include "stats_record.h"
 
 using namespace std;
 
@@ -45,6 +46,7 @@ struct Device {
 
     struct {
         struct stats_domain* domains[DeviceStatsDomain::NDOMAINS];
+        struct stats_recorder* recorders[DeviceStatsDomain::NDOMAINS];
         vector<DeviceStats*> zones[DeviceStatsZone::NZONES];
     } stats;
 };
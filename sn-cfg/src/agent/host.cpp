@@ -441,15 +441,20 @@ void SmartnicConfigImpl::get_or_clear_host_stats(
         auto& zones = dev->stats.zones[DeviceStatsZone::HOST_COUNTERS];
         for (host_id = begin_host_id; host_id <= end_host_id; ++host_id) {
             HostStatsResponse resp;
+            auto error_code = ErrorCode::EC_OK;
 
             if (do_clear) {
-                clear_stats_zone(zones[host_id]->zone, ctx.filters);
+                if (!clear_stats_zone(zones[host_id]->zone, ctx.filters)) {
+                    error_code = ErrorCode::EC_STATS_TOO_MANY_BASELINES;
+                }
+            } else if (!get_stats_zone_has_baseline(zones[host_id]->zone, ctx.filters)) {
+                error_code = ErrorCode::EC_STATS_UNKNOWN_BASELINE;
             } else {
                 ctx.stats = resp.mutable_stats();
-                stats_zone_for_each_metric(zones[host_id]->zone, get_stats_for_each_metric, &ctx);
+                get_stats_zone(zones[host_id]->zone, ctx);
             }
 
-            resp.set_error_code(ErrorCode::EC_OK);
+            resp.set_error_code(error_code);
             resp.set_dev_id(dev_id);
             resp.set_host_id(host_id);
 
@@ -482,15 +482,20 @@ void SmartnicConfigImpl::get_or_clear_port_stats(
         auto& zones = dev->stats.zones[DeviceStatsZone::PORT_COUNTERS];
         for (port_id = begin_port_id; port_id <= end_port_id; ++port_id) {
             PortStatsResponse resp;
+            auto error_code = ErrorCode::EC_OK;
 
             if (do_clear) {
-                clear_stats_zone(zones[port_id]->zone, ctx.filters);
+                if (!clear_stats_zone(zones[port_id]->zone, ctx.filters)) {
+                    error_code = ErrorCode::EC_STATS_TOO_MANY_BASELINES;
+                }
+            } else if (!get_stats_zone_has_baseline(zones[port_id]->zone, ctx.filters)) {
+                error_code = ErrorCode::EC_STATS_UNKNOWN_BASELINE;
             } else {
                 ctx.stats = resp.mutable_stats();
-                stats_zone_for_each_metric(zones[port_id]->zone, get_stats_for_each_metric, &ctx);
+                get_stats_zone(zones[port_id]->zone, ctx);
             }
 
-            resp.set_error_code(ErrorCode::EC_OK);
+            resp.set_error_code(error_code);
             resp.set_dev_id(dev_id);
             resp.set_port_id(port_id);
 
@@ -0,0 +1,282 @@
+#include "prometheus.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <microhttpd.h>
+#include <strings.h>
+#include <zlib.h>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Rendering of the registry in the Prometheus text format, shared by all scrapes made while it is
+ * current. The compressed form is only produced once a client asks for it.
+ */
+class PrometheusSnapshot {
+public:
+    PrometheusSnapshot(const char* text, chrono::steady_clock::time_point rendered) :
+        text(text), text_len(strlen(text)), rendered(rendered) {}
+
+    ~PrometheusSnapshot() {
+        free((void*)text);
+    }
+
+    const string& get_gzip(void) const {
+        call_once(gzip_once, [this]() {
+            if (!compress()) {
+                gzip.clear();
+            }
+        });
+        return gzip;
+    }
+
+    const char* const text;
+    const size_t text_len;
+    const chrono::steady_clock::time_point rendered;
+
+private:
+    bool compress(void) const {
+        z_stream zs = {};
+        if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+
+        gzip.resize(deflateBound(&zs, text_len));
+        zs.next_in = (Bytef*)text;
+        zs.avail_in = text_len;
+        zs.next_out = (Bytef*)gzip.data();
+        zs.avail_out = gzip.size();
+
+        int rv = deflate(&zs, Z_FINISH);
+        gzip.resize(zs.total_out);
+        deflateEnd(&zs);
+
+        return rv == Z_STREAM_END;
+    }
+
+    mutable once_flag gzip_once;
+    mutable string gzip; // Empty when compression failed.
+};
+
+//--------------------------------------------------------------------------------------------------
+struct PrometheusHttp {
+    prom_collector_registry_t* registry;
+    chrono::milliseconds max_age;
+    struct MHD_Daemon* daemon;
+
+    mutex lock;
+    condition_variable rendered;
+    bool rendering;
+    shared_ptr<const PrometheusSnapshot> snapshot;
+};
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Return the current snapshot, rendering a new one if it has aged out. Concurrent scrapes wait for
+ * a single rendering rather than each walking the registry.
+ */
+static shared_ptr<const PrometheusSnapshot> prometheus_http_get_snapshot(PrometheusHttp* http) {
+    unique_lock<mutex> lock(http->lock);
+    auto now = chrono::steady_clock::now();
+    if (http->snapshot == nullptr || now - http->snapshot->rendered >= http->max_age) {
+        if (!http->rendering) {
+            http->rendering = true;
+            lock.unlock();
+
+            auto text = prom_collector_registry_bridge(http->registry);
+            shared_ptr<const PrometheusSnapshot> snapshot;
+            if (text != NULL) {
+                snapshot = make_shared<const PrometheusSnapshot>(text, now);
+            }
+
+            lock.lock();
+            http->rendering = false;
+            if (snapshot != nullptr) {
+                http->snapshot = snapshot;
+            }
+            http->rendered.notify_all();
+            return snapshot;
+        }
+
+        // Another scrape is rendering on behalf of this one. Take its result however long it took.
+        auto prev = http->snapshot;
+        http->rendered.wait(lock, [&]() { return !http->rendering; });
+        if (http->snapshot == prev) {
+            return nullptr; // The rendering failed.
+        }
+    }
+
+    return http->snapshot;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void prometheus_http_free_snapshot(void* arg) {
+    delete (shared_ptr<const PrometheusSnapshot>*)arg;
+}
+
+//--------------------------------------------------------------------------------------------------
+static string_view prometheus_http_trim(string_view s) {
+    auto begin = s.find_first_not_of(" \t");
+    if (begin == string_view::npos) {
+        return string_view();
+    }
+
+    return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Check the Accept-Encoding header for gzip. Each listed coding may carry a quality value, of which
+ * only a zero matters here since it refuses the coding. An explicit gzip entry takes precedence over
+ * the "*" wildcard.
+ */
+static bool prometheus_http_accepts_gzip(struct MHD_Connection* conn) {
+    auto value = MHD_lookup_connection_value(conn, MHD_HEADER_KIND,
+                                             MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    if (value == NULL) {
+        return false;
+    }
+
+    int gzip = -1; // Whether gzip is accepted, or -1 when not listed.
+    int any = -1;
+    string_view list(value);
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto item = list.substr(0, comma);
+        list = comma == string_view::npos ? string_view() : list.substr(comma + 1);
+
+        auto semi = item.find(';');
+        auto coding = prometheus_http_trim(item.substr(0, semi));
+        bool accepted = true;
+        while (semi != string_view::npos) {
+            item = item.substr(semi + 1);
+            semi = item.find(';');
+            auto param = prometheus_http_trim(item.substr(0, semi));
+            if (param.size() > 2 && strncasecmp(param.data(), "q=", 2) == 0) {
+                accepted = strtod(string(param.substr(2)).c_str(), NULL) > 0;
+            }
+        }
+
+        if ((coding.size() == 4 && strncasecmp(coding.data(), "gzip", 4) == 0) ||
+            (coding.size() == 6 && strncasecmp(coding.data(), "x-gzip", 6) == 0)) {
+            gzip = accepted;
+        } else if (coding == "*") {
+            any = accepted;
+        }
+    }
+
+    return gzip >= 0 ? gzip > 0 : any > 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static enum MHD_Result prometheus_http_reply(struct MHD_Connection* conn,
+                                             unsigned int status,
+                                             const char* text) {
+    auto resp = MHD_create_response_from_buffer_static(strlen(text), text);
+    if (resp == NULL) {
+        return MHD_NO;
+    }
+
+    auto rv = MHD_queue_response(conn, status, resp);
+    MHD_destroy_response(resp);
+
+    return rv;
+}
+
+//--------------------------------------------------------------------------------------------------
+static enum MHD_Result prometheus_http_handler(void* cls,
+                                               struct MHD_Connection* conn,
+                                               const char* url,
+                                               const char* method,
+                                               [[maybe_unused]] const char* version,
+                                               [[maybe_unused]] const char* upload_data,
+                                               [[maybe_unused]] size_t* upload_data_size,
+                                               [[maybe_unused]] void** con_cls) {
+    auto http = (PrometheusHttp*)cls;
+
+    // HEAD is answered as GET, libmicrohttpd leaving out the body.
+    if (strcmp(method, MHD_HTTP_METHOD_GET) != 0 && strcmp(method, MHD_HTTP_METHOD_HEAD) != 0) {
+        return prometheus_http_reply(conn, MHD_HTTP_METHOD_NOT_ALLOWED, "Method not allowed\n");
+    }
+
+    if (strcmp(url, "/metrics") != 0) {
+        return prometheus_http_reply(conn, MHD_HTTP_NOT_FOUND, "Metrics are served at /metrics\n");
+    }
+
+    auto snapshot = prometheus_http_get_snapshot(http);
+    if (snapshot == nullptr) {
+        return prometheus_http_reply(conn, MHD_HTTP_INTERNAL_SERVER_ERROR,
+                                     "Failed to render metrics\n");
+    }
+
+    // The response references the snapshot directly, holding it alive until sent.
+    const void* body = snapshot->text;
+    size_t body_len = snapshot->text_len;
+    bool gzipped = false;
+    if (prometheus_http_accepts_gzip(conn)) {
+        const auto& gzip = snapshot->get_gzip();
+        if (!gzip.empty()) {
+            body = gzip.data();
+            body_len = gzip.size();
+            gzipped = true;
+        }
+    }
+
+    auto ref = new shared_ptr<const PrometheusSnapshot>(snapshot);
+    auto resp = MHD_create_response_from_buffer_with_free_callback_cls(
+        body_len, body, prometheus_http_free_snapshot, ref);
+    if (resp == NULL) {
+        delete ref;
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_VARY, MHD_HTTP_HEADER_ACCEPT_ENCODING);
+    if (gzipped) {
+        MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_ENCODING, "gzip");
+    }
+
+    auto rv = MHD_queue_response(conn, MHD_HTTP_OK, resp);
+    MHD_destroy_response(resp);
+
+    return rv;
+}
+
+//--------------------------------------------------------------------------------------------------
+PrometheusHttp* prometheus_http_start(prom_collector_registry_t* registry,
+                                      unsigned int port,
+                                      unsigned int nthreads,
+                                      unsigned int max_age_ms) {
+    auto http = new PrometheusHttp;
+    http->registry = registry;
+    http->max_age = chrono::milliseconds(max_age_ms);
+    http->rendering = false;
+
+    http->daemon = MHD_start_daemon(
+        MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_ERROR_LOG, port, NULL, NULL,
+        prometheus_http_handler, http,
+        MHD_OPTION_THREAD_POOL_SIZE, nthreads,
+        MHD_OPTION_END);
+    if (http->daemon == NULL) {
+        delete http;
+        return NULL;
+    }
+
+    return http;
+}
+
+//--------------------------------------------------------------------------------------------------
+void prometheus_http_stop(PrometheusHttp* http) {
+    if (http != NULL) {
+        MHD_stop_daemon(http->daemon);
+        delete http;
+    }
+}
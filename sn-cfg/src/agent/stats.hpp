@@ -3,19 +3,185 @@
 
 #include "sn_cfg_v2.grpc.pb.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 using namespace sn_cfg::v2;
 using namespace std;
 
+//--------------------------------------------------------------------------------------------------
+struct StatsRegexp;
+
+// State reused across all evaluations of the filters of a single request.
+struct StatsFilterCache {
+    unordered_map<const void*, shared_ptr<const StatsRegexp>> regexps; // By pattern message.
+    unordered_map<const void*, map<string, bool, less<>>> names; // By string match, then name.
+};
+
+//--------------------------------------------------------------------------------------------------
+// Point within the stats of a device at which a response was split, encoded as its cursor.
+struct GetStatsPosition {
+    unsigned int dev_id = 0;
+    unsigned int part = 0; // Index of the domain (or pipeline) holding the stats.
+    bool is_delta = false;
+    string token;
+
+    string zone;
+    unsigned int zone_occurrence = 0; // Tells apart the zones sharing the same name.
+    string block;
+    unsigned int metric = 0; // Index of the metric within its block.
+    string metric_name;
+    unsigned int value = 0; // Index of the first value not yet sent.
+};
+
+// Splitting of the stats of a device across several responses.
+struct GetStatsChunks {
+    enum class Resume {
+        NONE,
+        PENDING, // Skipping up to the block of the resume position.
+        ENTERED, // Skipping up to the metric of the resume position, within its block.
+        LOST, // The resume position no longer exists.
+    };
+
+    size_t max_values = 0;
+    size_t max_bytes = 0;
+    // Sends the current chunk, whose stats hold the cursor to the remainder. Leave unset to never
+    // split the stats.
+    function<void(void)> flush;
+    unsigned int dev_id = 0; // Device and part being retrieved, for the positions of the cursors.
+    unsigned int part = 0;
+
+    size_t nvalues = 0; // Size of the current chunk.
+    size_t nbytes = 0;
+
+    Resume resume = Resume::NONE;
+    GetStatsPosition from;
+
+    const void* zone = NULL; // Zone being visited, along with its occurrence.
+    unsigned int zone_occurrence = 0;
+    map<string, unsigned int, less<>> zone_occurrences;
+};
+
 //--------------------------------------------------------------------------------------------------
 struct GetStatsContext {
     const StatsFilters& filters;
     Stats* stats;
+    uint64_t since = 0; // Generation of the requested token when the stats are a delta.
+    StatsFilterCache cache = {};
+    GetStatsChunks chunks = {};
 };
 
-extern "C" {
-int get_stats_for_each_metric(const struct stats_for_each_spec* spec);
-}
+void get_stats_chunks_init(GetStatsContext& ctx,
+                           const StatsChunking& chunking,
+                           function<void(void)> flush);
+bool get_stats_resume_parse(const string& cursor, GetStatsPosition& pos);
+void get_stats_resume(GetStatsContext& ctx, const GetStatsPosition& pos);
+bool get_stats_resumed(GetStatsContext& ctx);
+void get_stats_zone(struct stats_zone* zone, GetStatsContext& ctx);
+bool get_stats_zone_has_baseline(struct stats_zone* zone, const StatsFilters& filters);
+bool clear_stats_zone(struct stats_zone* zone, const StatsFilters& filters);
+
+//--------------------------------------------------------------------------------------------------
+// Maximum number of devices whose stats are collected at the same time.
+#define STATS_FAN_OUT_MAX_THREADS 8
+// Maximum number of responses held for a device until the writer reaches it.
+#define STATS_FAN_OUT_MAX_QUEUED 4
+
+/*
+ * Collect the stats of the devices in [begin_dev_id, end_dev_id] concurrently, each on its own
+ * thread up to STATS_FAN_OUT_MAX_THREADS, while the responses emitted for the devices are written
+ * from the calling thread in device order. A device returning false from the collection stops the
+ * request once its responses are written, with the devices after it left out.
+ *
+ * Emitting a response blocks while STATS_FAN_OUT_MAX_QUEUED responses of the device are waiting to
+ * be written, so that a device collected ahead of the writer holds a few chunks of its stats at most
+ * rather than all of them.
+ */
+template <typename Response>
+void get_stats_fan_out(int begin_dev_id, int end_dev_id,
+                       function<bool(int, const function<void(const Response&)>&)> collect,
+                       const function<void(const Response&)>& write_resp) {
+    int ndevs = end_dev_id - begin_dev_id + 1;
+    if (ndevs <= 1) {
+        if (ndevs == 1) {
+            collect(begin_dev_id, write_resp);
+        }
+        return;
+    }
+
+    struct Device {
+        deque<Response> resps; // Emitted and not yet written.
+        bool done = false;
+    };
+    vector<Device> devs(ndevs);
+    mutex lock;
+    condition_variable cond;
+    int next = 0; // Devices are started in order, so all those before a failed one are started.
+    int failed = ndevs;
+
+    auto worker = [&]() -> void {
+        unique_lock<mutex> guard(lock);
+        while (next < ndevs && failed == ndevs) {
+            auto idx = next++;
+            guard.unlock();
 
-void clear_stats_zone(struct stats_zone* zone, const StatsFilters& filters);
+            auto ok = collect(begin_dev_id + idx, [&, idx](const Response& resp) -> void {
+                unique_lock<mutex> emit_guard(lock);
+                cond.wait(emit_guard, [&]() -> bool {
+                    return devs[idx].resps.size() < STATS_FAN_OUT_MAX_QUEUED || idx > failed;
+                });
+                if (idx > failed) {
+                    return; // Never written.
+                }
+
+                devs[idx].resps.push_back(resp);
+                cond.notify_all();
+            });
+
+            guard.lock();
+            devs[idx].done = true;
+            if (!ok) {
+                failed = min(failed, idx);
+            }
+            cond.notify_all();
+        }
+    };
+
+    vector<thread> threads;
+    for (auto n = 0; n < min(ndevs, STATS_FAN_OUT_MAX_THREADS); ++n) {
+        threads.emplace_back(worker);
+    }
+
+    unique_lock<mutex> guard(lock);
+    for (auto idx = 0; idx < ndevs && idx <= failed; ++idx) {
+        auto& dev = devs[idx];
+        while (true) {
+            cond.wait(guard, [&dev]() -> bool { return dev.done || !dev.resps.empty(); });
+            if (dev.resps.empty()) {
+                break;
+            }
+
+            auto resp = move(dev.resps.front());
+            dev.resps.pop_front();
+            cond.notify_all();
+            guard.unlock();
+            write_resp(resp);
+            guard.lock();
+        }
+    }
+    guard.unlock();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
 
 #endif // STATS_HPP
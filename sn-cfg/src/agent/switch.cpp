@@ -432,15 +432,20 @@ void SmartnicConfigImpl::get_or_clear_switch_stats(
         const auto dev = devices[dev_id];
         auto& zones = dev->stats.zones[DeviceStatsZone::SWITCH_COUNTERS];
         SwitchStatsResponse resp;
+        auto error_code = ErrorCode::EC_OK;
 
         if (do_clear) {
-            clear_stats_zone(zones[0]->zone, ctx.filters);
+            if (!clear_stats_zone(zones[0]->zone, ctx.filters)) {
+                error_code = ErrorCode::EC_STATS_TOO_MANY_BASELINES;
+            }
+        } else if (!get_stats_zone_has_baseline(zones[0]->zone, ctx.filters)) {
+            error_code = ErrorCode::EC_STATS_UNKNOWN_BASELINE;
         } else {
             ctx.stats = resp.mutable_stats();
-            stats_zone_for_each_metric(zones[0]->zone, get_stats_for_each_metric, &ctx);
+            get_stats_zone(zones[0]->zone, ctx);
         }
 
-        resp.set_error_code(ErrorCode::EC_OK);
+        resp.set_error_code(error_code);
         resp.set_dev_id(dev_id);
 
         write_resp(resp);
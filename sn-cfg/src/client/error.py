@@ -66,6 +66,11 @@ ERROR_MAP = {
     ErrorCode.EC_MODULE_GPIO_READ_FAILED: 'module-gpio-read-failed',
     ErrorCode.EC_MODULE_GPIO_WRITE_FAILED: 'module-gpio-write-failed',
     ErrorCode.EC_MODULE_NOT_PRESENT: 'module-not-present',
+
+    # Statistics error codes.
+    ErrorCode.EC_INVALID_STATS_CURSOR: 'invalid-stats-cursor',
+    ErrorCode.EC_STATS_TOO_MANY_BASELINES: 'stats-too-many-baselines',
+    ErrorCode.EC_STATS_UNKNOWN_BASELINE: 'stats-unknown-baseline',
 }
 
 def error_code_str(ec):
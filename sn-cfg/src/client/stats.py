@@ -2,6 +2,7 @@
 __all__ = (
     'add_sub_command',
     'stats_clear_base_options',
+    'stats_merge_chunks',
     'stats_req_kargs',
     'stats_show_base_options',
     'stats_show_format',
@@ -24,6 +25,7 @@ from sn_cfg_proto import (
     StatsMetricMatchIndexSlice,
     StatsMetricMatchIndices,
     StatsMetricMatchLabel,
+    StatsMetricMatchLastChange,
     StatsMetricMatchString,
     StatsMetricType,
     StatsRequest,
@@ -72,10 +74,13 @@ def stats_req_kargs(dev_id, stats_kargs):
                     uf.match.label.key.exact = 'units'
                     uf.match.label.value.exact = u
 
+        with_labels = stats_kargs.get('labels') or stats_kargs.get('aliases')
         req_kargs['filters'] = StatsFilters(
             non_zero=not stats_kargs.get('zeroes'),
-            with_labels=stats_kargs.get('labels') or stats_kargs.get('aliases'),
+            with_labels=with_labels,
             metric_filter=root,
+            packed_values=not with_labels,
+            with_last_change=stats_kargs.get('last_change', False),
         )
 
     return req_kargs
@@ -83,6 +88,58 @@ def stats_req_kargs(dev_id, stats_kargs):
 def stats_req(dev_id, **stats_kargs):
     return StatsRequest(**stats_req_kargs(dev_id, stats_kargs))
 
+#---------------------------------------------------------------------------------------------------
+def stats_merge_packed_values(merged, packed):
+    consecutive = not merged.indices and not packed.indices and \
+        packed.start_index == merged.start_index + len(merged.u64)
+    if not consecutive:
+        if not merged.indices:
+            merged.indices.extend(range(merged.start_index, merged.start_index + len(merged.u64)))
+            merged.start_index = 0
+        if packed.indices:
+            merged.indices.extend(packed.indices)
+        else:
+            merged.indices.extend(range(packed.start_index, packed.start_index + len(packed.u64)))
+
+    if merged.f64 or packed.f64:
+        # Values which weren't converted are kept as the u64 value as a double.
+        if not merged.f64:
+            merged.f64.extend(float(u64) for u64 in merged.u64)
+        merged.f64.extend(packed.f64 if packed.f64 else (float(u64) for u64 in packed.u64))
+    merged.u64.extend(packed.u64)
+    merged.last_change_ns.extend(packed.last_change_ns)
+
+def stats_merge_chunk(merged, stats):
+    # A metric split across the boundary of two chunks continues as the first metric of the latter.
+    metrics = stats.metrics
+    if merged.metrics and metrics:
+        last, first = merged.metrics[-1], metrics[0]
+        if last.type == first.type and last.name == first.name and last.scope == first.scope:
+            if first.HasField('packed_values'):
+                stats_merge_packed_values(last.packed_values, first.packed_values)
+            else:
+                last.values.extend(first.values)
+            last.last_update.CopyFrom(first.last_update)
+            metrics = metrics[1:]
+
+    merged.metrics.extend(metrics)
+    merged.removed.extend(stats.removed)
+    merged.cursor = stats.cursor
+
+def stats_merge_chunks(resps):
+    # The stats of a response may be split across several, all but the last holding a cursor.
+    merged = None
+    for resp in resps:
+        if merged is None:
+            merged = resp.stats
+        else:
+            stats_merge_chunk(merged, resp.stats)
+
+        if not resp.stats.cursor:
+            merged.ClearField('cursor')
+            yield resp, merged
+            merged = None
+
 #---------------------------------------------------------------------------------------------------
 def rpc_stats(op, **kargs):
     req = stats_req(**kargs)
@@ -99,8 +156,8 @@ def rpc_clear_stats(stub, **kargs):
         yield resp.dev_id
 
 def rpc_get_stats(stub, **kargs):
-    for resp in rpc_stats(stub.GetStats, **kargs):
-        yield resp.dev_id, resp.stats
+    for resp, stats in stats_merge_chunks(rpc_stats(stub.GetStats, **kargs)):
+        yield resp.dev_id, stats
 
 #---------------------------------------------------------------------------------------------------
 def clear_stats(client, **kargs):
@@ -108,8 +165,28 @@ def clear_stats(client, **kargs):
         click.echo(f'Cleared statistics for device ID {dev_id}.')
 
 #---------------------------------------------------------------------------------------------------
+def stats_metric_values(metric):
+    if not metric.HasField('packed_values'):
+        yield from metric.values
+        return
+
+    packed = metric.packed_values
+    indices = packed.indices
+    if not indices:
+        indices = range(packed.start_index, packed.start_index + len(packed.u64))
+
+    for n, (index, u64) in enumerate(zip(indices, packed.u64)):
+        f64 = packed.f64[n] if packed.f64 else float(u64)
+        last_change = None
+        if packed.last_change_ns:
+            ns = packed.last_change_ns[n]
+            last_change = types.SimpleNamespace(seconds=ns // 1000000000, nanos=ns % 1000000000)
+        yield types.SimpleNamespace(
+            index=index, u64=u64, f64=f64, labels=(), last_change=last_change)
+
 def stats_show_format(stats, kargs):
     with_last_update = kargs.get('last_update', False)
+    with_last_change = kargs.get('last_change', False)
     with_labels = kargs.get('labels', False)
     with_aliases = kargs.get('aliases', False)
     with_long_name = kargs.get('long_name', False)
@@ -118,7 +195,7 @@ def stats_show_format(stats, kargs):
     for metric in stats.metrics:
         is_array = metric.num_elements > 0
         last_update = format_timestamp(metric.last_update)
-        for value in metric.values:
+        for value in stats_metric_values(metric):
             if metric.type == StatsMetricType.STATS_METRIC_TYPE_FLAG:
                 svalue = 'yes' if value.u64 != 0 else 'no'
             elif metric.type == StatsMetricType.STATS_METRIC_TYPE_GAUGE:
@@ -147,6 +224,7 @@ def stats_show_format(stats, kargs):
                 long_name=long_name,
                 value=svalue,
                 last_update=last_update,
+                last_change=format_timestamp(value.last_change) if with_last_change else None,
                 labels=labels,
             )
 
@@ -182,6 +260,8 @@ def stats_show_format(stats, kargs):
                 row = f'{name:>{name_len}}: {metric.value:<{value_len}}'
                 if with_last_update:
                     row += f'    [{metric.last_update}]'
+                if with_last_change:
+                    row += f'    [changed {metric.last_change}]'
                 rows.append(row)
 
                 if with_labels:
@@ -271,8 +351,8 @@ def rpc_clear_stats_view(stub, **kargs):
         yield resp.dev_id
 
 def rpc_get_stats_view(stub, **kargs):
-    for resp in rpc_stats_view(stub.GetStats, **kargs):
-        yield resp.dev_id, resp.stats
+    for resp, stats in stats_merge_chunks(rpc_stats_view(stub.GetStats, **kargs)):
+        yield resp.dev_id, stats
 
 #---------------------------------------------------------------------------------------------------
 def clear_stats_view(client, **kargs):
@@ -531,6 +611,14 @@ Methods for creating a filter to match a specific attribute.
   may be set to "None" to indicate that they should be ignored during the match
   and treated as wilcards.
 \b
+- unchanged_for(milliseconds) -> filter
+  Create a new filter to match on metric values which have not changed for at
+  least the given number of milliseconds.
+\b
+- changed_within(milliseconds) -> filter
+  Create a new filter to match on metric values which have changed within the
+  given number of milliseconds.
+\b
 \b
 Methods for creating string matches used for specifying whether or not a filter
 will select a metric.
@@ -661,6 +749,10 @@ Example 4: Filter to select only metrics counting packets on the output side of
                   ) \\
               ) \\
           )'
+\b
+\b
+Example 5: Filter to select counters which have gone quiet for at least a minute.
+  {{prog_name}} show stats --last-change --filter 'all(type(COUNTER), unchanged_for(60000))'
 '''
 
     def convert(self, value, param, ctx):
@@ -765,6 +857,18 @@ Example 4: Filter to select only metrics counting packets on the output side of
             return StatsMetricFilter(match=StatsMetricMatch(label=StatsMetricMatchLabel(**fields)))
         ns['label'] = _label
 
+        def _unchanged_for(ms):
+            return StatsMetricFilter(
+                match=StatsMetricMatch(last_change=StatsMetricMatchLastChange(unchanged_for_ms=ms))
+            )
+        ns['unchanged_for'] = _unchanged_for
+
+        def _changed_within(ms):
+            return StatsMetricFilter(
+                match=StatsMetricMatch(last_change=StatsMetricMatchLastChange(changed_within_ms=ms))
+            )
+        ns['changed_within'] = _changed_within
+
         # Methods for creating string matches.
         def _exact(string):
             return StatsMetricMatchString(exact=string)
@@ -872,6 +976,11 @@ def stats_show_base_options():
             is_flag=True,
             help='Include the metric last update timestamp in the display.',
         ),
+        click.option(
+            '--last-change',
+            is_flag=True,
+            help='Include the timestamp of the last change to each metric value in the display.',
+        ),
         click.option(
             '--filter', '-f',
             'filters',
@@ -22,6 +22,7 @@
 
 #include "smartnic.h"
 #include "stats.h"
+#include "stats_record.h"
 
 using namespace google::protobuf;
 using namespace grpc;
@@ -66,13 +67,21 @@ using namespace std;
 #define HELP_CONFIG_AUTH_TOKENS    "{\"server\":{\"auth\":{\"tokens\":[\"<TOKEN1>\", ...]}}}"
 #define HELP_CONFIG_DEBUG_FLAGS    "{\"server\":{\"debug\":{\"flags\":[\"<FLAG1>\", ...]}}}"
 
-#define ENV_VAR_ADDRESS         "SN_P4_SERVER_ADDRESS"
-#define ENV_VAR_PORT            "SN_P4_SERVER_PORT"
-#define ENV_VAR_PROMETHEUS_PORT "SN_P4_SERVER_PROMETHEUS_PORT"
-#define ENV_VAR_TLS_CERT_CHAIN  "SN_P4_SERVER_TLS_CERT_CHAIN"
-#define ENV_VAR_TLS_KEY         "SN_P4_SERVER_TLS_KEY"
-#define ENV_VAR_AUTH_TOKENS     "SN_P4_SERVER_AUTH_TOKENS"
-#define ENV_VAR_DEBUG_FLAGS     "SN_P4_SERVER_DEBUG_FLAGS"
+#define ENV_VAR_ADDRESS          "SN_P4_SERVER_ADDRESS"
+#define ENV_VAR_PORT             "SN_P4_SERVER_PORT"
+#define ENV_VAR_PROMETHEUS_PORT  "SN_P4_SERVER_PROMETHEUS_PORT"
+#define ENV_VAR_TLS_CERT_CHAIN   "SN_P4_SERVER_TLS_CERT_CHAIN"
+#define ENV_VAR_TLS_KEY          "SN_P4_SERVER_TLS_KEY"
+#define ENV_VAR_AUTH_TOKENS      "SN_P4_SERVER_AUTH_TOKENS"
+#define ENV_VAR_DEBUG_FLAGS      "SN_P4_SERVER_DEBUG_FLAGS"
+#define ENV_VAR_STATS_RECORD_DIR "SN_P4_SERVER_STATS_RECORD_DIR"
+#define ENV_VAR_TABLE_SHADOWS    "SN_P4_SERVER_TABLE_SHADOWS"
+
+#define PROMETHEUS_HTTP_THREADS    4    // Number of concurrent scrapes served.
+#define PROMETHEUS_HTTP_MAX_AGE_MS 1000 // Scrapes within this interval share the rendered metrics.
+
+#define STATS_RECORD_MAX_FILE_SIZE (64 * 1024 * 1024) // Size at which recordings are rotated.
+#define STATS_RECORD_MAX_FILES     16                 // Number of recordings kept per domain.
 
 //--------------------------------------------------------------------------------------------------
 struct Arguments {
@@ -83,6 +92,9 @@ struct Arguments {
         unsigned int port;
 
         unsigned int prometheus_port;
+        string stats_record_dir;
+
+        vector<string> table_shadows;
 
         string tls_cert_chain;
         string tls_key;
@@ -104,7 +116,9 @@ struct Command {
 //--------------------------------------------------------------------------------------------------
 SmartnicP4Impl::SmartnicP4Impl(const vector<string>& bus_ids,
                                const vector<string>& debug_flags,
-                               unsigned int prometheus_port) {
+                               unsigned int prometheus_port,
+                               const string& stats_record_dir,
+                               const vector<string>& table_shadows) {
     int rv = prom_collector_registry_default_init();
     if (rv != 0) {
         SERVER_LOG_LINE_INIT(ctor, ERROR, "Failed to init default prometheus registry.");
@@ -164,9 +178,30 @@ SmartnicP4Impl::SmartnicP4Impl(const vector<string>& bus_ids,
                     "Failed to allocate statistics domain '" << dname << "' on device " << bus_id);
                 exit(EXIT_FAILURE);
             }
+
+            dev->stats.recorders[dom] = NULL;
+            if (!stats_record_dir.empty()) {
+                auto path = stats_record_dir + "/" + bus_id + "-" + dname;
+                struct stats_recorder_spec rspec = {
+                    .path = path.c_str(),
+                    .max_file_size = STATS_RECORD_MAX_FILE_SIZE,
+                    .max_files = STATS_RECORD_MAX_FILES,
+                };
+
+                SERVER_LOG_LINE_INIT(ctor, INFO,
+                    "Recording statistics domain '" << dname << "' on device " << bus_id <<
+                    " to " << path);
+                dev->stats.recorders[dom] = stats_recorder_alloc(dev->stats.domains[dom], &rspec);
+                if (dev->stats.recorders[dom] == NULL) {
+                    SERVER_LOG_LINE_INIT(ctor, ERROR,
+                        "Failed to record statistics domain '" << dname << "' on device " <<
+                        bus_id);
+                    exit(EXIT_FAILURE);
+                }
+            }
         }
 
-        init_pipeline(dev);
+        init_pipeline(dev, table_shadows);
 
         SERVER_LOG_LINE_INIT(ctor, INFO, "Starting statistics collection on device " << bus_id);
         for (auto domain : dev->stats.domains) {
@@ -202,10 +237,9 @@ SmartnicP4Impl::SmartnicP4Impl(const vector<string>& bus_ids,
     stats_domain_start(server_stats.domain);
 
     SERVER_LOG_LINE_INIT(ctor, INFO, "Starting Prometheus daemon on port " << prometheus_port);
-    promhttp_set_active_collector_registry(prometheus.registry);
-    prometheus.daemon = promhttp_start_daemon(
-        MHD_USE_SELECT_INTERNALLY, prometheus_port, NULL, NULL);
-    if (prometheus.daemon == NULL) {
+    prometheus.http = prometheus_http_start(prometheus.registry, prometheus_port,
+                                            PROMETHEUS_HTTP_THREADS, PROMETHEUS_HTTP_MAX_AGE_MS);
+    if (prometheus.http == NULL) {
         SERVER_LOG_LINE_INIT(ctor, ERROR, "Failed to start prometheus daemon");
         exit(EXIT_FAILURE);
     }
@@ -213,7 +247,7 @@ SmartnicP4Impl::SmartnicP4Impl(const vector<string>& bus_ids,
 
 //--------------------------------------------------------------------------------------------------
 SmartnicP4Impl::~SmartnicP4Impl() {
-    MHD_stop_daemon(prometheus.daemon);
+    prometheus_http_stop(prometheus.http);
 
     deinit_server();
     stats_domain_free(server_stats.domain);
@@ -223,8 +257,11 @@ SmartnicP4Impl::~SmartnicP4Impl() {
 
         deinit_pipeline(dev);
 
-        for (auto domain : dev->stats.domains) {
-            stats_domain_free(domain);
+        for (auto dom = 0; dom < DeviceStatsDomain::NDOMAINS; ++dom) {
+            if (dev->stats.recorders[dom] != NULL) {
+                stats_recorder_free(dev->stats.recorders[dom]);
+            }
+            stats_domain_free(dev->stats.domains[dom]);
         }
 
         smartnic_unmap_bar2(dev->bar2);
@@ -371,6 +408,10 @@ static int agent_server_run(const Arguments& args) {
         parse_env_list(args.server.debug_flags, debug_flags);
     }
 
+    // Setup the tables to be shadowed in host memory.
+    vector<string> table_shadows;
+    parse_env_list(args.server.table_shadows, table_shadows);
+
     // Setup the RPC authentication token(s).
     vector<string> auth_tokens;
     if (args.server.auth_tokens.empty()) { // Get default from config file.
@@ -444,7 +485,8 @@ static int agent_server_run(const Arguments& args) {
     builder.AddListeningPort(address, credentials);
 
     // Attach the gRPC configuration service.
-    SmartnicP4Impl service(args.server.bus_ids, debug_flags, args.server.prometheus_port);
+    SmartnicP4Impl service(args.server.bus_ids, debug_flags, args.server.prometheus_port,
+                           args.server.stats_record_dir, table_shadows);
     builder.RegisterService(&service);
 
     // Create the server and bind it's address.
@@ -493,6 +535,24 @@ static void agent_server_add(CLI::App& app, Arguments::Server& args, vector<Comm
         ENV_VAR_PROMETHEUS_PORT " environment variable.")->
         envname(ENV_VAR_PROMETHEUS_PORT)->
         default_val(args.prometheus_port);
+    cmd->add_option(
+        "--stats-record-dir", args.stats_record_dir,
+        "Directory in which to continuously record the statistics of each device, for offline "
+        "replay with the stats-replay tool. Recordings are rotated at " +
+        to_string(STATS_RECORD_MAX_FILE_SIZE >> 20) + "MiB, with the most recent " +
+        to_string(STATS_RECORD_MAX_FILES) + " kept per statistics domain. Disabled by default. Can "
+        "also be set via the " ENV_VAR_STATS_RECORD_DIR " environment variable.")->
+        envname(ENV_VAR_STATS_RECORD_DIR);
+
+    cmd->add_option(
+        "--table-shadow", args.table_shadows,
+        "Name of a pipeline table whose entries are to be shadowed in host memory. Inserts and "
+        "deletes of conflicting rules are then refused without accessing the device, at the cost "
+        "of memory for each rule. Only rules programmed through the agent are tracked, so the table "
+        "must not be modified by other means. Repeat for each table. By default, no tables are "
+        "shadowed. Can also be set as a colon-separated (:) list via the " ENV_VAR_TABLE_SHADOWS
+        " environment variable.")->
+        envname(ENV_VAR_TABLE_SHADOWS);
 
     cmd->add_option(
         "--tls-cert-chain", args.tls_cert_chain,
@@ -558,6 +618,9 @@ int main(int argc, char *argv[]) {
             .port = 50050,
 
             .prometheus_port = 8000,
+            .stats_record_dir = "",
+
+            .table_shadows = {},
 
             .tls_cert_chain = "",
             .tls_key = "",
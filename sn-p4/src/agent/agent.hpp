@@ -7,12 +7,20 @@
 
 #include <bitset>
 #include <ctime>
+#include <google/protobuf/arena.h>
+#include <memory>
 #include <string>
 #include <vector>
 
 using namespace grpc;
 using namespace sn_p4::v2;
 using namespace std;
+using google::protobuf::Arena;
+
+//--------------------------------------------------------------------------------------------------
+// Size of the initial block of the arenas on which the messages of a stream are built. The block is
+// reused by the arena of each message in turn, so that building a message seldom allocates.
+#define AGENT_ARENA_BLOCK_SIZE (64 * 1024)
 
 //--------------------------------------------------------------------------------------------------
 class SmartnicP4Impl final : public SmartnicP4::Service {
@@ -20,7 +28,9 @@ public:
     explicit SmartnicP4Impl(
         const vector<string>& bus_ids,
         const vector<string>& debug_flags,
-        unsigned int prometheus_port);
+        unsigned int prometheus_port,
+        const string& stats_record_dir,
+        const vector<string>& table_shadows);
     ~SmartnicP4Impl();
 
     // Batching of multiple RPCs.
@@ -56,6 +66,10 @@ public:
     // Stats configuration.
     Status GetStats(ServerContext*, const StatsRequest*, ServerWriter<StatsResponse>*) override;
     Status ClearStats(ServerContext*, const StatsRequest*, ServerWriter<StatsResponse>*) override;
+    Status WatchStats(
+        ServerContext*, const WatchStatsRequest*, ServerWriter<StatsResponse>*) override;
+    Status TopStats(
+        ServerContext*, const TopStatsRequest*, ServerWriter<TopStatsResponse>*) override;
 
     bool get_server_times(struct timespec* start, struct timespec* up);
 
@@ -64,7 +78,7 @@ private:
 
     struct {
         prom_collector_registry_t* registry;
-        struct MHD_Daemon* daemon;
+        PrometheusHttp* http;
     } prometheus;
 
     struct ServerStats {
@@ -115,13 +129,16 @@ private:
         const DevicePipeline* pipeline, const string& table_name);
     bool pipeline_has_table(const DevicePipeline* pipeline, const string& table_name);
     const struct snp4_info_action* pipeline_get_table_action_info(
-        const struct snp4_info_table* ti, const string& action_name);
-    bool pipeline_has_table_action(const struct snp4_info_table* ti, const string& action_name);
+        const DevicePipeline* pipeline, const struct snp4_info_table* ti,
+        const string& action_name);
+    bool pipeline_has_table_action(
+        const DevicePipeline* pipeline, const struct snp4_info_table* ti,
+        const string& action_name);
     const struct snp4_info_counter_block* pipeline_get_counter_block_info(
         const DevicePipeline* pipeline, const string& block_name);
     bool pipeline_has_counter_block(const DevicePipeline* pipeline, const string& block_name);
 
-    void init_pipeline(Device* dev);
+    void init_pipeline(Device* dev, const vector<string>& table_shadows);
     void deinit_pipeline(Device* dev);
     void get_pipeline_info(const PipelineInfoRequest&, function<void(const PipelineInfoResponse&)>);
     void batch_get_pipeline_info(
@@ -0,0 +1,191 @@
+/*
+ * Agent message allocation benchmark.
+ *
+ * Builds the stats responses of a device the way the agent streams them in a batch, one chunk at a
+ * time, each wrapped in a BatchResponse and serialized, and measures the cost per chunk of keeping
+ * the messages on the heap versus on arenas as done by the agent. Results are written as one JSON
+ * object per line to allow tracking regressions between builds.
+ */
+#include "agent.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <getopt.h>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------------------
+struct BenchArgs {
+    const char* output_path;
+    unsigned int metrics; // Number of metrics in each chunk.
+    unsigned int values; // Number of values of each metric.
+    unsigned int iterations;
+};
+
+//--------------------------------------------------------------------------------------------------
+static void bench_fill_stats(Stats* stats, const BenchArgs& args) {
+    for (unsigned int m = 0; m < args.metrics; ++m) {
+        auto metric = stats->add_metrics();
+        metric->set_type(StatsMetricType::STATS_METRIC_TYPE_COUNTER);
+        metric->set_name("rx_packets_with_a_typically_long_name");
+        metric->set_num_elements(args.values);
+
+        auto scope = metric->mutable_scope();
+        scope->set_domain("counters");
+        scope->set_zone("port0");
+        scope->set_block("mac_rx_counters");
+
+        auto last_update = metric->mutable_last_update();
+        last_update->set_seconds(m);
+        last_update->set_nanos(m);
+
+        for (unsigned int v = 0; v < args.values; ++v) {
+            auto value = metric->add_values();
+            value->set_index(v);
+            value->set_u64(m + v);
+            value->set_f64(m + v);
+
+            auto label = value->add_labels();
+            label->set_key("index");
+            label->set_value(to_string(v));
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_send(const StatsResponse& resp, BatchResponse& bresp, string& wire) {
+    auto stats = bresp.mutable_stats();
+    stats->CopyFrom(resp);
+    bresp.set_error_code(ErrorCode::EC_OK);
+    bresp.set_op(BatchOperation::BOP_GET);
+
+    resp.SerializeToString(&wire);
+    bresp.SerializeToString(&wire);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_run(FILE* out, const BenchArgs& args, const char* mode, function<void()> chunk) {
+    chunk(); // Warm up, so that reused messages and arenas start out at their steady state.
+
+    auto begin = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < args.iterations; ++i) {
+        chunk();
+    }
+    auto elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count();
+
+    fprintf(out,
+            "{\"bench\":\"stats_chunk\",\"mode\":\"%s\",\"metrics\":%u,\"values\":%u,"
+            "\"iterations\":%u,\"ns_per_chunk\":%.0f}\n",
+            mode, args.metrics, args.values, args.iterations, elapsed / args.iterations);
+    fflush(out);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_stats_chunks(FILE* out, const BenchArgs& args) {
+    string wire;
+
+    // Fresh response and batch response on the heap for every chunk.
+    bench_run(out, args, "heap_new", [&args, &wire]() -> void {
+        StatsResponse resp;
+        bench_fill_stats(resp.mutable_stats(), args);
+
+        BatchResponse bresp;
+        bench_send(resp, bresp, wire);
+    });
+
+    // Response on the heap reused across the chunks of a device, fresh batch response per chunk.
+    StatsResponse heap_resp;
+    bench_run(out, args, "heap_reused", [&args, &wire, &heap_resp]() -> void {
+        heap_resp.mutable_stats()->clear_metrics();
+        bench_fill_stats(heap_resp.mutable_stats(), args);
+
+        BatchResponse bresp;
+        bench_send(heap_resp, bresp, wire);
+    });
+
+    // As done by the agent: response on an arena reused across the chunks of a device, and batch
+    // response on an arena starting from a block allocated once per stream.
+    Arena arena;
+    auto& resp = *Arena::CreateMessage<StatsResponse>(&arena);
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    bench_run(out, args, "arena", [&args, &wire, &resp, &block]() -> void {
+        resp.mutable_stats()->clear_metrics();
+        bench_fill_stats(resp.mutable_stats(), args);
+
+        Arena barena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&barena);
+        bench_send(resp, bresp, wire);
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -o, --output PATH      Write JSON lines results to PATH instead of stdout.\n"
+            "  -m, --metrics N        Number of metrics in each chunk. Default: 2000\n"
+            "  -v, --values N         Number of values of each metric. Default: 4\n"
+            "  -i, --iterations N     Number of timed chunks per measurement. Default: 300\n",
+            prog);
+}
+
+int main(int argc, char* argv[]) {
+    BenchArgs args{
+        .output_path = NULL,
+        .metrics = 2000,
+        .values = 4,
+        .iterations = 300,
+    };
+
+    static const struct option long_opts[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"values", required_argument, NULL, 'v'},
+        {"iterations", required_argument, NULL, 'i'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "o:m:v:i:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'o': args.output_path = optarg; break;
+        case 'm': args.metrics = strtoul(optarg, NULL, 0); break;
+        case 'v': args.values = strtoul(optarg, NULL, 0); break;
+        case 'i': args.iterations = strtoul(optarg, NULL, 0); break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (args.metrics == 0 || args.iterations == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = stdout;
+    if (args.output_path != NULL) {
+        out = fopen(args.output_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: failed to open output file %s: %s\n",
+                    args.output_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_stats_chunks(out, args);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return EXIT_SUCCESS;
+}
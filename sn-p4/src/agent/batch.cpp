@@ -21,8 +21,10 @@ static void error_resp(
 Status SmartnicP4Impl::Batch(
     [[maybe_unused]] ServerContext* ctx,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
     while (true) {
-        BatchRequest req;
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& req = *Arena::CreateMessage<BatchRequest>(&arena);
         if (!rdwr->Read(&req)) {
             break;
         }
@@ -17,6 +17,7 @@ using namespace std;
 extern "C" {
     struct CountersIoData {
         void* handle;
+        const struct snp4_info_pipeline* pipeline;
         const struct snp4_info_counter_block* info;
     };
 
@@ -36,7 +37,7 @@ extern "C" {
         switch (iod->info->type) {
         case SNP4_INFO_COUNTER_TYPE_PACKETS_AND_BYTES:
             ld->valid = snp4_counter_block_combo_read(
-                iod->handle, iod->info->name,
+                iod->handle, snp4_info_name(iod->pipeline, iod->info->name),
                 &ld->values[0], &ld->values[iod->info->num_counters], iod->info->num_counters);
             break;
 
@@ -44,7 +45,8 @@ extern "C" {
         case SNP4_INFO_COUNTER_TYPE_BYTES:
         case SNP4_INFO_COUNTER_TYPE_FLAG:
             ld->valid = snp4_counter_block_simple_read(
-                iod->handle, iod->info->name, ld->values, iod->info->num_counters);
+                iod->handle, snp4_info_name(iod->pipeline, iod->info->name),
+                ld->values, iod->info->num_counters);
             break;
         }
     }
@@ -73,6 +75,7 @@ extern "C" {
 struct InitCountersBlock {
     const struct snp4_info_pipeline* pipeline;
     const struct snp4_info_counter_block* info;
+    CountersIoData* io_data;
     struct stats_block_spec* bspec;
     struct stats_label_spec* labels;
     struct stats_metric_spec* mspecs;
@@ -82,13 +85,9 @@ struct InitCountersBlock {
 
 extern "C" {
     static const char* counter_block_label_value_alias(const struct stats_label_format_spec* spec) {
-        const struct snp4_info_counter_block* info = (typeof(info))spec->label->data;
-
-        const char* value = NULL;
-        if (spec->idx < info->num_aliases) {
-            value = info->aliases[spec->idx];
-        }
+        const CountersIoData* iod = (typeof(iod))spec->label->data;
 
+        const char* value = snp4_info_counter_block_alias(iod->pipeline, iod->info, spec->idx);
         if (value == NULL) {
             value = "";
         }
@@ -106,7 +105,7 @@ static void init_counters_block_metric(InitCountersBlock* blk,
     auto strs = &blk->strings[idx * COUNTER_NSTRINGS];
 
     ostringstream name;
-    name << blk->info->name;
+    name << snp4_info_name(blk->pipeline, blk->info->name);
     if (units != NULL && add_suffix) {
         name << '_' << units;
     }
@@ -126,7 +125,7 @@ static void init_counters_block_metric(InitCountersBlock* blk,
     mspec->io.offset = idx * blk->info->num_counters;
 
     labels->key = "pipeline";
-    labels->value = blk->pipeline->name;
+    labels->value = snp4_info_name(blk->pipeline, blk->pipeline->name);
     labels += 1;
     mspec->nlabels += 1;
 
@@ -138,11 +137,11 @@ static void init_counters_block_metric(InitCountersBlock* blk,
         mspec->nlabels += 1;
     }
 
-    if (blk->info->aliases != NULL) {
+    if (blk->info->num_aliases > 0) {
         labels->key = "alias";
         labels->flags = STATS_LABEL_FLAG_MASK(NO_EXPORT);
         labels->value_alloc = counter_block_label_value_alias;
-        labels->data = (typeof(labels->data))blk->info;
+        labels->data = (typeof(labels->data))blk->io_data;
         labels += 1;
         mspec->nlabels += 1;
     }
@@ -150,7 +149,7 @@ static void init_counters_block_metric(InitCountersBlock* blk,
 
 //--------------------------------------------------------------------------------------------------
 void SmartnicP4Impl::init_counters(Device* dev, DevicePipeline* pipeline) {
-    const auto pi = &pipeline->info;
+    const auto pi = pipeline->info;
     SERVER_LOG_LINE_INIT(counters, INFO,
         "Initializing " << pi->num_counter_blocks << " counter blocks of pipeline ID " <<
         pipeline->id << " on device " << dev->bus_id);
@@ -173,8 +172,9 @@ void SmartnicP4Impl::init_counters(Device* dev, DevicePipeline* pipeline) {
     memset(bspecs, 0, sizeof(bspecs));
 
     unsigned int total_nmetrics = 0;
+    const auto blocks_info = snp4_info_counter_blocks(pi);
     for (auto bidx = 0; bidx < pi->num_counter_blocks; ++bidx) {
-        const auto bi = &pi->counter_blocks[bidx];
+        const auto bi = &blocks_info[bidx];
 
         auto blk = &blocks[bidx];
         blk->pipeline = pi;
@@ -215,6 +215,13 @@ void SmartnicP4Impl::init_counters(Device* dev, DevicePipeline* pipeline) {
         blk->labels = labels_base;
         labels_base += blk->nmetrics * COUNTER_NLABELS;
 
+        blk->io_data = new CountersIoData{
+            .handle = pipeline->handle,
+            .pipeline = pi,
+            .info = blk->info,
+        };
+        stats->io_data.push_back(blk->io_data);
+
         const char* tname = "UNKNOWN";
         switch (blk->info->type) {
         case SNP4_INFO_COUNTER_TYPE_PACKETS_AND_BYTES:
@@ -239,24 +246,18 @@ void SmartnicP4Impl::init_counters(Device* dev, DevicePipeline* pipeline) {
             break;
         }
 
-        auto io_data = new CountersIoData{
-            .handle = pipeline->handle,
-            .info = blk->info,
-        };
-        stats->io_data.push_back(io_data);
-
-        blk->bspec->name = blk->info->name;
+        blk->bspec->name = snp4_info_name(pi, blk->info->name);
         blk->bspec->metrics = blk->mspecs;
         blk->bspec->nmetrics = blk->nmetrics;
         blk->bspec->latch_metrics = counters_latch_metrics;
         blk->bspec->read_metric = counters_read_metric;
-        blk->bspec->io.data.ptr = io_data;
+        blk->bspec->io.data.ptr = blk->io_data;
         blk->bspec->latch.data_size =
             sizeof(CountersLatchData) +
             blk->nmetrics * blk->info->num_counters * sizeof(uint64_t);
 
         SERVER_LOG_LINE_INIT(counters, INFO,
-            "Setup for block '" << blk->info->name << "' containing " << blk->info->num_counters <<
+            "Setup for block '" << blk->bspec->name << "' containing " << blk->info->num_counters <<
             " counters of type '" << tname << "'" << " of pipeline ID " << pipeline->id <<
             " on device " << dev->bus_id);
     }
@@ -7,6 +7,7 @@
 #include "esnet_smartnic_toplevel.h"
 #include "snp4.h"
 #include "stats.h"
+#include "stats_record.h"
 
 using namespace std;
 
@@ -25,10 +26,16 @@ struct DeviceStats {
 };
 
 //--------------------------------------------------------------------------------------------------
+struct DevicePipelineTable {
+    const struct snp4_table* handle;
+    vector<uint32_t> action_ids; // Indexed in the same order as the actions of the table info.
+};
+
 struct DevicePipeline {
     unsigned int id;
     void* handle;
-    struct snp4_info_pipeline info;
+    struct snp4_info_pipeline* info;
+    vector<DevicePipelineTable> tables; // Indexed in the same order as the tables of the info.
 
     struct {
         DeviceStats* counters;
@@ -44,6 +51,7 @@ struct Device {
 
     struct {
         struct stats_domain* domains[DeviceStatsDomain::NDOMAINS];
+        struct stats_recorder* recorders[DeviceStatsDomain::NDOMAINS];
     } stats;
 };
 
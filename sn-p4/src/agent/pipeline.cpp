@@ -2,6 +2,7 @@
 #include "device.hpp"
 #include "stats.hpp"
 
+#include <algorithm>
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
@@ -20,10 +21,11 @@ using namespace std;
 const struct snp4_info_table*
 SmartnicP4Impl::pipeline_get_table_info(const DevicePipeline* pipeline,
                                         const string& table_name) {
-    const auto pi = &pipeline->info;
+    const auto pi = pipeline->info;
+    const auto tables = snp4_info_tables(pi);
     for (auto idx = 0; idx < pi->num_tables; ++idx) {
-        const auto ti = &pi->tables[idx];
-        if (ti->name == table_name) {
+        const auto ti = &tables[idx];
+        if (snp4_info_name(pi, ti->name) == table_name) {
             return ti;
         }
     }
@@ -37,11 +39,14 @@ bool SmartnicP4Impl::pipeline_has_table(const DevicePipeline* pipeline, const st
 
 //--------------------------------------------------------------------------------------------------
 const struct snp4_info_action*
-SmartnicP4Impl::pipeline_get_table_action_info(const struct snp4_info_table* ti,
+SmartnicP4Impl::pipeline_get_table_action_info(const DevicePipeline* pipeline,
+                                               const struct snp4_info_table* ti,
                                                const string& action_name) {
+    const auto pi = pipeline->info;
+    const auto actions = snp4_info_table_actions(pi, ti);
     for (auto idx = 0; idx < ti->num_actions; ++idx) {
-        const auto ai = &ti->actions[idx];
-        if (ai->name == action_name) {
+        const auto ai = &actions[idx];
+        if (snp4_info_name(pi, ai->name) == action_name) {
             return ai;
         }
     }
@@ -49,19 +54,21 @@ SmartnicP4Impl::pipeline_get_table_action_info(const struct snp4_info_table* ti,
     return NULL;
 }
 
-bool SmartnicP4Impl::pipeline_has_table_action(const struct snp4_info_table* ti,
+bool SmartnicP4Impl::pipeline_has_table_action(const DevicePipeline* pipeline,
+                                               const struct snp4_info_table* ti,
                                                const string& action_name) {
-    return pipeline_get_table_action_info(ti, action_name) != NULL;
+    return pipeline_get_table_action_info(pipeline, ti, action_name) != NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
 const struct snp4_info_counter_block*
 SmartnicP4Impl::pipeline_get_counter_block_info(const DevicePipeline* pipeline,
                                                 const string& block_name) {
-    const auto pi = &pipeline->info;
+    const auto pi = pipeline->info;
+    const auto blocks = snp4_info_counter_blocks(pi);
     for (auto idx = 0; idx < pi->num_counter_blocks; ++idx) {
-        const auto bi = &pi->counter_blocks[idx];
-        if (bi->name == block_name) {
+        const auto bi = &blocks[idx];
+        if (snp4_info_name(pi, bi->name) == block_name) {
             return bi;
         }
     }
@@ -75,7 +82,7 @@ bool SmartnicP4Impl::pipeline_has_counter_block(const DevicePipeline* pipeline,
 }
 
 //--------------------------------------------------------------------------------------------------
-void SmartnicP4Impl::init_pipeline(Device* dev) {
+void SmartnicP4Impl::init_pipeline(Device* dev, const vector<string>& table_shadows) {
     for (unsigned int id = 0; id < snp4_sdnet_count(); ++id) {
         if (!snp4_sdnet_present(id)) {
             continue;
@@ -86,7 +93,8 @@ void SmartnicP4Impl::init_pipeline(Device* dev) {
         auto pipeline = new DevicePipeline{
             .id = id,
             .handle = NULL,
-            .info = {},
+            .info = NULL,
+            .tables = {},
             .stats = {},
         };
 
@@ -116,6 +124,53 @@ void SmartnicP4Impl::init_pipeline(Device* dev) {
             exit(EXIT_FAILURE);
         }
 
+        // Resolve the snp4 handles of all tables and actions up front so that programming rules
+        // doesn't need to look them up by name each time.
+        const auto pi = pipeline->info;
+        const auto tables = snp4_info_tables(pi);
+        pipeline->tables.resize(pi->num_tables);
+        for (auto tidx = 0; tidx < pi->num_tables; ++tidx) {
+            const auto ti = &tables[tidx];
+            const auto table_name = snp4_info_name(pi, ti->name);
+            auto table = &pipeline->tables[tidx];
+
+            table->handle = snp4_table_lookup(pipeline->handle, table_name);
+            if (table->handle == NULL) {
+                SERVER_LOG_LINE_INIT(pipeline, ERROR,
+                    "Failed to resolve table '" << table_name << "' of pipeline ID " << id <<
+                    " on device " << dev->bus_id);
+                exit(EXIT_FAILURE);
+            }
+
+            // Keep a host-side record of the entries of the tables requested, so that conflicting
+            // rules are caught without a round trip to the hardware.
+            if (find(table_shadows.begin(), table_shadows.end(), table_name) !=
+                table_shadows.end()) {
+                SERVER_LOG_LINE_INIT(pipeline, INFO,
+                    "Enabling shadow of table '" << table_name << "' of pipeline ID " << id <<
+                    " on device " << dev->bus_id);
+                if (!snp4_table_shadow_enable(pipeline->handle, table->handle)) {
+                    SERVER_LOG_LINE_INIT(pipeline, ERROR,
+                        "Failed to enable shadow of table '" << table_name << "' of pipeline ID " <<
+                        id << " on device " << dev->bus_id);
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            const auto actions = snp4_info_table_actions(pi, ti);
+            table->action_ids.resize(ti->num_actions);
+            for (auto aidx = 0; aidx < ti->num_actions; ++aidx) {
+                const auto action_name = snp4_info_name(pi, actions[aidx].name);
+                if (!snp4_table_lookup_action(
+                        table->handle, action_name, &table->action_ids[aidx])) {
+                    SERVER_LOG_LINE_INIT(pipeline, ERROR,
+                        "Failed to resolve action '" << action_name << "' of table '" <<
+                        table_name << "' of pipeline ID " << id << " on device " << dev->bus_id);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
         init_counters(dev, pipeline);
         init_table_ecc(dev, pipeline);
 
@@ -139,6 +194,8 @@ void SmartnicP4Impl::deinit_pipeline(Device* dev) {
                 " on device " << dev->bus_id);
         }
 
+        snp4_info_free_pipeline(pipeline->info);
+
         dev->pipelines.pop_back();
         delete pipeline;
     }
@@ -223,17 +280,19 @@ void SmartnicP4Impl::get_pipeline_info(
 
         for (pipeline_id = begin_pipeline_id; pipeline_id <= end_pipeline_id; ++pipeline_id) {
             const auto pipeline = dev->pipelines[pipeline_id];
-            const auto pi = &pipeline->info;
+            const auto pi = pipeline->info;
             PipelineInfoResponse resp;
             auto err = ErrorCode::EC_OK;
 
             auto info = resp.mutable_info();
-            info->set_name(pi->name);
+            info->set_name(snp4_info_name(pi, pi->name));
 
+            const auto tables = snp4_info_tables(pi);
             for (auto tidx = 0; tidx < pi->num_tables; ++tidx) {
-                const auto ti = &pi->tables[tidx];
+                const auto ti = &tables[tidx];
+                const auto table_name = snp4_info_name(pi, ti->name);
                 auto table = info->add_tables();
-                table->set_name(ti->name);
+                table->set_name(table_name);
                 table->set_num_entries(ti->num_entries);
 
                 auto endian = TableEndian::TABLE_ENDIAN_UNKNOWN;
@@ -283,8 +342,9 @@ void SmartnicP4Impl::get_pipeline_info(
                 table->set_priority_width(ti->priority_bits);
                 table->set_action_id_width(ti->actionid_bits);
 
+                const auto matches = snp4_info_table_matches(pi, ti);
                 for (auto midx = 0; midx < ti->num_matches; ++midx) {
-                    const auto mi = &ti->matches[midx];
+                    const auto mi = &matches[midx];
                     auto match = table->add_matches();
                     match->set_width(mi->bits);
 
@@ -321,19 +381,21 @@ void SmartnicP4Impl::get_pipeline_info(
                     match->set_type(type);
                 }
 
+                const auto actions = snp4_info_table_actions(pi, ti);
                 for (auto aidx = 0; aidx < ti->num_actions; ++aidx) {
-                    const auto ai = &ti->actions[aidx];
+                    const auto ai = &actions[aidx];
                     auto action = table->add_actions();
 
-                    action->set_name(ai->name);
+                    action->set_name(snp4_info_name(pi, ai->name));
                     action->set_width(ai->param_bits);
 
+                    const auto params = snp4_info_action_params(pi, ai);
                     for (auto pidx = 0; pidx < ai->num_params; ++pidx) {
-                        const auto pi = &ai->params[pidx];
+                        const auto pri = &params[pidx];
                         auto param = action->add_parameters();
 
-                        param->set_name(pi->name);
-                        param->set_width(pi->bits);
+                        param->set_name(snp4_info_name(pi, pri->name));
+                        param->set_width(pri->bits);
                     }
                 }
 
@@ -343,9 +405,11 @@ void SmartnicP4Impl::get_pipeline_info(
                     };
 
                     SERVER_LOG_LINE_DEBUG(debug_flag, INFO, string(40, '-'));
-                    SERVER_LOG_LINE_DEBUG(debug_flag, INFO, "Dump of table '" << ti->name << "':");
-                    snp4_table_for_each_entry(pipeline->handle, ti->name,
-                                              get_pipeline_info_dump_table, &ctx);
+                    SERVER_LOG_LINE_DEBUG(debug_flag, INFO, "Dump of table '" << table_name << "':");
+                    // Read back from the hardware, even for shadowed tables, to show what the
+                    // pipeline actually holds.
+                    snp4_table_hw_for_each_entry(pipeline->handle, table_name,
+                                                 get_pipeline_info_dump_table, &ctx);
 
                     if (tidx == pi->num_tables - 1) {
                         SERVER_LOG_LINE_DEBUG(debug_flag, INFO, string(40, '-'));
@@ -353,11 +417,12 @@ void SmartnicP4Impl::get_pipeline_info(
                 }
             }
 
+            const auto blocks = snp4_info_counter_blocks(pi);
             for (auto bidx = 0; bidx < pi->num_counter_blocks; ++bidx) {
-                const auto bi = &pi->counter_blocks[bidx];
+                const auto bi = &blocks[bidx];
                 auto block = info->add_counter_blocks();
 
-                block->set_name(bi->name);
+                block->set_name(snp4_info_name(pi, bi->name));
                 block->set_width(bi->width);
                 block->set_num_counters(bi->num_counters);
 
@@ -437,23 +502,54 @@ void SmartnicP4Impl::get_or_clear_pipeline_stats(
         end_dev_id = dev_id;
     }
 
-    GetStatsContext ctx{
-        .filters = req.filters(),
-        .stats = NULL,
-    };
+    GetStatsPosition resume;
+    bool resuming = false;
+    if (!do_clear) {
+        const auto& chunking = req.chunking();
+        if (!chunking.resume_cursor().empty()) {
+            if (!get_stats_resume_parse(chunking.resume_cursor(), resume) ||
+                (int)resume.dev_id < begin_dev_id || (int)resume.dev_id > end_dev_id) {
+                PipelineStatsResponse resp;
+                resp.set_error_code(ErrorCode::EC_INVALID_STATS_CURSOR);
+                write_resp(resp);
+                return;
+            }
 
-    for (dev_id = begin_dev_id; dev_id <= end_dev_id; ++dev_id) {
+            begin_dev_id = resume.dev_id;
+            resuming = true;
+        }
+    }
+
+    // Each device is collected on its own thread, with its own context and response. The response
+    // is built on an arena and reused for all the chunks of all pipelines of the device, keeping
+    // hold of its allocations.
+    auto collect = [&](int dev_id,
+                       const function<void(const PipelineStatsResponse&)>& emit) -> bool {
         const auto dev = devices[dev_id];
+        GetStatsContext ctx{
+            .filters = req.filters(),
+            .stats = NULL,
+        };
+
+        Arena arena;
+        auto& resp = *Arena::CreateMessage<PipelineStatsResponse>(&arena);
+        if (!do_clear) {
+            get_stats_chunks_init(ctx, req.chunking(), [&resp, &ctx, &emit]() -> void {
+                resp.set_error_code(ErrorCode::EC_OK);
+                resp.set_dev_id(ctx.chunks.dev_id);
+                resp.set_pipeline_id(ctx.chunks.part);
+                emit(resp);
+            });
+        }
 
         int begin_pipeline_id = 0;
         int end_pipeline_id = dev->pipelines.size() - 1;
         int pipeline_id = req.pipeline_id(); // 0-based index. -1 means all pipelines.
         if (pipeline_id > end_pipeline_id) {
-            PipelineStatsResponse resp;
             resp.set_error_code(ErrorCode::EC_INVALID_PIPELINE_ID);
             resp.set_dev_id(dev_id);
-            write_resp(resp);
-            continue;
+            emit(resp);
+            return true;
         }
 
         if (pipeline_id > -1) {
@@ -461,35 +557,80 @@ void SmartnicP4Impl::get_or_clear_pipeline_stats(
             end_pipeline_id = pipeline_id;
         }
 
+        auto dev_resuming = resuming && dev_id == (int)resume.dev_id;
+        if (dev_resuming) {
+            if ((int)resume.part < begin_pipeline_id || (int)resume.part > end_pipeline_id) {
+                resp.set_error_code(ErrorCode::EC_INVALID_STATS_CURSOR);
+                resp.set_dev_id(dev_id);
+                emit(resp);
+                return false;
+            }
+            begin_pipeline_id = resume.part;
+        }
+
         for (pipeline_id = begin_pipeline_id; pipeline_id <= end_pipeline_id; ++pipeline_id) {
             auto pipeline = dev->pipelines[pipeline_id];
-            PipelineStatsResponse resp;
 
+            resp.Clear();
             if (pipeline->stats.counters != NULL) {
                 if (do_clear) {
-                    clear_stats_zone(pipeline->stats.counters->zone, ctx.filters);
+                    if (!clear_stats_zone(pipeline->stats.counters->zone, ctx.filters)) {
+                        resp.set_error_code(ErrorCode::EC_STATS_TOO_MANY_BASELINES);
+                        resp.set_dev_id(dev_id);
+                        resp.set_pipeline_id(pipeline_id);
+                        emit(resp);
+                        return false;
+                    }
+                } else if (!get_stats_zone_has_baseline(pipeline->stats.counters->zone,
+                                                        ctx.filters)) {
+                    resp.set_error_code(ErrorCode::EC_STATS_UNKNOWN_BASELINE);
+                    resp.set_dev_id(dev_id);
+                    resp.set_pipeline_id(pipeline_id);
+                    emit(resp);
+                    return false;
                 } else {
                     ctx.stats = resp.mutable_stats();
-                    stats_zone_for_each_metric(
-                        pipeline->stats.counters->zone, get_stats_for_each_metric, &ctx);
+                    ctx.chunks.dev_id = dev_id;
+                    ctx.chunks.part = pipeline_id;
+                    if (dev_resuming) {
+                        get_stats_resume(ctx, resume);
+                    }
+
+                    get_stats_zone(pipeline->stats.counters->zone, ctx);
+                    if (dev_resuming && !get_stats_resumed(ctx)) {
+                        resp.Clear();
+                        resp.set_error_code(ErrorCode::EC_INVALID_STATS_CURSOR);
+                        resp.set_dev_id(dev_id);
+                        resp.set_pipeline_id(pipeline_id);
+                        emit(resp);
+                        return false;
+                    }
                 }
             }
+            dev_resuming = false;
 
             resp.set_error_code(ErrorCode::EC_OK);
             resp.set_dev_id(dev_id);
             resp.set_pipeline_id(pipeline_id);
 
-            write_resp(resp);
+            emit(resp);
         }
-    }
+
+        return true;
+    };
+
+    get_stats_fan_out<PipelineStatsResponse>(begin_dev_id, end_dev_id, collect, write_resp);
 }
 
 //--------------------------------------------------------------------------------------------------
 void SmartnicP4Impl::batch_get_pipeline_stats(
     const PipelineStatsRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    get_or_clear_pipeline_stats(req, false, [&rdwr](const PipelineStatsResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    get_or_clear_pipeline_stats(req, false,
+                                [&rdwr, &block](const PipelineStatsResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto stats = bresp.mutable_pipeline_stats();
         stats->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
@@ -513,8 +654,11 @@ Status SmartnicP4Impl::GetPipelineStats(
 void SmartnicP4Impl::batch_clear_pipeline_stats(
     const PipelineStatsRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    get_or_clear_pipeline_stats(req, true, [&rdwr](const PipelineStatsResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    get_or_clear_pipeline_stats(req, true,
+                                [&rdwr, &block](const PipelineStatsResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto stats = bresp.mutable_pipeline_stats();
         stats->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
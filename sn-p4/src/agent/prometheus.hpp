@@ -4,7 +4,20 @@
 // The prometheus C client headers are not C++ friendly.
 extern "C" {
 #include <prom.h>
-#include <promhttp.h>
 }
 
+//--------------------------------------------------------------------------------------------------
+/*
+ * HTTP endpoint serving the metrics of a registry at /metrics. Requests are handled by a pool of
+ * threads, with scrapes arriving within max_age_ms of each other sharing a single rendering of the
+ * registry. Responses are gzip compressed for clients accepting it.
+ */
+struct PrometheusHttp;
+
+PrometheusHttp* prometheus_http_start(prom_collector_registry_t* registry,
+                                      unsigned int port,
+                                      unsigned int nthreads,
+                                      unsigned int max_age_ms);
+void prometheus_http_stop(PrometheusHttp* http);
+
 #endif // PROMETHEUS_HPP
@@ -3,20 +3,45 @@
 #include "stats.hpp"
 
 #undef NDEBUG // Always force the assert to be non-empty.
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <google/protobuf/io/coded_stream.h>
 #include <grpc/grpc.h>
 #include "sn_p4_v2.grpc.pb.h"
 
+using google::protobuf::io::CodedOutputStream;
 using namespace grpc;
 using namespace sn_p4::v2;
 using namespace std;
 
+#define STATS_BASELINE_TTL 3600 // Default lifetime of a client baseline in seconds.
+#define STATS_REGEXP_CACHE_SIZE 256 // Number of compiled expressions shared across requests.
+#define STATS_WATCH_POLL_MS 500 // Longest wait of a stats watch before checking for cancellation.
+#define STATS_CHUNK_MAX_BYTES (1024 * 1024) // Default and upper limit on the size of a response.
+#define STATS_TOP_K 10 // Default number of values returned by a TopStats request for each device.
+#define STATS_TOP_MAX_K 10000 // Upper limit on the number of values of a TopStats request.
+#define STATS_TOP_WINDOW_MS 1000 // Default window of a TopStats request.
+
 //--------------------------------------------------------------------------------------------------
 class BitArray {
 public:
@@ -55,10 +80,8 @@ public:
 
     size_t count_all_set() const {
         size_t count = 0;
-        for (unsigned int pos = 0; pos < _nbits; ++pos) {
-            if (is_bit_set(pos)) {
-                count += 1;
-            }
+        for (unsigned int w = 0; w < _nwords; ++w) {
+            count += __builtin_popcountll(_words[w]);
         }
 
         return count;
@@ -82,6 +105,24 @@ public:
         return !is_bit_set(pos);
     }
 
+    // Position of the first set bit at or after pos, or size() when there are none.
+    size_t find_next_set(size_t pos) const {
+        if (pos >= _nbits) {
+            return _nbits;
+        }
+
+        size_t w = pos / NBITS_PER_WORD;
+        Word word = _words[w] & (FULL_MASK << (pos % NBITS_PER_WORD));
+        while (word == 0) {
+            if (++w >= _nwords) {
+                return _nbits;
+            }
+            word = _words[w];
+        }
+
+        return w * NBITS_PER_WORD + __builtin_ctzll(word);
+    }
+
     bool is_all_set() const {
         for (unsigned int w = 0; w < _nwords - 1; ++w) {
             if (_words[w] != FULL_MASK) {
@@ -117,6 +158,31 @@ public:
         _words[_nwords - 1] = _upper_mask;
     }
 
+    // Set all bits from first to last inclusively.
+    void set_range(unsigned int first, unsigned int last) {
+        if (first > last || first >= _nbits) {
+            return;
+        }
+        if (last >= _nbits) {
+            last = _nbits - 1;
+        }
+
+        unsigned int fw = first / NBITS_PER_WORD;
+        unsigned int lw = last / NBITS_PER_WORD;
+        Word fmask = FULL_MASK << (first % NBITS_PER_WORD);
+        Word lmask = FULL_MASK >> (NBITS_PER_WORD - 1 - last % NBITS_PER_WORD);
+        if (fw == lw) {
+            _words[fw] |= fmask & lmask;
+            return;
+        }
+
+        _words[fw] |= fmask;
+        for (unsigned int w = fw + 1; w < lw; ++w) {
+            _words[w] = FULL_MASK;
+        }
+        _words[lw] |= lmask;
+    }
+
     void clear_bit(unsigned int pos) {
         if (pos < _nbits) {
             unsigned int w = pos / NBITS_PER_WORD;
@@ -162,6 +228,24 @@ public:
         }
     }
 
+    // Assign each bit from the result of fn(pos), a whole word at a time.
+    template <typename Fn>
+    void assign_each(Fn fn) {
+        for (unsigned int w = 0; w < _nwords; ++w) {
+            _words[w] = eval_word(w, fn);
+        }
+    }
+
+    // Clear each bit for which fn(pos) is false, a whole word at a time.
+    template <typename Fn>
+    void retain_each(Fn fn) {
+        for (unsigned int w = 0; w < _nwords; ++w) {
+            if (_words[w] != 0) {
+                _words[w] &= eval_word(w, fn);
+            }
+        }
+    }
+
     void operator&=(const BitArray& rhs) {
         assert(_nwords == rhs._nwords);
 
@@ -182,6 +266,18 @@ private:
     typedef uint64_t Word;
     static const size_t NBITS_PER_WORD = sizeof(Word) * 8;
 
+    template <typename Fn>
+    Word eval_word(unsigned int w, Fn& fn) const {
+        unsigned int base = w * NBITS_PER_WORD;
+        unsigned int nbits = w < _nwords - 1 ? NBITS_PER_WORD : _nbits - base;
+        Word word = 0;
+        for (unsigned int p = 0; p < nbits; ++p) {
+            word |= (Word)(fn(base + p) ? 1 : 0) << p;
+        }
+
+        return word;
+    }
+
     size_t _nbits;
     size_t _nwords;
     Word* _words;
@@ -191,7 +287,242 @@ private:
 };
 
 //--------------------------------------------------------------------------------------------------
-static bool apply_metric_filter_match_string_regexp(const StringRegexp& regexp, const string str) {
+/*
+ * Compiled form of a regular expression. Patterns which reduce to a literal string are matched with
+ * plain string comparisons rather than through the regex engine. When matched against a full string,
+ * the literal may also be anchored and preceded and/or followed by a ".*" wildcard.
+ */
+struct StatsRegexp {
+    enum class Method {
+        NONE, // The pattern is invalid and never matches.
+        EXACT,
+        PREFIX,
+        SUFFIX,
+        SUBSTRING,
+        REGEX,
+    } method;
+
+    string literal;
+    bool ecma; // Wildcards don't match line terminators.
+    regex re;
+};
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_regexp_literal(const string& pattern, size_t begin, size_t end, string& literal) {
+    // Characters which are taken literally by all grammars, either as is or when escaped.
+    static const char plain[] = "_-:/,=@#%!<>~&;'\" ";
+    static const char escaped[] = ".*[]^$\\";
+
+    literal.clear();
+    for (auto n = begin; n < end; ++n) {
+        auto c = pattern[n];
+        if (c == '\\') {
+            if (++n >= end || pattern[n] == '\0' || strchr(escaped, pattern[n]) == NULL) {
+                return false;
+            }
+            c = pattern[n];
+        } else if (!isalnum((unsigned char)c) && (c == '\0' || strchr(plain, c) == NULL)) {
+            return false;
+        }
+
+        literal.push_back(c);
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+static shared_ptr<const StatsRegexp> stats_regexp_compile(
+    const string& pattern, regex_constants::syntax_option_type syntax, bool search) {
+    auto re = make_shared<StatsRegexp>();
+    re->ecma = syntax == regex_constants::ECMAScript;
+
+    size_t begin = 0;
+    size_t end = pattern.size();
+    bool any_prefix = false;
+    bool any_suffix = false;
+    if (!search) {
+        // Anchors are implied when matching against the full string.
+        if (begin < end && pattern[begin] == '^') {
+            begin += 1;
+        }
+        if (end > begin && pattern[end - 1] == '$' && (end - 1 == begin || pattern[end - 2] != '\\')) {
+            end -= 1;
+        }
+
+        any_prefix = end - begin >= 2 && pattern.compare(begin, 2, ".*") == 0;
+        if (any_prefix) {
+            begin += 2;
+        }
+
+        any_suffix = end - begin >= 2 && pattern.compare(end - 2, 2, ".*") == 0 &&
+            (end - 2 == begin || pattern[end - 3] != '\\');
+        if (any_suffix) {
+            end -= 2;
+        }
+    }
+
+    // Searching for an empty pattern matches between every character, leave that to the engine.
+    if (stats_regexp_literal(pattern, begin, end, re->literal) &&
+        !(search && re->literal.empty())) {
+        if (any_prefix && any_suffix) {
+            re->method = StatsRegexp::Method::SUBSTRING;
+        } else if (any_prefix) {
+            re->method = StatsRegexp::Method::SUFFIX;
+        } else if (any_suffix) {
+            re->method = StatsRegexp::Method::PREFIX;
+        } else {
+            re->method = StatsRegexp::Method::EXACT;
+        }
+        return re;
+    }
+
+    try {
+        re->re.assign(pattern, syntax | regex_constants::optimize);
+        re->method = StatsRegexp::Method::REGEX;
+    } catch (const regex_error&) {
+        re->method = StatsRegexp::Method::NONE;
+    }
+
+    return re;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Compiled expressions are shared by all requests, since clients tend to repeat the same filters on
+ * every poll.
+ */
+static shared_ptr<const StatsRegexp> stats_regexp_get(
+    const string& pattern, regex_constants::syntax_option_type syntax, bool search) {
+    static mutex lock;
+    static unordered_map<string, shared_ptr<const StatsRegexp>> cache;
+
+    auto key = to_string((unsigned int)syntax) + (search ? "s:" : "m:") + pattern;
+    {
+        lock_guard<mutex> guard(lock);
+        auto iter = cache.find(key);
+        if (iter != cache.end()) {
+            return iter->second;
+        }
+    }
+
+    // Compile without holding the lock, since complex patterns can take a while.
+    auto re = stats_regexp_compile(pattern, syntax, search);
+
+    lock_guard<mutex> guard(lock);
+    if (cache.size() >= STATS_REGEXP_CACHE_SIZE) {
+        cache.clear();
+    }
+    cache.emplace(key, re);
+
+    return re;
+}
+
+//--------------------------------------------------------------------------------------------------
+static const StatsRegexp& stats_filter_regexp(const void* msg,
+                                              const string& pattern,
+                                              regex_constants::syntax_option_type syntax,
+                                              bool search,
+                                              StatsFilterCache& cache) {
+    auto& re = cache.regexps[msg];
+    if (re == nullptr) {
+        re = stats_regexp_get(pattern, syntax, search);
+    }
+
+    return *re;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_regexp_match(const StatsRegexp& re, string_view str) {
+    switch (re.method) {
+    case StatsRegexp::Method::NONE:
+        return false;
+
+    case StatsRegexp::Method::EXACT:
+        return str == re.literal;
+
+    case StatsRegexp::Method::REGEX:
+        return regex_match(str.begin(), str.end(), re.re);
+
+    default:
+        break;
+    }
+
+    // The literal holds no line terminators, so the wildcards must match all of them.
+    if (re.ecma && str.find_first_of("\n\r") != string_view::npos) {
+        return false;
+    }
+
+    auto len = re.literal.size();
+    switch (re.method) {
+    case StatsRegexp::Method::PREFIX:
+        return len <= str.size() && str.compare(0, len, re.literal) == 0;
+
+    case StatsRegexp::Method::SUFFIX:
+        return len <= str.size() && str.compare(str.size() - len, len, re.literal) == 0;
+
+    case StatsRegexp::Method::SUBSTRING:
+        return str.find(re.literal) != string_view::npos;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Invoke the callback for each part of the string between matches of the expression, until the
+ * callback returns false. Literal separators yield the same parts as the regex engine would, and an
+ * empty string yields none.
+ */
+template<typename Callback>
+static void stats_regexp_split(const StatsRegexp& re, string_view str, Callback callback) {
+    if (str.empty()) {
+        return;
+    }
+
+    switch (re.method) {
+    case StatsRegexp::Method::NONE:
+        return;
+
+    case StatsRegexp::Method::EXACT: {
+        size_t pos = 0;
+        bool found = false;
+        for (auto next = str.find(re.literal); next != string_view::npos;
+             next = str.find(re.literal, pos)) {
+            found = true;
+            if (!callback(str.substr(pos, next - pos))) {
+                return;
+            }
+            pos = next + re.literal.size();
+        }
+
+        // A trailing empty part is only yielded when the separator isn't found at all.
+        if (!found || pos < str.size()) {
+            callback(str.substr(pos));
+        }
+        return;
+    }
+
+    default:
+        break;
+    }
+
+    cregex_token_iterator parts(str.data(), str.data() + str.size(), re.re, -1);
+    cregex_token_iterator parts_end;
+    for (; parts != parts_end; ++parts) {
+        if (!callback(string_view(parts->first, parts->length()))) {
+            return;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool apply_metric_filter_match_string_regexp(const StringRegexp& regexp,
+                                                    string_view str,
+                                                    StatsFilterCache& cache) {
     regex_constants::syntax_option_type syntax;
     switch (regexp.grammar()) {
     case StringRegexpGrammar::STR_REGEXP_GRAMMAR_BASIC_POSIX:
@@ -221,21 +552,24 @@ static bool apply_metric_filter_match_string_regexp(const StringRegexp& regexp,
         break;
     }
 
-    regex re(regexp.pattern(), syntax);
-    return regex_match(str, re);
+    const auto& re = stats_filter_regexp(&regexp, regexp.pattern(), syntax, false, cache);
+    return stats_regexp_match(re, str);
 }
 
 //--------------------------------------------------------------------------------------------------
-static bool apply_metric_filter_match_string(const StatsMetricMatchString& match, const string str);
+static bool apply_metric_filter_match_string(const StatsMetricMatchString& match,
+                                             string_view str,
+                                             StatsFilterCache& cache);
 
 static bool apply_metric_filter_match_string_split_part_attr(
     const StatsMetricMatchString::Split::Part::Match& match,
-    const string str,
-    const unsigned int index) {
+    string_view str,
+    const unsigned int index,
+    StatsFilterCache& cache) {
     bool ok = false;
     switch (match.attribute_case()) {
     case StatsMetricMatchString::Split::Part::Match::AttributeCase::kValue:
-        ok = apply_metric_filter_match_string(match.value(), str);
+        ok = apply_metric_filter_match_string(match.value(), str, cache);
         break;
 
     case StatsMetricMatchString::Split::Part::Match::AttributeCase::kIndex:
@@ -254,19 +588,20 @@ static bool apply_metric_filter_match_string_split_part_attr(
 //--------------------------------------------------------------------------------------------------
 static bool apply_metric_filter_match_string_split_part(
     const StatsMetricMatchString::Split::Part& part,
-    const string str,
-    const unsigned int index) {
+    string_view str,
+    const unsigned int index,
+    StatsFilterCache& cache) {
     bool ok = false;
     switch (part.term_case()) {
     case StatsMetricMatchString::Split::Part::TermCase::kMatch:
-        ok = apply_metric_filter_match_string_split_part_attr(part.match(), str, index);
+        ok = apply_metric_filter_match_string_split_part_attr(part.match(), str, index, cache);
         break;
 
     case StatsMetricMatchString::Split::Part::TermCase::kAnySet: {
-        auto set = part.any_set();
+        const auto& set = part.any_set();
         ok = set.members_size() < 1; // Treat as a wildcard that always matches.
         for (const auto& member : set.members()) {
-            ok = ok || apply_metric_filter_match_string_split_part(member, str, index);
+            ok = ok || apply_metric_filter_match_string_split_part(member, str, index, cache);
             if (ok) { // Short-circuit logical OR.
                 break;
             }
@@ -275,10 +610,10 @@ static bool apply_metric_filter_match_string_split_part(
     }
 
     case StatsMetricMatchString::Split::Part::TermCase::kAllSet: {
-        auto set = part.all_set();
+        const auto& set = part.all_set();
         ok = true; // Treat as a wildcard that always matches.
         for (const auto& member : set.members()) {
-            ok = ok && apply_metric_filter_match_string_split_part(member, str, index);
+            ok = ok && apply_metric_filter_match_string_split_part(member, str, index, cache);
             if (!ok) { // Short-circuit logical AND.
                 break;
             }
@@ -302,30 +637,35 @@ static bool apply_metric_filter_match_string_split_part(
 //--------------------------------------------------------------------------------------------------
 static bool apply_metric_filter_match_string_split(
     const StatsMetricMatchString::Split& split,
-    const string str) {
-    regex split_re(split.pattern(), regex_constants::ECMAScript);
-    sregex_token_iterator parts(str.begin(), str.end(), split_re, -1);
-    sregex_token_iterator parts_end;
-
-    auto part = split.part();
+    string_view str,
+    StatsFilterCache& cache) {
+    const auto& re = stats_filter_regexp(&split, split.pattern(), regex_constants::ECMAScript, true,
+                                         cache);
+    const auto& part = split.part();
     auto any = split.any();
     unsigned int index = 0;
-    for (; parts != parts_end; ++parts, ++index) {
-        bool ok = apply_metric_filter_match_string_split_part(part, *parts, index);
+    bool done = false;
+    bool result = false;
+    stats_regexp_split(re, str, [&](string_view s) -> bool {
+        bool ok = apply_metric_filter_match_string_split_part(part, s, index++, cache);
         if (any && ok) { // Short-circuit logical OR.
-            return true;
+            done = true;
+            result = true;
         }
         if (!any && !ok) { // Short-circuit logical AND.
-            return false;
+            done = true;
+            result = false;
         }
-    }
+        return !done;
+    });
 
-    return !any && index > 0;
+    return done ? result : !any && index > 0;
 }
 
 //--------------------------------------------------------------------------------------------------
 static bool apply_metric_filter_match_string(const StatsMetricMatchString& match,
-                                             const string str) {
+                                             string_view str,
+                                             StatsFilterCache& cache) {
     bool ok = false;
     switch (match.method_case()) {
     case StatsMetricMatchString::MethodCase::kExact:
@@ -333,7 +673,7 @@ static bool apply_metric_filter_match_string(const StatsMetricMatchString& match
         break;
 
     case StatsMetricMatchString::MethodCase::kPrefix: {
-        const auto prefix = match.prefix();
+        const auto& prefix = match.prefix();
         auto prefix_len = prefix.size();
         ok =
             prefix_len <= str.size() &&
@@ -342,7 +682,7 @@ static bool apply_metric_filter_match_string(const StatsMetricMatchString& match
     }
 
     case StatsMetricMatchString::MethodCase::kSuffix: {
-        const auto suffix = match.suffix();
+        const auto& suffix = match.suffix();
         auto suffix_len = suffix.size();
         auto str_len = str.size();
         ok =
@@ -352,20 +692,20 @@ static bool apply_metric_filter_match_string(const StatsMetricMatchString& match
     }
 
     case StatsMetricMatchString::MethodCase::kSubstring: {
-        const auto sub = match.substring();
+        const auto& sub = match.substring();
         auto sub_len = sub.size();
         ok =
             sub_len <= str.size() &&
-            str.find(sub) != string::npos;
+            str.find(sub) != string_view::npos;
         break;
     }
 
     case StatsMetricMatchString::MethodCase::kRegexp:
-        ok = apply_metric_filter_match_string_regexp(match.regexp(), str);
+        ok = apply_metric_filter_match_string_regexp(match.regexp(), str, cache);
         break;
 
     case StatsMetricMatchString::MethodCase::kSplit:
-        ok = apply_metric_filter_match_string_split(match.split(), str);
+        ok = apply_metric_filter_match_string_split(match.split(), str, cache);
         break;
 
     case StatsMetricMatchString::MethodCase::METHOD_NOT_SET:
@@ -377,11 +717,37 @@ static bool apply_metric_filter_match_string(const StatsMetricMatchString& match
     return ok;
 }
 
+//--------------------------------------------------------------------------------------------------
+/*
+ * Match a name shared by many metrics, such as that of a zone or block. The outcome of the costlier
+ * methods is remembered for the remainder of the request.
+ */
+static bool apply_metric_filter_match_name(const StatsMetricMatchString& match,
+                                           const char* name,
+                                           StatsFilterCache& cache) {
+    auto method = match.method_case();
+    if (method != StatsMetricMatchString::MethodCase::kRegexp &&
+        method != StatsMetricMatchString::MethodCase::kSplit) {
+        return apply_metric_filter_match_string(match, name, cache);
+    }
+
+    auto& names = cache.names[&match];
+    auto iter = names.find(string_view(name));
+    if (iter != names.end()) {
+        return iter->second;
+    }
+
+    bool ok = apply_metric_filter_match_string(match, name, cache);
+    names.emplace(name, ok);
+
+    return ok;
+}
+
 //--------------------------------------------------------------------------------------------------
 static void apply_metric_filter_match_indices(const StatsMetricMatchIndices& indices,
-                                              const struct stats_for_each_spec* spec,
+                                              const struct stats_metric_view* view,
                                               BitArray& valid) {
-    bool is_array = STATS_METRIC_FLAG_TEST(spec->metric->flags, ARRAY);
+    bool is_array = STATS_METRIC_FLAG_TEST(view->metric->flags, ARRAY);
     if (!is_array) {
         // An empty list of slices means to only match the metric if it's a singleton.
         valid.assign_all(indices.slices_size() < 1);
@@ -422,8 +788,9 @@ static void apply_metric_filter_match_indices(const StatsMetricMatchIndices& ind
         // intent is for filtering rather than sorting, using a negative step to reverse the
         // sequence is not supported.
         auto step = slice.step();
-        if (step < 1) {
-            step = 1;
+        if (step <= 1) {
+            valid.set_range(start, end);
+            continue;
         }
 
         for (auto n = start; n <= end; n += step) {
@@ -434,24 +801,25 @@ static void apply_metric_filter_match_indices(const StatsMetricMatchIndices& ind
 
 //--------------------------------------------------------------------------------------------------
 static void apply_metric_filter_match_label(const StatsMetricMatchLabel& label,
-                                            const struct stats_for_each_spec* spec,
-                                            BitArray& valid) {
+                                            const struct stats_metric_view* view,
+                                            BitArray& valid,
+                                            StatsFilterCache& cache) {
     bool has_key = label.has_key();
-    auto key = label.key();
+    const auto& key = label.key();
 
     bool has_value = label.has_value();
-    auto value = label.value();
+    const auto& value = label.value();
 
-    for (unsigned int n = 0; n < spec->nvalues; ++n) {
-        auto v = &spec->values[n];
-        for (auto vl = v->labels; vl < &v->labels[v->nlabels]; ++vl) {
+    for (unsigned int n = 0; n < view->nvalues; ++n) {
+        auto labels = &view->labels[n * view->nlabels];
+        for (auto vl = labels; vl < &labels[view->nlabels]; ++vl) {
             // Treat missing key as a wildcard that always matches.
-            if (has_key && !apply_metric_filter_match_string(key, vl->key)) {
+            if (has_key && !apply_metric_filter_match_name(key, vl->key, cache)) {
                 continue;
             }
 
             // Treat missing value as a wildcard that always matches.
-            if (has_value && !apply_metric_filter_match_string(value, vl->value)) {
+            if (has_value && !apply_metric_filter_match_string(value, vl->value, cache)) {
                 continue;
             }
 
@@ -462,10 +830,37 @@ static void apply_metric_filter_match_label(const StatsMetricMatchLabel& label,
 }
 
 //--------------------------------------------------------------------------------------------------
-static void apply_metric_filter_match(const struct stats_for_each_spec* spec,
+static void apply_metric_filter_match_last_change(const StatsMetricMatchLastChange& last_change,
+                                                  const struct stats_metric_view* view,
+                                                  BitArray& valid) {
+    if (last_change.age_case() == StatsMetricMatchLastChange::AgeCase::AGE_NOT_SET) {
+        // Treat as a wildcard that always matches for all indices.
+        valid.set_all();
+        return;
+    }
+
+    // Values which don't track when they last changed can't be matched by age.
+    struct timespec ts;
+    if (view->last_change == NULL || clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return;
+    }
+
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    bool unchanged = last_change.has_unchanged_for_ms();
+    uint64_t age_ns =
+        (unchanged ? last_change.unchanged_for_ms() : last_change.changed_within_ms()) * 1000000;
+    valid.assign_each([&](unsigned int n) {
+        auto age = now - view->last_change[n];
+        return unchanged ? age >= age_ns : age <= age_ns;
+    });
+}
+
+//--------------------------------------------------------------------------------------------------
+static void apply_metric_filter_match(const struct stats_metric_view* view,
                                       const StatsMetricMatch& match,
                                       const StatsMetricType type,
-                                      BitArray& valid) {
+                                      BitArray& valid,
+                                      StatsFilterCache& cache) {
     bool ok = false;
     switch (match.attribute_case()) {
     case StatsMetricMatch::AttributeCase::kType:
@@ -475,32 +870,37 @@ static void apply_metric_filter_match(const struct stats_for_each_spec* spec,
 
     case StatsMetricMatch::AttributeCase::kDomain:
         // Validity is computed once for all indices since the attribute is shared by all values.
-        ok = apply_metric_filter_match_string(match.domain(), spec->domain->name);
+        ok = apply_metric_filter_match_name(match.domain(), view->domain->name, cache);
         break;
 
     case StatsMetricMatch::AttributeCase::kZone:
         // Validity is computed once for all indices since the attribute is shared by all values.
-        ok = apply_metric_filter_match_string(match.zone(), spec->zone->name);
+        ok = apply_metric_filter_match_name(match.zone(), view->zone->name, cache);
         break;
 
     case StatsMetricMatch::AttributeCase::kBlock:
         // Validity is computed once for all indices since the attribute is shared by all values.
-        ok = apply_metric_filter_match_string(match.block(), spec->block->name);
+        ok = apply_metric_filter_match_name(match.block(), view->block->name, cache);
         break;
 
     case StatsMetricMatch::AttributeCase::kName:
         // Validity is computed once for all indices since the attribute is shared by all values.
-        ok = apply_metric_filter_match_string(match.name(), spec->metric->name);
+        ok = apply_metric_filter_match_name(match.name(), view->metric->name, cache);
         break;
 
     case StatsMetricMatch::AttributeCase::kIndices:
         // Validity is computed per index based on whether each is included in the given slices.
-        apply_metric_filter_match_indices(match.indices(), spec, valid);
+        apply_metric_filter_match_indices(match.indices(), view, valid);
         return;
 
     case StatsMetricMatch::AttributeCase::kLabel:
         // Validity is computed per index based on whether each value has the given labels.
-        apply_metric_filter_match_label(match.label(), spec, valid);
+        apply_metric_filter_match_label(match.label(), view, valid, cache);
+        return;
+
+    case StatsMetricMatch::AttributeCase::kLastChange:
+        // Validity is computed per index based on the time elapsed since each value last changed.
+        apply_metric_filter_match_last_change(match.last_change(), view, valid);
         return;
 
     case StatsMetricMatch::AttributeCase::ATTRIBUTE_NOT_SET:
@@ -513,17 +913,18 @@ static void apply_metric_filter_match(const struct stats_for_each_spec* spec,
 }
 
 //--------------------------------------------------------------------------------------------------
-static void apply_metric_filter(const struct stats_for_each_spec* spec,
+static void apply_metric_filter(const struct stats_metric_view* view,
                                 const StatsMetricFilter& filter,
                                 const StatsMetricType type,
-                                BitArray& valid) {
+                                BitArray& valid,
+                                StatsFilterCache& cache) {
     switch (filter.term_case()) {
     case StatsMetricFilter::TermCase::kMatch:
-        apply_metric_filter_match(spec, filter.match(), type, valid);
+        apply_metric_filter_match(view, filter.match(), type, valid, cache);
         break;
 
     case StatsMetricFilter::TermCase::kAnySet: {
-        auto set = filter.any_set();
+        const auto& set = filter.any_set();
         if (set.members_size() < 1) {
             // Treat as a wildcard that always matches for all indices.
             valid.set_all();
@@ -532,7 +933,7 @@ static void apply_metric_filter(const struct stats_for_each_spec* spec,
 
         BitArray v(valid.size());
         for (const auto& member : set.members()) {
-            apply_metric_filter(spec, member, type, v);
+            apply_metric_filter(view, member, type, v, cache);
             valid |= v;
             if (valid.is_all_set()) { // Short-circuit logical OR.
                 break;
@@ -543,7 +944,7 @@ static void apply_metric_filter(const struct stats_for_each_spec* spec,
     }
 
     case StatsMetricFilter::TermCase::kAllSet: {
-        auto set = filter.all_set();
+        const auto& set = filter.all_set();
         valid.set_all();
         if (set.members_size() < 1) {
             // Treat as a wildcard that always matches for all indices.
@@ -552,7 +953,7 @@ static void apply_metric_filter(const struct stats_for_each_spec* spec,
 
         BitArray v(valid.size());
         for (const auto& member : set.members()) {
-            apply_metric_filter(spec, member, type, v);
+            apply_metric_filter(view, member, type, v, cache);
             valid &= v;
             if (valid.is_all_cleared()) { // Short-circuit logical AND.
                 break;
@@ -574,190 +975,944 @@ static void apply_metric_filter(const struct stats_for_each_spec* spec,
 }
 
 //--------------------------------------------------------------------------------------------------
-static void apply_filters(const struct stats_for_each_spec* spec,
-                          const StatsFilters& filters,
-                          const StatsMetricType type,
-                          BitArray& valid) {
-    bool non_zero = filters.non_zero();
-    for(unsigned int n = 0; n < spec->nvalues; ++n) {
-        valid.assign_bit(n, !non_zero || spec->values[n].u64 != 0);
-    }
+/*
+ * Outcome of a filter for all metrics of a block, determined from the domain, zone and block alone.
+ */
+enum class StatsScopeMatch {
+    NONE, // No value of any metric in the block can match.
+    ALL,  // All values of every metric in the block match.
+    SOME, // Depends on the metric or its values.
+};
 
-    if (valid.is_all_cleared()) {
-        return;
-    }
+static StatsScopeMatch apply_scope_filter_match(const struct stats_metric_view* scope,
+                                                const StatsMetricMatch& match,
+                                                StatsFilterCache& cache) {
+    bool ok = false;
+    switch (match.attribute_case()) {
+    case StatsMetricMatch::AttributeCase::kDomain:
+        ok = apply_metric_filter_match_name(match.domain(), scope->domain->name, cache);
+        break;
 
-    if (filters.has_metric_filter()) {
-        BitArray v(valid.size());
-        apply_metric_filter(spec, filters.metric_filter(), type, v);
-        valid &= v;
+    case StatsMetricMatch::AttributeCase::kZone:
+        ok = apply_metric_filter_match_name(match.zone(), scope->zone->name, cache);
+        break;
+
+    case StatsMetricMatch::AttributeCase::kBlock:
+        ok = apply_metric_filter_match_name(match.block(), scope->block->name, cache);
+        break;
+
+    case StatsMetricMatch::AttributeCase::ATTRIBUTE_NOT_SET:
+        ok = true;
+        break;
+
+    default:
+        return StatsScopeMatch::SOME;
     }
+
+    return ok ? StatsScopeMatch::ALL : StatsScopeMatch::NONE;
 }
 
 //--------------------------------------------------------------------------------------------------
-extern "C" {
-    int get_stats_for_each_metric(const struct stats_for_each_spec* spec) {
-        GetStatsContext* ctx = static_cast<typeof(ctx)>(spec->arg);
-
-        StatsMetricType type;
-        switch (spec->metric->type) {
-        case stats_metric_type_COUNTER:
-            type = StatsMetricType::STATS_METRIC_TYPE_COUNTER;
-            break;
-
-        case stats_metric_type_GAUGE:
-            type = StatsMetricType::STATS_METRIC_TYPE_GAUGE;
-            break;
+/*
+ * Evaluate a filter for the scope of a block. Only the domain, zone and block of the scope view are
+ * set. Follows the same rules as apply_metric_filter, with metric and value attributes unknown.
+ */
+static StatsScopeMatch apply_scope_filter(const struct stats_metric_view* scope,
+                                          const StatsMetricFilter& filter,
+                                          StatsFilterCache& cache) {
+    auto result = StatsScopeMatch::ALL;
+    switch (filter.term_case()) {
+    case StatsMetricFilter::TermCase::kMatch:
+        result = apply_scope_filter_match(scope, filter.match(), cache);
+        break;
 
-        case stats_metric_type_FLAG:
-            type = StatsMetricType::STATS_METRIC_TYPE_FLAG;
+    case StatsMetricFilter::TermCase::kAnySet: {
+        const auto& set = filter.any_set();
+        if (set.members_size() < 1) {
             break;
-
-        default:
-            return 0;
         }
 
-        BitArray valid(spec->nvalues);
-        apply_filters(spec, ctx->filters, type, valid);
-        if (valid.is_all_cleared()) {
-            return 0;
+        result = StatsScopeMatch::NONE;
+        for (const auto& member : set.members()) {
+            auto r = apply_scope_filter(scope, member, cache);
+            if (r == StatsScopeMatch::ALL) { // Short-circuit logical OR.
+                result = r;
+                break;
+            }
+            if (r == StatsScopeMatch::SOME) {
+                result = r;
+            }
         }
+        break;
+    }
 
-        auto metric = ctx->stats->add_metrics();
-        metric->set_type(type);
-        metric->set_name(spec->metric->name);
-        metric->set_num_elements(spec->metric->nelements);
-
-        auto scope = metric->mutable_scope();
-        scope->set_domain(spec->domain->name);
-        scope->set_zone(spec->zone->name);
-        scope->set_block(spec->block->name);
-
-        auto last_update = metric->mutable_last_update();
-        last_update->set_seconds(spec->last_update.tv_sec);
-        last_update->set_nanos(spec->last_update.tv_nsec);
-
-        bool with_labels = ctx->filters.with_labels();
-        for (unsigned int n = 0; n < spec->nvalues; ++n) {
-            if (!valid.is_bit_set(n)) {
-                continue;
+    case StatsMetricFilter::TermCase::kAllSet:
+        for (const auto& member : filter.all_set().members()) {
+            auto r = apply_scope_filter(scope, member, cache);
+            if (r == StatsScopeMatch::NONE) { // Short-circuit logical AND.
+                result = r;
+                break;
             }
-
-            auto v = &spec->values[n];
-            auto value = metric->add_values();
-            value->set_index(n);
-            value->set_u64(v->u64);
-            value->set_f64(v->f64);
-
-            if (with_labels) {
-                for (auto l = v->labels; l < &v->labels[v->nlabels]; ++l) {
-                    auto label = value->add_labels();
-                    label->set_key(l->key);
-                    label->set_value(l->value);
-                }
+            if (r == StatsScopeMatch::SOME) {
+                result = r;
             }
         }
+        break;
 
-        return 0;
+    case StatsMetricFilter::TermCase::TERM_NOT_SET:
+        break;
     }
 
-    struct ClearStatsContext {
-        const StatsFilters& filters;
-        BitArray* valid;
-    };
-
-    void clear_stats_filter_setup(const struct stats_clear_filter_spec* spec, void* arg) {
-        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
-
-        StatsMetricType type;
-        switch (spec->metric->type) {
-        case stats_metric_type_COUNTER:
-            type = StatsMetricType::STATS_METRIC_TYPE_COUNTER;
-            break;
-
-        case stats_metric_type_GAUGE:
-            type = StatsMetricType::STATS_METRIC_TYPE_GAUGE;
+    if (filter.negated()) {
+        switch (result) {
+        case StatsScopeMatch::NONE:
+            result = StatsScopeMatch::ALL;
             break;
 
-        case stats_metric_type_FLAG:
-            type = StatsMetricType::STATS_METRIC_TYPE_FLAG;
+        case StatsScopeMatch::ALL:
+            result = StatsScopeMatch::NONE;
             break;
 
-        default:
-            type = StatsMetricType::STATS_METRIC_TYPE_UNKNOWN;
+        case StatsScopeMatch::SOME:
             break;
         }
-
-        struct stats_for_each_spec for_each_spec = {
-            .domain = spec->domain,
-            .zone = spec->zone,
-            .block = spec->block,
-            .metric = spec->metric,
-            .values = spec->values,
-            .nvalues = spec->nvalues,
-            .last_update = {},
-            .arg = NULL,
-        };
-        ctx->valid = new BitArray(spec->nvalues);
-        apply_metric_filter(&for_each_spec, ctx->filters.metric_filter(), type, *ctx->valid);
     }
 
-    void clear_stats_filter_teardown([[maybe_unused]] const struct stats_clear_filter_spec* spec,
-                                     void* arg) {
-        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
-        delete ctx->valid;
-        ctx->valid = NULL;
-    }
-
-    bool clear_stats_filter_match([[maybe_unused]] const struct stats_clear_filter_spec* spec,
-                                  unsigned int value_idx,
-                                  void* arg) {
-        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
-        return ctx->valid->is_bit_set(value_idx);
-    }
+    return result;
 }
 
 //--------------------------------------------------------------------------------------------------
-static void clear_stats_domain(struct stats_domain* domain, const StatsFilters& filters) {
-    if (filters.has_metric_filter()) {
-        ClearStatsContext ctx{
-            .filters = filters,
-            .valid = NULL,
-        };
-        struct stats_clear_filter clear_filter{
-            .setup = clear_stats_filter_setup,
-            .teardown = clear_stats_filter_teardown,
-            .match = clear_stats_filter_match,
-            .arg = &ctx,
-        };
-        stats_domain_clear_metrics(domain, &clear_filter);
+static void apply_filters(const struct stats_metric_view* view,
+                          const StatsFilters& filters,
+                          const StatsMetricType type,
+                          BitArray& valid,
+                          StatsFilterCache& cache) {
+    if (filters.non_zero()) {
+        valid.assign_each([view](unsigned int n) { return view->u64[n] != 0; });
     } else {
-        stats_domain_clear_metrics(domain, NULL);
+        valid.set_all();
+    }
+
+    if (valid.is_all_cleared()) {
+        return;
     }
-}
 
-//--------------------------------------------------------------------------------------------------
-void clear_stats_zone(struct stats_zone* zone, const StatsFilters& filters) {
     if (filters.has_metric_filter()) {
-        ClearStatsContext ctx{
-            .filters = filters,
-            .valid = NULL,
-        };
-        struct stats_clear_filter clear_filter{
-            .setup = clear_stats_filter_setup,
-            .teardown = clear_stats_filter_teardown,
-            .match = clear_stats_filter_match,
-            .arg = &ctx,
-        };
-        stats_zone_clear_metrics(zone, &clear_filter);
-    } else {
-        stats_zone_clear_metrics(zone, NULL);
+        BitArray v(valid.size());
+        apply_metric_filter(view, filters.metric_filter(), type, v, cache);
+        valid &= v;
     }
 }
 
 //--------------------------------------------------------------------------------------------------
-void SmartnicP4Impl::get_or_clear_stats(
-    const StatsRequest& req,
+static StatsMetricType stats_metric_type(enum stats_metric_type type) {
+    switch (type) {
+    case stats_metric_type_COUNTER:
+        return StatsMetricType::STATS_METRIC_TYPE_COUNTER;
+
+    case stats_metric_type_GAUGE:
+        return StatsMetricType::STATS_METRIC_TYPE_GAUGE;
+
+    case stats_metric_type_FLAG:
+        return StatsMetricType::STATS_METRIC_TYPE_FLAG;
+    }
+
+    return StatsMetricType::STATS_METRIC_TYPE_UNKNOWN;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Cursors are opaque to clients. The numeric parts of the position come first, followed by the
+ * token and the names, which are each on their own line since they may contain any other character.
+ */
+static string get_stats_resume_format(const GetStatsPosition& pos) {
+    char prefix[6 * (8 + 1) + 1];
+    snprintf(prefix, sizeof(prefix), "%x:%x:%x:%x:%x:%x:",
+             pos.dev_id, pos.part, pos.is_delta, pos.zone_occurrence, pos.metric, pos.value);
+
+    string cursor(prefix);
+    for (auto part : {&pos.token, &pos.zone, &pos.block, &pos.metric_name}) {
+        if (part != &pos.token) {
+            cursor += '\n';
+        }
+        cursor += *part;
+    }
+
+    return cursor;
+}
+
+//--------------------------------------------------------------------------------------------------
+bool get_stats_resume_parse(const string& cursor, GetStatsPosition& pos) {
+    unsigned int is_delta;
+    int len = 0;
+    if (sscanf(cursor.c_str(), "%x:%x:%x:%x:%x:%x:%n",
+               &pos.dev_id, &pos.part, &is_delta, &pos.zone_occurrence, &pos.metric, &pos.value,
+               &len) != 6 || len == 0) {
+        return false;
+    }
+    pos.is_delta = is_delta != 0;
+
+    size_t begin = len;
+    for (auto part : {&pos.token, &pos.zone, &pos.block, &pos.metric_name}) {
+        if (begin > cursor.size()) {
+            return false;
+        }
+
+        auto end = cursor.find('\n', begin);
+        if (end == string::npos) {
+            end = cursor.size();
+        }
+        part->assign(cursor, begin, end - begin);
+        begin = end + 1;
+    }
+
+    return begin == cursor.size() + 1 && !pos.token.empty();
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_set_metric_scope(const struct stats_metric_view* view,
+                                       StatsMetricType type,
+                                       StatsMetric* metric) {
+    metric->set_type(type);
+    metric->set_name(view->metric->name);
+    metric->set_num_elements(view->metric->nelements);
+
+    auto scope = metric->mutable_scope();
+    scope->set_domain(view->domain->name);
+    scope->set_zone(view->zone->name);
+    scope->set_block(view->block->name);
+
+    auto last_update = metric->mutable_last_update();
+    last_update->set_seconds(view->last_update.tv_sec);
+    last_update->set_nanos(view->last_update.tv_nsec);
+}
+
+//--------------------------------------------------------------------------------------------------
+static StatsMetric* get_stats_add_metric_scope(const struct stats_metric_view* view,
+                                               StatsMetricType type,
+                                               GetStatsContext& ctx) {
+    auto metric = ctx.stats->add_metrics();
+    get_stats_set_metric_scope(view, type, metric);
+
+    if (ctx.chunks.flush != nullptr) {
+        ctx.chunks.nbytes += metric->ByteSizeLong();
+    }
+
+    return metric;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool get_stats_chunk_is_full(const GetStatsChunks& chunks) {
+    return
+        chunks.flush != nullptr && chunks.nvalues > 0 &&
+        ((chunks.max_values > 0 && chunks.nvalues >= chunks.max_values) ||
+         (chunks.max_bytes > 0 && chunks.nbytes >= chunks.max_bytes));
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Send the current chunk, positioned at the given value of the metric in view. The next chunk
+ * starts out empty, but keeps the token of the stats.
+ */
+static void get_stats_chunk_flush(const struct stats_metric_view* view,
+                                  unsigned int value_idx,
+                                  GetStatsContext& ctx) {
+    auto& chunks = ctx.chunks;
+    auto stats = ctx.stats;
+    GetStatsPosition pos;
+    pos.dev_id = chunks.dev_id;
+    pos.part = chunks.part;
+    pos.is_delta = stats->is_delta();
+    pos.token = stats->token();
+    pos.zone = view->zone->name;
+    pos.zone_occurrence = chunks.zone_occurrence;
+    pos.block = view->block->name;
+    pos.metric = view->index;
+    pos.metric_name = view->metric->name;
+    pos.value = value_idx;
+    stats->set_cursor(get_stats_resume_format(pos));
+    chunks.flush();
+
+    stats->clear_metrics();
+    stats->clear_removed();
+    stats->clear_cursor();
+    chunks.nvalues = 0;
+    chunks.nbytes = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Skip the metrics of the resumed block which precede the resume position. Returns false when the
+ * metric is to be skipped, otherwise sets the index of its first value to include.
+ */
+static bool get_stats_resume_metric(const struct stats_metric_view* view,
+                                    GetStatsContext& ctx,
+                                    unsigned int& first) {
+    auto& chunks = ctx.chunks;
+    switch (chunks.resume) {
+    case GetStatsChunks::Resume::NONE:
+        return true;
+
+    case GetStatsChunks::Resume::ENTERED: {
+        const auto& from = chunks.from;
+        if (view->index < from.metric) {
+            return false;
+        }
+
+        chunks.resume = GetStatsChunks::Resume::NONE;
+        if (view->index > from.metric) {
+            return true; // The metric of the position had nothing left to include.
+        }
+
+        if (from.metric_name != view->metric->name || from.value > view->nvalues) {
+            chunks.resume = GetStatsChunks::Resume::LOST;
+            return false;
+        }
+
+        first = from.value;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Append a value to the packed values of an array metric. Indices are only listed once a value
+ * breaks the run of consecutive indices following the start index.
+ */
+static void get_stats_add_packed_value(const struct stats_metric_view* view,
+                                       unsigned int value_idx,
+                                       bool with_last_change,
+                                       StatsMetricPackedValues* packed,
+                                       GetStatsChunks& chunks) {
+    unsigned int nvalues = packed->u64_size();
+    if (packed->indices_size() > 0) {
+        packed->add_indices(value_idx);
+    } else if (value_idx != packed->start_index() + nvalues) {
+        auto indices = packed->mutable_indices();
+        indices->Reserve(nvalues + 1);
+        for (unsigned int n = 0; n < nvalues; ++n) {
+            indices->AddAlreadyReserved(packed->start_index() + n);
+        }
+        indices->AddAlreadyReserved(value_idx);
+        packed->set_start_index(0);
+    }
+
+    // Unconverted values are the same as doubles, so are left for clients to convert themselves.
+    auto u64 = view->u64[value_idx];
+    bool converted = view->block->convert_metric != NULL;
+    packed->add_u64(u64);
+    if (converted) {
+        packed->add_f64(view->f64[value_idx]);
+    }
+    if (with_last_change) {
+        packed->add_last_change_ns(view->last_change[value_idx]);
+    }
+
+    if (chunks.flush != nullptr) {
+        chunks.nvalues += 1;
+        chunks.nbytes += CodedOutputStream::VarintSize64(u64);
+        if (converted) {
+            chunks.nbytes += sizeof(double);
+        }
+        if (with_last_change) {
+            chunks.nbytes += CodedOutputStream::VarintSize64(view->last_change[value_idx]);
+        }
+        if (packed->indices_size() > 0) {
+            chunks.nbytes += CodedOutputStream::VarintSize32(value_idx);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_set_value(const struct stats_metric_view* view,
+                                unsigned int value_idx,
+                                bool with_labels,
+                                bool with_last_change,
+                                StatsMetricValue* value) {
+    value->set_index(value_idx);
+    value->set_u64(view->u64[value_idx]);
+    value->set_f64(view->f64[value_idx]);
+
+    if (with_labels) {
+        auto labels = &view->labels[value_idx * view->nlabels];
+        for (auto l = labels; l < &labels[view->nlabels]; ++l) {
+            auto label = value->add_labels();
+            label->set_key(l->key);
+            label->set_value(l->value);
+        }
+    }
+
+    if (with_last_change) {
+        auto last_change = value->mutable_last_change();
+        last_change->set_seconds(view->last_change[value_idx] / 1000000000);
+        last_change->set_nanos(view->last_change[value_idx] % 1000000000);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_add_metric(const struct stats_metric_view* view, GetStatsContext& ctx) {
+    auto type = stats_metric_type(view->metric->type);
+    if (type == StatsMetricType::STATS_METRIC_TYPE_UNKNOWN) {
+        return;
+    }
+
+    unsigned int first = 0;
+    if (!get_stats_resume_metric(view, ctx, first)) {
+        return;
+    }
+
+    BitArray valid(view->nvalues);
+    apply_filters(view, ctx.filters, type, valid, ctx.cache);
+    if (ctx.since > 0) {
+        valid.retain_each([view, &ctx](unsigned int n) { return view->generations[n] > ctx.since; });
+    }
+
+    if (valid.is_all_cleared()) {
+        return;
+    }
+
+    auto& chunks = ctx.chunks;
+    StatsMetric* metric = NULL;
+    bool with_labels = ctx.filters.with_labels();
+    bool with_last_change = ctx.filters.with_last_change() && view->last_change != NULL;
+    bool packed =
+        ctx.filters.packed_values() && !with_labels &&
+        STATS_METRIC_FLAG_TEST(view->metric->flags, ARRAY);
+    for (auto n = valid.find_next_set(first); n < view->nvalues; n = valid.find_next_set(n + 1)) {
+        // Large arrays are split, each chunk holding a metric with the values which it includes.
+        if (get_stats_chunk_is_full(chunks)) {
+            get_stats_chunk_flush(view, n, ctx);
+            metric = NULL;
+        }
+
+        if (metric == NULL) {
+            metric = get_stats_add_metric_scope(view, type, ctx);
+            if (packed) {
+                metric->mutable_packed_values()->set_start_index(n);
+            }
+        }
+
+        if (packed) {
+            get_stats_add_packed_value(
+                view, n, with_last_change, metric->mutable_packed_values(), chunks);
+            continue;
+        }
+
+        auto value = metric->add_values();
+        get_stats_set_value(view, n, with_labels, with_last_change, value);
+
+        if (chunks.flush != nullptr) {
+            chunks.nvalues += 1;
+            chunks.nbytes += value->ByteSizeLong();
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_cursor_filter_match(const StatsMetricMatch& match,
+                                          struct stats_cursor_filter& cfilter) {
+    switch (match.attribute_case()) {
+    case StatsMetricMatch::AttributeCase::kZone:
+        if (cfilter.zone == NULL && match.zone().has_exact()) {
+            cfilter.zone = match.zone().exact().c_str();
+        }
+        break;
+
+    case StatsMetricMatch::AttributeCase::kBlock:
+        if (cfilter.block == NULL && match.block().has_exact()) {
+            cfilter.block = match.block().exact().c_str();
+        }
+        break;
+
+    case StatsMetricMatch::AttributeCase::kName:
+        if (cfilter.metric == NULL && match.name().has_exact()) {
+            cfilter.metric = match.name().exact().c_str();
+        }
+        break;
+
+    case StatsMetricMatch::AttributeCase::kLabel: {
+        const auto& label = match.label();
+        if (cfilter.label.key != NULL || !label.has_key() || !label.key().has_exact()) {
+            break;
+        }
+
+        cfilter.label.key = label.key().exact().c_str();
+        if (label.has_value() && label.value().has_exact()) {
+            cfilter.label.value = label.value().exact().c_str();
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Track the occurrence of the zone of each block, for positions to tell apart zones sharing the same
+ * name, and skip the blocks which precede the resume position. Returns false to skip the block.
+ */
+static bool get_stats_resume_block(const struct stats_zone_spec* zone,
+                                   const struct stats_block_spec* block,
+                                   GetStatsContext& ctx) {
+    auto& chunks = ctx.chunks;
+    if (chunks.zone != zone) {
+        chunks.zone = zone;
+        chunks.zone_occurrence = chunks.zone_occurrences[zone->name]++;
+    }
+
+    const auto& from = chunks.from;
+    switch (chunks.resume) {
+    case GetStatsChunks::Resume::PENDING:
+        if (from.zone_occurrence != chunks.zone_occurrence ||
+            from.zone != zone->name ||
+            from.block != block->name) {
+            return false;
+        }
+        chunks.resume = GetStatsChunks::Resume::ENTERED;
+        return true;
+
+    case GetStatsChunks::Resume::ENTERED:
+        // The remaining metrics of the resumed block had nothing left to include.
+        chunks.resume = GetStatsChunks::Resume::NONE;
+        return true;
+
+    case GetStatsChunks::Resume::LOST:
+        return false;
+
+    default:
+        return true;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+extern "C" {
+    bool get_stats_match_block(const struct stats_domain_spec* domain,
+                               const struct stats_zone_spec* zone,
+                               const struct stats_block_spec* block,
+                               void* arg) {
+        GetStatsContext* ctx = static_cast<typeof(ctx)>(arg);
+        if (!get_stats_resume_block(zone, block, *ctx)) {
+            return false;
+        }
+
+        if (!ctx->filters.has_metric_filter()) {
+            return true;
+        }
+
+        struct stats_metric_view scope = {
+            .domain = domain,
+            .zone = zone,
+            .block = block,
+            .metric = NULL,
+            .index = 0,
+            .last_update = {},
+            .nvalues = 0,
+            .u64 = NULL,
+            .f64 = NULL,
+            .generations = NULL,
+            .last_change = NULL,
+            .labels = NULL,
+            .nlabels = 0,
+        };
+
+        auto result = apply_scope_filter(&scope, ctx->filters.metric_filter(), ctx->cache);
+        return result != StatsScopeMatch::NONE;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Collect the exact matches which every metric selected by the filter must satisfy.
+ */
+static void get_stats_cursor_filter_matches(const StatsMetricFilter& filter,
+                                            struct stats_cursor_filter& cfilter) {
+    if (filter.negated()) {
+        return;
+    }
+
+    switch (filter.term_case()) {
+    case StatsMetricFilter::TermCase::kMatch:
+        get_stats_cursor_filter_match(filter.match(), cfilter);
+        break;
+
+    case StatsMetricFilter::TermCase::kAllSet:
+        for (const auto& member : filter.all_set().members()) {
+            if (!member.negated() && member.term_case() == StatsMetricFilter::TermCase::kMatch) {
+                get_stats_cursor_filter_match(member.match(), cfilter);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Push the exact matches which every returned metric must satisfy down into the stats engine, so
+ * that non-matching metrics are skipped before their values are visited. Metrics with an exact name
+ * or label are looked up through the index of each zone rather than found by a scan. Blocks which can't match
+ * based on their scope alone are skipped as a whole. The full set of filters is still applied to
+ * each metric yielded by the cursor.
+ */
+static void get_stats_cursor_filter(GetStatsContext& ctx, struct stats_cursor_filter& cfilter) {
+    const auto& filters = ctx.filters;
+    cfilter = {};
+    cfilter.non_zero = filters.non_zero();
+    cfilter.changed_since = ctx.since;
+    if (!filters.baseline().empty()) {
+        cfilter.baseline = filters.baseline().c_str();
+    }
+
+    if (ctx.chunks.flush != nullptr || filters.has_metric_filter()) {
+        cfilter.match_block = get_stats_match_block;
+        cfilter.arg = &ctx;
+    }
+
+    if (filters.has_metric_filter()) {
+        get_stats_cursor_filter_matches(filters.metric_filter(), cfilter);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Tokens pair a change generation of the stats engine with an identifier of the agent instance, so
+ * that tokens handed out prior to a restart of the agent are not mistaken for current ones.
+ */
+static uint64_t stats_token_instance(void) {
+    static const uint64_t instance = []() -> uint64_t {
+        random_device rd;
+        return ((uint64_t)rd() << 32) | rd();
+    }();
+
+    return instance;
+}
+
+//--------------------------------------------------------------------------------------------------
+static string stats_token_format(uint64_t generation) {
+    char token[2 * 16 + 2];
+    snprintf(token, sizeof(token), "%016" PRIx64 ".%" PRIx64, stats_token_instance(), generation);
+    return token;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool stats_token_parse(const string& token, uint64_t& generation) {
+    uint64_t instance;
+    int len = 0;
+    if (sscanf(token.c_str(), "%16" SCNx64 ".%" SCNx64 "%n", &instance, &generation, &len) != 2 ||
+        (size_t)len != token.size()) {
+        return false;
+    }
+
+    return instance == stats_token_instance();
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Called before each retrieval into the stats of a response. The token is taken on the first
+ * retrieval, before any values are read, so that changes made while the response is being built are
+ * repeated in the next delta rather than missed.
+ */
+static void get_stats_begin(GetStatsContext& ctx) {
+    auto stats = ctx.stats;
+    if (!stats->token().empty()) {
+        return;
+    }
+
+    // A resumed response carries on under the token of the response it continues.
+    auto& chunks = ctx.chunks;
+    if (chunks.resume != GetStatsChunks::Resume::NONE) {
+        stats->set_token(chunks.from.token);
+    } else {
+        stats->set_token(stats_token_format(stats_generation()));
+    }
+
+    uint64_t since;
+    bool is_delta =
+        !ctx.filters.since_token().empty() &&
+        stats_token_parse(ctx.filters.since_token(), since) &&
+        stats_removed_metrics_since(since);
+    stats->set_is_delta(is_delta);
+    ctx.since = is_delta ? since : 0;
+
+    if (chunks.resume != GetStatsChunks::Resume::NONE && chunks.from.is_delta != is_delta) {
+        chunks.resume = GetStatsChunks::Resume::LOST;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+extern "C" {
+    void get_stats_add_removed(const struct stats_removed_metric* removed, void* arg) {
+        GetStatsContext* ctx = static_cast<typeof(ctx)>(arg);
+        auto metric = ctx->stats->add_removed();
+        metric->set_name(removed->metric);
+
+        auto scope = metric->mutable_scope();
+        scope->set_domain(removed->domain_name);
+        scope->set_zone(removed->zone);
+        scope->set_block(removed->block);
+
+        if (ctx->chunks.flush != nullptr) {
+            ctx->chunks.nbytes += metric->ByteSizeLong();
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+void get_stats_chunks_init(GetStatsContext& ctx,
+                           const StatsChunking& chunking,
+                           function<void(void)> flush) {
+    auto& chunks = ctx.chunks;
+    chunks.max_values = chunking.max_values();
+    chunks.max_bytes = chunking.max_bytes();
+    if (chunks.max_bytes == 0 || chunks.max_bytes > STATS_CHUNK_MAX_BYTES) {
+        chunks.max_bytes = STATS_CHUNK_MAX_BYTES;
+    }
+    chunks.flush = flush;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Skip everything preceding the position in the next retrieval. The position is taken to have been
+ * parsed from a cursor of the same domain (or pipeline) of the same device.
+ */
+void get_stats_resume(GetStatsContext& ctx, const GetStatsPosition& pos) {
+    ctx.chunks.resume = GetStatsChunks::Resume::PENDING;
+    ctx.chunks.from = pos;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Check whether the position of a retrieval was found, ending the resumption either way. Reaching
+ * the block of the position is enough, since its remaining metrics may all have been filtered out.
+ */
+bool get_stats_resumed(GetStatsContext& ctx) {
+    auto resume = ctx.chunks.resume;
+    ctx.chunks.resume = GetStatsChunks::Resume::NONE;
+
+    return resume == GetStatsChunks::Resume::NONE || resume == GetStatsChunks::Resume::ENTERED;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_chunks_begin(GetStatsContext& ctx) {
+    auto& chunks = ctx.chunks;
+    chunks.zone = NULL;
+    chunks.zone_occurrence = 0;
+    chunks.zone_occurrences.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_cursor(struct stats_cursor* cursor, GetStatsContext& ctx) {
+    if (cursor == NULL) {
+        return;
+    }
+
+    const struct stats_metric_view* view;
+    while ((view = stats_cursor_next(cursor)) != NULL) {
+        get_stats_add_metric(view, ctx);
+    }
+    stats_cursor_free(cursor);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void get_stats_domain(struct stats_domain* domain, GetStatsContext& ctx) {
+    get_stats_begin(ctx);
+    get_stats_chunks_begin(ctx);
+    if (ctx.since > 0 && ctx.chunks.resume == GetStatsChunks::Resume::NONE) {
+        stats_domain_for_each_removed_metric(domain, NULL, ctx.since, get_stats_add_removed, &ctx);
+    }
+
+    struct stats_cursor_filter cfilter;
+    get_stats_cursor_filter(ctx, cfilter);
+    get_stats_cursor(stats_domain_cursor_alloc(domain, &cfilter), ctx);
+}
+
+//--------------------------------------------------------------------------------------------------
+void get_stats_zone(struct stats_zone* zone, GetStatsContext& ctx) {
+    get_stats_begin(ctx);
+    get_stats_chunks_begin(ctx);
+    if (ctx.since > 0 && ctx.chunks.resume == GetStatsChunks::Resume::NONE) {
+        stats_zone_for_each_removed_metric(zone, ctx.since, get_stats_add_removed, &ctx);
+    }
+
+    struct stats_cursor_filter cfilter;
+    get_stats_cursor_filter(ctx, cfilter);
+    get_stats_cursor(stats_zone_cursor_alloc(zone, &cfilter), ctx);
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Check that the baseline named by the filters, if any, is known. A get request naming an unknown or
+ * expired baseline is refused, since its plain values couldn't be told apart from relative ones.
+ */
+bool get_stats_zone_has_baseline(struct stats_zone* zone, const StatsFilters& filters) {
+    return filters.baseline().empty() || stats_zone_has_baseline(zone, filters.baseline().c_str());
+}
+
+static bool get_stats_domains_have_baseline(struct stats_domain* const* domains,
+                                            size_t ndomains,
+                                            const StatsFilters& filters) {
+    if (filters.baseline().empty()) {
+        return true;
+    }
+
+    for (size_t n = 0; n < ndomains; ++n) {
+        if (stats_domain_has_baseline(domains[n], filters.baseline().c_str())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------------------------------------
+extern "C" {
+    struct ClearStatsContext {
+        const StatsFilters& filters;
+        BitArray* valid;
+        StatsFilterCache cache;
+    };
+
+    void clear_stats_filter_setup(const struct stats_clear_filter_spec* spec, void* arg) {
+        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
+        auto type = stats_metric_type(spec->metric->type);
+
+        // Clearing is infrequent, so gather the values into a view rather than filtering in place.
+        size_t nlabels = spec->nvalues > 0 ? spec->values[0].nlabels : 0;
+        vector<uint64_t> u64(spec->nvalues);
+        vector<double> f64(spec->nvalues);
+        vector<struct stats_label> labels(spec->nvalues * nlabels);
+        for (unsigned int n = 0; n < spec->nvalues; ++n) {
+            const auto v = &spec->values[n];
+            u64[n] = v->u64;
+            f64[n] = v->f64;
+            for (unsigned int l = 0; l < nlabels; ++l) {
+                labels[n * nlabels + l] = v->labels[l];
+            }
+        }
+
+        struct stats_metric_view view = {
+            .domain = spec->domain,
+            .zone = spec->zone,
+            .block = spec->block,
+            .metric = spec->metric,
+            .index = 0,
+            .last_update = {},
+            .nvalues = spec->nvalues,
+            .u64 = u64.data(),
+            .f64 = f64.data(),
+            .generations = NULL,
+            .last_change = spec->last_change,
+            .labels = labels.data(),
+            .nlabels = nlabels,
+        };
+        ctx->valid = new BitArray(spec->nvalues);
+        apply_metric_filter(&view, ctx->filters.metric_filter(), type, *ctx->valid, ctx->cache);
+    }
+
+    void clear_stats_filter_teardown([[maybe_unused]] const struct stats_clear_filter_spec* spec,
+                                     void* arg) {
+        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
+        delete ctx->valid;
+        ctx->valid = NULL;
+    }
+
+    bool clear_stats_filter_match([[maybe_unused]] const struct stats_clear_filter_spec* spec,
+                                  unsigned int value_idx,
+                                  void* arg) {
+        ClearStatsContext* ctx = static_cast<typeof(ctx)>(arg);
+        return ctx->valid->is_bit_set(value_idx);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Pass the exact metric name and label matches down to the stats engine, to skip the other metrics
+ * before their values are gathered for the filter.
+ */
+static void clear_stats_filter_exact(const StatsFilters& filters,
+                                     struct stats_clear_filter& clear_filter) {
+    if (!filters.has_metric_filter()) {
+        return;
+    }
+
+    struct stats_cursor_filter cfilter = {};
+    get_stats_cursor_filter_matches(filters.metric_filter(), cfilter);
+    clear_filter.metric = cfilter.metric;
+    clear_filter.label.key = cfilter.label.key;
+    clear_filter.label.value = cfilter.label.value;
+}
+
+//--------------------------------------------------------------------------------------------------
+static unsigned int clear_stats_baseline_ttl_ms(const StatsFilters& filters) {
+    unsigned int ttl = filters.baseline_ttl() != 0 ? filters.baseline_ttl() : STATS_BASELINE_TTL;
+    return min(ttl, UINT_MAX / 1000) * 1000;
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool clear_stats_domain(struct stats_domain* domain, const StatsFilters& filters) {
+    ClearStatsContext ctx{
+        .filters = filters,
+        .valid = NULL,
+        .cache = {},
+    };
+    struct stats_clear_filter clear_filter{
+        .metric = NULL,
+        .label = {},
+        .setup = clear_stats_filter_setup,
+        .teardown = clear_stats_filter_teardown,
+        .match = clear_stats_filter_match,
+        .arg = &ctx,
+    };
+    clear_stats_filter_exact(filters, clear_filter);
+    const struct stats_clear_filter* filter = filters.has_metric_filter() ? &clear_filter : NULL;
+
+    if (filters.baseline().empty()) {
+        stats_domain_clear_metrics(domain, filter);
+        return true;
+    }
+
+    return stats_domain_clear_baseline(domain, filters.baseline().c_str(),
+                                       clear_stats_baseline_ttl_ms(filters), filter);
+}
+
+//--------------------------------------------------------------------------------------------------
+bool clear_stats_zone(struct stats_zone* zone, const StatsFilters& filters) {
+    ClearStatsContext ctx{
+        .filters = filters,
+        .valid = NULL,
+        .cache = {},
+    };
+    struct stats_clear_filter clear_filter{
+        .metric = NULL,
+        .label = {},
+        .setup = clear_stats_filter_setup,
+        .teardown = clear_stats_filter_teardown,
+        .match = clear_stats_filter_match,
+        .arg = &ctx,
+    };
+    clear_stats_filter_exact(filters, clear_filter);
+    const struct stats_clear_filter* filter = filters.has_metric_filter() ? &clear_filter : NULL;
+
+    if (filters.baseline().empty()) {
+        stats_zone_clear_metrics(zone, filter);
+        return true;
+    }
+
+    return stats_zone_clear_baseline(zone, filters.baseline().c_str(),
+                                     clear_stats_baseline_ttl_ms(filters), filter);
+}
+
+//--------------------------------------------------------------------------------------------------
+void SmartnicP4Impl::get_or_clear_stats(
+    const StatsRequest& req,
     bool do_clear,
     function<void(const StatsResponse&)> write_resp) {
     auto debug_flag = ServerDebugFlag::DEBUG_FLAG_STATS;
@@ -777,49 +1932,119 @@ void SmartnicP4Impl::get_or_clear_stats(
         end_dev_id = dev_id;
     }
 
-    GetStatsContext ctx{
-        .filters = req.filters(),
-        .stats = NULL,
-    };
-
     SERVER_LOG_IF_DEBUG(debug_flag, INFO,
-        "---> Filters:" << endl << ctx.filters.DebugString());
+        "---> Filters:" << endl << req.filters().DebugString());
+
+    GetStatsPosition resume;
+    bool resuming = false;
+    if (!do_clear) {
+        const auto& chunking = req.chunking();
+        if (!chunking.resume_cursor().empty()) {
+            if (!get_stats_resume_parse(chunking.resume_cursor(), resume) ||
+                (int)resume.dev_id < begin_dev_id || (int)resume.dev_id > end_dev_id ||
+                resume.part >= DeviceStatsDomain::NDOMAINS) {
+                StatsResponse resp;
+                resp.set_error_code(ErrorCode::EC_INVALID_STATS_CURSOR);
+                write_resp(resp);
+                return;
+            }
 
-    for (dev_id = begin_dev_id; dev_id <= end_dev_id; ++dev_id) {
+            begin_dev_id = resume.dev_id;
+            resuming = true;
+        }
+    }
+
+    // Each device is collected on its own thread, with its own context and response. The response
+    // is built on an arena and reused for all the chunks of the device, keeping hold of its
+    // allocations.
+    auto collect = [&](int dev_id, const function<void(const StatsResponse&)>& emit) -> bool {
         const auto dev = devices[dev_id];
+        GetStatsContext ctx{
+            .filters = req.filters(),
+            .stats = NULL,
+        };
 
-        StatsResponse resp;
+        Arena arena;
+        auto& resp = *Arena::CreateMessage<StatsResponse>(&arena);
         if (!do_clear) {
+            get_stats_chunks_init(ctx, req.chunking(), [&resp, &ctx, &emit]() -> void {
+                resp.set_error_code(ErrorCode::EC_OK);
+                resp.set_dev_id(ctx.chunks.dev_id);
+                emit(resp);
+            });
             ctx.stats = resp.mutable_stats();
+            ctx.chunks.dev_id = dev_id;
+        }
+
+        auto dev_resuming = resuming && dev_id == (int)resume.dev_id;
+        auto begin_dom = 0;
+        if (dev_resuming) {
+            begin_dom = resume.part;
+        }
+
+        // The baseline is held by the domains it was cleared in, not necessarily all of them.
+        if (!do_clear &&
+            !get_stats_domains_have_baseline(&dev->stats.domains[begin_dom],
+                                             DeviceStatsDomain::NDOMAINS - begin_dom,
+                                             ctx.filters)) {
+            resp.set_error_code(ErrorCode::EC_STATS_UNKNOWN_BASELINE);
+            resp.set_dev_id(dev_id);
+            emit(resp);
+            return false;
         }
 
-        for (auto dom = 0; dom < DeviceStatsDomain::NDOMAINS; ++dom) {
+        for (auto dom = begin_dom; dom < DeviceStatsDomain::NDOMAINS; ++dom) {
             auto domain = dev->stats.domains[dom];
             auto dname = device_stats_domain_name((DeviceStatsDomain)dom);
             if (do_clear) {
-                clear_stats_domain(domain, ctx.filters);
+                if (!clear_stats_domain(domain, ctx.filters)) {
+                    resp.set_error_code(ErrorCode::EC_STATS_TOO_MANY_BASELINES);
+                    resp.set_dev_id(dev_id);
+                    emit(resp);
+                    return false;
+                }
                 SERVER_LOG_IF_DEBUG(debug_flag, INFO,
                     "Cleared stats metrics in domain " << dname << " on device ID " << dev_id);
-            } else {
-                stats_domain_for_each_metric(domain, get_stats_for_each_metric, &ctx);
-                SERVER_LOG_IF_DEBUG(debug_flag, INFO,
-                    "Retrieved stats metrics in domain " << dname << " on device ID " << dev_id);
+                continue;
+            }
+
+            ctx.chunks.part = dom;
+            if (dev_resuming) {
+                get_stats_resume(ctx, resume);
+            }
+
+            get_stats_domain(domain, ctx);
+            if (dev_resuming && !get_stats_resumed(ctx)) {
+                resp.Clear();
+                resp.set_error_code(ErrorCode::EC_INVALID_STATS_CURSOR);
+                resp.set_dev_id(dev_id);
+                emit(resp);
+                return false;
             }
+            dev_resuming = false;
+
+            SERVER_LOG_IF_DEBUG(debug_flag, INFO,
+                "Retrieved stats metrics in domain " << dname << " on device ID " << dev_id);
         }
 
         resp.set_error_code(ErrorCode::EC_OK);
         resp.set_dev_id(dev_id);
 
-        write_resp(resp);
-    }
+        emit(resp);
+        return true;
+    };
+
+    get_stats_fan_out<StatsResponse>(begin_dev_id, end_dev_id, collect, write_resp);
 }
 
 //--------------------------------------------------------------------------------------------------
 void SmartnicP4Impl::batch_get_stats(
     const StatsRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    get_or_clear_stats(req, false, [&rdwr](const StatsResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    get_or_clear_stats(req, false, [&rdwr, &block](const StatsResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto stats = bresp.mutable_stats();
         stats->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
@@ -843,8 +2068,10 @@ Status SmartnicP4Impl::GetStats(
 void SmartnicP4Impl::batch_clear_stats(
     const StatsRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    get_or_clear_stats(req, true, [&rdwr](const StatsResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    get_or_clear_stats(req, true, [&rdwr, &block](const StatsResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto stats = bresp.mutable_stats();
         stats->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
@@ -863,3 +2090,576 @@ Status SmartnicP4Impl::ClearStats(
     });
     return Status::OK;
 }
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Subscription of a WatchStats stream to a device. Updates of the stats domains of the device only
+ * flag it as pending and wake the stream, whose handler builds and sends the response from its own
+ * thread so that a slow client never holds up the collection of statistics.
+ */
+struct StatsWatch;
+struct StatsWatchDevice {
+    StatsWatch* watch;
+    Device* dev;
+    unsigned int dev_id;
+    bool pending; // Protected by the lock of the watch.
+
+    bool sent; // Whether a response has been sent for the device yet.
+    chrono::steady_clock::time_point sent_at;
+    string token; // Token of the stats last sent for the device.
+    unsigned int nchunks; // Responses already sent for the update being built.
+};
+
+struct StatsWatch {
+    mutex lock;
+    condition_variable updated;
+    vector<StatsWatchDevice> devices; // Never resized once hooks are added.
+};
+
+extern "C" {
+    void watch_stats_domain_updated([[maybe_unused]] struct stats_domain* domain, void* arg) {
+        StatsWatchDevice* wdev = static_cast<typeof(wdev)>(arg);
+        auto watch = wdev->watch;
+        {
+            lock_guard<mutex> guard(watch->lock);
+            wdev->pending = true;
+        }
+        watch->updated.notify_one();
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void watch_stats_remove_hooks(StatsWatch& watch) {
+    for (auto& wdev : watch.devices) {
+        for (auto domain : wdev.dev->stats.domains) {
+            stats_domain_remove_update_hook(domain, watch_stats_domain_updated, &wdev);
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+static bool watch_stats_add_hooks(StatsWatch& watch) {
+    for (auto& wdev : watch.devices) {
+        for (auto domain : wdev.dev->stats.domains) {
+            if (!stats_domain_add_update_hook(domain, watch_stats_domain_updated, &wdev)) {
+                // Removing the hooks which were never added is harmless.
+                watch_stats_remove_hooks(watch);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Build the stats of a device for a watch. Any chunks the stats are split into are sent along the
+ * way, leaving the last one in the response. Returns false when there is nothing worth sending,
+ * i.e. when only changes were requested and none happened since the previous response.
+ */
+static bool watch_stats_device(StatsWatchDevice& wdev,
+                               bool changed_only,
+                               StatsFilters& filters,
+                               GetStatsContext& ctx,
+                               StatsResponse& resp) {
+    if (changed_only && wdev.sent) {
+        filters.set_since_token(wdev.token);
+    } else {
+        filters.clear_since_token();
+    }
+
+    auto& chunks = ctx.chunks;
+    chunks.dev_id = wdev.dev_id;
+    chunks.nvalues = 0;
+    chunks.nbytes = 0;
+    wdev.nchunks = 0;
+
+    ctx.stats = resp.mutable_stats();
+    ctx.since = 0;
+    for (auto dom = 0; dom < DeviceStatsDomain::NDOMAINS; ++dom) {
+        chunks.part = dom;
+        get_stats_domain(wdev.dev->stats.domains[dom], ctx);
+    }
+
+    const auto& stats = resp.stats();
+    wdev.sent = true;
+    wdev.token = stats.token();
+    if (wdev.nchunks == 0 &&
+        stats.is_delta() && stats.metrics_size() < 1 && stats.removed_size() < 1) {
+        return false;
+    }
+
+    resp.set_error_code(ErrorCode::EC_OK);
+    resp.set_dev_id(wdev.dev_id);
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+Status SmartnicP4Impl::WatchStats(
+    ServerContext* ctx,
+    const WatchStatsRequest* req,
+    ServerWriter<StatsResponse>* writer) {
+    auto debug_flag = ServerDebugFlag::DEBUG_FLAG_STATS;
+    int begin_dev_id = 0;
+    int end_dev_id = devices.size() - 1;
+    int dev_id = req->dev_id(); // 0-based index. -1 means all devices.
+
+    if (dev_id > end_dev_id) {
+        StatsResponse resp;
+        resp.set_error_code(ErrorCode::EC_INVALID_DEVICE_ID);
+        writer->Write(resp);
+        return Status::OK;
+    }
+
+    if (dev_id > -1) {
+        begin_dev_id = dev_id;
+        end_dev_id = dev_id;
+    }
+
+    StatsWatch watch;
+    for (dev_id = begin_dev_id; dev_id <= end_dev_id; ++dev_id) {
+        watch.devices.push_back({
+            .watch = &watch,
+            .dev = devices[dev_id],
+            .dev_id = (unsigned int)dev_id,
+            .pending = true, // Start the stream with complete stats.
+            .sent = false,
+            .sent_at = {},
+            .token = "",
+            .nchunks = 0,
+        });
+    }
+
+    if (!watch_stats_add_hooks(watch)) {
+        return Status(StatusCode::RESOURCE_EXHAUSTED, "Failed to subscribe to stats updates.");
+    }
+
+    // The filters and their context persist for the lifetime of the stream, so that the expressions
+    // and names matched by the filters are only evaluated once rather than on every update.
+    StatsFilters filters(req->filters());
+    GetStatsContext gctx{
+        .filters = filters,
+        .stats = NULL,
+    };
+    auto period = chrono::milliseconds(req->period_ms());
+    auto changed_only = req->changed_only();
+
+    // Updates are capped in size like the responses of GetStats, sending all but their last chunk
+    // from here as they fill up.
+    StatsResponse resp;
+    StatsWatchDevice* sending = NULL;
+    auto connected = true;
+    get_stats_chunks_init(gctx, req->chunking(), [&resp, &sending, &connected, &writer]() -> void {
+        resp.set_error_code(ErrorCode::EC_OK);
+        resp.set_dev_id(sending->dev_id);
+        sending->nchunks += 1;
+        if (connected && !writer->Write(resp)) {
+            connected = false;
+        }
+    });
+
+    SERVER_LOG_IF_DEBUG(debug_flag, INFO,
+        "---> Watch period " << req->period_ms() << "ms, changed only " << changed_only <<
+        ", filters:" << endl << filters.DebugString());
+
+    vector<StatsWatchDevice*> due;
+    unique_lock<mutex> lock(watch.lock);
+    while (!ctx->IsCancelled()) {
+        auto now = chrono::steady_clock::now();
+        auto wake_at = now + chrono::milliseconds(STATS_WATCH_POLL_MS);
+
+        due.clear();
+        for (auto& wdev : watch.devices) {
+            if (!wdev.pending) {
+                continue;
+            }
+
+            auto due_at = wdev.sent ? wdev.sent_at + period : now;
+            if (due_at <= now) {
+                wdev.pending = false;
+                due.push_back(&wdev);
+            } else if (due_at < wake_at) {
+                wake_at = due_at;
+            }
+        }
+
+        if (due.empty()) {
+            // Bound the wait so that cancellation of the stream is noticed in a timely manner.
+            watch.updated.wait_until(lock, wake_at);
+            continue;
+        }
+
+        lock.unlock();
+        for (auto wdev : due) {
+            wdev->sent_at = now;
+
+            resp.Clear();
+            sending = wdev;
+            if (!watch_stats_device(*wdev, changed_only, filters, gctx, resp)) {
+                continue;
+            }
+
+            if (!connected || !writer->Write(resp)) {
+                connected = false;
+                break;
+            }
+
+            SERVER_LOG_IF_DEBUG(debug_flag, INFO,
+                "Sent watched stats metrics on device ID " << wdev->dev_id);
+        }
+        lock.lock();
+
+        if (!connected) {
+            break;
+        }
+    }
+    lock.unlock();
+
+    watch_stats_remove_hooks(watch);
+
+    return Status::OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Counter values of a device taken on a pass of a TopStats request, against which the increase
+ * of each value is taken on the next pass. Metrics are identified by the specs of their zone, block
+ * and metric, which are replaced along with any change to their layout. Since the metrics of a
+ * device are nearly always visited in the same order on each pass, a metric is first looked for
+ * right after the one previously found, and only looked up through the index (built on the first
+ * miss) otherwise.
+ */
+struct TopStatsMetricKey {
+    const struct stats_zone_spec* zone;
+    const struct stats_block_spec* block;
+    const struct stats_metric_spec* metric;
+
+    bool operator==(const TopStatsMetricKey& other) const {
+        return zone == other.zone && block == other.block && metric == other.metric;
+    }
+};
+
+struct TopStatsMetricKeyHash {
+    size_t operator()(const TopStatsMetricKey& key) const {
+        hash<const void*> h;
+        return h(key.zone) ^ (h(key.block) << 1) ^ (h(key.metric) << 2);
+    }
+};
+
+struct TopStatsMetricSample {
+    TopStatsMetricKey key;
+    size_t nvalues;
+    struct timespec last_update;
+    size_t offset; // Position of the first value of the metric within those of the sample.
+};
+
+struct TopStatsSample {
+    vector<TopStatsMetricSample> metrics; // In the order visited.
+    vector<uint64_t> values;
+    unordered_map<TopStatsMetricKey, size_t, TopStatsMetricKeyHash> index;
+    size_t pos = 0; // Metric following the one last found.
+
+    void clear() {
+        metrics.clear();
+        values.clear();
+        index.clear();
+        pos = 0;
+    }
+};
+
+struct TopStatsDevice {
+    Device* dev;
+    unsigned int dev_id;
+    TopStatsSample sample;
+};
+
+struct TopStatsCandidate {
+    double score;
+    TopStatsEntry entry;
+};
+
+struct TopStatsContext {
+    GetStatsContext& gctx;
+    TopStatsOrder order;
+    size_t k;
+    double window; // Seconds elapsed since the previous pass.
+    TopStatsSample& prev;
+    TopStatsSample& next;
+    uint64_t nranked;
+    vector<TopStatsCandidate> heap; // Min-heap of the best k candidates, by score.
+};
+
+//--------------------------------------------------------------------------------------------------
+static bool top_stats_candidate_better(const TopStatsCandidate& a, const TopStatsCandidate& b) {
+    return a.score > b.score;
+}
+
+//--------------------------------------------------------------------------------------------------
+static const TopStatsMetricSample* top_stats_find_sample(TopStatsSample& sample,
+                                                         const TopStatsMetricKey& key) {
+    auto& metrics = sample.metrics;
+    if (sample.pos < metrics.size() && metrics[sample.pos].key == key) {
+        return &metrics[sample.pos++];
+    }
+
+    if (sample.index.empty()) {
+        for (size_t n = 0; n < metrics.size(); ++n) {
+            sample.index.emplace(metrics[n].key, n);
+        }
+    }
+
+    auto it = sample.index.find(key);
+    if (it == sample.index.end()) {
+        return NULL;
+    }
+
+    sample.pos = it->second + 1;
+    return &metrics[it->second];
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Sample the values of a counter for the next pass, and rank the increase of each of its values
+ * selected by the filters since the previous pass. Only the best k candidates are kept, so that
+ * the entries of the response are only built for values which make it into the running top k.
+ */
+static void top_stats_add_metric(const struct stats_metric_view* view, TopStatsContext& ctx) {
+    if (view->metric->type != stats_metric_type_COUNTER) {
+        return;
+    }
+
+    TopStatsMetricKey key{
+        .zone = view->zone,
+        .block = view->block,
+        .metric = view->metric,
+    };
+    auto& next = ctx.next;
+    next.metrics.push_back({
+        .key = key,
+        .nvalues = view->nvalues,
+        .last_update = view->last_update,
+        .offset = next.values.size(),
+    });
+    next.values.insert(next.values.end(), view->u64, &view->u64[view->nvalues]);
+
+    auto sample = top_stats_find_sample(ctx.prev, key);
+    if (sample == NULL) {
+        return;
+    }
+
+    auto& gctx = ctx.gctx;
+    auto type = StatsMetricType::STATS_METRIC_TYPE_COUNTER;
+    BitArray valid(view->nvalues);
+    apply_filters(view, gctx.filters, type, valid, gctx.cache);
+    if (valid.is_all_cleared()) {
+        return;
+    }
+
+    // Rates are taken over the updates of the block bounding the window, falling back to the window
+    // itself when the block was not updated within it.
+    double elapsed =
+        (double)(view->last_update.tv_sec - sample->last_update.tv_sec) +
+        (double)(view->last_update.tv_nsec - sample->last_update.tv_nsec) / 1e9;
+    if (elapsed <= 0) {
+        elapsed = ctx.window;
+    }
+
+    bool with_labels = gctx.filters.with_labels();
+    bool with_last_change = gctx.filters.with_last_change() && view->last_change != NULL;
+    auto before = &ctx.prev.values[sample->offset];
+    auto nvalues = min(view->nvalues, sample->nvalues);
+    for (auto n = valid.find_next_set(0); n < nvalues; n = valid.find_next_set(n + 1)) {
+        ctx.nranked += 1;
+
+        // A counter found below its previous value was cleared within the window.
+        auto after = view->u64[n];
+        auto delta = after >= before[n] ? after - before[n] : after;
+        if (delta == 0) {
+            continue;
+        }
+
+        auto rate = elapsed > 0 ? (double)delta / elapsed : 0;
+        auto score = ctx.order == TopStatsOrder::TOP_STATS_ORDER_RATE ? rate : (double)delta;
+        auto& heap = ctx.heap;
+        if (heap.size() >= ctx.k) {
+            if (score <= heap.front().score) {
+                continue;
+            }
+
+            // Reuse the entry of the worst candidate for the new one.
+            pop_heap(heap.begin(), heap.end(), top_stats_candidate_better);
+            heap.back().entry.Clear();
+        } else {
+            heap.emplace_back();
+        }
+
+        auto& candidate = heap.back();
+        candidate.score = score;
+
+        auto& entry = candidate.entry;
+        auto metric = entry.mutable_metric();
+        get_stats_set_metric_scope(view, type, metric);
+        get_stats_set_value(view, n, with_labels, with_last_change, metric->add_values());
+        entry.set_delta(delta);
+        entry.set_rate(rate);
+
+        push_heap(heap.begin(), heap.end(), top_stats_candidate_better);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+/*
+ * Make a pass over the counters of a device, sampling their values for the next pass. The top
+ * values since the previous pass are added to the given stats, unless it is NULL.
+ */
+static void top_stats_device(TopStatsDevice& tdev,
+                             GetStatsContext& gctx,
+                             const TopStatsRequest& req,
+                             size_t k,
+                             double window,
+                             TopStats* top) {
+    TopStatsSample next;
+    next.metrics.reserve(tdev.sample.metrics.size());
+    next.values.reserve(tdev.sample.values.size());
+
+    TopStatsContext ctx{
+        .gctx = gctx,
+        .order = req.order(),
+        .k = k,
+        .window = window,
+        .prev = tdev.sample,
+        .next = next,
+        .nranked = 0,
+        .heap = {},
+    };
+    ctx.heap.reserve(k);
+
+    for (auto domain : tdev.dev->stats.domains) {
+        // Counters are sampled whatever their values, so that any increase from zero is ranked.
+        struct stats_cursor_filter cfilter;
+        get_stats_chunks_begin(gctx);
+        get_stats_cursor_filter(gctx, cfilter);
+        cfilter.non_zero = false;
+
+        auto cursor = stats_domain_cursor_alloc(domain, &cfilter);
+        if (cursor == NULL) {
+            continue;
+        }
+
+        const struct stats_metric_view* view;
+        while ((view = stats_cursor_next(cursor)) != NULL) {
+            top_stats_add_metric(view, ctx);
+        }
+        stats_cursor_free(cursor);
+    }
+
+    tdev.sample = move(next);
+
+    if (top != NULL) {
+        auto& heap = ctx.heap;
+        sort_heap(heap.begin(), heap.end(), top_stats_candidate_better);
+        for (auto& candidate : heap) {
+            top->add_entries()->Swap(&candidate.entry);
+        }
+        top->set_num_ranked(ctx.nranked);
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+Status SmartnicP4Impl::TopStats(
+    ServerContext* ctx,
+    const TopStatsRequest* req,
+    ServerWriter<TopStatsResponse>* writer) {
+    auto debug_flag = ServerDebugFlag::DEBUG_FLAG_STATS;
+    int begin_dev_id = 0;
+    int end_dev_id = devices.size() - 1;
+    int dev_id = req->dev_id(); // 0-based index. -1 means all devices.
+
+    if (dev_id > end_dev_id) {
+        TopStatsResponse resp;
+        resp.set_error_code(ErrorCode::EC_INVALID_DEVICE_ID);
+        writer->Write(resp);
+        return Status::OK;
+    }
+
+    if (dev_id > -1) {
+        begin_dev_id = dev_id;
+        end_dev_id = dev_id;
+    }
+
+    vector<TopStatsDevice> tdevs;
+    for (dev_id = begin_dev_id; dev_id <= end_dev_id; ++dev_id) {
+        tdevs.push_back({
+            .dev = devices[dev_id],
+            .dev_id = (unsigned int)dev_id,
+            .sample = {},
+        });
+    }
+
+    size_t k = req->k() != 0 ? min(req->k(), (uint32_t)STATS_TOP_MAX_K) : STATS_TOP_K;
+    auto window = chrono::milliseconds(
+        req->window_ms() != 0 ? req->window_ms() : STATS_TOP_WINDOW_MS);
+
+    // The filters and their context persist for the lifetime of the stream, as for a watch.
+    GetStatsContext gctx{
+        .filters = req->filters(),
+        .stats = NULL,
+    };
+
+    SERVER_LOG_IF_DEBUG(debug_flag, INFO,
+        "---> Top " << k << " by " << TopStatsOrder_Name(req->order()) <<
+        " over " << window.count() << "ms, continuous " << req->continuous() <<
+        ", filters:" << endl << gctx.filters.DebugString());
+
+    auto begin = chrono::steady_clock::now();
+    for (auto& tdev : tdevs) {
+        top_stats_device(tdev, gctx, *req, k, 0, NULL);
+    }
+
+    auto poll = chrono::milliseconds(STATS_WATCH_POLL_MS);
+    while (true) {
+        // Sleep in bounded steps so that cancellation of the stream is noticed in a timely manner.
+        auto end = begin + window;
+        auto now = chrono::steady_clock::now();
+        while (now < end && !ctx->IsCancelled()) {
+            this_thread::sleep_until(min(end, now + poll));
+            now = chrono::steady_clock::now();
+        }
+
+        if (ctx->IsCancelled()) {
+            break;
+        }
+
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(now - begin).count();
+        auto connected = true;
+        for (auto& tdev : tdevs) {
+            TopStatsResponse resp;
+            auto top = resp.mutable_top();
+            top_stats_device(tdev, gctx, *req, k, (double)elapsed / 1e9, top);
+
+            auto duration = top->mutable_window();
+            duration->set_seconds(elapsed / 1000000000);
+            duration->set_nanos(elapsed % 1000000000);
+
+            resp.set_error_code(ErrorCode::EC_OK);
+            resp.set_dev_id(tdev.dev_id);
+            if (!writer->Write(resp)) {
+                connected = false;
+                break;
+            }
+
+            SERVER_LOG_IF_DEBUG(debug_flag, INFO,
+                "Sent top " << top->entries_size() << " of " << top->num_ranked() <<
+                " stats values on device ID " << tdev.dev_id);
+        }
+
+        if (!connected || !req->continuous()) {
+            break;
+        }
+        begin = now;
+    }
+
+    return Status::OK;
+}
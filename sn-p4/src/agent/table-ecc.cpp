@@ -96,7 +96,7 @@ static void init_table_ecc_metric(InitTableEcc* tecc, TableEccCounterId cid) {
     mspec->io.offset = cid;
 
     labels->key = "pipeline";
-    labels->value = tecc->pipeline->name;
+    labels->value = snp4_info_name(tecc->pipeline, tecc->pipeline->name);
     labels += 1;
 
     labels->key = "mode";
@@ -133,9 +133,10 @@ static bool is_table_ecc_supported(enum snp4_info_table_mode mode) {
 
 //--------------------------------------------------------------------------------------------------
 void SmartnicP4Impl::init_table_ecc(Device* dev, DevicePipeline* pipeline) {
-    const auto pi = &pipeline->info;
+    const auto pi = pipeline->info;
+    const auto tables = snp4_info_tables(pi);
     unsigned int total_ntables = 0;
-    for (auto ti = pi->tables; ti < &pi->tables[pi->num_tables]; ++ti) {
+    for (auto ti = tables; ti < &tables[pi->num_tables]; ++ti) {
         if (is_table_ecc_supported(ti->mode)) {
             total_ntables += 1;
         }
@@ -171,10 +172,11 @@ void SmartnicP4Impl::init_table_ecc(Device* dev, DevicePipeline* pipeline) {
     auto mspecs_base = mspecs;
     auto labels_base = labels;
     unsigned int tidx = 0;
-    for (auto ti = pi->tables; ti < &pi->tables[pi->num_tables]; ++ti) {
+    for (auto ti = tables; ti < &tables[pi->num_tables]; ++ti) {
         if (!is_table_ecc_supported(ti->mode)) {
             continue;
         }
+        const auto table_name = snp4_info_name(pi, ti->name);
 
         auto tecc = &table_ecc[tidx];
         tecc->pipeline = pi;
@@ -192,11 +194,11 @@ void SmartnicP4Impl::init_table_ecc(Device* dev, DevicePipeline* pipeline) {
 
         auto io_data = new TableEccIoData{
             .handle = pipeline->handle,
-            .table_name = ti->name,
+            .table_name = table_name,
         };
         stats->io_data.push_back(io_data);
 
-        tecc->bspec->name = ti->name;
+        tecc->bspec->name = table_name;
         tecc->bspec->metrics = tecc->mspecs;
         tecc->bspec->nmetrics = TABLE_ECC_NCOUNTERS;
         tecc->bspec->latch_metrics = table_ecc_latch_metrics;
@@ -207,7 +209,7 @@ void SmartnicP4Impl::init_table_ecc(Device* dev, DevicePipeline* pipeline) {
         tidx += 1;
 
         SERVER_LOG_LINE_INIT(table_ecc, INFO,
-            "Setup for ECC counters on table '" << ti->name << "' of pipeline ID " <<
+            "Setup for ECC counters on table '" << table_name << "' of pipeline ID " <<
             pipeline->id << " on device " << dev->bus_id);
     }
 
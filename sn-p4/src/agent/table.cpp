@@ -230,9 +230,10 @@ static ErrorCode table_rule_pack(const DevicePipeline* pipeline,
     enum snp4_status status;
     if (ti != NULL) {
         status = snp4_rule_pack_matches(
-            ti->matches, ti->key_bits, rule->matches, rule->num_matches, pack);
+            snp4_info_table_matches(pipeline->info, ti), ti->key_bits,
+            rule->matches, rule->num_matches, pack);
     } else {
-        status = snp4_rule_pack(&pipeline->info, rule, pack);
+        status = snp4_rule_pack(pipeline->info, rule, pack);
     }
 
     auto err = ErrorCode::EC_UNKNOWN;
@@ -337,8 +338,8 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                 " on device ID " << dev_id);
 
             unsigned int rule_idx = 1;
-            for (auto rule : req.rules()) {
-                const auto table_name = rule.table_name();
+            for (const auto& rule : req.rules()) {
+                const auto& table_name = rule.table_name();
                 const auto ti = pipeline_get_table_info(pipeline, table_name);
                 if (ti == NULL) {
                     err = ErrorCode::EC_INVALID_TABLE_NAME;
@@ -352,7 +353,8 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
 
                 struct sn_rule sr;
                 snp4_rule_init(&sr);
-                sr.table_name = ti->name;
+                unsigned int action_idx = 0;
+                sr.table_name = snp4_info_name(pipeline->info, ti->name);
                 sr.priority = rule.priority();
 
                 {
@@ -378,6 +380,15 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                             " on device ID " << dev_id <<
                             " (rule " << rule_idx << "/" << rule_count << ")");
                         goto clear_rule;
+                    } else if (nmatches > SNP4_MAX_TABLE_MATCHES) {
+                        err = ErrorCode::EC_TABLE_RULE_TOO_MANY_MATCHES;
+                        SERVER_LOG_IF_DEBUG(debug_flag, ERROR,
+                            "Too many matches. At most " << SNP4_MAX_TABLE_MATCHES <<
+                            " matches are supported per rule, but table '" << table_name <<
+                            "' in pipeline ID " << pipeline_id <<
+                            " on device ID " << dev_id << " has " << ti->num_matches <<
+                            " (rule " << rule_idx << "/" << rule_count << ")");
+                        goto clear_rule;
                     }
 
                     SERVER_LOG_IF_DEBUG(debug_flag, INFO,
@@ -402,9 +413,9 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
 
                 if (do_insert) {
                     // Actions used only for insert operation.
-                    const auto action = rule.action();
-                    const auto action_name = action.name();
-                    const auto ai = pipeline_get_table_action_info(ti, action_name);
+                    const auto& action = rule.action();
+                    const auto& action_name = action.name();
+                    const auto ai = pipeline_get_table_action_info(pipeline, ti, action_name);
                     if (ai == NULL) {
                         err = ErrorCode::EC_INVALID_ACTION_NAME;
                         SERVER_LOG_IF_DEBUG(debug_flag, ERROR,
@@ -415,7 +426,8 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                             " (rule " << rule_idx << "/" << rule_count << ")");
                         goto clear_rule;
                     }
-                    sr.action_name = ai->name;
+                    sr.action_name = snp4_info_name(pipeline->info, ai->name);
+                    action_idx = ai - snp4_info_table_actions(pipeline->info, ti);
 
                     auto nparams = action.parameters_size();
                     if (nparams < ai->num_params) {
@@ -440,6 +452,16 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                             " on device ID " << dev_id <<
                             " (rule " << rule_idx << "/" << rule_count << ")");
                         goto clear_rule;
+                    } else if (nparams > SNP4_MAX_ACTION_PARAMS) {
+                        err = ErrorCode::EC_TABLE_RULE_TOO_MANY_ACTION_PARAMETERS;
+                        SERVER_LOG_IF_DEBUG(debug_flag, ERROR,
+                            "Too many parameters. At most " << SNP4_MAX_ACTION_PARAMS <<
+                            " params are supported per rule, but action '" << action_name <<
+                            "' for table '" << table_name <<
+                            "' in pipeline ID " << pipeline_id <<
+                            " on device ID " << dev_id << " has " << ai->num_params <<
+                            " (rule " << rule_idx << "/" << rule_count << ")");
+                        goto clear_rule;
                     }
 
                     SERVER_LOG_IF_DEBUG(debug_flag, INFO,
@@ -478,15 +500,16 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                         goto clear_rule;
                     }
 
+                    const auto table = &pipeline->tables[ti - snp4_info_tables(pipeline->info)];
                     if (do_insert) {
-                        if (!snp4_table_insert_kma(pipeline->handle,
-                                                   sr.table_name,
-                                                   pack.key, pack.key_len,
-                                                   pack.mask, pack.mask_len,
-                                                   sr.action_name,
-                                                   pack.params, pack.params_len,
-                                                   sr.priority,
-                                                   rule.replace())) {
+                        if (!snp4_table_insert_kma_h(pipeline->handle,
+                                                     table->handle,
+                                                     pack.key, pack.key_len,
+                                                     pack.mask, pack.mask_len,
+                                                     table->action_ids[action_idx],
+                                                     pack.params, pack.params_len,
+                                                     sr.priority,
+                                                     rule.replace())) {
                             err = ErrorCode::EC_FAILED_INSERT_TABLE_RULE;
                             SERVER_LOG_IF_DEBUG(debug_flag, ERROR,
                                 "Failed to insert rule into table '" << table_name <<
@@ -501,10 +524,10 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
                                 " (rule " << rule_idx << "/" << rule_count << ")");
                         }
                     } else {
-                        if (!snp4_table_delete_k(pipeline->handle,
-                                                    sr.table_name,
-                                                    pack.key, pack.key_len,
-                                                    pack.mask, pack.mask_len)) {
+                        if (!snp4_table_delete_k_h(pipeline->handle,
+                                                   table->handle,
+                                                   pack.key, pack.key_len,
+                                                   pack.mask, pack.mask_len)) {
                             err = ErrorCode::EC_FAILED_DELETE_TABLE_RULE;
                             SERVER_LOG_IF_DEBUG(debug_flag, ERROR,
                                 "Failed to delete rule from table '" << table_name <<
@@ -547,8 +570,11 @@ void SmartnicP4Impl::insert_or_delete_table_rule(
 void SmartnicP4Impl::batch_insert_table_rule(
     const TableRuleRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    insert_or_delete_table_rule(req, true, [&rdwr](const TableRuleResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    insert_or_delete_table_rule(req, true,
+                                [&rdwr, &block](const TableRuleResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto rule = bresp.mutable_table_rule();
         rule->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
@@ -572,8 +598,11 @@ Status SmartnicP4Impl::InsertTableRule(
 void SmartnicP4Impl::batch_delete_table_rule(
     const TableRuleRequest& req,
     ServerReaderWriter<BatchResponse, BatchRequest>* rdwr) {
-    insert_or_delete_table_rule(req, false, [&rdwr](const TableRuleResponse& resp) -> void {
-        BatchResponse bresp;
+    unique_ptr<char[]> block(new char[AGENT_ARENA_BLOCK_SIZE]);
+    insert_or_delete_table_rule(req, false,
+                                [&rdwr, &block](const TableRuleResponse& resp) -> void {
+        Arena arena(block.get(), AGENT_ARENA_BLOCK_SIZE);
+        auto& bresp = *Arena::CreateMessage<BatchResponse>(&arena);
         auto rule = bresp.mutable_table_rule();
         rule->CopyFrom(resp);
         bresp.set_error_code(ErrorCode::EC_OK);
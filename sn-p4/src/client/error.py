@@ -64,6 +64,11 @@ ERROR_MAP = {
 
     # Server configuration error codes.
     ErrorCode.EC_SERVER_FAILED_GET_TIME: 'SERVER_FAILED_GET_TIME',
+
+    # Statistics error codes.
+    ErrorCode.EC_INVALID_STATS_CURSOR: 'INVALID_STATS_CURSOR',
+    ErrorCode.EC_STATS_TOO_MANY_BASELINES: 'STATS_TOO_MANY_BASELINES',
+    ErrorCode.EC_STATS_UNKNOWN_BASELINE: 'STATS_UNKNOWN_BASELINE',
 }
 
 def error_code_str(ec):
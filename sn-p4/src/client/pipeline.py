@@ -24,6 +24,7 @@ from .device import device_id_option
 from .error import error_code_str
 from .stats import (
     stats_clear_base_options,
+    stats_merge_chunks,
     stats_req_kargs,
     stats_show_base_options,
     stats_show_format,
@@ -217,8 +218,8 @@ def rpc_clear_pipeline_stats(stub, **kargs):
         yield resp.dev_id, resp.pipeline_id
 
 def rpc_get_pipeline_stats(stub, **kargs):
-    for resp in rpc_pipeline_stats(stub.GetPipelineStats, **kargs):
-        yield resp.dev_id, resp.pipeline_id, resp.stats
+    for resp, stats in stats_merge_chunks(rpc_pipeline_stats(stub.GetPipelineStats, **kargs)):
+        yield resp.dev_id, resp.pipeline_id, stats
 
 #---------------------------------------------------------------------------------------------------
 def clear_pipeline_stats(client, **kargs):